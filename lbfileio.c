@@ -18,6 +18,19 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#if defined(_WIN32)
+#include <windows.h>
+#include <io.h>
+#include <fcntl.h>
+#else
+#include <sys/mman.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <time.h>
+#include <sys/syscall.h>
+#endif
 
 #include "lbfileio.h"
 
@@ -215,6 +228,240 @@ inline long file_length_opened (FILE *fp)
     return length;
 }
 
+/**
+ * Gives size and modification time of given file, without opening it.
+ * @return Returns 0 on success, -1 if the file doesn't exist.
+ */
+int file_stat (const char *path, long *size, long *mtime)
+{
+    struct stat st;
+    if (stat(path, &st) != 0)
+      return -1;
+    (*size) = st.st_size;
+    (*mtime) = st.st_mtime;
+    return 0;
+}
+
+/**
+ * Computes 64-bit FNV-1a hash of given buffer.
+ * To hash data in parts, give previous result as the hash parameter;
+ * for the first part, use FNV_HASH_INIT.
+ */
+unsigned long long hash_fnv64_buf (const void *buff, long len, unsigned long long hash)
+{
+    const unsigned char *ptr = buff;
+    long i;
+    for (i=0; i < len; i++)
+    {
+      hash ^= ptr[i];
+      hash *= 0x100000001b3ULL;
+    }
+    return hash;
+}
+
+/**
+ * Computes 64-bit FNV-1a hash of given file content.
+ * @return Returns 0 on success, -1 if the file cannot be read.
+ */
+int file_hash (const char *path, unsigned long long *hash)
+{
+    FILE *fp;
+    unsigned char buf[4096];
+    size_t n;
+
+    fp = fopen (path, "rb");
+    if (fp==NULL)
+      return -1;
+    (*hash) = FNV_HASH_INIT;
+    do {
+      n = fread (buf, 1, sizeof(buf), fp);
+      (*hash) = hash_fnv64_buf (buf, n, *hash);
+    } while (n == sizeof(buf));
+    if (ferror(fp))
+    {
+      fclose (fp);
+      return -1;
+    }
+    fclose (fp);
+    return 0;
+}
+
+/**
+ * Maps whole file into memory for reading.
+ * @param size Output for the file size.
+ * @return Returns pointer to the file content, or NULL on error.
+ *     Empty files cannot be mapped.
+ */
+void *file_map (const char *path, long *size)
+{
+    void *ptr;
+#if defined(_WIN32)
+    HANDLE fh,mh;
+    fh = CreateFile(path, GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING,
+        FILE_ATTRIBUTE_NORMAL, NULL);
+    if (fh == INVALID_HANDLE_VALUE)
+      return NULL;
+    (*size) = GetFileSize(fh, NULL);
+    if (((*size) <= 0) || ((mh = CreateFileMapping(fh, NULL, PAGE_READONLY, 0, 0, NULL)) == NULL))
+    {
+      CloseHandle(fh);
+      return NULL;
+    }
+    ptr = MapViewOfFile(mh, FILE_MAP_READ, 0, 0, 0);
+    // The view keeps the mapping alive
+    CloseHandle(mh);
+    CloseHandle(fh);
+    return ptr;
+#else
+    struct stat st;
+    int fd;
+    fd = open(path, O_RDONLY);
+    if (fd < 0)
+      return NULL;
+    if ((fstat(fd, &st) != 0) || (st.st_size <= 0))
+    {
+      close(fd);
+      return NULL;
+    }
+    (*size) = st.st_size;
+    ptr = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if (ptr == MAP_FAILED)
+      return NULL;
+    return ptr;
+#endif
+}
+
+/**
+ * Unmaps file mapped by file_map().
+ */
+void file_unmap (void *ptr, long size)
+{
+    if (ptr == NULL)
+      return;
+#if defined(_WIN32)
+    UnmapViewOfFile(ptr);
+#else
+    munmap(ptr, size);
+#endif
+}
+
+/**
+ * Compares content of two files.
+ * Files of different size are recognized without reading them.
+ * @return Returns 0 if files are identical, 1 if they differ,
+ *     -1 if any of them cannot be read.
+ */
+int file_compare (const char *path1, const char *path2)
+{
+    FILE *fp1;
+    FILE *fp2;
+    unsigned char buf1[4096];
+    unsigned char buf2[4096];
+    size_t n1,n2;
+    int result;
+
+    fp1 = fopen (path1, "rb");
+    if (fp1==NULL)
+      return -1;
+    fp2 = fopen (path2, "rb");
+    if (fp2==NULL)
+    {
+      fclose (fp1);
+      return -1;
+    }
+    if (file_length_opened(fp1) != file_length_opened(fp2))
+      result = 1;
+    else
+      result = 0;
+    while (result == 0)
+    {
+      n1 = fread (buf1, 1, sizeof(buf1), fp1);
+      n2 = fread (buf2, 1, sizeof(buf2), fp2);
+      if ((n1 != n2) || (memcmp(buf1, buf2, n1) != 0))
+        result = 1;
+      if (n1 < sizeof(buf1))
+        break;
+    }
+    fclose (fp1);
+    fclose (fp2);
+    return result;
+}
+
+/**
+ * Replaces destination file with the source file, if their content
+ * differs. The replacement is made by renaming, so that the destination
+ * file is never left half-written. If content is identical, the source
+ * file is deleted and destination isn't touched.
+ * @return Returns 1 if the file was replaced, 0 if it was unchanged,
+ *     -1 on error.
+ */
+int file_replace_if_changed (const char *srcpath, const char *destpath)
+{
+    if (file_compare(srcpath, destpath) == 0)
+    {
+      remove (srcpath);
+      return 0;
+    }
+#if defined(_WIN32)
+    if (!MoveFileEx(srcpath, destpath, MOVEFILE_REPLACE_EXISTING))
+#else
+    if (rename(srcpath, destpath) != 0)
+#endif
+    {
+      remove (srcpath);
+      return -1;
+    }
+    return 1;
+}
+
+/**
+ * Returns monotonic time in nanoseconds, for measuring time intervals.
+ * The starting point is undefined.
+ */
+unsigned long long clock_ns (void)
+{
+#if defined(_WIN32)
+    LARGE_INTEGER freq,count;
+    if (!QueryPerformanceFrequency(&freq) || !QueryPerformanceCounter(&count))
+      return 0;
+    return (unsigned long long)(count.QuadPart/freq.QuadPart)*1000000000ULL +
+        (unsigned long long)(count.QuadPart%freq.QuadPart)*1000000000ULL/freq.QuadPart;
+#else
+    struct timespec ts;
+    if (clock_gettime(CLOCK_MONOTONIC, &ts) != 0)
+      return 0;
+    return (unsigned long long)ts.tv_sec*1000000000ULL + ts.tv_nsec;
+#endif
+}
+
+/**
+ * Returns identifier of the calling thread, as shown by system tools.
+ */
+unsigned long current_thread_id (void)
+{
+#if defined(_WIN32)
+    return GetCurrentThreadId();
+#elif defined(SYS_gettid)
+    return syscall(SYS_gettid);
+#else
+    return getpid();
+#endif
+}
+
+/**
+ * Switches opened stream, like stdin, into binary mode.
+ * @return Returns 0 on success, -1 on error.
+ */
+int file_set_binary (FILE *fp)
+{
+#if defined(_WIN32)
+    if (_setmode(_fileno(fp), _O_BINARY) == -1)
+      return -1;
+#endif
+    return 0;
+}
+
 /**
  * Reads 1-byte number from given buffer.
  * Simple wrapper for use with both little and big endian files.
@@ -20,10 +20,22 @@
 
 # include <stdio.h>
 
+#define FNV_HASH_INIT 0xcbf29ce484222325ULL
+
 // Routines
 
 inline long file_length (char *path);
 inline long file_length_opened (FILE *fp);
+int file_stat (const char *path, long *size, long *mtime);
+int file_hash (const char *path, unsigned long long *hash);
+unsigned long long hash_fnv64_buf (const void *buff, long len, unsigned long long hash);
+void *file_map (const char *path, long *size);
+void file_unmap (void *ptr, long size);
+int file_compare (const char *path1, const char *path2);
+int file_replace_if_changed (const char *srcpath, const char *destpath);
+unsigned long long clock_ns (void);
+unsigned long current_thread_id (void);
+int file_set_binary (FILE *fp);
 
 inline long read_int32_le_file (FILE *fp);
 inline long read_int32_le_buf (const unsigned char *buff);
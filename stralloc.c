@@ -0,0 +1,294 @@
+/******************************************************************************/
+/** @file stralloc.c
+ * Library for r/w of DK2 STR text strings files.
+ * @par Purpose:
+ *     Pluggable memory allocator, with optional accounting of memory
+ *     used by every call site.
+ * @par Comment:
+ *     Accounting allocator places a small header before every block,
+ *     to remember its size and the site which allocated it.
+ * @par  Copying and copyrights:
+ *     This program is free software; you can redistribute it and/or modify
+ *     it under the terms of the GNU General Public License as published by
+ *     the Free Software Foundation; either version 2 of the License, or
+ *     (at your option) any later version.
+ */
+/******************************************************************************/
+
+#include "stralloc.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "unitext.h"
+#include "strstats.h"
+
+void *stralloc_libc_alloc(void *ctx,size_t size,const char *site)
+{
+  return malloc(size);
+}
+
+void *stralloc_libc_realloc(void *ctx,void *ptr,size_t size,const char *site)
+{
+  return realloc(ptr,size);
+}
+
+void stralloc_libc_free(void *ctx,void *ptr,const char *site)
+{
+  free(ptr);
+}
+
+struct STR_Allocator str_allocator={
+    stralloc_libc_alloc, stralloc_libc_realloc, stralloc_libc_free, NULL,
+    };
+
+/**
+ * Sets the allocator used by the library.
+ */
+void str_set_allocator(const struct STR_Allocator *alloc)
+{
+  memcpy(&str_allocator,alloc,sizeof(struct STR_Allocator));
+}
+
+void *str_malloc_at(size_t size,const char *site)
+{
+  return str_allocator.alloc(str_allocator.ctx,size,site);
+}
+
+void *str_calloc_at(size_t count,size_t size,const char *site)
+{
+  void *ptr;
+  if ((size>0)&&(count>((size_t)-1)/size))
+    return NULL;
+  ptr=str_allocator.alloc(str_allocator.ctx,count*size,site);
+  if (ptr!=NULL)
+    memset(ptr,0,count*size);
+  return ptr;
+}
+
+void *str_realloc_at(void *ptr,size_t size,const char *site)
+{
+  STATS_ADD(reallocs,1);
+  return str_allocator.realloc(str_allocator.ctx,ptr,size,site);
+}
+
+void str_free_at(void *ptr,const char *site)
+{
+  str_allocator.free(str_allocator.ctx,ptr,site);
+}
+
+/**
+ * Counters of one allocation site.
+ */
+struct STR_AllocSite {
+    const char *site;
+    unsigned long allocs;
+    unsigned long reallocs;
+    unsigned long frees;
+    unsigned long long copied;  // Bytes moved by realloc
+    unsigned long long live;    // Bytes allocated and not freed
+    unsigned long long peak;    // Maximal value of live
+    };
+
+// Header placed before every block
+struct STR_AllocHeader {
+    size_t size;
+    struct STR_AllocSite *site;
+    };
+
+// Space reserved for the header; 16 bytes keep the alignment of malloc()
+#define STRALLOC_HEADER_SIZE 16
+#define STRALLOC_HEADER(ptr) ((struct STR_AllocHeader *)(((char *)(ptr))-STRALLOC_HEADER_SIZE))
+#define STRALLOC_BLOCK(hdr) ((void *)(((char *)(hdr))+STRALLOC_HEADER_SIZE))
+
+#define STRALLOC_SITES_COUNT 1024
+
+struct STR_AllocAccounting {
+    volatile int lock;
+    struct STR_AllocSite sites[STRALLOC_SITES_COUNT];
+    unsigned int sites_count;
+    unsigned long long live;
+    unsigned long long peak;
+    struct STR_AllocSite other; // Sites which didn't fit in the table
+    };
+
+struct STR_AllocAccounting *stralloc_acct=NULL;
+
+void stralloc_lock(struct STR_AllocAccounting *acct)
+{
+  while (__sync_lock_test_and_set(&acct->lock,1))
+    ;
+}
+
+void stralloc_unlock(struct STR_AllocAccounting *acct)
+{
+  __sync_lock_release(&acct->lock);
+}
+
+/**
+ * Finds counters of given allocation site, adding it if needed.
+ * Sites are identified by the string pointer, which is constant.
+ */
+struct STR_AllocSite *stralloc_site(struct STR_AllocAccounting *acct,const char *site)
+{
+  unsigned int pos;
+  pos=(((size_t)site)>>3)%STRALLOC_SITES_COUNT;
+  while (acct->sites[pos].site!=NULL)
+  {
+    if (acct->sites[pos].site==site)
+      return &acct->sites[pos];
+    pos=(pos+1)%STRALLOC_SITES_COUNT;
+  }
+  if (acct->sites_count+1>=STRALLOC_SITES_COUNT)
+    return &acct->other;
+  acct->sites[pos].site=site;
+  acct->sites_count++;
+  return &acct->sites[pos];
+}
+
+void stralloc_site_add(struct STR_AllocAccounting *acct,struct STR_AllocSite *asite,size_t size)
+{
+  asite->live+=size;
+  if (asite->live>asite->peak)
+    asite->peak=asite->live;
+  acct->live+=size;
+  if (acct->live>acct->peak)
+    acct->peak=acct->live;
+}
+
+void stralloc_site_remove(struct STR_AllocAccounting *acct,struct STR_AllocSite *asite,size_t size)
+{
+  asite->live-=size;
+  acct->live-=size;
+}
+
+void *stralloc_acct_alloc(void *ctx,size_t size,const char *site)
+{
+  struct STR_AllocAccounting *acct=ctx;
+  struct STR_AllocHeader *hdr;
+  hdr=malloc(STRALLOC_HEADER_SIZE+size);
+  if (hdr==NULL)
+    return NULL;
+  stralloc_lock(acct);
+  hdr->size=size;
+  hdr->site=stralloc_site(acct,site);
+  hdr->site->allocs++;
+  stralloc_site_add(acct,hdr->site,size);
+  stralloc_unlock(acct);
+  return STRALLOC_BLOCK(hdr);
+}
+
+/**
+ * Reallocates block with accounting. The block stays assigned to
+ * the site which allocated it; reallocs are counted for the site
+ * which called realloc.
+ */
+void *stralloc_acct_realloc(void *ctx,void *ptr,size_t size,const char *site)
+{
+  struct STR_AllocAccounting *acct=ctx;
+  struct STR_AllocHeader *hdr;
+  struct STR_AllocHeader *new_hdr;
+  struct STR_AllocSite *asite;
+  size_t old_size;
+  if (ptr==NULL)
+    return stralloc_acct_alloc(ctx,size,site);
+  hdr=STRALLOC_HEADER(ptr);
+  old_size=hdr->size;
+  new_hdr=realloc(hdr,STRALLOC_HEADER_SIZE+size);
+  if (new_hdr==NULL)
+    return NULL;
+  stralloc_lock(acct);
+  asite=stralloc_site(acct,site);
+  asite->reallocs++;
+  if (new_hdr!=hdr)
+    asite->copied+=(old_size<size)?old_size:size;
+  stralloc_site_remove(acct,new_hdr->site,old_size);
+  new_hdr->size=size;
+  stralloc_site_add(acct,new_hdr->site,size);
+  stralloc_unlock(acct);
+  return STRALLOC_BLOCK(new_hdr);
+}
+
+void stralloc_acct_free(void *ctx,void *ptr,const char *site)
+{
+  struct STR_AllocAccounting *acct=ctx;
+  struct STR_AllocHeader *hdr;
+  if (ptr==NULL)
+    return;
+  hdr=STRALLOC_HEADER(ptr);
+  stralloc_lock(acct);
+  hdr->site->frees++;
+  stralloc_site_remove(acct,hdr->site,hdr->size);
+  stralloc_unlock(acct);
+  free(hdr);
+}
+
+/**
+ * Switches the library to the accounting allocator.
+ * Has to be called before anything is allocated.
+ * @return Returns ERR_NONE on success.
+ */
+short stralloc_accounting_enable(void)
+{
+  struct STR_Allocator alloc;
+  if (stralloc_acct!=NULL)
+    return ERR_NONE;
+  stralloc_acct=calloc(1,sizeof(struct STR_AllocAccounting));
+  if (stralloc_acct==NULL)
+    return -1;
+  stralloc_acct->other.site="(other)";
+  alloc.alloc=stralloc_acct_alloc;
+  alloc.realloc=stralloc_acct_realloc;
+  alloc.free=stralloc_acct_free;
+  alloc.ctx=stralloc_acct;
+  str_set_allocator(&alloc);
+  return ERR_NONE;
+}
+
+static int stralloc_site_cmp(const void *ptr1,const void *ptr2)
+{
+  const struct STR_AllocSite *site1=*(const struct STR_AllocSite **)ptr1;
+  const struct STR_AllocSite *site2=*(const struct STR_AllocSite **)ptr2;
+  if (site1->peak!=site2->peak)
+    return (site1->peak>site2->peak)?-1:1;
+  if (site1->copied!=site2->copied)
+    return (site1->copied>site2->copied)?-1:1;
+  return strcmp(site1->site,site2->site);
+}
+
+/**
+ * Prints memory usage of every allocation site, largest first.
+ */
+void stralloc_accounting_print(FILE *fp)
+{
+  struct STR_AllocAccounting *acct=stralloc_acct;
+  struct STR_AllocSite **list;
+  unsigned int i,n;
+  if (acct==NULL)
+    return;
+  list=malloc((STRALLOC_SITES_COUNT+1)*sizeof(struct STR_AllocSite *));
+  if (list==NULL)
+    return;
+  stralloc_lock(acct);
+  n=0;
+  for (i=0;i<STRALLOC_SITES_COUNT;i++)
+  {
+    if (acct->sites[i].site!=NULL)
+      list[n++]=&acct->sites[i];
+  }
+  if ((acct->other.allocs>0)||(acct->other.reallocs>0))
+    list[n++]=&acct->other;
+  qsort(list,n,sizeof(struct STR_AllocSite *),stralloc_site_cmp);
+  fprintf(fp,"Memory allocations:\n");
+  fprintf(fp,"  %-24s %10s %10s %12s %12s %10s\n","site","allocs","reallocs",
+      "copied","peak bytes","live");
+  for (i=0;i<n;i++)
+  {
+    fprintf(fp,"  %-24s %10lu %10lu %12llu %12llu %10llu\n",list[i]->site,list[i]->allocs,
+        list[i]->reallocs,list[i]->copied,list[i]->peak,list[i]->live);
+  }
+  fprintf(fp,"  Peak memory used: %llu bytes, not freed at exit: %llu bytes\n",
+      acct->peak,acct->live);
+  stralloc_unlock(acct);
+  free(list);
+}
@@ -0,0 +1,58 @@
+/******************************************************************************/
+/** @file stralloc.h
+ * Library for r/w of DK2 STR text strings files.
+ * @par Purpose:
+ *     Header file. Defines exported routines from stralloc.c.
+ * @par Comment:
+ *     All memory used by the library is allocated with the macros below,
+ *     so that every call site is known to the allocator.
+ * @par  Copying and copyrights:
+ *     This program is free software; you can redistribute it and/or modify
+ *     it under the terms of the GNU General Public License as published by
+ *     the Free Software Foundation; either version 2 of the License, or
+ *     (at your option) any later version.
+ */
+/******************************************************************************/
+
+#ifndef STRALLOC_H
+#define STRALLOC_H
+
+#include <stdio.h>
+#include <stddef.h>
+
+#define STRALLOC_STR2(x) #x
+#define STRALLOC_STR(x) STRALLOC_STR2(x)
+// Call site given to the allocator - source file name and line
+#define STRALLOC_SITE __FILE__ ":" STRALLOC_STR(__LINE__)
+
+#define str_malloc(size) str_malloc_at((size),STRALLOC_SITE)
+#define str_calloc(count,size) str_calloc_at((count),(size),STRALLOC_SITE)
+#define str_realloc(ptr,size) str_realloc_at((ptr),(size),STRALLOC_SITE)
+#define str_free(ptr) str_free_at((ptr),STRALLOC_SITE)
+
+/**
+ * Memory allocator used by the library. Blocks allocated by one
+ * allocator must be freed by the same one, so it can be changed
+ * only before anything is allocated.
+ */
+struct STR_Allocator {
+    void *(*alloc)(void *ctx,size_t size,const char *site);
+    void *(*realloc)(void *ctx,void *ptr,size_t size,const char *site);
+    void (*free)(void *ctx,void *ptr,const char *site);
+    void *ctx;
+    };
+
+extern struct STR_Allocator str_allocator;
+
+// Routines
+
+void str_set_allocator(const struct STR_Allocator *alloc);
+void *str_malloc_at(size_t size,const char *site);
+void *str_calloc_at(size_t count,size_t size,const char *site);
+void *str_realloc_at(void *ptr,size_t size,const char *site);
+void str_free_at(void *ptr,const char *site);
+
+short stralloc_accounting_enable(void);
+void stralloc_accounting_print(FILE *fp);
+
+#endif
@@ -0,0 +1,479 @@
+/******************************************************************************/
+/** @file strbatch.c
+ * Library for r/w of DK2 STR text strings files.
+ * @par Purpose:
+ *     Processing of whole folders of STR and TXT files.
+ * @par Comment:
+ *     None.
+ * @par  Copying and copyrights:
+ *     This program is free software; you can redistribute it and/or modify
+ *     it under the terms of the GNU General Public License as published by
+ *     the Free Software Foundation; either version 2 of the License, or
+ *     (at your option) any later version.
+ */
+/******************************************************************************/
+
+#include "strbatch.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <ctype.h>
+#include <dirent.h>
+#include "lbfileio.h"
+#include "unitext.h"
+#include "strfile.h"
+#include "strmaker.h"
+#include "strcache.h"
+#include "strstats.h"
+#include "stralloc.h"
+
+/**
+ * Creates file name with path from given folder and file names.
+ * @return Returns newly allocated string, or NULL.
+ */
+char *path_join(const char *dirname,const char *fname)
+{
+  int dir_len=strlen(dirname);
+  char *path=str_malloc(dir_len+strlen(fname)+2);
+  if (path==NULL)
+    return NULL;
+  strcpy(path,dirname);
+  if ((dir_len>0)&&(dirname[dir_len-1]!='/')&&(dirname[dir_len-1]!='\\'))
+  {
+    path[dir_len]='/';
+    dir_len++;
+  }
+  strcpy(path+dir_len,fname);
+  return path;
+}
+
+/**
+ * Checks if file name ends with given extension, ignoring case.
+ * @param ext The extension, with dot.
+ */
+short fname_has_ext(const char *fname,const char *ext)
+{
+  int fname_len=strlen(fname);
+  int ext_len=strlen(ext);
+  int i;
+  if (fname_len<=ext_len)
+    return 0;
+  for (i=0;i<ext_len;i++)
+    if (tolower((unsigned char)fname[fname_len-ext_len+i])!=tolower((unsigned char)ext[i]))
+      return 0;
+  return 1;
+}
+
+/**
+ * Writes 64-bit hash as 16 hex digits.
+ */
+void hash_to_hex(char *dst,unsigned long long hash)
+{
+  sprintf(dst,"%08lx%08lx",(unsigned long)(hash>>32),(unsigned long)(hash&0xffffffffUL));
+}
+
+/**
+ * Reads 64-bit hash from 16 hex digits.
+ */
+unsigned long long hash_from_hex(const char *src)
+{
+  unsigned long long hash=0;
+  int i;
+  for (i=0;i<16;i++)
+  {
+    char chr=tolower((unsigned char)src[i]);
+    if ((chr>='0')&&(chr<='9'))
+      hash=(hash<<4)+(chr-'0');
+    else
+    if ((chr>='a')&&(chr<='f'))
+      hash=(hash<<4)+(chr-'a'+10);
+    else
+      break;
+  }
+  return hash;
+}
+
+/**
+ * Clears the STR_Manifest structure, drops any pointers.
+ */
+short manifest_clear(struct STR_Manifest *mft)
+{
+  mft->items=NULL;
+  mft->items_alloc=0;
+  mft->items_count=0;
+  return ERR_NONE;
+}
+
+/**
+ * Frees the STR_Manifest structure and all sub-structures.
+ */
+short manifest_free(struct STR_Manifest *mft)
+{
+  unsigned int i;
+  if (mft==NULL)
+    return -1;
+  for (i=0;i<mft->items_count;i++)
+    str_free(mft->items[i].name);
+  str_free(mft->items);
+  str_free(mft);
+  return ERR_NONE;
+}
+
+/**
+ * Adds new item with given name into manifest.
+ * @return Returns the new item, or NULL on error.
+ */
+struct STR_ManifestItem *manifest_add_item(struct STR_Manifest *mft,const char *name)
+{
+  struct STR_ManifestItem *item;
+  if (mft->items_count+1>mft->items_alloc)
+  {
+    item=str_realloc(mft->items,(mft->items_alloc+32)*sizeof(struct STR_ManifestItem));
+    if (item==NULL)
+      return NULL;
+    mft->items=item;
+    mft->items_alloc+=32;
+  }
+  item=&mft->items[mft->items_count];
+  memset(item,0,sizeof(struct STR_ManifestItem));
+  item->name=str_malloc(strlen(name)+1);
+  if (item->name==NULL)
+    return NULL;
+  strcpy(item->name,name);
+  mft->items_count++;
+  return item;
+}
+
+/**
+ * Finds manifest item for given source file name.
+ * @return Returns the item, or NULL if not found.
+ */
+struct STR_ManifestItem *manifest_get_item(struct STR_Manifest *mft,const char *name)
+{
+  unsigned int i;
+  for (i=0;i<mft->items_count;i++)
+    if (strcmp(mft->items[i].name,name)==0)
+      return &mft->items[i];
+  return NULL;
+}
+
+/**
+ * Reads manifest file. Missing file is not an error - the manifest
+ * is just left empty.
+ * @return Returns ERR_NONE on success.
+ */
+short manifest_read(struct STR_Manifest *mft,const char *fname,short flags)
+{
+  FILE *fp;
+  char line[1024];
+  fp=fopen(fname,"rb");
+  if (fp==NULL)
+    return ERR_NONE;
+  while (fgets(line,sizeof(line),fp)!=NULL)
+  {
+    struct STR_ManifestItem *item;
+    char txt_hash[17],cp_hash[17],str_hash[17];
+    long txt_size,txt_mtime,str_size,str_mtime;
+    unsigned int options;
+    int name_pos,n;
+    if (line[0]=='#')
+      continue;
+    n=strlen(line);
+    while ((n>0)&&((line[n-1]=='\n')||(line[n-1]=='\r')))
+      n--;
+    line[n]='\0';
+    name_pos=0;
+    if (sscanf(line,"%ld %ld %16s %16s %x %ld %ld %16s %n",&txt_size,&txt_mtime,
+        txt_hash,cp_hash,&options,&str_size,&str_mtime,str_hash,&name_pos)<8)
+      continue;
+    if ((name_pos<=0)||(line[name_pos]=='\0'))
+      continue;
+    item=manifest_add_item(mft,line+name_pos);
+    if (item==NULL)
+    {
+      if (flags&STRFLAG_VERBOSE)
+        str_error("Cannot allocate memory for manifest");
+      fclose(fp);
+      return -1;
+    }
+    item->txt_size=txt_size;
+    item->txt_mtime=txt_mtime;
+    item->txt_hash=hash_from_hex(txt_hash);
+    item->cp_hash=hash_from_hex(cp_hash);
+    item->options=options;
+    item->str_size=str_size;
+    item->str_mtime=str_mtime;
+    item->str_hash=hash_from_hex(str_hash);
+  }
+  fclose(fp);
+  return ERR_NONE;
+}
+
+/**
+ * Writes manifest file. Items which are not marked as used are skipped.
+ * @return Returns ERR_NONE on success, ERR_UNCHANGED if the file
+ *     had the same content before.
+ */
+short manifest_write(struct STR_Manifest *mft,const char *fname,short flags)
+{
+  FILE *fp;
+  char *tmpfname;
+  unsigned int i;
+  fp=str_fopen_temp(fname,&tmpfname,flags);
+  if (fp==NULL)
+    return -1;
+  fprintf(fp,"# strtool build manifest\n");
+  fprintf(fp,"# txt_size txt_mtime txt_hash cp_hash options str_size str_mtime str_hash name\n");
+  for (i=0;i<mft->items_count;i++)
+  {
+    struct STR_ManifestItem *item=&mft->items[i];
+    char txt_hash[17],cp_hash[17],str_hash[17];
+    if (!item->used)
+      continue;
+    hash_to_hex(txt_hash,item->txt_hash);
+    hash_to_hex(cp_hash,item->cp_hash);
+    hash_to_hex(str_hash,item->str_hash);
+    fprintf(fp,"%ld %ld %s %s %x %ld %ld %s %s\n",item->txt_size,item->txt_mtime,
+        txt_hash,cp_hash,(unsigned int)item->options,item->str_size,item->str_mtime,
+        str_hash,item->name);
+  }
+  return str_fclose_temp(fp,tmpfname,fname,ERR_NONE,flags);
+}
+
+/**
+ * Checks whether the STR file produced from manifest item is up to date.
+ * Hashes are computed only if size or modification time has changed;
+ * in that case the item is updated with new values.
+ * @param options Flags of current build which change the STR content.
+ * @return Returns 1 if the STR is up to date, 0 if it needs rebuild.
+ */
+short manifest_item_is_current(struct STR_ManifestItem *item,
+    const char *txtfname,const char *strfname,unsigned long long cp_hash,unsigned short options)
+{
+  long size,mtime;
+  unsigned long long hash;
+  if ((item->cp_hash!=cp_hash)||(item->options!=options))
+    return 0;
+  // Check the source
+  if (file_stat(txtfname,&size,&mtime)!=0)
+    return 0;
+  if ((size!=item->txt_size)||(mtime!=item->txt_mtime))
+  {
+    if (size!=item->txt_size)
+      return 0;
+    if (file_hash(txtfname,&hash)!=0)
+      return 0;
+    if (hash!=item->txt_hash)
+      return 0;
+    item->txt_mtime=mtime;
+  }
+  // Check the produced file
+  if (file_stat(strfname,&size,&mtime)!=0)
+    return 0;
+  if ((size!=item->str_size)||(mtime!=item->str_mtime))
+  {
+    if (size!=item->str_size)
+      return 0;
+    if (file_hash(strfname,&hash)!=0)
+      return 0;
+    if (hash!=item->str_hash)
+      return 0;
+    item->str_mtime=mtime;
+  }
+  return 1;
+}
+
+/**
+ * Converts TXT file into STR and stores information about both files
+ * in the manifest item.
+ * @return Returns ERR_NONE or ERR_UNCHANGED on success.
+ */
+short manifest_item_build(struct STR_ManifestItem *item,char *txtfname,char *strfname,
+    unsigned long long cp_hash,struct STR_EncCache *cache,short flags)
+{
+  struct STR_File *strfile;
+  short result;
+  stats_file_enter(txtfname);
+  strfile=str_open_unicode(txtfname,flags);
+  if (strfile!=NULL)
+  {
+    result=str_write_cached(strfile,strfname,NULL,cache,flags);
+    str_close(strfile,flags);
+  } else
+  {
+    result=-1;
+  }
+  stats_file_leave();
+  if (result<ERR_NONE)
+    return result;
+  if ((file_stat(txtfname,&item->txt_size,&item->txt_mtime)!=0)||
+      (file_hash(txtfname,&item->txt_hash)!=0)||
+      (file_stat(strfname,&item->str_size,&item->str_mtime)!=0)||
+      (file_hash(strfname,&item->str_hash)!=0))
+  {
+    if (flags&STRFLAG_VERBOSE)
+      str_ferror("Cannot read back %s after conversion",strfname);
+    return -1;
+  }
+  item->cp_hash=cp_hash;
+  item->options=flags&MANIFEST_OUTPUT_FLAGS;
+  return result;
+}
+
+/**
+ * Converts all TXT files in given folder into STR files, skipping
+ * the ones which are up to date according to the build manifest.
+ * @param dirname The folder with TXT files and MBToUni.dat.
+ * @param flags Flags used to manage the behaviour of the function.
+ * @return Returns ERR_NONE on success, or negative error code
+ *     if any of the files couldn't be converted.
+ */
+short str_batch_build(const char *dirname,short flags)
+{
+  struct STR_Manifest *mft;
+  struct STR_EncCache *cache;
+  DIR *dir;
+  struct dirent *dent;
+  unsigned long long cp_hash;
+  char *mftfname;
+  char *cpfname;
+  char *cachefname;
+  unsigned int count_total,count_current,count_written,count_unchanged,count_failed;
+  short result;
+  mft=str_malloc(sizeof(struct STR_Manifest));
+  mftfname=path_join(dirname,MANIFEST_FNAME);
+  cpfname=path_join(dirname,"MBToUni.dat");
+  if ((mft==NULL)||(mftfname==NULL)||(cpfname==NULL))
+  {
+    if (flags&STRFLAG_VERBOSE)
+      str_error("Cannot allocate memory for manifest");
+    str_free(mft);
+    str_free(mftfname);
+    str_free(cpfname);
+    return -1;
+  }
+  manifest_clear(mft);
+  if (file_hash(cpfname,&cp_hash)!=0)
+  {
+    if (flags&STRFLAG_VERBOSE)
+      str_ferror("%s when reading %s",strerror(errno),cpfname);
+    manifest_free(mft);
+    str_free(mftfname);
+    str_free(cpfname);
+    return -1;
+  }
+  str_free(cpfname);
+  // Texts repeated in many files are encoded only once
+  cache=enccache_create(cp_hash,ENCCACHE_DEFAULT_LIMIT);
+  cachefname=path_join(dirname,ENCCACHE_FNAME);
+  if ((cache==NULL)||(cachefname==NULL))
+  {
+    if (flags&STRFLAG_VERBOSE)
+      str_error("Cannot allocate memory for encoding cache");
+    enccache_free(cache);
+    str_free(cachefname);
+    manifest_free(mft);
+    str_free(mftfname);
+    return -1;
+  }
+  result=manifest_read(mft,mftfname,flags);
+  if ((result==ERR_NONE)&&(flags&STRFLAG_KEEPCACHE))
+    result=enccache_read(cache,cachefname,flags);
+  dir=NULL;
+  if (result==ERR_NONE)
+  {
+    dir=opendir(dirname);
+    if (dir==NULL)
+    {
+      if (flags&STRFLAG_VERBOSE)
+        str_ferror("%s when opening folder %s",strerror(errno),dirname);
+      result=-1;
+    }
+  }
+  count_total=0;
+  count_current=0;
+  count_written=0;
+  count_unchanged=0;
+  count_failed=0;
+  while ((result==ERR_NONE)&&((dent=readdir(dir))!=NULL))
+  {
+    struct STR_ManifestItem *item;
+    char *txtfname;
+    char *strfname;
+    int name_len;
+    if (!fname_has_ext(dent->d_name,".txt"))
+      continue;
+    count_total++;
+    txtfname=path_join(dirname,dent->d_name);
+    strfname=path_join(dirname,dent->d_name);
+    item=manifest_get_item(mft,dent->d_name);
+    if (item==NULL)
+      item=manifest_add_item(mft,dent->d_name);
+    if ((txtfname==NULL)||(strfname==NULL)||(item==NULL))
+    {
+      if (flags&STRFLAG_VERBOSE)
+        str_error("Cannot allocate memory for file names");
+      str_free(txtfname);
+      str_free(strfname);
+      result=-1;
+      break;
+    }
+    name_len=strlen(strfname);
+    strcpy(strfname+name_len-4,".str");
+    item->used=1;
+    if (manifest_item_is_current(item,txtfname,strfname,cp_hash,flags&MANIFEST_OUTPUT_FLAGS))
+    {
+      if (flags&STRFLAG_DEBUG)
+        printf("Up to date: %s\n",dent->d_name);
+      count_current++;
+    } else
+    {
+      if (flags&STRFLAG_VERBOSE)
+        printf("Converting %s\n",dent->d_name);
+      switch (manifest_item_build(item,txtfname,strfname,cp_hash,cache,flags))
+      {
+      case ERR_NONE:
+        count_written++;
+        break;
+      case ERR_UNCHANGED:
+        count_unchanged++;
+        break;
+      default:
+        // Make sure the item will be rebuilt next time
+        item->cp_hash=0;
+        item->str_size=-1;
+        count_failed++;
+        break;
+      }
+    }
+    str_free(txtfname);
+    str_free(strfname);
+  }
+  if (dir!=NULL)
+    closedir(dir);
+  if (result==ERR_NONE)
+    result=manifest_write(mft,mftfname,flags);
+  if ((result>=ERR_NONE)&&(flags&STRFLAG_KEEPCACHE))
+    result=enccache_write(cache,cachefname,flags);
+  if (flags&STRFLAG_VERBOSE)
+    printf("Encoding cache hits: %lu, misses: %lu, entries kept: %u\n",cache->hits,
+        cache->misses,cache->items_count);
+  enccache_free(cache);
+  str_free(cachefname);
+  manifest_free(mft);
+  str_free(mftfname);
+  if (flags&STRFLAG_VERBOSE)
+  {
+    printf("Text files: %u, up to date: %u, converted: %u\n",count_total,
+        count_current,count_total-count_current);
+    printf("Files written: %u, skipped as unchanged: %u, failed: %u\n",count_written,
+        count_unchanged,count_failed);
+  }
+  if (result<ERR_NONE)
+    return result;
+  if (count_failed>0)
+    return -1;
+  return ERR_NONE;
+}
@@ -0,0 +1,57 @@
+/******************************************************************************/
+/** @file strbatch.h
+ * Library for r/w of DK2 STR text strings files.
+ * @par Purpose:
+ *     Header file. Defines exported routines from strbatch.c.
+ * @par Comment:
+ *     None.
+ * @par  Copying and copyrights:
+ *     This program is free software; you can redistribute it and/or modify
+ *     it under the terms of the GNU General Public License as published by
+ *     the Free Software Foundation; either version 2 of the License, or
+ *     (at your option) any later version.
+ */
+/******************************************************************************/
+
+#ifndef STRBATCH_H
+#define STRBATCH_H
+
+#include <stdio.h>
+
+#define MANIFEST_FNAME "strtool.mft"
+// Flags which change content of produced STR files; stored in manifest
+#define MANIFEST_OUTPUT_FLAGS (STRFLAG_DEDUP)
+
+struct STR_ManifestItem {
+    char *name;              // Source TXT file name, without path
+    long txt_size;           // Source file size and modification time
+    long txt_mtime;
+    unsigned long long txt_hash;
+    unsigned long long cp_hash; // Hash of MBToUni.dat used for conversion
+    unsigned short options;  // MANIFEST_OUTPUT_FLAGS used for conversion
+    long str_size;           // Produced STR size and modification time
+    long str_mtime;
+    unsigned long long str_hash;
+    short used;              // Nonzero if the source still exists
+    };
+
+struct STR_Manifest {
+    unsigned int items_alloc;// Allocated items
+    unsigned int items_count;// Used items
+    struct STR_ManifestItem *items;
+    };
+
+// Routines
+
+char *path_join(const char *dirname,const char *fname);
+short fname_has_ext(const char *fname,const char *ext);
+
+short manifest_clear(struct STR_Manifest *mft);
+short manifest_free(struct STR_Manifest *mft);
+short manifest_read(struct STR_Manifest *mft,const char *fname,short flags);
+short manifest_write(struct STR_Manifest *mft,const char *fname,short flags);
+struct STR_ManifestItem *manifest_get_item(struct STR_Manifest *mft,const char *name);
+
+short str_batch_build(const char *dirname,short flags);
+
+#endif
@@ -0,0 +1,599 @@
+/******************************************************************************/
+/** @file strbench.c
+ * Library for r/w of DK2 STR text strings files.
+ * @par Purpose:
+ *     Benchmark of the STR encoding and decoding routines.
+ * @par Comment:
+ *     Separate program; every routine is run on real STR file and on
+ *     generated entries, and the results can be compared with baseline.
+ * @par  Copying and copyrights:
+ *     This program is free software; you can redistribute it and/or modify
+ *     it under the terms of the GNU General Public License as published by
+ *     the Free Software Foundation; either version 2 of the License, or
+ *     (at your option) any later version.
+ */
+/******************************************************************************/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "lbfileio.h"
+#include "unitext.h"
+#include "strfile.h"
+#include "strmaker.h"
+#include "strgen.h"
+#include "stralloc.h"
+
+// Minimal time of running every benchmark
+#define BENCH_MIN_TIME_NS 300000000ULL
+// Default allowed slowdown against baseline, in percent
+#define BENCH_DEFAULT_THRESHOLD 15
+#define BENCH_SYNTH_ENTRIES 2000
+#define BENCH_MAX_RESULTS 32
+
+struct BENCH_Fixture {
+    char name[32];
+    struct STR_Maker *mkstr; // Encoded entries and codepage
+    unsigned short **texts;  // Decoded entries
+    unsigned int count;
+    unsigned short *txtbuf;  // All entries joined into lines
+    long txtbuf_len;
+    unsigned short *outbuf;  // Buffer for decoding single chunk
+    FILE *iofp;              // Temporary file for lbfileio file routines
+    };
+
+struct BENCH_Result {
+    char name[64];
+    unsigned long long ops;
+    double ns_per_op;
+    double mb_per_s;
+    double allocs_per_op;
+    };
+
+typedef long (*BenchKernel)(struct BENCH_Fixture *fix);
+
+#ifdef BENCH_COUNT_ALLOCS
+unsigned long bench_allocs=0;
+
+// Allocations are counted by wrapping the functions at link time,
+// with "-Wl,--wrap=malloc,--wrap=calloc,--wrap=realloc"
+void *__real_malloc(size_t size);
+void *__real_calloc(size_t nmemb,size_t size);
+void *__real_realloc(void *ptr,size_t size);
+
+void *__wrap_malloc(size_t size)
+{
+  bench_allocs++;
+  return __real_malloc(size);
+}
+
+void *__wrap_calloc(size_t nmemb,size_t size)
+{
+  bench_allocs++;
+  return __real_calloc(nmemb,size);
+}
+
+void *__wrap_realloc(void *ptr,size_t size)
+{
+  bench_allocs++;
+  return __real_realloc(ptr,size);
+}
+#endif
+
+void bench_fixture_free(struct BENCH_Fixture *fix)
+{
+  unsigned int i;
+  if (fix->texts!=NULL)
+    for (i=0;i<fix->count;i++)
+      str_free(fix->texts[i]);
+  str_free(fix->texts);
+  str_free(fix->txtbuf);
+  str_free(fix->outbuf);
+  if (fix->mkstr!=NULL)
+    strmaker_free(fix->mkstr);
+  if (fix->iofp!=NULL)
+    fclose(fix->iofp);
+  memset(fix,0,sizeof(struct BENCH_Fixture));
+}
+
+/**
+ * Prepares decoded texts and text buffer for fixture with filled STR_Maker.
+ */
+short bench_fixture_prepare(struct BENCH_Fixture *fix)
+{
+  unsigned int i;
+  long len,pos,maxlen;
+  fix->count=fix->mkstr->offs_count;
+  fix->texts=str_calloc(fix->count+1,sizeof(unsigned short *));
+  if (fix->texts==NULL)
+    return -1;
+  len=0;
+  maxlen=0;
+  for (i=0;i<fix->count;i++)
+  {
+    if (strmaker_get_unicode_entry(fix->mkstr,&fix->texts[i],i,0)<0)
+      return -1;
+    if (fix->texts[i]==NULL)
+      return -1;
+    len+=unicode_strlen(fix->texts[i])+2;
+  }
+  fix->txtbuf=str_malloc((len+1)*sizeof(unsigned short));
+  if (fix->txtbuf==NULL)
+    return -1;
+  pos=0;
+  for (i=0;i<fix->count;i++)
+  {
+    len=unicode_strlen(fix->texts[i]);
+    memcpy(fix->txtbuf+pos,fix->texts[i],len*sizeof(unsigned short));
+    pos+=len;
+    fix->txtbuf[pos++]='\r';
+    fix->txtbuf[pos++]='\n';
+  }
+  fix->txtbuf[pos]=0;
+  fix->txtbuf_len=pos;
+  for (i=0;i<fix->count;i++)
+  {
+    char *edata;
+    len=strmaker_get_entry(fix->mkstr,&edata,i,0);
+    if (len>maxlen)
+      maxlen=len;
+  }
+  fix->outbuf=str_malloc((maxlen*2+16)*sizeof(unsigned short));
+  if (fix->outbuf==NULL)
+    return -1;
+  fix->iofp=tmpfile();
+  if (fix->iofp==NULL)
+    return -1;
+  return ERR_NONE;
+}
+
+/**
+ * Loads fixture from STR file; the codepage is loaded from the same folder.
+ */
+short bench_fixture_load(struct BENCH_Fixture *fix,const char *fname)
+{
+  FILE *fp;
+  memset(fix,0,sizeof(struct BENCH_Fixture));
+  strncpy(fix->name,filename_from_path(fname),sizeof(fix->name)-1);
+  fix->mkstr=str_malloc(sizeof(struct STR_Maker));
+  if (fix->mkstr==NULL)
+    return -1;
+  strmaker_clear(fix->mkstr);
+  if (str_mb2uni_load(fix->mkstr,fname,STRFLAG_VERBOSE)!=ERR_NONE)
+    return -1;
+  fp=fopen(fname,"rb");
+  if (fp==NULL)
+  {
+    str_ferror("Cannot open fixture %s",fname);
+    return -1;
+  }
+  if (strmaker_fread(fix->mkstr,fp,STRFLAG_VERBOSE)!=ERR_NONE)
+  {
+    fclose(fp);
+    return -1;
+  }
+  fclose(fp);
+  return bench_fixture_prepare(fix);
+}
+
+/**
+ * Creates fixture with generated entries, using characters from
+ * codepage of the given fixture. The codepage is extended, so that
+ * some characters need 0xff escape.
+ */
+short bench_fixture_generate(struct BENCH_Fixture *fix,const struct BENCH_Fixture *cpfix)
+{
+  struct STR_GenParams gp;
+  struct STR_Generator gen;
+  unsigned short *text;
+  unsigned int i;
+  memset(fix,0,sizeof(struct BENCH_Fixture));
+  strcpy(fix->name,"synthetic");
+  fix->mkstr=str_malloc(sizeof(struct STR_Maker));
+  if (fix->mkstr==NULL)
+    return -1;
+  strmaker_clear(fix->mkstr);
+  fix->mkstr->mb2uni_count=cpfix->mkstr->mb2uni_count;
+  fix->mkstr->mb2uni=str_malloc(fix->mkstr->mb2uni_count*sizeof(unsigned short));
+  if (fix->mkstr->mb2uni==NULL)
+    return -1;
+  memcpy(fix->mkstr->mb2uni,cpfix->mkstr->mb2uni,fix->mkstr->mb2uni_count*sizeof(unsigned short));
+  if (strgen_extend_codepage(fix->mkstr,STRGEN_EXTENDED_CP_COUNT)!=ERR_NONE)
+    return -1;
+  strgen_defaults(&gp);
+  gp.entries=BENCH_SYNTH_ENTRIES;
+  gp.escape_pct=2;
+  if (strgen_init(&gen,&gp,fix->mkstr->mb2uni,fix->mkstr->mb2uni_count)!=ERR_NONE)
+    return -1;
+  text=str_malloc((gp.max_len+16)*sizeof(unsigned short));
+  if (text==NULL)
+  {
+    strgen_free(&gen);
+    return -1;
+  }
+  for (i=0;i<gp.entries;i++)
+  {
+    strgen_entry_text(&gen,i,text,gp.max_len+16);
+    if (strmaker_add_unicode_entry(fix->mkstr,text,STRFLAG_VERBOSE)!=ERR_NONE)
+      break;
+  }
+  str_free(text);
+  strgen_free(&gen);
+  if (i<gp.entries)
+    return -1;
+  return bench_fixture_prepare(fix);
+}
+
+long bench_kernel_encode(struct BENCH_Fixture *fix)
+{
+  unsigned int i;
+  long bytes=0;
+  for (i=0;i<fix->count;i++)
+  {
+    unsigned char *edata;
+    long edata_len,len;
+    len=unicode_strlen(fix->texts[i]);
+    if (str_data_encode_r(&edata,&edata_len,fix->mkstr->mb2uni,fix->mkstr->mb2uni_count,
+        fix->texts[i],len)!=ERR_NONE)
+      return -1;
+    str_free(edata);
+    bytes+=len*sizeof(unsigned short);
+  }
+  return bytes;
+}
+
+long bench_kernel_decode(struct BENCH_Fixture *fix)
+{
+  unsigned int i;
+  long bytes=0;
+  for (i=0;i<fix->count;i++)
+  {
+    unsigned short *udata;
+    char *edata;
+    long edata_len,udata_len;
+    edata_len=strmaker_get_entry(fix->mkstr,&edata,i,0);
+    if (str_data_decode(&udata,&udata_len,fix->mkstr->mb2uni,fix->mkstr->mb2uni_count,
+        (unsigned char *)edata,edata_len)!=ERR_NONE)
+      return -1;
+    str_free(udata);
+    bytes+=edata_len;
+  }
+  return bytes;
+}
+
+long bench_kernel_decode_unchecked(struct BENCH_Fixture *fix)
+{
+  unsigned int i;
+  long bytes=0;
+  for (i=0;i<fix->count;i++)
+  {
+    unsigned short *udata;
+    char *edata;
+    long edata_len,udata_len;
+    edata_len=strmaker_get_entry(fix->mkstr,&edata,i,0);
+    if (str_data_decode_unchecked(&udata,&udata_len,fix->mkstr->mb2uni,fix->mkstr->mb2uni_count,
+        (unsigned char *)edata,edata_len)!=ERR_NONE)
+      return -1;
+    str_free(udata);
+    bytes+=edata_len;
+  }
+  return bytes;
+}
+
+long bench_kernel_validate(struct BENCH_Fixture *fix)
+{
+  if (strmaker_validate(fix->mkstr,NULL)!=ERR_NONE)
+    return -1;
+  return fix->mkstr->data_len;
+}
+
+long bench_kernel_strchunk(struct BENCH_Fixture *fix)
+{
+  unsigned int i;
+  long bytes=0;
+  for (i=0;i<fix->count;i++)
+  {
+    unsigned char *edata;
+    unsigned long chunk;
+    long edata_len,len;
+    edata_len=strmaker_get_entry(fix->mkstr,(char **)&edata,i,0);
+    if (edata_len<SIZEOF_STR_ChunkHeader)
+      continue;
+    chunk=read_int32_le_buf(edata);
+    len=(chunk>>8);
+    if (((chunk&0xff)!=CTSTR_STRING)||(len+SIZEOF_STR_ChunkHeader>edata_len))
+      continue;
+    str_data_strchunk_decode(fix->outbuf,fix->mkstr->mb2uni,fix->mkstr->mb2uni_count,
+        edata+SIZEOF_STR_ChunkHeader,len);
+    bytes+=len;
+  }
+  return bytes;
+}
+
+long bench_kernel_lines_count(struct BENCH_Fixture *fix)
+{
+  if (unicode_buf_lines_count(fix->txtbuf,fix->txtbuf_len)<fix->count)
+    return -1;
+  return fix->txtbuf_len*sizeof(unsigned short);
+}
+
+long bench_kernel_int32_le(struct BENCH_Fixture *fix)
+{
+  unsigned long sum=0;
+  long i,len;
+  len=fix->mkstr->data_len&(~3);
+  for (i=0;i<len;i+=4)
+    sum+=read_int32_le_buf(fix->mkstr->data+i);
+  for (i=0;i<len;i+=4)
+    write_int32_le_buf((unsigned char *)fix->outbuf,sum+i);
+  return len*2;
+}
+
+/**
+ * Writes data of the fixture into temporary file with lbfileio file
+ * routines, 4 or 2 bytes at once, and reads it back.
+ */
+long bench_kernel_int32_le_file(struct BENCH_Fixture *fix)
+{
+  unsigned long sum1=0,sum2=0;
+  long i,len;
+  len=fix->mkstr->data_len&(~3);
+  rewind(fix->iofp);
+  for (i=0;i<len;i+=4)
+  {
+    unsigned long x=read_int32_le_buf(fix->mkstr->data+i);
+    write_int32_le_file(fix->iofp,x);
+    sum1+=x;
+  }
+  rewind(fix->iofp);
+  for (i=0;i<len;i+=4)
+    sum2+=read_int32_le_file(fix->iofp);
+  if (ferror(fix->iofp)||(sum1!=sum2))
+    return -1;
+  return len*2;
+}
+
+long bench_kernel_int16_le_file(struct BENCH_Fixture *fix)
+{
+  unsigned short sum1=0,sum2=0;
+  long i,len;
+  len=fix->mkstr->data_len&(~1);
+  rewind(fix->iofp);
+  for (i=0;i<len;i+=2)
+  {
+    unsigned short x=read_int16_le_buf(fix->mkstr->data+i);
+    write_int16_le_file(fix->iofp,x);
+    sum1+=x;
+  }
+  rewind(fix->iofp);
+  for (i=0;i<len;i+=2)
+    sum2+=read_int16_le_file(fix->iofp);
+  if (ferror(fix->iofp)||(sum1!=sum2))
+    return -1;
+  return len*2;
+}
+
+long bench_kernel_hash(struct BENCH_Fixture *fix)
+{
+  unsigned long long hash;
+  hash=hash_fnv64_buf(fix->mkstr->data,fix->mkstr->data_len,FNV_HASH_INIT);
+  if (hash==0)
+    return -1;
+  return fix->mkstr->data_len;
+}
+
+/**
+ * Runs the kernel repeatedly until minimal time passes, and computes
+ * the results. Operations are entries of the fixture.
+ */
+short bench_run(struct BENCH_Result *res,const char *kname,BenchKernel kernel,
+    struct BENCH_Fixture *fix)
+{
+  unsigned long long start,elapsed,passes,bytes;
+#ifdef BENCH_COUNT_ALLOCS
+  unsigned long allocs;
+#endif
+  long pass_bytes;
+  sprintf(res->name,"%s/%s",kname,fix->name);
+  // Warm up caches
+  if (kernel(fix)<0)
+  {
+    str_ferror("Benchmark %s failed",res->name);
+    return -1;
+  }
+  passes=0;
+  bytes=0;
+#ifdef BENCH_COUNT_ALLOCS
+  allocs=bench_allocs;
+#endif
+  start=clock_ns();
+  do {
+    pass_bytes=kernel(fix);
+    if (pass_bytes<0)
+    {
+      str_ferror("Benchmark %s failed",res->name);
+      return -1;
+    }
+    bytes+=pass_bytes;
+    passes++;
+    elapsed=clock_ns()-start;
+  } while (elapsed<BENCH_MIN_TIME_NS);
+  res->ops=passes*fix->count;
+  res->ns_per_op=(double)elapsed/res->ops;
+  res->mb_per_s=(double)bytes*1000.0/elapsed;
+  res->allocs_per_op=-1.0;
+#ifdef BENCH_COUNT_ALLOCS
+  res->allocs_per_op=(double)(bench_allocs-allocs)/res->ops;
+#endif
+  return ERR_NONE;
+}
+
+void bench_print_json(FILE *fp,struct BENCH_Result *results,int count)
+{
+  int i;
+  fprintf(fp,"{\"benchmarks\": [\n");
+  for (i=0;i<count;i++)
+  {
+    fprintf(fp,"{\"name\": \"%s\", \"ops\": %llu, \"ns_per_op\": %.2f, \"mb_per_s\": %.2f, \"allocs_per_op\": %.2f}%s\n",
+        results[i].name,results[i].ops,results[i].ns_per_op,results[i].mb_per_s,
+        results[i].allocs_per_op,(i+1<count)?",":"");
+  }
+  fprintf(fp,"]}\n");
+}
+
+/**
+ * Compares results with baseline file, written before with --save.
+ * @return Returns amount of benchmarks slower than the threshold allows.
+ */
+int bench_compare_baseline(const char *fname,struct BENCH_Result *results,int count,
+    int threshold)
+{
+  FILE *fp;
+  char line[512];
+  int regressions,i;
+  fp=fopen(fname,"r");
+  if (fp==NULL)
+  {
+    str_ferror("Cannot open baseline %s",fname);
+    return -1;
+  }
+  regressions=0;
+  while (fgets(line,sizeof(line),fp)!=NULL)
+  {
+    char name[64];
+    double ns_per_op;
+    char *pos;
+    if (sscanf(line,"{\"name\": \"%63[^\"]\"",name)!=1)
+      continue;
+    pos=strstr(line,"\"ns_per_op\":");
+    if ((pos==NULL)||(sscanf(pos,"\"ns_per_op\": %lf",&ns_per_op)!=1))
+      continue;
+    for (i=0;i<count;i++)
+    {
+      if (strcmp(results[i].name,name)!=0)
+        continue;
+      double change=(results[i].ns_per_op-ns_per_op)*100.0/ns_per_op;
+      if (change>threshold)
+      {
+        fprintf(stderr,"REGRESSION %s: %.2f ns/entry, baseline %.2f (%+.1f%%)\n",name,
+            results[i].ns_per_op,ns_per_op,change);
+        regressions++;
+      }
+      break;
+    }
+  }
+  fclose(fp);
+  return regressions;
+}
+
+int main(int argc, char *argv[])
+{
+  struct BENCH_Fixture fixtures[2];
+  struct BENCH_Result results[BENCH_MAX_RESULTS];
+  const char *fixture_fname="LEVEL1.str";
+  const char *baseline_fname=NULL;
+  const char *save_fname=NULL;
+  short print_json=0;
+  int threshold=BENCH_DEFAULT_THRESHOLD;
+  int count,i,k;
+  static const struct {
+    const char *name;
+    BenchKernel kernel;
+  } kernels[]={
+    {"str_data_encode_r",bench_kernel_encode},
+    {"str_data_decode",bench_kernel_decode},
+    {"str_data_decode_unchecked",bench_kernel_decode_unchecked},
+    {"strmaker_validate",bench_kernel_validate},
+    {"str_data_strchunk_decode",bench_kernel_strchunk},
+    {"unicode_buf_lines_count",bench_kernel_lines_count},
+    {"int32_le_buf",bench_kernel_int32_le},
+    {"int32_le_file",bench_kernel_int32_le_file},
+    {"int16_le_file",bench_kernel_int16_le_file},
+    {"hash_fnv64_buf",bench_kernel_hash},
+  };
+  for (i=1;i<argc;i++)
+  {
+    if (strcmp(argv[i],"--json")==0)
+      print_json=1;
+    else
+    if (strncmp(argv[i],"--save=",7)==0)
+      save_fname=argv[i]+7;
+    else
+    if (strncmp(argv[i],"--baseline=",11)==0)
+      baseline_fname=argv[i]+11;
+    else
+    if (strncmp(argv[i],"--threshold=",12)==0)
+      threshold=atoi(argv[i]+12);
+    else
+    if (strncmp(argv[i],"--",2)!=0)
+      fixture_fname=argv[i];
+    else
+    {
+      printf("Usage:\n");
+      printf("  strbench [--json] [--save=<file>] [--baseline=<file>]\n");
+      printf("           [--threshold=<percent>] [<strfile>]\n");
+      printf("The <strfile> must have MBToUni.dat in its folder;\n");
+      printf("default is %s in current folder.\n",fixture_fname);
+      return 1;
+    }
+  }
+  if (bench_fixture_load(&fixtures[0],fixture_fname)!=ERR_NONE)
+  {
+    str_error("Cannot load the fixture");
+    return 2;
+  }
+  if (bench_fixture_generate(&fixtures[1],&fixtures[0])!=ERR_NONE)
+  {
+    str_error("Cannot generate synthetic fixture");
+    return 2;
+  }
+  count=0;
+  for (k=0;k<2;k++)
+    for (i=0;i<sizeof(kernels)/sizeof(kernels[0]);i++)
+    {
+      if (bench_run(&results[count],kernels[i].name,kernels[i].kernel,&fixtures[k])!=ERR_NONE)
+        return 2;
+      count++;
+    }
+  for (k=0;k<2;k++)
+    bench_fixture_free(&fixtures[k]);
+  if (print_json)
+  {
+    bench_print_json(stdout,results,count);
+  } else
+  {
+    printf("%-40s %12s %10s %12s\n","benchmark","ns/entry","MB/s","allocs/entry");
+    for (i=0;i<count;i++)
+    {
+      if (results[i].allocs_per_op<0)
+        printf("%-40s %12.2f %10.2f %12s\n",results[i].name,results[i].ns_per_op,
+            results[i].mb_per_s,"n/a");
+      else
+        printf("%-40s %12.2f %10.2f %12.2f\n",results[i].name,results[i].ns_per_op,
+            results[i].mb_per_s,results[i].allocs_per_op);
+    }
+  }
+  if (save_fname!=NULL)
+  {
+    FILE *fp=fopen(save_fname,"w");
+    if (fp==NULL)
+    {
+      str_ferror("Cannot write %s",save_fname);
+      return 2;
+    }
+    bench_print_json(fp,results,count);
+    fclose(fp);
+  }
+  if (baseline_fname!=NULL)
+  {
+    int regressions=bench_compare_baseline(baseline_fname,results,count,threshold);
+    if (regressions<0)
+      return 2;
+    if (regressions>0)
+    {
+      fprintf(stderr,"Benchmarks slower than baseline by over %d%%: %d\n",threshold,regressions);
+      return 3;
+    }
+  }
+  return 0;
+}
@@ -0,0 +1,584 @@
+/******************************************************************************/
+/** @file strbundle.c
+ * Library for r/w of DK2 STR text strings files.
+ * @par Purpose:
+ *     Bundle of many STR files, used directly after mapping into memory.
+ * @par Comment:
+ *     Entries in the bundle are kept encoded, exactly as in STR files;
+ *     unpacking gives back identical STR files.
+ * @par  Copying and copyrights:
+ *     This program is free software; you can redistribute it and/or modify
+ *     it under the terms of the GNU General Public License as published by
+ *     the Free Software Foundation; either version 2 of the License, or
+ *     (at your option) any later version.
+ */
+/******************************************************************************/
+
+#include "strbundle.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <dirent.h>
+#include "lbfileio.h"
+#include "unitext.h"
+#include "strfile.h"
+#include "strmaker.h"
+#include "strbatch.h"
+#include "strctx.h"
+#include "strdcache.h"
+#include "stralloc.h"
+
+const char bnd_magic[]="BFSB";
+const char bnd_str_magic[]="BFST";
+#define BND_VERSION 1
+
+#define BND_ALIGNED(pos) (((pos)+BND_ALIGN-1)&(~(unsigned long)(BND_ALIGN-1)))
+// Bundle is mapped whole, so its size must fit in long
+#define BND_MAX_SIZE 0x7fffff00UL
+
+struct BND_File {
+    char *name;              // File name, without extension
+    struct STR_Maker *mkstr;
+    unsigned long data_offs; // Offset of the data in data section
+    };
+
+static int bnd_file_cmp(const void *ptr1,const void *ptr2)
+{
+  const struct BND_File *file1=ptr1;
+  const struct BND_File *file2=ptr2;
+  return strcmp(file1->name,file2->name);
+}
+
+/**
+ * Clears the STR_Bundle structure, drops any pointers.
+ */
+short strbundle_clear(struct STR_Bundle *bnd)
+{
+  memset(bnd,0,sizeof(struct STR_Bundle));
+  return ERR_NONE;
+}
+
+/**
+ * Maps bundle file into memory and checks its structure; entries are
+ * checked to be within data of their file, but their chunks are not.
+ * @return Returns ERR_NONE on success.
+ */
+short strbundle_open(struct STR_Bundle *bnd,const char *fname,short flags)
+{
+  unsigned long files_pos,offsets_pos,names_pos,blocks_pos;
+  unsigned long name_offs,first,count,data_offs,data_size,offs;
+  unsigned int i,k;
+  const unsigned char *item;
+  strbundle_clear(bnd);
+  bnd->data=file_map(fname,&bnd->data_len);
+  if (bnd->data==NULL)
+  {
+    if (flags&STRFLAG_VERBOSE)
+      str_ferror("Cannot map bundle file %s",fname);
+    return -1;
+  }
+  if ((bnd->data_len<SIZEOF_BND_Header)||(memcmp(bnd->data,bnd_magic,4)!=0)||
+      (read_int32_le_buf(bnd->data+4)!=BND_VERSION))
+  {
+    if (flags&STRFLAG_VERBOSE)
+      str_ferror("File %s is not a STR bundle",fname);
+    strbundle_close(bnd);
+    return -1;
+  }
+  bnd->files_count=read_int32_le_buf(bnd->data+8);
+  bnd->offsets_count=read_int32_le_buf(bnd->data+12);
+  bnd->names_size=read_int32_le_buf(bnd->data+16);
+  bnd->blocks_size=read_int32_le_buf(bnd->data+20)&0xffffffffUL;
+  // Every section is bounded by the file size before its end is computed
+  files_pos=SIZEOF_BND_Header;
+  offsets_pos=0;
+  names_pos=0;
+  blocks_pos=0;
+  if (bnd->files_count<=(bnd->data_len-files_pos)/SIZEOF_BND_FileItem)
+    offsets_pos=files_pos+(unsigned long)bnd->files_count*SIZEOF_BND_FileItem;
+  if ((offsets_pos>0)&&(bnd->offsets_count<=(bnd->data_len-offsets_pos)/SIZEOF_BND_Offset))
+    names_pos=BND_ALIGNED(offsets_pos+(unsigned long)bnd->offsets_count*SIZEOF_BND_Offset);
+  if ((names_pos>0)&&(names_pos<=bnd->data_len)&&(bnd->names_size<=bnd->data_len-names_pos))
+    blocks_pos=BND_ALIGNED(names_pos+bnd->names_size);
+  if ((blocks_pos==0)||(blocks_pos>bnd->data_len)||(bnd->blocks_size!=bnd->data_len-blocks_pos)||
+      (bnd->names_size<1)||(bnd->data[names_pos+bnd->names_size-1]!=0))
+  {
+    if (flags&STRFLAG_VERBOSE)
+      str_ferror("Bundle file %s is damaged",fname);
+    strbundle_close(bnd);
+    return -1;
+  }
+  bnd->files=bnd->data+files_pos;
+  bnd->offsets=bnd->data+offsets_pos;
+  bnd->names=(const char *)bnd->data+names_pos;
+  bnd->blocks=bnd->data+blocks_pos;
+  for (i=0;i<bnd->files_count;i++)
+  {
+    item=bnd->files+i*SIZEOF_BND_FileItem;
+    name_offs=read_int32_le_buf(item)&0xffffffffUL;
+    count=read_int32_le_buf(item+8)&0xffffffffUL;
+    first=read_int32_le_buf(item+12)&0xffffffffUL;
+    data_offs=read_int32_le_buf(item+16)&0xffffffffUL;
+    data_size=read_int32_le_buf(item+20)&0xffffffffUL;
+    if ((name_offs>=bnd->names_size)||(first>bnd->offsets_count)||
+        (count>bnd->offsets_count-first)||(data_offs>bnd->blocks_size)||
+        (data_size>bnd->blocks_size-data_offs)||((data_offs%BND_ALIGN)!=0)||
+        ((i>0)&&(strcmp(strbundle_file_name(bnd,i-1),bnd->names+name_offs)>=0)))
+      break;
+    for (k=0;k<count;k++)
+    {
+      offs=read_int32_le_buf(bnd->offsets+(first+k)*SIZEOF_BND_Offset)&0xffffffffUL;
+      if (offs+SIZEOF_STR_ChunkHeader>data_size)
+        break;
+    }
+    if (k<count)
+      break;
+  }
+  if (i<bnd->files_count)
+  {
+    if (flags&STRFLAG_VERBOSE)
+      str_ferror("Bundle file %s is damaged at file %u",fname,i);
+    strbundle_close(bnd);
+    return -1;
+  }
+  return ERR_NONE;
+}
+
+/**
+ * Unmaps the bundle file.
+ */
+short strbundle_close(struct STR_Bundle *bnd)
+{
+  file_unmap(bnd->data,bnd->data_len);
+  strbundle_clear(bnd);
+  return ERR_NONE;
+}
+
+const char *strbundle_file_name(const struct STR_Bundle *bnd,unsigned int file_idx)
+{
+  unsigned long offs=read_int32_le_buf(bnd->files+file_idx*SIZEOF_BND_FileItem);
+  if (offs>=bnd->names_size)
+    return "";
+  return bnd->names+offs;
+}
+
+unsigned int strbundle_file_id(const struct STR_Bundle *bnd,unsigned int file_idx)
+{
+  return read_int32_le_buf(bnd->files+file_idx*SIZEOF_BND_FileItem+4);
+}
+
+unsigned int strbundle_entries_count(const struct STR_Bundle *bnd,unsigned int file_idx)
+{
+  return read_int32_le_buf(bnd->files+file_idx*SIZEOF_BND_FileItem+8);
+}
+
+/**
+ * Finds STR file in the bundle.
+ * @param name File name, without extension.
+ * @return Returns index of the file, or -1 if it's not in the bundle.
+ */
+int strbundle_find_file(const struct STR_Bundle *bnd,const char *name)
+{
+  unsigned int lo=0,hi=bnd->files_count;
+  while (lo<hi)
+  {
+    unsigned int mid=(lo+hi)>>1;
+    int cmp=strcmp(strbundle_file_name(bnd,mid),name);
+    if (cmp==0)
+      return mid;
+    if (cmp<0)
+      lo=mid+1;
+    else
+      hi=mid;
+  }
+  return -1;
+}
+
+/**
+ * Gives encoded entry from the bundle, without copying it.
+ * @param edata Output for pointer to the entry, inside mapped file.
+ * @return Returns size of the entry, or -1 if there's no such entry.
+ */
+long strbundle_get_entry(const struct STR_Bundle *bnd,unsigned int file_idx,
+    unsigned int entry_idx,const unsigned char **edata)
+{
+  const unsigned char *item;
+  unsigned long offs,data_size;
+  (*edata)=NULL;
+  if (file_idx>=bnd->files_count)
+    return -1;
+  item=bnd->files+file_idx*SIZEOF_BND_FileItem;
+  if (entry_idx>=(read_int32_le_buf(item+8)&0xffffffffUL))
+    return -1;
+  offs=read_int32_le_buf(bnd->offsets+((read_int32_le_buf(item+12)&0xffffffffUL)+entry_idx)
+      *SIZEOF_BND_Offset)&0xffffffffUL;
+  data_size=read_int32_le_buf(item+20)&0xffffffffUL;
+  (*edata)=bnd->blocks+(read_int32_le_buf(item+16)&0xffffffffUL)+offs;
+  return str_entry_length(*edata,data_size-offs);
+}
+
+/**
+ * Writes zeros up to the next aligned position.
+ * @return Returns the new position.
+ */
+unsigned long bundle_write_padding(FILE *fp,unsigned long pos)
+{
+  while ((pos%BND_ALIGN)!=0)
+  {
+    fputc(0,fp);
+    pos++;
+  }
+  return pos;
+}
+
+/**
+ * Writes the bundle file from loaded STR files, sorted by name.
+ */
+short bundle_write(struct BND_File *files,unsigned int files_count,const char *fname,short flags)
+{
+  FILE *fp;
+  char *tmpfname;
+  unsigned long offsets_count,names_size,blocks_size,pos,k;
+  unsigned int i,n;
+  offsets_count=0;
+  names_size=1;
+  blocks_size=0;
+  pos=SIZEOF_BND_Header+BND_ALIGN;
+  for (i=0;i<files_count;i++)
+  {
+    // Size of every part is added to the total before it can overflow
+    k=SIZEOF_BND_FileItem+(unsigned long)files[i].mkstr->offs_count*SIZEOF_BND_Offset+
+        strlen(files[i].name)+1+files[i].mkstr->data_len+BND_ALIGN;
+    if ((files[i].mkstr->offs_count>BND_MAX_SIZE/SIZEOF_BND_Offset)||
+        (files[i].mkstr->data_len>BND_MAX_SIZE)||(k>BND_MAX_SIZE-pos))
+      break;
+    pos+=k;
+    offsets_count+=files[i].mkstr->offs_count;
+    names_size+=strlen(files[i].name)+1;
+    files[i].data_offs=blocks_size;
+    blocks_size=BND_ALIGNED(blocks_size+files[i].mkstr->data_len);
+  }
+  if (i<files_count)
+  {
+    if (flags&STRFLAG_VERBOSE)
+      str_ferror("Bundle would be too large with %s",files[i].name);
+    return -1;
+  }
+  fp=str_fopen_temp(fname,&tmpfname,flags);
+  if (fp==NULL)
+    return -1;
+  // Header
+  fwrite(bnd_magic,1,4,fp);
+  write_int32_le_file(fp,BND_VERSION);
+  write_int32_le_file(fp,files_count);
+  write_int32_le_file(fp,offsets_count);
+  write_int32_le_file(fp,names_size);
+  write_int32_le_file(fp,blocks_size);
+  write_int32_le_file(fp,0);
+  write_int32_le_file(fp,0);
+  // Files
+  k=0;
+  pos=0;
+  for (i=0;i<files_count;i++)
+  {
+    write_int32_le_file(fp,k);
+    write_int32_le_file(fp,files[i].mkstr->file_id);
+    write_int32_le_file(fp,files[i].mkstr->offs_count);
+    write_int32_le_file(fp,pos);
+    write_int32_le_file(fp,files[i].data_offs);
+    write_int32_le_file(fp,files[i].mkstr->data_len);
+    write_int32_le_file(fp,0);
+    write_int32_le_file(fp,0);
+    k+=strlen(files[i].name)+1;
+    pos+=files[i].mkstr->offs_count;
+  }
+  // Offsets
+  for (i=0;i<files_count;i++)
+    for (n=0;n<files[i].mkstr->offs_count;n++)
+      write_int32_le_file(fp,files[i].mkstr->offsets[n]);
+  pos=SIZEOF_BND_Header+files_count*SIZEOF_BND_FileItem+offsets_count*SIZEOF_BND_Offset;
+  pos=bundle_write_padding(fp,pos);
+  // Names
+  for (i=0;i<files_count;i++)
+    fwrite(files[i].name,1,strlen(files[i].name)+1,fp);
+  fputc(0,fp);
+  pos=bundle_write_padding(fp,pos+names_size);
+  // Data
+  pos=0;
+  for (i=0;i<files_count;i++)
+  {
+    fwrite(files[i].mkstr->data,1,files[i].mkstr->data_len,fp);
+    pos=bundle_write_padding(fp,pos+files[i].mkstr->data_len);
+  }
+  if (flags&STRFLAG_VERBOSE)
+    printf("Bundle has %u files, %lu entries, %lu bytes of data\n",files_count,
+        offsets_count,blocks_size);
+  return str_fclose_temp(fp,tmpfname,fname,ferror(fp)?-1:ERR_NONE,flags);
+}
+
+/**
+ * Packs all STR files from given folder into one bundle file.
+ * @param dirname The folder with STR files.
+ * @param fname Name of the bundle file.
+ * @param flags Flags used to manage the behaviour of the function.
+ * @return Returns ERR_NONE, ERR_UNCHANGED or negative error code.
+ */
+short str_bundle_pack(const char *dirname,const char *fname,short flags)
+{
+  struct BND_File *files;
+  struct BND_File *file;
+  struct dirent *dent;
+  unsigned int files_count,files_alloc,i;
+  char *strfname;
+  DIR *dir;
+  FILE *fp;
+  short result;
+  dir=opendir(dirname);
+  if (dir==NULL)
+  {
+    if (flags&STRFLAG_VERBOSE)
+      str_ferror("%s when opening folder %s",strerror(errno),dirname);
+    return -1;
+  }
+  files=NULL;
+  files_count=0;
+  files_alloc=0;
+  result=ERR_NONE;
+  while ((result==ERR_NONE)&&((dent=readdir(dir))!=NULL))
+  {
+    if (!fname_has_ext(dent->d_name,".str"))
+      continue;
+    if (files_count>=files_alloc)
+    {
+      file=str_realloc(files,(files_alloc+32)*sizeof(struct BND_File));
+      if (file==NULL)
+      {
+        result=ERR_NO_MEMORY;
+        break;
+      }
+      files=file;
+      files_alloc+=32;
+    }
+    file=&files[files_count];
+    file->name=str_malloc(strlen(dent->d_name)+1);
+    file->mkstr=str_malloc(sizeof(struct STR_Maker));
+    strfname=path_join(dirname,dent->d_name);
+    if ((file->name==NULL)||(file->mkstr==NULL)||(strfname==NULL))
+    {
+      str_free(file->name);
+      str_free(file->mkstr);
+      str_free(strfname);
+      result=ERR_NO_MEMORY;
+      break;
+    }
+    files_count++;
+    strcpy(file->name,dent->d_name);
+    file->name[strlen(file->name)-4]='\0';
+    strmaker_clear(file->mkstr);
+    fp=fopen(strfname,"rb");
+    if (fp==NULL)
+    {
+      if (flags&STRFLAG_VERBOSE)
+        str_ferror("%s when opening %s",strerror(errno),strfname);
+      result=-1;
+    } else
+    {
+      result=strmaker_fread(file->mkstr,fp,flags);
+      fclose(fp);
+      if ((result!=ERR_NONE)&&(flags&STRFLAG_VERBOSE))
+        str_ferror("Cannot pack %s",strfname);
+    }
+    str_free(strfname);
+  }
+  closedir(dir);
+  if (result==ERR_NO_MEMORY)
+  {
+    if (flags&STRFLAG_VERBOSE)
+      str_error("Cannot allocate memory for STR files");
+  }
+  if (result==ERR_NONE)
+  {
+    qsort(files,files_count,sizeof(struct BND_File),bnd_file_cmp);
+    result=bundle_write(files,files_count,fname,flags);
+  }
+  for (i=0;i<files_count;i++)
+  {
+    str_free(files[i].name);
+    strmaker_free(files[i].mkstr);
+  }
+  str_free(files);
+  return result;
+}
+
+/**
+ * Checks whether file name from the bundle can be used for writing
+ * into the folder; it cannot be empty, contain a path or lead outside
+ * of the folder.
+ * @return Returns non-zero if the name is correct.
+ */
+int bundle_name_valid(const char *name)
+{
+  if ((name[0]=='\0')||(strpbrk(name,"/\\:")!=NULL)||(strstr(name,"..")!=NULL))
+    return 0;
+  return 1;
+}
+
+/**
+ * Writes STR files from the bundle into given folder; files which
+ * already have identical content are not modified.
+ * @return Returns ERR_NONE on success, or negative error code.
+ */
+short str_bundle_unpack(const char *fname,const char *dirname,short flags)
+{
+  struct STR_Bundle bnd;
+  const unsigned char *item;
+  unsigned int i,k,count,first;
+  unsigned int count_written,count_unchanged;
+  char *strfname;
+  char *tmpfname;
+  FILE *fp;
+  short result;
+  result=strbundle_open(&bnd,fname,flags);
+  if (result!=ERR_NONE)
+    return result;
+  count_written=0;
+  count_unchanged=0;
+  for (i=0;(result>=ERR_NONE)&&(i<bnd.files_count);i++)
+  {
+    item=bnd.files+i*SIZEOF_BND_FileItem;
+    count=read_int32_le_buf(item+8);
+    first=read_int32_le_buf(item+12);
+    if (!bundle_name_valid(strbundle_file_name(&bnd,i)))
+    {
+      if (flags&STRFLAG_VERBOSE)
+        str_ferror("Bundle file %s has invalid file name at file %u",fname,i);
+      result=-1;
+      break;
+    }
+    strfname=str_malloc(strlen(dirname)+strlen(strbundle_file_name(&bnd,i))+6);
+    if (strfname==NULL)
+    {
+      result=ERR_NO_MEMORY;
+      break;
+    }
+    sprintf(strfname,"%s.str",strbundle_file_name(&bnd,i));
+    tmpfname=strfname;
+    strfname=path_join(dirname,tmpfname);
+    str_free(tmpfname);
+    if (strfname==NULL)
+    {
+      result=ERR_NO_MEMORY;
+      break;
+    }
+    fp=str_fopen_temp(strfname,&tmpfname,flags);
+    if (fp==NULL)
+    {
+      str_free(strfname);
+      result=-1;
+      break;
+    }
+    fwrite(bnd_str_magic,1,4,fp);
+    write_int32_le_file(fp,strbundle_file_id(&bnd,i));
+    write_int32_le_file(fp,count);
+    for (k=0;k<count;k++)
+      write_int32_le_file(fp,read_int32_le_buf(bnd.offsets+(first+k)*SIZEOF_BND_Offset)+(count<<2));
+    fwrite(bnd.blocks+read_int32_le_buf(item+16),1,read_int32_le_buf(item+20),fp);
+    result=str_fclose_temp(fp,tmpfname,strfname,ferror(fp)?-1:ERR_NONE,flags);
+    if (result==ERR_NONE)
+      count_written++;
+    else
+    if (result==ERR_UNCHANGED)
+      count_unchanged++;
+    str_free(strfname);
+  }
+  if ((result==ERR_NO_MEMORY)&&(flags&STRFLAG_VERBOSE))
+    str_error("Cannot allocate memory for file name");
+  if (flags&STRFLAG_VERBOSE)
+    printf("Files written: %u, skipped as unchanged: %u\n",count_written,count_unchanged);
+  strbundle_close(&bnd);
+  if (result<ERR_NONE)
+    return result;
+  return ERR_NONE;
+}
+
+struct STR_BundleLookup {
+    const struct STR_Bundle *bnd;
+    int file_idx;
+    const struct STR_Codepage *cp;
+    };
+
+/**
+ * Prints one entry from the bundle, for str_bundle_lookup().
+ * @return Returns 1 if the entry was printed, 0 if it doesn't exist.
+ */
+int str_bundle_lookup_entry(void *data,unsigned int index,short flags)
+{
+  struct STR_BundleLookup *lookup=data;
+  const char *name;
+  const unsigned char *edata;
+  unsigned short *udata=NULL;
+  long edata_len,udata_len;
+  name=strbundle_file_name(lookup->bnd,lookup->file_idx);
+  edata_len=strbundle_get_entry(lookup->bnd,lookup->file_idx,index,&edata);
+  if (edata_len<0)
+  {
+    if (flags&STRFLAG_VERBOSE)
+      str_ferror("No entry %u in %s",index,name);
+    return 0;
+  }
+  // Chunks in the bundle weren't checked, so the checked decoder is used
+  if (str_data_decode(&udata,&udata_len,lookup->cp->mb2uni,lookup->cp->mb2uni_count,
+      edata,edata_len)!=ERR_NONE)
+  {
+    if (flags&STRFLAG_VERBOSE)
+      str_ferror("Cannot decode entry %u of %s",index,name);
+    str_free(udata);
+    return 0;
+  }
+  str_print_entry(name,index,udata);
+  str_free(udata);
+  return 1;
+}
+
+/**
+ * Prints entries of one STR file from the bundle. If no entry numbers
+ * are given, they are read from standard input, one per line.
+ * @param fname Name of the bundle file; MBToUni.dat is taken from its folder.
+ * @param name Name of the STR file in the bundle, without extension.
+ * @return Returns amount of entries printed, or negative error code.
+ */
+int str_bundle_lookup(const char *fname,const char *name,char **ids,int ids_count,short flags)
+{
+  struct STR_Bundle bnd;
+  struct STR_BundleLookup lookup;
+  struct STR_Codepage *cp;
+  struct STR_Error err;
+  int file_idx,count;
+  if (strbundle_open(&bnd,fname,flags)!=ERR_NONE)
+    return -1;
+  file_idx=strbundle_find_file(&bnd,name);
+  if (file_idx<0)
+  {
+    if (flags&STRFLAG_VERBOSE)
+      str_ferror("No file %s in bundle %s",name,fname);
+    strbundle_close(&bnd);
+    return -1;
+  }
+  cp=str_codepage_load(fname,&err);
+  if (cp==NULL)
+  {
+    if (flags&STRFLAG_VERBOSE)
+      str_ferror("%s",err.message);
+    strbundle_close(&bnd);
+    return -1;
+  }
+  lookup.bnd=&bnd;
+  lookup.file_idx=file_idx;
+  lookup.cp=cp;
+  count=str_lookup_ids(ids,ids_count,str_bundle_lookup_entry,&lookup,flags);
+  str_codepage_free(cp);
+  strbundle_close(&bnd);
+  return count;
+}
@@ -0,0 +1,67 @@
+/******************************************************************************/
+/** @file strbundle.h
+ * Library for r/w of DK2 STR text strings files.
+ * @par Purpose:
+ *     Header file. Defines exported routines from strbundle.c.
+ * @par Comment:
+ *     None.
+ * @par  Copying and copyrights:
+ *     This program is free software; you can redistribute it and/or modify
+ *     it under the terms of the GNU General Public License as published by
+ *     the Free Software Foundation; either version 2 of the License, or
+ *     (at your option) any later version.
+ */
+/******************************************************************************/
+
+#ifndef STRBUNDLE_H
+#define STRBUNDLE_H
+
+#include <stdio.h>
+
+#define SIZEOF_BND_Header     32
+#define SIZEOF_BND_FileItem   32
+#define SIZEOF_BND_Offset      4
+// Alignment of sections and of data of every STR file
+#define BND_ALIGN             16
+
+/**
+ * Bundle of STR files; all values are little-endian, and every section
+ * starts at offset aligned to 16 bytes, so entries can be used directly
+ * after mapping the file into memory.
+ *   Header:   magic "BFSB", version, files count, offsets count,
+ *             names size, data size, 8 reserved bytes
+ *   Files:    name offset, file ID, entries count, index of first offset,
+ *             data offset, data size, 8 reserved bytes; sorted by name
+ *   Offsets:  offset of every entry, relative to data of its file
+ *   Names:    zero-terminated file names, without extension
+ *   Data:     data blocks of the STR files, each one aligned
+ */
+struct STR_Bundle {
+    unsigned char *data;     // Mapped bundle file
+    long data_len;
+    unsigned int files_count;
+    unsigned int offsets_count;
+    unsigned int names_size;
+    unsigned long blocks_size;
+    const unsigned char *files;
+    const unsigned char *offsets;
+    const char *names;
+    const unsigned char *blocks;
+    };
+
+// Routines
+
+short strbundle_open(struct STR_Bundle *bnd,const char *fname,short flags);
+short strbundle_close(struct STR_Bundle *bnd);
+int strbundle_find_file(const struct STR_Bundle *bnd,const char *name);
+const char *strbundle_file_name(const struct STR_Bundle *bnd,unsigned int file_idx);
+unsigned int strbundle_file_id(const struct STR_Bundle *bnd,unsigned int file_idx);
+unsigned int strbundle_entries_count(const struct STR_Bundle *bnd,unsigned int file_idx);
+long strbundle_get_entry(const struct STR_Bundle *bnd,unsigned int file_idx,
+    unsigned int entry_idx,const unsigned char **edata);
+
+short str_bundle_pack(const char *dirname,const char *fname,short flags);
+short str_bundle_unpack(const char *fname,const char *dirname,short flags);
+int str_bundle_lookup(const char *fname,const char *name,char **ids,int ids_count,short flags);
+
+#endif
@@ -0,0 +1,356 @@
+/******************************************************************************/
+/** @file strcache.c
+ * Library for r/w of DK2 STR text strings files.
+ * @par Purpose:
+ *     Cache of encoded STR entries, used when converting many files.
+ * @par Comment:
+ *     Entries are identified by their Unicode text; the whole cache
+ *     is valid only for one codepage.
+ * @par  Copying and copyrights:
+ *     This program is free software; you can redistribute it and/or modify
+ *     it under the terms of the GNU General Public License as published by
+ *     the Free Software Foundation; either version 2 of the License, or
+ *     (at your option) any later version.
+ */
+/******************************************************************************/
+
+#include "strcache.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "lbfileio.h"
+#include "unitext.h"
+#include "strfile.h"
+#include "strmaker.h"
+#include "stralloc.h"
+
+const char enccache_magic[]="BFEC";
+#define ENCCACHE_VERSION 1
+
+/**
+ * Computes memory used by cache item.
+ */
+unsigned long enccache_item_size(const struct STR_EncCacheItem *item)
+{
+  return sizeof(struct STR_EncCacheItem)+item->text_len*sizeof(unsigned short)+item->edata_len;
+}
+
+unsigned long long enccache_text_hash(const unsigned short *text,long text_len)
+{
+  return hash_fnv64_buf(text,text_len*sizeof(unsigned short),FNV_HASH_INIT);
+}
+
+/**
+ * Creates new, empty encoding cache.
+ * @param cp_hash Hash of the codepage used for encoding.
+ * @param mem_limit Memory budget for cached items.
+ * @return Returns the new cache, or NULL on error.
+ */
+struct STR_EncCache *enccache_create(unsigned long long cp_hash,unsigned long mem_limit)
+{
+  struct STR_EncCache *cache;
+  cache=str_malloc(sizeof(struct STR_EncCache));
+  if (cache==NULL)
+    return NULL;
+  memset(cache,0,sizeof(struct STR_EncCache));
+  cache->cp_hash=cp_hash;
+  cache->mem_limit=mem_limit;
+  cache->buckets_count=1024;
+  cache->buckets=str_calloc(cache->buckets_count,sizeof(struct STR_EncCacheItem *));
+  if (cache->buckets==NULL)
+  {
+    str_free(cache);
+    return NULL;
+  }
+  return cache;
+}
+
+void enccache_item_free(struct STR_EncCacheItem *item)
+{
+  str_free(item->text);
+  str_free(item->edata);
+  str_free(item);
+}
+
+/**
+ * Frees the cache with all its items.
+ * @return Returns ERR_NONE on success.
+ */
+short enccache_free(struct STR_EncCache *cache)
+{
+  struct STR_EncCacheItem *item;
+  if (cache==NULL)
+    return ERR_NONE;
+  while (cache->lru_first!=NULL)
+  {
+    item=cache->lru_first;
+    cache->lru_first=item->lru_next;
+    enccache_item_free(item);
+  }
+  str_free(cache->buckets);
+  str_free(cache);
+  return ERR_NONE;
+}
+
+void enccache_lru_unlink(struct STR_EncCache *cache,struct STR_EncCacheItem *item)
+{
+  if (item->lru_prev!=NULL)
+    item->lru_prev->lru_next=item->lru_next;
+  else
+    cache->lru_first=item->lru_next;
+  if (item->lru_next!=NULL)
+    item->lru_next->lru_prev=item->lru_prev;
+  else
+    cache->lru_last=item->lru_prev;
+  item->lru_prev=NULL;
+  item->lru_next=NULL;
+}
+
+void enccache_lru_push(struct STR_EncCache *cache,struct STR_EncCacheItem *item)
+{
+  item->lru_prev=NULL;
+  item->lru_next=cache->lru_first;
+  if (cache->lru_first!=NULL)
+    cache->lru_first->lru_prev=item;
+  else
+    cache->lru_last=item;
+  cache->lru_first=item;
+}
+
+/**
+ * Removes the least recently used item from cache.
+ */
+void enccache_evict(struct STR_EncCache *cache)
+{
+  struct STR_EncCacheItem *item;
+  struct STR_EncCacheItem **link;
+  item=cache->lru_last;
+  if (item==NULL)
+    return;
+  enccache_lru_unlink(cache,item);
+  link=&cache->buckets[item->hash&(cache->buckets_count-1)];
+  while ((*link)!=NULL)
+  {
+    if ((*link)==item)
+    {
+      (*link)=item->hash_next;
+      break;
+    }
+    link=&(*link)->hash_next;
+  }
+  cache->mem_used-=enccache_item_size(item);
+  cache->items_count--;
+  enccache_item_free(item);
+}
+
+/**
+ * Makes the hash table twice as large.
+ */
+short enccache_grow(struct STR_EncCache *cache)
+{
+  struct STR_EncCacheItem **buckets;
+  struct STR_EncCacheItem *item;
+  unsigned int new_count,i;
+  new_count=cache->buckets_count<<1;
+  buckets=str_calloc(new_count,sizeof(struct STR_EncCacheItem *));
+  if (buckets==NULL)
+    return -1;
+  for (i=0;i<cache->buckets_count;i++)
+  {
+    while (cache->buckets[i]!=NULL)
+    {
+      item=cache->buckets[i];
+      cache->buckets[i]=item->hash_next;
+      item->hash_next=buckets[item->hash&(new_count-1)];
+      buckets[item->hash&(new_count-1)]=item;
+    }
+  }
+  str_free(cache->buckets);
+  cache->buckets=buckets;
+  cache->buckets_count=new_count;
+  return ERR_NONE;
+}
+
+/**
+ * Finds encoded data of given text in the cache.
+ * The returned data stays owned by the cache, and is valid only until
+ * next item is added.
+ * @return Returns 1 if the text was found, 0 if not.
+ */
+short enccache_get(struct STR_EncCache *cache,const unsigned short *text,long text_len,
+    const unsigned char **edata,long *edata_len)
+{
+  struct STR_EncCacheItem *item;
+  unsigned long long hash;
+  hash=enccache_text_hash(text,text_len);
+  item=cache->buckets[hash&(cache->buckets_count-1)];
+  while (item!=NULL)
+  {
+    if ((item->hash==hash)&&(item->text_len==text_len)&&
+        (memcmp(item->text,text,text_len*sizeof(unsigned short))==0))
+    {
+      // Mark as most recently used
+      enccache_lru_unlink(cache,item);
+      enccache_lru_push(cache,item);
+      (*edata)=item->edata;
+      (*edata_len)=item->edata_len;
+      cache->hits++;
+      return 1;
+    }
+    item=item->hash_next;
+  }
+  cache->misses++;
+  return 0;
+}
+
+/**
+ * Adds copy of encoded text to the cache, removing least recently used
+ * items if the memory limit is exceeded.
+ * @return Returns ERR_NONE on success.
+ */
+short enccache_put(struct STR_EncCache *cache,const unsigned short *text,long text_len,
+    const unsigned char *edata,long edata_len)
+{
+  struct STR_EncCacheItem *item;
+  unsigned int bucket;
+  item=str_malloc(sizeof(struct STR_EncCacheItem));
+  if (item==NULL)
+    return -1;
+  memset(item,0,sizeof(struct STR_EncCacheItem));
+  item->text_len=text_len;
+  item->edata_len=edata_len;
+  // Items larger than the whole budget are not cached
+  if (enccache_item_size(item)>cache->mem_limit)
+  {
+    str_free(item);
+    return ERR_NONE;
+  }
+  item->text=str_malloc(text_len*sizeof(unsigned short)+1);
+  item->edata=str_malloc(edata_len+1);
+  if ((item->text==NULL)||(item->edata==NULL))
+  {
+    enccache_item_free(item);
+    return -1;
+  }
+  memcpy(item->text,text,text_len*sizeof(unsigned short));
+  memcpy(item->edata,edata,edata_len);
+  item->hash=enccache_text_hash(text,text_len);
+  while ((cache->lru_last!=NULL)&&(cache->mem_used+enccache_item_size(item)>cache->mem_limit))
+    enccache_evict(cache);
+  if (cache->items_count>=(cache->buckets_count<<1))
+    enccache_grow(cache);
+  bucket=item->hash&(cache->buckets_count-1);
+  item->hash_next=cache->buckets[bucket];
+  cache->buckets[bucket]=item;
+  enccache_lru_push(cache,item);
+  cache->mem_used+=enccache_item_size(item);
+  cache->items_count++;
+  return ERR_NONE;
+}
+
+/**
+ * Reads cache items from file. Missing file, or a file created for
+ * another codepage, is not an error - the cache just stays empty.
+ * @return Returns ERR_NONE on success.
+ */
+short enccache_read(struct STR_EncCache *cache,const char *fname,short flags)
+{
+  FILE *fp;
+  char magic[4];
+  unsigned long long cp_hash;
+  unsigned long count,i;
+  long k,text_len,edata_len;
+  unsigned short *text;
+  unsigned char *edata;
+  short result;
+  fp=fopen(fname,"rb");
+  if (fp==NULL)
+    return ERR_NONE;
+  if ((fread(magic,1,4,fp)!=4)||(memcmp(magic,enccache_magic,4)!=0)||
+      (read_int32_le_file(fp)!=ENCCACHE_VERSION))
+  {
+    if (flags&STRFLAG_VERBOSE)
+      printf("Encoding cache %s not recognized, ignored.\n",fname);
+    fclose(fp);
+    return ERR_NONE;
+  }
+  cp_hash=read_int32_le_file(fp)&0xffffffffUL;
+  cp_hash|=(unsigned long long)(read_int32_le_file(fp)&0xffffffffUL)<<32;
+  count=read_int32_le_file(fp);
+  if (cp_hash!=cache->cp_hash)
+  {
+    if (flags&STRFLAG_VERBOSE)
+      printf("Encoding cache was made for another codepage, ignored.\n");
+    fclose(fp);
+    return ERR_NONE;
+  }
+  // Items are stored from the least recently used
+  result=ERR_NONE;
+  for (i=0;i<count;i++)
+  {
+    text_len=read_int32_le_file(fp);
+    edata_len=read_int32_le_file(fp);
+    if (feof(fp)||(text_len<0)||(edata_len<=0)||
+        (text_len*sizeof(unsigned short)+edata_len>cache->mem_limit))
+      break;
+    text=str_malloc(text_len*sizeof(unsigned short)+1);
+    edata=str_malloc(edata_len);
+    if ((text==NULL)||(edata==NULL))
+    {
+      str_free(text);
+      str_free(edata);
+      result=-1;
+      break;
+    }
+    for (k=0;k<text_len;k++)
+      text[k]=read_int16_le_file(fp);
+    if (fread(edata,1,edata_len,fp)!=edata_len)
+    {
+      str_free(text);
+      str_free(edata);
+      break;
+    }
+    result=enccache_put(cache,text,text_len,edata,edata_len);
+    str_free(text);
+    str_free(edata);
+    if (result!=ERR_NONE)
+      break;
+  }
+  fclose(fp);
+  if ((result!=ERR_NONE)&&(flags&STRFLAG_VERBOSE))
+    str_error("Cannot allocate memory for encoding cache");
+  if ((flags&STRFLAG_VERBOSE)&&(result==ERR_NONE))
+    printf("Encoding cache loaded, %u entries.\n",cache->items_count);
+  return result;
+}
+
+/**
+ * Writes all cache items into file, so they can be used in next run.
+ * @return Returns ERR_NONE on success, ERR_UNCHANGED if the file
+ *     had the same content before.
+ */
+short enccache_write(struct STR_EncCache *cache,const char *fname,short flags)
+{
+  struct STR_EncCacheItem *item;
+  FILE *fp;
+  char *tmpfname;
+  long k;
+  fp=str_fopen_temp(fname,&tmpfname,flags);
+  if (fp==NULL)
+    return -1;
+  fwrite(enccache_magic,1,4,fp);
+  write_int32_le_file(fp,ENCCACHE_VERSION);
+  write_int32_le_file(fp,cache->cp_hash&0xffffffffUL);
+  write_int32_le_file(fp,cache->cp_hash>>32);
+  write_int32_le_file(fp,cache->items_count);
+  for (item=cache->lru_last;item!=NULL;item=item->lru_prev)
+  {
+    write_int32_le_file(fp,item->text_len);
+    write_int32_le_file(fp,item->edata_len);
+    for (k=0;k<item->text_len;k++)
+      write_int16_le_file(fp,item->text[k]);
+    fwrite(item->edata,1,item->edata_len,fp);
+  }
+  return str_fclose_temp(fp,tmpfname,fname,ERR_NONE,flags);
+}
@@ -0,0 +1,65 @@
+/******************************************************************************/
+/** @file strcache.h
+ * Library for r/w of DK2 STR text strings files.
+ * @par Purpose:
+ *     Header file. Defines exported routines from strcache.c.
+ * @par Comment:
+ *     None.
+ * @par  Copying and copyrights:
+ *     This program is free software; you can redistribute it and/or modify
+ *     it under the terms of the GNU General Public License as published by
+ *     the Free Software Foundation; either version 2 of the License, or
+ *     (at your option) any later version.
+ */
+/******************************************************************************/
+
+#ifndef STRCACHE_H
+#define STRCACHE_H
+
+#include <stdio.h>
+
+#define ENCCACHE_FNAME "strtool.enc"
+// Default memory budget of the encoding cache
+#define ENCCACHE_DEFAULT_LIMIT (16*1024*1024)
+
+struct STR_EncCacheItem {
+    unsigned long long hash; // Hash of the text
+    unsigned short *text;    // Unicode text, as given to the encoder
+    long text_len;
+    unsigned char *edata;    // Encoded entry
+    long edata_len;
+    struct STR_EncCacheItem *hash_next; // Next item in hash bucket
+    struct STR_EncCacheItem *lru_prev;  // More recently used item
+    struct STR_EncCacheItem *lru_next;  // Less recently used item
+    };
+
+/**
+ * Cache of encoded entries, shared by many STR files using the same
+ * codepage. Least recently used items are removed when the memory
+ * used by items exceeds the limit.
+ */
+struct STR_EncCache {
+    unsigned long long cp_hash; // Hash of MBToUni.dat used for encoding
+    unsigned long mem_limit; // Memory budget for items
+    unsigned long mem_used;  // Memory used by items
+    unsigned int items_count;
+    unsigned int buckets_count; // Size of hash table, power of 2
+    struct STR_EncCacheItem **buckets;
+    struct STR_EncCacheItem *lru_first; // Most recently used
+    struct STR_EncCacheItem *lru_last;  // Least recently used
+    unsigned long hits;
+    unsigned long misses;
+    };
+
+// Routines
+
+struct STR_EncCache *enccache_create(unsigned long long cp_hash,unsigned long mem_limit);
+short enccache_free(struct STR_EncCache *cache);
+short enccache_get(struct STR_EncCache *cache,const unsigned short *text,long text_len,
+    const unsigned char **edata,long *edata_len);
+short enccache_put(struct STR_EncCache *cache,const unsigned short *text,long text_len,
+    const unsigned char *edata,long edata_len);
+short enccache_read(struct STR_EncCache *cache,const char *fname,short flags);
+short enccache_write(struct STR_EncCache *cache,const char *fname,short flags);
+
+#endif
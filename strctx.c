@@ -0,0 +1,419 @@
+/******************************************************************************/
+/** @file strctx.c
+ * Library for r/w of DK2 STR text strings files.
+ * @par Purpose:
+ *     Reentrant conversion routines, working on explicit context.
+ * @par Comment:
+ *     The routines never print anything; errors are returned in
+ *     STR_Error given by caller. Codepage is loaded once and shared,
+ *     so many threads can convert files at once without locking.
+ *     Statistics are gathered separately by every thread, and trace
+ *     events are tagged with the thread which made them.
+ * @par  Copying and copyrights:
+ *     This program is free software; you can redistribute it and/or modify
+ *     it under the terms of the GNU General Public License as published by
+ *     the Free Software Foundation; either version 2 of the License, or
+ *     (at your option) any later version.
+ */
+/******************************************************************************/
+
+#include "strctx.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdarg.h>
+#include <errno.h>
+#include "lbfileio.h"
+#include "unitext.h"
+#include "strfile.h"
+#include "strmaker.h"
+#include "strstats.h"
+#include "stralloc.h"
+
+/**
+ * Marks the error structure as having no error.
+ */
+void strctx_error_clear(struct STR_Error *err)
+{
+  if (err==NULL)
+    return;
+  err->code=ERR_NONE;
+  err->message[0]='\0';
+}
+
+/**
+ * Stores error code and formatted message in the error structure.
+ * @param err The error structure; may be NULL if caller isn't interested.
+ * @return Returns the error code, so it can be directly returned.
+ */
+short strctx_error_set(struct STR_Error *err,short code,const char *format, ...)
+{
+  va_list val;
+  if (err==NULL)
+    return code;
+  err->code=code;
+  va_start(val, format);
+  vsnprintf(err->message,sizeof(err->message),format,val);
+  va_end(val);
+  return code;
+}
+
+/**
+ * Loads the codepage from MBToUni.dat which lies in the same folder
+ * as given STR or TXT file.
+ * @param fname Name of a file in the folder which contains MBToUni.dat.
+ * @param err Error structure, filled on failure.
+ * @return Returns the new codepage, or NULL on error.
+ */
+struct STR_Codepage *str_codepage_load(const char *fname,struct STR_Error *err)
+{
+  struct STR_Codepage *cp;
+  struct STR_Maker mkstr;
+  char *mbfname;
+  FILE *fp;
+  short result;
+  short prev_phase;
+  strctx_error_clear(err);
+  int path_len=filename_from_path(fname)-fname;
+  if (path_len<0) path_len=0;
+  mbfname=str_malloc(path_len+16);
+  if (mbfname==NULL)
+  {
+    strctx_error_set(err,-1,"Cannot allocate memory for codepage file name");
+    return NULL;
+  }
+  strncpy(mbfname,fname,path_len);
+  strcpy(mbfname+path_len,"MBToUni.dat");
+  prev_phase=stats_phase_enter(STAT_CODEPAGE);
+  fp=fopen(mbfname,"rb");
+  if (fp==NULL)
+  {
+    stats_phase_leave(prev_phase);
+    strctx_error_set(err,-1,"%s when opening %s",strerror(errno),mbfname);
+    str_free(mbfname);
+    return NULL;
+  }
+  strmaker_clear(&mkstr);
+  result=str_mb2uni_fread(&mkstr,fp,0);
+  fclose(fp);
+  stats_phase_leave(prev_phase);
+  if (result!=ERR_NONE)
+  {
+    str_free(mkstr.mb2uni);
+    strctx_error_set(err,-1,"%s is not a valid codepage file",mbfname);
+    str_free(mbfname);
+    return NULL;
+  }
+  str_free(mbfname);
+  cp=str_malloc(sizeof(struct STR_Codepage));
+  if (cp==NULL)
+  {
+    str_free(mkstr.mb2uni);
+    strctx_error_set(err,-1,"Cannot allocate memory for codepage");
+    return NULL;
+  }
+  // The tables are moved from the maker
+  cp->mb2uni=mkstr.mb2uni;
+  cp->mb2uni_count=mkstr.mb2uni_count;
+  cp->hash=hash_fnv64_buf(cp->mb2uni,cp->mb2uni_count*sizeof(unsigned short),FNV_HASH_INIT);
+  return cp;
+}
+
+/**
+ * Frees the codepage. No context using it may be used afterwards.
+ */
+void str_codepage_free(struct STR_Codepage *cp)
+{
+  if (cp==NULL)
+    return;
+  str_free(cp->mb2uni);
+  str_free(cp);
+}
+
+/**
+ * Prepares conversion context.
+ * @param cp The codepage; must stay loaded as long as the context is used.
+ * @param flags Flags used to manage the conversion; STRFLAG_VERBOSE
+ *     and STRFLAG_DEBUG are ignored, as the context routines never print.
+ * @return Returns ERR_NONE on success.
+ */
+short strctx_init(struct STR_Context *ctx,const struct STR_Codepage *cp,short flags)
+{
+  ctx->codepage=cp;
+  ctx->flags=flags&(~(STRFLAG_VERBOSE|STRFLAG_DEBUG));
+  return ERR_NONE;
+}
+
+/**
+ * Lets the maker use codepage of the context.
+ * The codepage must be detached before freeing the maker.
+ */
+void strctx_maker_attach(const struct STR_Context *ctx,struct STR_Maker *mkstr)
+{
+  mkstr->mb2uni=ctx->codepage->mb2uni;
+  mkstr->mb2uni_count=ctx->codepage->mb2uni_count;
+}
+
+void strctx_maker_detach(struct STR_Maker *mkstr)
+{
+  mkstr->mb2uni=NULL;
+  mkstr->mb2uni_count=0;
+}
+
+/**
+ * Reads STR file into new STR_Maker, which uses codepage of the context.
+ * @return Returns the new STR_Maker, to be freed with strctx_close_maker(),
+ *     or NULL on error.
+ */
+struct STR_Maker *strctx_open_maker(const struct STR_Context *ctx,const char *fname,
+    struct STR_Error *err)
+{
+  struct STR_Maker *mkstr;
+  FILE *fp;
+  short result;
+  short prev_phase;
+  strctx_error_clear(err);
+  mkstr=str_malloc(sizeof(struct STR_Maker));
+  if (mkstr==NULL)
+  {
+    strctx_error_set(err,-1,"Cannot allocate STR_Maker memory");
+    return NULL;
+  }
+  strmaker_clear(mkstr);
+  prev_phase=stats_phase_enter(STAT_READ);
+  fp=fopen(fname,"rb");
+  if (fp==NULL)
+  {
+    stats_phase_leave(prev_phase);
+    strctx_error_set(err,-1,"%s when opening %s",strerror(errno),fname);
+    strmaker_free(mkstr);
+    return NULL;
+  }
+  result=strmaker_fread(mkstr,fp,ctx->flags);
+  fclose(fp);
+  stats_phase_leave(prev_phase);
+  if (result!=ERR_NONE)
+  {
+    strctx_error_set(err,-1,"%s is not a valid STR file",fname);
+    strmaker_free(mkstr);
+    return NULL;
+  }
+  strctx_maker_attach(ctx,mkstr);
+  return mkstr;
+}
+
+/**
+ * Frees STR_Maker created by strctx_open_maker(), leaving the codepage.
+ */
+void strctx_close_maker(struct STR_Maker *mkstr)
+{
+  if (mkstr==NULL)
+    return;
+  strctx_maker_detach(mkstr);
+  strmaker_free(mkstr);
+}
+
+/**
+ * Reads STR file and decodes all its entries.
+ * @return Returns the new STR_File, to be freed with str_close(),
+ *     or NULL on error.
+ */
+struct STR_File *strctx_read_str(const struct STR_Context *ctx,const char *fname,
+    struct STR_Error *err)
+{
+  struct STR_File *strfile;
+  struct STR_Maker *mkstr;
+  short result;
+  short prev_phase;
+  mkstr=strctx_open_maker(ctx,fname,err);
+  if (mkstr==NULL)
+    return NULL;
+  strfile=str_malloc(sizeof(struct STR_File));
+  if (strfile==NULL)
+  {
+    strctx_error_set(err,-1,"Cannot allocate STR_File memory");
+    strctx_close_maker(mkstr);
+    return NULL;
+  }
+  str_clear(strfile);
+  prev_phase=stats_phase_enter(STAT_DECODE);
+  result=strfile_from_strmaker(strfile,mkstr,ctx->flags);
+  stats_phase_leave(prev_phase);
+  strctx_close_maker(mkstr);
+  if (result!=ERR_NONE)
+  {
+    strctx_error_set(err,-1,"Cannot decode entries of %s",fname);
+    str_close(strfile,ctx->flags);
+    return NULL;
+  }
+  return strfile;
+}
+
+/**
+ * Reads Unicode text file into new STR_File.
+ * @return Returns the new STR_File, to be freed with str_close(),
+ *     or NULL on error.
+ */
+struct STR_File *strctx_read_text(const struct STR_Context *ctx,const char *fname,
+    struct STR_Error *err)
+{
+  struct STR_File *strfile;
+  struct TXT_File *txtfile;
+  FILE *fp;
+  short result;
+  short prev_phase;
+  strctx_error_clear(err);
+  strfile=str_malloc(sizeof(struct STR_File));
+  txtfile=str_malloc(sizeof(struct TXT_File));
+  if ((strfile==NULL)||(txtfile==NULL))
+  {
+    strctx_error_set(err,-1,"Cannot allocate memory for structures");
+    str_free(strfile);
+    str_free(txtfile);
+    return NULL;
+  }
+  str_clear(strfile);
+  txtuni_clear(txtfile);
+  prev_phase=stats_phase_enter(STAT_READ);
+  fp=fopen(fname,"rb");
+  if (fp==NULL)
+  {
+    stats_phase_leave(prev_phase);
+    strctx_error_set(err,-1,"%s when opening %s",strerror(errno),fname);
+    txtuni_free(txtfile);
+    str_free(strfile);
+    return NULL;
+  }
+  result=txtuni_read(txtfile,fp,ctx->flags);
+  fclose(fp);
+  stats_phase_leave(prev_phase);
+  if (result==ERR_NONE)
+  {
+    prev_phase=stats_phase_enter(STAT_LINES);
+    result=str_from_txtuni(strfile,txtfile,ctx->flags);
+    stats_phase_leave(prev_phase);
+  }
+  txtuni_free(txtfile);
+  if (result!=ERR_NONE)
+  {
+    strctx_error_set(err,-1,"%s is not a valid Unicode text file",fname);
+    str_close(strfile,ctx->flags);
+    return NULL;
+  }
+  return strfile;
+}
+
+/**
+ * Encodes the STR_File and writes it into STR file. The file is not
+ * modified if it already has the same content.
+ * @return Returns ERR_NONE on success, ERR_UNCHANGED if the file
+ *     was identical, negative value on error.
+ */
+short strctx_write_str(const struct STR_Context *ctx,struct STR_File *strfile,
+    const char *fname,struct STR_Error *err)
+{
+  struct STR_Maker *mkstr;
+  char *tmpfname;
+  FILE *fp;
+  short result;
+  short prev_phase;
+  strctx_error_clear(err);
+  mkstr=str_malloc(sizeof(struct STR_Maker));
+  if (mkstr==NULL)
+    return strctx_error_set(err,-1,"Cannot allocate STR_Maker memory");
+  strmaker_clear(mkstr);
+  strctx_maker_attach(ctx,mkstr);
+  prev_phase=stats_phase_enter(STAT_ENCODE);
+  result=strmaker_from_strfile(mkstr,strfile,NULL,NULL,NULL,ctx->flags);
+  stats_phase_leave(prev_phase);
+  if (result!=ERR_NONE)
+  {
+    strctx_close_maker(mkstr);
+    return strctx_error_set(err,-1,"Cannot encode entries for %s",fname);
+  }
+  if ((ctx->flags&STRFLAG_DEDUP)&&(strmaker_check_strfile(mkstr,strfile,ctx->flags)!=0))
+  {
+    strctx_close_maker(mkstr);
+    return strctx_error_set(err,-1,"Verification of deduplicated entries failed");
+  }
+  prev_phase=stats_phase_enter(STAT_WRITE);
+  fp=str_fopen_temp(fname,&tmpfname,ctx->flags);
+  if (fp==NULL)
+  {
+    stats_phase_leave(prev_phase);
+    strctx_close_maker(mkstr);
+    return strctx_error_set(err,-1,"%s when creating temporary file for %s",strerror(errno),fname);
+  }
+  result=strmaker_fwrite(mkstr,fp,ctx->flags);
+  result=str_fclose_temp(fp,tmpfname,fname,result,ctx->flags);
+  stats_phase_leave(prev_phase);
+  strctx_close_maker(mkstr);
+  if (result<ERR_NONE)
+    return strctx_error_set(err,result,"%s when writing %s",strerror(errno),fname);
+  return result;
+}
+
+/**
+ * Writes entries of STR_File into Unicode text file. The file is not
+ * modified if it already has the same content.
+ * @return Returns ERR_NONE on success, ERR_UNCHANGED if the file
+ *     was identical, negative value on error.
+ */
+short strctx_write_text(const struct STR_Context *ctx,struct STR_File *strfile,
+    const char *fname,struct STR_Error *err)
+{
+  char *tmpfname;
+  FILE *fp;
+  unsigned int k;
+  short result;
+  short prev_phase;
+  strctx_error_clear(err);
+  prev_phase=stats_phase_enter(STAT_WRITE);
+  fp=str_fopen_temp(fname,&tmpfname,ctx->flags);
+  if (fp==NULL)
+  {
+    stats_phase_leave(prev_phase);
+    return strctx_error_set(err,-1,"%s when creating temporary file for %s",strerror(errno),fname);
+  }
+  unicode_fwrite_header(fp,strfile->file_id);
+  for (k=0;k<strfile->str_count;k++)
+    unicode_fwrite_line(fp,strfile->str[k]);
+  result=str_fclose_temp(fp,tmpfname,fname,ERR_NONE,ctx->flags);
+  stats_phase_leave(prev_phase);
+  if (result<ERR_NONE)
+    return strctx_error_set(err,result,"%s when writing %s",strerror(errno),fname);
+  return result;
+}
+
+/**
+ * Decodes one STR entry into newly allocated Unicode string.
+ * @return Returns ERR_NONE on success.
+ */
+short strctx_decode_entry(const struct STR_Context *ctx,unsigned short **udata,long *udata_len,
+    const unsigned char *edata,long edata_len,struct STR_Error *err)
+{
+  short result;
+  strctx_error_clear(err);
+  result=str_data_decode(udata,udata_len,ctx->codepage->mb2uni,ctx->codepage->mb2uni_count,
+      edata,edata_len);
+  if (result!=ERR_NONE)
+    return strctx_error_set(err,result,"Cannot decode STR entry");
+  return ERR_NONE;
+}
+
+/**
+ * Encodes Unicode string into newly allocated STR entry.
+ * @return Returns ERR_NONE on success.
+ */
+short strctx_encode_entry(const struct STR_Context *ctx,unsigned char **edata,long *edata_len,
+    const unsigned short *udata,long udata_len,struct STR_Error *err)
+{
+  short result;
+  strctx_error_clear(err);
+  result=str_data_encode_r(edata,edata_len,ctx->codepage->mb2uni,ctx->codepage->mb2uni_count,
+      udata,udata_len);
+  if (result!=ERR_NONE)
+    return strctx_error_set(err,result,"Cannot encode text into STR entry");
+  return ERR_NONE;
+}
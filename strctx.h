@@ -0,0 +1,79 @@
+/******************************************************************************/
+/** @file strctx.h
+ * Library for r/w of DK2 STR text strings files.
+ * @par Purpose:
+ *     Header file. Defines exported routines from strctx.c.
+ * @par Comment:
+ *     None.
+ * @par  Copying and copyrights:
+ *     This program is free software; you can redistribute it and/or modify
+ *     it under the terms of the GNU General Public License as published by
+ *     the Free Software Foundation; either version 2 of the License, or
+ *     (at your option) any later version.
+ */
+/******************************************************************************/
+
+#ifndef STRCTX_H
+#define STRCTX_H
+
+#include <stdio.h>
+
+#define STR_ERROR_MESSAGE_LEN 256
+
+/**
+ * Error of a library call; every call gets its own, so errors
+ * from many threads don't mix.
+ */
+struct STR_Error {
+    short code;              // ERR_NONE, or negative error code
+    char message[STR_ERROR_MESSAGE_LEN];
+    };
+
+/**
+ * Codepage tables, loaded once and then only read. One codepage
+ * can be used by any amount of contexts and threads.
+ */
+struct STR_Codepage {
+    unsigned int mb2uni_count;
+    unsigned short *mb2uni;
+    unsigned long long hash; // Hash of the table, to identify the codepage
+    };
+
+/**
+ * Conversion context. Nothing in it is modified by the conversion
+ * routines, so one context can be used by many threads at once.
+ */
+struct STR_Context {
+    const struct STR_Codepage *codepage;
+    short flags;             // STRFLAG_DEDUP; verbose flags are ignored
+    };
+
+struct STR_File;
+struct STR_Maker;
+
+// Routines
+
+void strctx_error_clear(struct STR_Error *err);
+short strctx_error_set(struct STR_Error *err,short code,const char *format, ...);
+
+struct STR_Codepage *str_codepage_load(const char *fname,struct STR_Error *err);
+void str_codepage_free(struct STR_Codepage *cp);
+short strctx_init(struct STR_Context *ctx,const struct STR_Codepage *cp,short flags);
+
+struct STR_Maker *strctx_open_maker(const struct STR_Context *ctx,const char *fname,
+    struct STR_Error *err);
+void strctx_close_maker(struct STR_Maker *mkstr);
+struct STR_File *strctx_read_str(const struct STR_Context *ctx,const char *fname,
+    struct STR_Error *err);
+struct STR_File *strctx_read_text(const struct STR_Context *ctx,const char *fname,
+    struct STR_Error *err);
+short strctx_write_str(const struct STR_Context *ctx,struct STR_File *strfile,
+    const char *fname,struct STR_Error *err);
+short strctx_write_text(const struct STR_Context *ctx,struct STR_File *strfile,
+    const char *fname,struct STR_Error *err);
+short strctx_decode_entry(const struct STR_Context *ctx,unsigned short **udata,long *udata_len,
+    const unsigned char *edata,long edata_len,struct STR_Error *err);
+short strctx_encode_entry(const struct STR_Context *ctx,unsigned char **edata,long *edata_len,
+    const unsigned short *udata,long udata_len,struct STR_Error *err);
+
+#endif
@@ -0,0 +1,339 @@
+/******************************************************************************/
+/** @file strdcache.c
+ * Library for r/w of DK2 STR text strings files.
+ * @par Purpose:
+ *     Cache of decoded STR entries, for repeated queries of one file.
+ * @par Comment:
+ *     Entries are identified by their index in the offsets table; the
+ *     STR file stays loaded in encoded form, and only entries which are
+ *     used are kept decoded, within a memory budget.
+ * @par  Copying and copyrights:
+ *     This program is free software; you can redistribute it and/or modify
+ *     it under the terms of the GNU General Public License as published by
+ *     the Free Software Foundation; either version 2 of the License, or
+ *     (at your option) any later version.
+ */
+/******************************************************************************/
+
+#include "strdcache.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include "lbfileio.h"
+#include "unitext.h"
+#include "strfile.h"
+#include "strmaker.h"
+#include "stralloc.h"
+
+/**
+ * Computes memory used by cache item.
+ */
+unsigned long deccache_item_size(const struct STR_DecCacheItem *item)
+{
+  return sizeof(struct STR_DecCacheItem)+(item->text_len+1)*sizeof(unsigned short);
+}
+
+/**
+ * Creates new, empty decoding cache for entries of given STR_Maker.
+ * The STR_Maker must have codepage loaded, and can't be modified
+ * while the cache exists.
+ * @param mem_limit Memory budget for cached items.
+ * @return Returns the new cache, or NULL on error.
+ */
+struct STR_DecCache *deccache_create(const struct STR_Maker *mkstr,unsigned long mem_limit)
+{
+  struct STR_DecCache *cache;
+  cache=str_malloc(sizeof(struct STR_DecCache));
+  if (cache==NULL)
+    return NULL;
+  memset(cache,0,sizeof(struct STR_DecCache));
+  cache->mkstr=mkstr;
+  cache->mem_limit=mem_limit;
+  cache->items=str_calloc(mkstr->offs_count+1,sizeof(struct STR_DecCacheItem *));
+  if (cache->items==NULL)
+  {
+    str_free(cache);
+    return NULL;
+  }
+  return cache;
+}
+
+void deccache_item_free(struct STR_DecCacheItem *item)
+{
+  str_free(item->text);
+  str_free(item);
+}
+
+/**
+ * Frees the cache with all its items.
+ * @return Returns ERR_NONE on success.
+ */
+short deccache_free(struct STR_DecCache *cache)
+{
+  struct STR_DecCacheItem *item;
+  if (cache==NULL)
+    return ERR_NONE;
+  while (cache->lru_first!=NULL)
+  {
+    item=cache->lru_first;
+    cache->lru_first=item->lru_next;
+    deccache_item_free(item);
+  }
+  str_free(cache->uncached);
+  str_free(cache->items);
+  str_free(cache);
+  return ERR_NONE;
+}
+
+void deccache_lru_unlink(struct STR_DecCache *cache,struct STR_DecCacheItem *item)
+{
+  if (item->lru_prev!=NULL)
+    item->lru_prev->lru_next=item->lru_next;
+  else
+    cache->lru_first=item->lru_next;
+  if (item->lru_next!=NULL)
+    item->lru_next->lru_prev=item->lru_prev;
+  else
+    cache->lru_last=item->lru_prev;
+  item->lru_prev=NULL;
+  item->lru_next=NULL;
+}
+
+void deccache_lru_push(struct STR_DecCache *cache,struct STR_DecCacheItem *item)
+{
+  item->lru_prev=NULL;
+  item->lru_next=cache->lru_first;
+  if (cache->lru_first!=NULL)
+    cache->lru_first->lru_prev=item;
+  else
+    cache->lru_last=item;
+  cache->lru_first=item;
+}
+
+/**
+ * Removes the least recently used item from cache.
+ */
+void deccache_evict(struct STR_DecCache *cache)
+{
+  struct STR_DecCacheItem *item;
+  item=cache->lru_last;
+  if (item==NULL)
+    return;
+  deccache_lru_unlink(cache,item);
+  cache->items[item->index]=NULL;
+  cache->mem_used-=deccache_item_size(item);
+  cache->items_count--;
+  cache->evictions++;
+  deccache_item_free(item);
+}
+
+/**
+ * Gives decoded text of an entry, decoding it if it's not in the cache.
+ * The returned text stays owned by the cache, and is valid only until
+ * next call.
+ * @param index Index of the entry.
+ * @param text Output for the text.
+ * @return Returns length of the text, or negative error code.
+ */
+long deccache_get(struct STR_DecCache *cache,unsigned int index,const unsigned short **text)
+{
+  struct STR_DecCacheItem *item;
+  unsigned short *udata;
+  long len;
+  short result;
+  (*text)=NULL;
+  if (index>=cache->mkstr->offs_count)
+    return -1;
+  item=cache->items[index];
+  if (item!=NULL)
+  {
+    // Mark as most recently used
+    deccache_lru_unlink(cache,item);
+    deccache_lru_push(cache,item);
+    cache->hits++;
+    (*text)=item->text;
+    return item->text_len;
+  }
+  cache->misses++;
+  str_free(cache->uncached);
+  cache->uncached=NULL;
+  result=strmaker_decode_entry(cache->mkstr,&udata,&len,index,0);
+  if (result<ERR_NONE)
+  {
+    str_free(udata);
+    return result;
+  }
+  item=str_malloc(sizeof(struct STR_DecCacheItem));
+  if (item==NULL)
+  {
+    cache->uncached=udata;
+    (*text)=udata;
+    return len;
+  }
+  item->index=index;
+  item->text=udata;
+  item->text_len=len;
+  if (deccache_item_size(item)>cache->mem_limit)
+  {
+    // Too large to keep; evicting everything wouldn't make room
+    str_free(item);
+    cache->uncached=udata;
+    (*text)=udata;
+    return len;
+  }
+  while (cache->mem_used+deccache_item_size(item)>cache->mem_limit)
+    deccache_evict(cache);
+  deccache_lru_push(cache,item);
+  cache->items[index]=item;
+  cache->mem_used+=deccache_item_size(item);
+  cache->items_count++;
+  (*text)=item->text;
+  return len;
+}
+
+/**
+ * Prints counters of the cache.
+ */
+void deccache_print(const struct STR_DecCache *cache,FILE *fp)
+{
+  fprintf(fp,"Decoding cache hits: %lu, misses: %lu, evictions: %lu\n",cache->hits,
+      cache->misses,cache->evictions);
+  fprintf(fp,"Entries kept: %u of %u, memory used: %lu of %lu bytes\n",cache->items_count,
+      cache->mkstr->offs_count,cache->mem_used,cache->mem_limit);
+}
+
+/**
+ * Parses one entry number and prints the entry, for str_lookup_ids().
+ * @return Returns 1 if the entry was printed, 0 otherwise.
+ */
+int str_lookup_id(const char *id,str_lookup_func print_entry,void *data,short flags)
+{
+  unsigned int index;
+  if (str_parse_entry_index(id,&index)!=ERR_NONE)
+  {
+    if (flags&STRFLAG_VERBOSE)
+      str_ferror("Bad entry number \"%s\"",id);
+    return 0;
+  }
+  return print_entry(data,index,flags);
+}
+
+/**
+ * Prints entries with given numbers through a callback. If no numbers
+ * are given, they are read from standard input, one per line, until end
+ * of input, and every entry is printed as soon as its number is read.
+ * @param print_entry Callback which prints one entry; returns 1 if printed.
+ * @param data Data passed to the callback.
+ * @return Returns amount of entries printed.
+ */
+int str_lookup_ids(char **ids,int ids_count,str_lookup_func print_entry,void *data,short flags)
+{
+  char line[64];
+  int count,i;
+  count=0;
+  if (ids_count>0)
+  {
+    for (i=0;i<ids_count;i++)
+      count+=str_lookup_id(ids[i],print_entry,data,flags);
+    return count;
+  }
+  while (fgets(line,sizeof(line),stdin)!=NULL)
+  {
+    i=strlen(line);
+    while ((i>0)&&((line[i-1]=='\n')||(line[i-1]=='\r')||(line[i-1]==' ')))
+      i--;
+    line[i]='\0';
+    if (i==0)
+      continue;
+    count+=str_lookup_id(line,print_entry,data,flags);
+    // Answer every query before the next one is given
+    fflush(stdout);
+  }
+  return count;
+}
+
+struct STR_Lookup {
+    struct STR_DecCache *cache;
+    const char *name;
+    };
+
+/**
+ * Prints one entry of STR file, for str_lookup().
+ * @return Returns 1 if the entry was printed, 0 if it doesn't exist.
+ */
+int str_lookup_entry(void *data,unsigned int index,short flags)
+{
+  struct STR_Lookup *lookup=data;
+  const unsigned short *text;
+  if (deccache_get(lookup->cache,index,&text)<0)
+  {
+    if (flags&STRFLAG_VERBOSE)
+      str_ferror("No entry %u in %s",index,lookup->name);
+    return 0;
+  }
+  str_print_entry(lookup->name,index,text);
+  return 1;
+}
+
+/**
+ * Prints entries of STR file with given numbers. If no numbers are given,
+ * they are read from standard input, one per line, until end of input;
+ * entries are decoded through cache, so repeated queries are fast.
+ * @param name STR file name, without extension.
+ * @param ids Entry numbers, as text.
+ * @param mem_limit Memory budget for decoded entries.
+ * @return Returns amount of entries printed, or negative error code.
+ */
+int str_lookup(const char *name,char **ids,int ids_count,unsigned long mem_limit,short flags)
+{
+  struct STR_Maker *mkstr;
+  struct STR_DecCache *cache;
+  struct STR_Lookup lookup;
+  char *strfname;
+  FILE *fp;
+  short result;
+  int count;
+  strfname=str_malloc(strlen(name)+5);
+  mkstr=str_malloc(sizeof(struct STR_Maker));
+  if ((strfname==NULL)||(mkstr==NULL))
+  {
+    str_free(strfname);
+    str_free(mkstr);
+    return -1;
+  }
+  sprintf(strfname,"%s.str",name);
+  strmaker_clear(mkstr);
+  fp=fopen(strfname,"rb");
+  if (fp==NULL)
+  {
+    if (flags&STRFLAG_VERBOSE)
+      str_ferror("%s when opening %s",strerror(errno),strfname);
+    str_free(strfname);
+    strmaker_free(mkstr);
+    return -1;
+  }
+  result=strmaker_fread(mkstr,fp,flags);
+  fclose(fp);
+  if (result==ERR_NONE)
+    result=str_mb2uni_load(mkstr,strfname,flags);
+  cache=NULL;
+  if (result==ERR_NONE)
+    cache=deccache_create(mkstr,mem_limit);
+  if (cache==NULL)
+  {
+    str_free(strfname);
+    strmaker_free(mkstr);
+    return -1;
+  }
+  lookup.cache=cache;
+  lookup.name=filename_from_path(strfname);
+  count=str_lookup_ids(ids,ids_count,str_lookup_entry,&lookup,flags);
+  if (flags&STRFLAG_VERBOSE)
+    deccache_print(cache,stdout);
+  deccache_free(cache);
+  str_free(strfname);
+  strmaker_free(mkstr);
+  return count;
+}
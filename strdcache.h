@@ -0,0 +1,65 @@
+/******************************************************************************/
+/** @file strdcache.h
+ * Library for r/w of DK2 STR text strings files.
+ * @par Purpose:
+ *     Header file. Defines exported routines from strdcache.c.
+ * @par Comment:
+ *     None.
+ * @par  Copying and copyrights:
+ *     This program is free software; you can redistribute it and/or modify
+ *     it under the terms of the GNU General Public License as published by
+ *     the Free Software Foundation; either version 2 of the License, or
+ *     (at your option) any later version.
+ */
+/******************************************************************************/
+
+#ifndef STRDCACHE_H
+#define STRDCACHE_H
+
+#include <stdio.h>
+
+// Default memory budget of the decoding cache
+#define DECCACHE_DEFAULT_LIMIT (1024*1024)
+
+struct STR_Maker;
+
+struct STR_DecCacheItem {
+    unsigned int index;      // Entry index in STR file
+    unsigned short *text;    // Decoded entry
+    long text_len;
+    struct STR_DecCacheItem *lru_prev;  // More recently used item
+    struct STR_DecCacheItem *lru_next;  // Less recently used item
+    };
+
+/**
+ * Cache of decoded entries of one STR file. Entries are decoded when
+ * first requested; least recently used ones are removed when the memory
+ * used by items exceeds the limit, and stay only in encoded form.
+ */
+struct STR_DecCache {
+    const struct STR_Maker *mkstr; // Source of encoded entries, with codepage
+    unsigned long mem_limit; // Memory budget for items
+    unsigned long mem_used;  // Memory used by items
+    unsigned int items_count;
+    struct STR_DecCacheItem **items; // Cached item of every entry, or NULL
+    struct STR_DecCacheItem *lru_first; // Most recently used
+    struct STR_DecCacheItem *lru_last;  // Least recently used
+    unsigned short *uncached;// Last entry too large to be cached
+    unsigned long hits;
+    unsigned long misses;
+    unsigned long evictions;
+    };
+
+// Routines
+
+struct STR_DecCache *deccache_create(const struct STR_Maker *mkstr,unsigned long mem_limit);
+short deccache_free(struct STR_DecCache *cache);
+long deccache_get(struct STR_DecCache *cache,unsigned int index,const unsigned short **text);
+void deccache_print(const struct STR_DecCache *cache,FILE *fp);
+
+typedef int (*str_lookup_func)(void *data,unsigned int index,short flags);
+
+int str_lookup_ids(char **ids,int ids_count,str_lookup_func print_entry,void *data,short flags);
+int str_lookup(const char *name,char **ids,int ids_count,unsigned long mem_limit,short flags);
+
+#endif
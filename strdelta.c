@@ -0,0 +1,850 @@
+/******************************************************************************/
+/** @file strdelta.c
+ * Library for r/w of DK2 STR text strings files.
+ * @par Purpose:
+ *     Differences between versions of STR file, at the level of entries.
+ * @par Comment:
+ *     Entries are compared in encoded form, as given by offsets tables
+ *     of both files; nothing is decoded, so the codepage is not needed.
+ *     Entries are matched by content, so that inserted and removed
+ *     entries don't make all following entries differ. Offsets table
+ *     of the new file, and bytes between entries, are kept in the delta,
+ *     so the file is rebuilt byte for byte; the result is checked by
+ *     its hash.
+ * @par  Copying and copyrights:
+ *     This program is free software; you can redistribute it and/or modify
+ *     it under the terms of the GNU General Public License as published by
+ *     the Free Software Foundation; either version 2 of the License, or
+ *     (at your option) any later version.
+ */
+/******************************************************************************/
+
+#include "strdelta.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include "lbfileio.h"
+#include "unitext.h"
+#include "strfile.h"
+#include "strmaker.h"
+#include "stralloc.h"
+
+const char dlt_magic[]="BFSD";
+#define DLT_VERSION 3
+
+#define DLT_PADDED(len) (((len)+3)&(~3UL))
+
+/**
+ * Operation of the delta, with amount of entries it applies to.
+ */
+struct DLT_Op {
+    unsigned long type;
+    unsigned long count;
+    };
+
+/**
+ * Hash of old entry, for finding entries by content.
+ */
+struct DLT_EntryHash {
+    unsigned long long hash;
+    unsigned int index;
+    };
+
+/**
+ * Part of the new data block which is outside of all entries.
+ */
+struct DLT_Gap {
+    unsigned long offs;
+    unsigned long len;
+    };
+
+/**
+ * Differences between two STR files, ready to be written.
+ */
+struct DLT_Diff {
+    struct DLT_Op *ops;
+    unsigned int ops_count;
+    unsigned int *items;     // New entries which are written into delta
+    long *items_len;         // Size of every item, 0 if data is shared
+    unsigned int items_count;
+    struct DLT_Gap *gaps;
+    unsigned int gaps_count;
+    unsigned int kept;
+    unsigned int deleted;
+    };
+
+/**
+ * Reads STR file for comparing, and computes hash of the file.
+ * @return Returns the STR_Maker struct pointer, or NULL on error.
+ */
+struct STR_Maker *delta_read_str(const char *fname,unsigned long long *hash,short flags)
+{
+  struct STR_Maker *mkstr;
+  FILE *fp;
+  short result;
+  mkstr=str_malloc(sizeof(struct STR_Maker));
+  if (mkstr==NULL)
+  {
+    if (flags&STRFLAG_VERBOSE)
+      str_error("Cannot allocate memory for structures");
+    return NULL;
+  }
+  strmaker_clear(mkstr);
+  fp=fopen(fname,"rb");
+  if (fp==NULL)
+  {
+    if (flags&STRFLAG_VERBOSE)
+      str_ferror("%s when opening %s",strerror(errno),fname);
+    strmaker_free(mkstr);
+    return NULL;
+  }
+  result=strmaker_fread(mkstr,fp,flags);
+  fclose(fp);
+  if ((result==ERR_NONE)&&(file_hash(fname,hash)!=0))
+  {
+    if (flags&STRFLAG_VERBOSE)
+      str_ferror("%s when reading %s",strerror(errno),fname);
+    result=-1;
+  }
+  if (result!=ERR_NONE)
+  {
+    strmaker_free(mkstr);
+    return NULL;
+  }
+  return mkstr;
+}
+
+/**
+ * Checks whether entry of old file is the same as entry of new file.
+ */
+short delta_entries_equal(const struct STR_Maker *oldmk,unsigned int old_idx,
+    const struct STR_Maker *newmk,unsigned int new_idx)
+{
+  char *old_edata,*new_edata;
+  long old_len,new_len;
+  if ((old_idx>=oldmk->offs_count)||(new_idx>=newmk->offs_count))
+    return 0;
+  old_len=strmaker_get_entry(oldmk,&old_edata,old_idx,0);
+  new_len=strmaker_get_entry(newmk,&new_edata,new_idx,0);
+  if (old_len!=new_len)
+    return 0;
+  return (old_len==0)||(memcmp(old_edata,new_edata,old_len)==0);
+}
+
+/**
+ * Computes hash of content of one entry.
+ */
+unsigned long long delta_entry_hash(const struct STR_Maker *mkstr,unsigned int idx)
+{
+  char *edata;
+  long len;
+  len=strmaker_get_entry(mkstr,&edata,idx,0);
+  if (len<=0)
+    return FNV_HASH_INIT;
+  return hash_fnv64_buf(edata,len,FNV_HASH_INIT);
+}
+
+static int entry_hash_cmp(const void *ptr1,const void *ptr2)
+{
+  const struct DLT_EntryHash *eh1=ptr1;
+  const struct DLT_EntryHash *eh2=ptr2;
+  if (eh1->hash!=eh2->hash)
+    return (eh1->hash<eh2->hash)?-1:1;
+  if (eh1->index!=eh2->index)
+    return (eh1->index<eh2->index)?-1:1;
+  return 0;
+}
+
+/**
+ * Finds the first old entry, at or after given index, with the same
+ * content as the new entry.
+ * @param hashes Hashes of old entries, sorted by hash and index.
+ * @return Returns index of the old entry, or -1 if there's none.
+ */
+long delta_find_old(const struct STR_Maker *oldmk,const struct DLT_EntryHash *hashes,
+    const struct STR_Maker *newmk,unsigned int new_idx,unsigned int from)
+{
+  unsigned long long hash;
+  unsigned int lo,hi,mid;
+  hash=delta_entry_hash(newmk,new_idx);
+  // Lower bound of (hash,from)
+  lo=0;
+  hi=oldmk->offs_count;
+  while (lo<hi)
+  {
+    mid=lo+((hi-lo)>>1);
+    if ((hashes[mid].hash<hash)||((hashes[mid].hash==hash)&&(hashes[mid].index<from)))
+      lo=mid+1;
+    else
+      hi=mid;
+  }
+  for (;(lo<oldmk->offs_count)&&(hashes[lo].hash==hash);lo++)
+  {
+    if (delta_entries_equal(oldmk,hashes[lo].index,newmk,new_idx))
+      return hashes[lo].index;
+  }
+  return -1;
+}
+
+/**
+ * Adds operation at end of the diff, merging it with the previous one
+ * if it's of the same type.
+ */
+void delta_add_op(struct DLT_Diff *diff,unsigned long type,unsigned long count)
+{
+  if (count==0)
+    return;
+  if ((diff->ops_count>0)&&(diff->ops[diff->ops_count-1].type==type))
+  {
+    diff->ops[diff->ops_count-1].count+=count;
+    return;
+  }
+  diff->ops[diff->ops_count].type=type;
+  diff->ops[diff->ops_count].count=count;
+  diff->ops_count++;
+}
+
+/**
+ * Lists operations which give the new entries from the old ones.
+ * Entries are matched by content: if the next old entry differs, old
+ * entries up to the next match are deleted, but only if the entry after
+ * the match matches too; otherwise, the new entry is inserted.
+ * @return Returns ERR_NONE, or negative error code.
+ */
+short delta_match_entries(struct DLT_Diff *diff,const struct STR_Maker *oldmk,
+    const struct STR_Maker *newmk)
+{
+  struct DLT_EntryHash *hashes;
+  unsigned int i,p;
+  long q;
+  hashes=str_malloc((oldmk->offs_count+1)*sizeof(struct DLT_EntryHash));
+  // Every new entry adds at most two operations, and there's final delete
+  diff->ops=str_malloc((2*newmk->offs_count+2)*sizeof(struct DLT_Op));
+  diff->items=str_malloc((newmk->offs_count+1)*sizeof(unsigned int));
+  diff->items_len=str_malloc((newmk->offs_count+1)*sizeof(long));
+  if ((hashes==NULL)||(diff->ops==NULL)||(diff->items==NULL)||(diff->items_len==NULL))
+  {
+    str_free(hashes);
+    return ERR_NO_MEMORY;
+  }
+  for (i=0;i<oldmk->offs_count;i++)
+  {
+    hashes[i].hash=delta_entry_hash(oldmk,i);
+    hashes[i].index=i;
+  }
+  qsort(hashes,oldmk->offs_count,sizeof(struct DLT_EntryHash),entry_hash_cmp);
+  p=0;
+  for (i=0;i<newmk->offs_count;i++)
+  {
+    if (delta_entries_equal(oldmk,p,newmk,i))
+    {
+      delta_add_op(diff,DLT_OP_KEEP,1);
+      diff->kept++;
+      p++;
+      continue;
+    }
+    q=delta_find_old(oldmk,hashes,newmk,i,p+1);
+    if ((q>=0)&&((i+1>=newmk->offs_count)||(q+1>=oldmk->offs_count)||
+        delta_entries_equal(oldmk,q+1,newmk,i+1)))
+    {
+      delta_add_op(diff,DLT_OP_DELETE,q-p);
+      delta_add_op(diff,DLT_OP_KEEP,1);
+      diff->deleted+=q-p;
+      diff->kept++;
+      p=q+1;
+      continue;
+    }
+    delta_add_op(diff,DLT_OP_INSERT,1);
+    diff->items[diff->items_count]=i;
+    diff->items_count++;
+  }
+  if (p<oldmk->offs_count)
+  {
+    delta_add_op(diff,DLT_OP_DELETE,oldmk->offs_count-p);
+    diff->deleted+=oldmk->offs_count-p;
+  }
+  str_free(hashes);
+  return ERR_NONE;
+}
+
+/**
+ * Finds sizes of the items. Item of entry which starts at the same
+ * offset as an earlier new entry is empty, as its data is already there.
+ * @return Returns ERR_NONE, or negative error code.
+ */
+short delta_items_size(struct DLT_Diff *diff,const struct STR_Maker *newmk)
+{
+  unsigned char *placed;
+  unsigned int i,k;
+  char *edata;
+  long len;
+  placed=str_malloc(newmk->data_len+1);
+  if (placed==NULL)
+    return ERR_NO_MEMORY;
+  memset(placed,0,newmk->data_len+1);
+  k=0;
+  for (i=0;i<newmk->offs_count;i++)
+  {
+    len=strmaker_get_entry(newmk,&edata,i,0);
+    if ((k<diff->items_count)&&(diff->items[k]==i))
+    {
+      diff->items_len[k]=((len>0)&&(placed[newmk->offsets[i]]))?0:len;
+      k++;
+    }
+    if (len>0)
+      placed[newmk->offsets[i]]=1;
+  }
+  str_free(placed);
+  return ERR_NONE;
+}
+
+/**
+ * Lists the non-zero bytes of new data block which are outside of all
+ * entries; the rebuilt data block starts filled with zeros, so only
+ * these must be stored.
+ * @return Returns ERR_NONE, or negative error code.
+ */
+short delta_find_gaps(struct DLT_Diff *diff,const struct STR_Maker *newmk)
+{
+  unsigned char *covered;
+  unsigned long offs,end,gaps_alloc;
+  unsigned int i;
+  char *edata;
+  long len;
+  covered=str_malloc(newmk->data_len+1);
+  if (covered==NULL)
+    return ERR_NO_MEMORY;
+  memset(covered,0,newmk->data_len+1);
+  for (i=0;i<newmk->offs_count;i++)
+  {
+    len=strmaker_get_entry(newmk,&edata,i,0);
+    if (len>0)
+      memset(covered+newmk->offsets[i],1,len);
+  }
+  gaps_alloc=0;
+  offs=0;
+  while (offs<newmk->data_len)
+  {
+    if ((covered[offs])||(newmk->data[offs]==0))
+    {
+      offs++;
+      continue;
+    }
+    end=offs+1;
+    while ((end<newmk->data_len)&&(!covered[end])&&(newmk->data[end]!=0))
+      end++;
+    if (diff->gaps_count>=gaps_alloc)
+    {
+      gaps_alloc=gaps_alloc+(gaps_alloc>>1)+16;
+      diff->gaps=str_realloc(diff->gaps,gaps_alloc*sizeof(struct DLT_Gap));
+      if (diff->gaps==NULL)
+      {
+        str_free(covered);
+        return ERR_NO_MEMORY;
+      }
+    }
+    diff->gaps[diff->gaps_count].offs=offs;
+    diff->gaps[diff->gaps_count].len=end-offs;
+    diff->gaps_count++;
+    offs=end;
+  }
+  str_free(covered);
+  return ERR_NONE;
+}
+
+void delta_diff_free(struct DLT_Diff *diff)
+{
+  str_free(diff->ops);
+  str_free(diff->items);
+  str_free(diff->items_len);
+  str_free(diff->gaps);
+  memset(diff,0,sizeof(struct DLT_Diff));
+}
+
+/**
+ * Computes hash of STR file which would be written from given STR_Maker
+ * by strmaker_fwrite().
+ * @return Returns the hash, same as file_hash() of the written file.
+ */
+unsigned long long delta_str_hash(const struct STR_Maker *mkstr)
+{
+  unsigned char buf[4];
+  unsigned long long hash;
+  unsigned int i;
+  hash=hash_fnv64_buf(mkstr->magic,4,FNV_HASH_INIT);
+  write_int32_le_buf(buf,mkstr->file_id);
+  hash=hash_fnv64_buf(buf,4,hash);
+  write_int32_le_buf(buf,mkstr->offs_count);
+  hash=hash_fnv64_buf(buf,4,hash);
+  for (i=0;i<mkstr->offs_count;i++)
+  {
+    write_int32_le_buf(buf,mkstr->offsets[i]+(mkstr->offs_count<<2));
+    hash=hash_fnv64_buf(buf,4,hash);
+  }
+  return hash_fnv64_buf(mkstr->data,mkstr->data_len,hash);
+}
+
+/**
+ * Parsed delta file; sections point into the mapped file, and were
+ * checked to be within it.
+ */
+struct DLT_Patch {
+    unsigned long old_count;
+    unsigned long new_count;
+    unsigned long new_len;
+    const unsigned char *offsets;
+    const unsigned char *ops;
+    unsigned long ops_count;
+    const unsigned char *items;
+    unsigned long items_count;
+    const unsigned char *gaps;
+    unsigned long gaps_count;
+    unsigned long kept;
+    unsigned long deleted;
+    };
+
+/**
+ * Places one entry in the new data block at its offset from the delta.
+ * @return Returns ERR_NONE, or -1 if the entry doesn't fit the block.
+ */
+short delta_place_entry(unsigned char *new_data,long *new_offsets,
+    const struct DLT_Patch *patch,unsigned long idx,const char *src,long len)
+{
+  unsigned long offs;
+  offs=read_int32_le_buf(patch->offsets+idx*SIZEOF_DLT_Offset)&0xffffffffUL;
+  if ((offs>patch->new_len)||((unsigned long)len>patch->new_len-offs))
+    return -1;
+  new_offsets[idx]=offs;
+  if (len>0)
+    memcpy(new_data+offs,src,len);
+  return ERR_NONE;
+}
+
+/**
+ * Rebuilds data block of STR_Maker into the new version. Operations of
+ * the delta give every new entry from an old entry or from delta item,
+ * and it's placed at its offset from the delta; then the gaps are added.
+ * @return Returns ERR_NONE, or -1 if the delta doesn't fit the entries.
+ */
+short delta_rebuild(struct STR_Maker *mkstr,const struct DLT_Patch *patch)
+{
+  const unsigned char *item,*gap;
+  unsigned char *new_data;
+  long *new_offsets;
+  unsigned long i,n,p,op,count,offs,len;
+  char *src;
+  long src_len;
+  short result;
+  new_data=str_malloc(patch->new_len+16);
+  new_offsets=str_malloc((patch->new_count+2)*sizeof(long));
+  if ((new_data==NULL)||(new_offsets==NULL))
+  {
+    str_free(new_data);
+    str_free(new_offsets);
+    return ERR_NO_MEMORY;
+  }
+  memset(new_data,0,patch->new_len+16);
+  result=ERR_NONE;
+  item=patch->items;
+  i=0;
+  p=0;
+  for (n=0;(n<patch->ops_count)&&(result==ERR_NONE);n++)
+  {
+    op=read_int32_le_buf(patch->ops+n*SIZEOF_DLT_Op)&0xffffffffUL;
+    count=read_int32_le_buf(patch->ops+n*SIZEOF_DLT_Op+4)&0xffffffffUL;
+    for (;(count>0)&&(result==ERR_NONE);count--)
+    {
+      switch (op)
+      {
+      case DLT_OP_KEEP:
+          src_len=strmaker_get_entry(mkstr,&src,p,0);
+          result=delta_place_entry(new_data,new_offsets,patch,i,src,src_len);
+          i++;
+          p++;
+          break;
+      case DLT_OP_DELETE:
+          p++;
+          break;
+      case DLT_OP_INSERT:
+          len=read_int32_le_buf(item)&0xffffffffUL;
+          result=delta_place_entry(new_data,new_offsets,patch,i,
+              (const char *)item+SIZEOF_DLT_ItemHeader,len);
+          item+=SIZEOF_DLT_ItemHeader+DLT_PADDED(len);
+          i++;
+          break;
+      }
+    }
+  }
+  gap=patch->gaps;
+  for (n=0;(n<patch->gaps_count)&&(result==ERR_NONE);n++)
+  {
+    offs=read_int32_le_buf(gap)&0xffffffffUL;
+    len=read_int32_le_buf(gap+4)&0xffffffffUL;
+    if ((offs>patch->new_len)||(len>patch->new_len-offs))
+      result=-1;
+    else
+      memcpy(new_data+offs,gap+SIZEOF_DLT_GapHeader,len);
+    gap+=SIZEOF_DLT_GapHeader+DLT_PADDED(len);
+  }
+  if (result!=ERR_NONE)
+  {
+    str_free(new_data);
+    str_free(new_offsets);
+    return -1;
+  }
+  str_free(mkstr->data);
+  str_free(mkstr->offsets);
+  mkstr->data=new_data;
+  mkstr->data_alloc=patch->new_len+16;
+  mkstr->data_len=patch->new_len;
+  mkstr->offsets=new_offsets;
+  mkstr->offs_alloc=patch->new_count+2;
+  mkstr->offs_count=patch->new_count;
+  mkstr->validated=0;
+  return ERR_NONE;
+}
+
+/**
+ * Writes delta file with differences between two STR files.
+ * @param oldfname The previous version of STR file.
+ * @param newfname The current version of STR file.
+ * @param fname Name of the delta file.
+ * @param flags Flags used to manage the behaviour of the function.
+ * @return Returns ERR_NONE, ERR_UNCHANGED or negative error code.
+ */
+short str_delta_make(const char *oldfname,const char *newfname,const char *fname,short flags)
+{
+  static const unsigned char padding[4]={0,0,0,0};
+  struct STR_Maker *oldmk,*newmk;
+  struct DLT_Diff diff;
+  unsigned long long old_hash,new_hash;
+  unsigned long delta_size;
+  unsigned int i;
+  char *edata;
+  char *tmpfname;
+  long len;
+  FILE *fp;
+  short result;
+  oldmk=delta_read_str(oldfname,&old_hash,flags);
+  if (oldmk==NULL)
+    return -1;
+  newmk=delta_read_str(newfname,&new_hash,flags);
+  if (newmk==NULL)
+  {
+    strmaker_free(oldmk);
+    return -1;
+  }
+  memset(&diff,0,sizeof(struct DLT_Diff));
+  result=delta_match_entries(&diff,oldmk,newmk);
+  if (result==ERR_NONE)
+    result=delta_items_size(&diff,newmk);
+  if (result==ERR_NONE)
+    result=delta_find_gaps(&diff,newmk);
+  fp=NULL;
+  if (result!=ERR_NONE)
+  {
+    if (flags&STRFLAG_VERBOSE)
+      str_error("Cannot allocate memory for differences");
+  } else
+  {
+    fp=str_fopen_temp(fname,&tmpfname,flags);
+    if (fp==NULL)
+      result=-1;
+  }
+  if (result!=ERR_NONE)
+  {
+    delta_diff_free(&diff);
+    strmaker_free(oldmk);
+    strmaker_free(newmk);
+    return -1;
+  }
+  // Header
+  fwrite(dlt_magic,1,4,fp);
+  write_int32_le_file(fp,DLT_VERSION);
+  write_int32_le_file(fp,oldmk->offs_count);
+  write_int32_le_file(fp,newmk->offs_count);
+  write_int32_le_file(fp,old_hash&0xffffffffUL);
+  write_int32_le_file(fp,old_hash>>32);
+  write_int32_le_file(fp,new_hash&0xffffffffUL);
+  write_int32_le_file(fp,new_hash>>32);
+  write_int32_le_file(fp,newmk->file_id);
+  write_int32_le_file(fp,diff.ops_count);
+  write_int32_le_file(fp,diff.items_count);
+  write_int32_le_file(fp,diff.gaps_count);
+  write_int32_le_file(fp,newmk->data_len);
+  delta_size=SIZEOF_DLT_Header;
+  // Offsets
+  for (i=0;i<newmk->offs_count;i++)
+    write_int32_le_file(fp,newmk->offsets[i]);
+  delta_size+=newmk->offs_count*SIZEOF_DLT_Offset;
+  // Operations
+  for (i=0;i<diff.ops_count;i++)
+  {
+    write_int32_le_file(fp,diff.ops[i].type);
+    write_int32_le_file(fp,diff.ops[i].count);
+  }
+  delta_size+=diff.ops_count*SIZEOF_DLT_Op;
+  // Items
+  for (i=0;i<diff.items_count;i++)
+  {
+    len=diff.items_len[i];
+    write_int32_le_file(fp,len);
+    if (len>0)
+    {
+      strmaker_get_entry(newmk,&edata,diff.items[i],0);
+      fwrite(edata,1,len,fp);
+      fwrite(padding,1,DLT_PADDED(len)-len,fp);
+    }
+    delta_size+=SIZEOF_DLT_ItemHeader+DLT_PADDED(len);
+  }
+  // Gaps
+  for (i=0;i<diff.gaps_count;i++)
+  {
+    len=diff.gaps[i].len;
+    write_int32_le_file(fp,diff.gaps[i].offs);
+    write_int32_le_file(fp,len);
+    fwrite(newmk->data+diff.gaps[i].offs,1,len,fp);
+    fwrite(padding,1,DLT_PADDED(len)-len,fp);
+    delta_size+=SIZEOF_DLT_GapHeader+DLT_PADDED(len);
+  }
+  if (flags&STRFLAG_VERBOSE)
+  {
+    printf("Entries kept: %u, inserted: %u, deleted: %u\n",diff.kept,diff.items_count,
+        diff.deleted);
+    printf("Delta has %lu bytes, new STR file %lu bytes\n",delta_size,
+        SIZEOF_STR_Header+(newmk->offs_count<<2)+newmk->data_len);
+  }
+  result=str_fclose_temp(fp,tmpfname,fname,ferror(fp)?-1:ERR_NONE,flags);
+  delta_diff_free(&diff);
+  strmaker_free(oldmk);
+  strmaker_free(newmk);
+  return result;
+}
+
+/**
+ * Checks sections of the delta file, and finds where they start.
+ * Operations must give exactly the entries of both files, and every
+ * item must be a complete entry.
+ * @return Returns ERR_NONE, or -1 if the delta is damaged.
+ */
+short delta_parse(struct DLT_Patch *patch,const unsigned char *data,unsigned long data_len)
+{
+  unsigned long pos,i,op,count,len,inserted;
+  memset(patch,0,sizeof(struct DLT_Patch));
+  patch->old_count=read_int32_le_buf(data+8)&0xffffffffUL;
+  patch->new_count=read_int32_le_buf(data+12)&0xffffffffUL;
+  patch->ops_count=read_int32_le_buf(data+36)&0xffffffffUL;
+  patch->items_count=read_int32_le_buf(data+40)&0xffffffffUL;
+  patch->gaps_count=read_int32_le_buf(data+44)&0xffffffffUL;
+  patch->new_len=read_int32_le_buf(data+48)&0xffffffffUL;
+  pos=SIZEOF_DLT_Header;
+  if (patch->new_count>(data_len-pos)/SIZEOF_DLT_Offset)
+    return -1;
+  patch->offsets=data+pos;
+  pos+=patch->new_count*SIZEOF_DLT_Offset;
+  if (patch->ops_count>(data_len-pos)/SIZEOF_DLT_Op)
+    return -1;
+  patch->ops=data+pos;
+  inserted=0;
+  for (i=0;i<patch->ops_count;i++)
+  {
+    op=read_int32_le_buf(data+pos)&0xffffffffUL;
+    count=read_int32_le_buf(data+pos+4)&0xffffffffUL;
+    pos+=SIZEOF_DLT_Op;
+    switch (op)
+    {
+    case DLT_OP_KEEP:
+        if ((count>patch->new_count-patch->kept-inserted)||
+            (count>patch->old_count-patch->kept-patch->deleted))
+          return -1;
+        patch->kept+=count;
+        break;
+    case DLT_OP_DELETE:
+        if (count>patch->old_count-patch->kept-patch->deleted)
+          return -1;
+        patch->deleted+=count;
+        break;
+    case DLT_OP_INSERT:
+        if (count>patch->new_count-patch->kept-inserted)
+          return -1;
+        inserted+=count;
+        break;
+    default:
+        return -1;
+    }
+  }
+  if ((patch->kept+inserted!=patch->new_count)||(inserted!=patch->items_count)||
+      (patch->kept+patch->deleted!=patch->old_count))
+    return -1;
+  patch->items=data+pos;
+  for (i=0;i<patch->items_count;i++)
+  {
+    if ((pos>data_len)||(SIZEOF_DLT_ItemHeader>data_len-pos))
+      return -1;
+    len=read_int32_le_buf(data+pos)&0xffffffffUL;
+    pos+=SIZEOF_DLT_ItemHeader;
+    if ((len>data_len-pos)||((len>0)&&(str_entry_length(data+pos,len)!=len)))
+      return -1;
+    pos+=DLT_PADDED(len);
+  }
+  patch->gaps=data+pos;
+  for (i=0;i<patch->gaps_count;i++)
+  {
+    if ((pos>data_len)||(SIZEOF_DLT_GapHeader>data_len-pos))
+      return -1;
+    len=read_int32_le_buf(data+pos+4)&0xffffffffUL;
+    pos+=SIZEOF_DLT_GapHeader;
+    if (len>data_len-pos)
+      return -1;
+    pos+=DLT_PADDED(len);
+  }
+  if (pos!=data_len)
+    return -1;
+  return ERR_NONE;
+}
+
+/**
+ * Applies delta file to the previous version of STR file, replacing it
+ * with the version from which the delta was made.
+ * @param strfname The STR file to update.
+ * @param fname Name of the delta file.
+ * @param flags Flags used to manage the behaviour of the function.
+ * @return Returns ERR_NONE, ERR_UNCHANGED if the STR file already was
+ *     the new version, or negative error code.
+ */
+short str_delta_apply(const char *strfname,const char *fname,short flags)
+{
+  struct STR_Maker *mkstr;
+  struct DLT_Patch patch;
+  unsigned char *data;
+  unsigned long long old_hash,new_hash,hash;
+  char *tmpfname;
+  long data_len;
+  FILE *fp;
+  short result;
+  data=file_map(fname,&data_len);
+  if (data==NULL)
+  {
+    if (flags&STRFLAG_VERBOSE)
+      str_ferror("Cannot map delta file %s",fname);
+    return -1;
+  }
+  if ((data_len<SIZEOF_DLT_Header)||(memcmp(data,dlt_magic,4)!=0)||
+      (read_int32_le_buf(data+4)!=DLT_VERSION))
+  {
+    if (flags&STRFLAG_VERBOSE)
+      str_ferror("File %s is not a STR delta",fname);
+    file_unmap(data,data_len);
+    return -1;
+  }
+  old_hash=((unsigned long long)(read_int32_le_buf(data+20)&0xffffffffUL)<<32)|
+      (read_int32_le_buf(data+16)&0xffffffffUL);
+  new_hash=((unsigned long long)(read_int32_le_buf(data+28)&0xffffffffUL)<<32)|
+      (read_int32_le_buf(data+24)&0xffffffffUL);
+  // The delta can only be applied to the exact file it was made from
+  if (file_hash(strfname,&hash)!=0)
+  {
+    if (flags&STRFLAG_VERBOSE)
+      str_ferror("%s when reading %s",strerror(errno),strfname);
+    file_unmap(data,data_len);
+    return -1;
+  }
+  if (hash==new_hash)
+  {
+    if (flags&STRFLAG_VERBOSE)
+      printf("STR file is already up to date.\n");
+    file_unmap(data,data_len);
+    return ERR_UNCHANGED;
+  }
+  if (hash!=old_hash)
+  {
+    if (flags&STRFLAG_VERBOSE)
+      str_ferror("Delta %s was made for different version of %s",fname,strfname);
+    file_unmap(data,data_len);
+    return -1;
+  }
+  result=delta_parse(&patch,data,data_len);
+  if ((result!=ERR_NONE)&&(flags&STRFLAG_VERBOSE))
+    str_ferror("Delta file %s is damaged",fname);
+  mkstr=NULL;
+  if (result==ERR_NONE)
+  {
+    mkstr=str_malloc(sizeof(struct STR_Maker));
+    if (mkstr==NULL)
+    {
+      if (flags&STRFLAG_VERBOSE)
+        str_error("Cannot allocate memory for structures");
+      result=-1;
+    } else
+    {
+      strmaker_clear(mkstr);
+    }
+  }
+  if (result==ERR_NONE)
+  {
+    fp=fopen(strfname,"rb");
+    if (fp!=NULL)
+    {
+      result=strmaker_fread(mkstr,fp,flags);
+      fclose(fp);
+    } else
+    {
+      if (flags&STRFLAG_VERBOSE)
+        str_ferror("%s when opening %s",strerror(errno),strfname);
+      result=-1;
+    }
+  }
+  if ((result==ERR_NONE)&&(mkstr->offs_count!=patch.old_count))
+  {
+    if (flags&STRFLAG_VERBOSE)
+      str_ferror("Delta %s was made for different version of %s",fname,strfname);
+    result=-1;
+  }
+  // Every byte of new data block comes from the old file or the delta
+  if ((result==ERR_NONE)&&(patch.new_len>mkstr->data_len+data_len))
+  {
+    if (flags&STRFLAG_VERBOSE)
+      str_ferror("Delta file %s is damaged - wrong data size",fname);
+    result=-1;
+  }
+  // Rebuild the data block, and check it before writing the file
+  if (result==ERR_NONE)
+  {
+    mkstr->file_id=read_int32_le_buf(data+32);
+    result=delta_rebuild(mkstr,&patch);
+    if ((result!=ERR_NONE)&&(flags&STRFLAG_VERBOSE))
+    {
+      if (result==ERR_NO_MEMORY)
+        str_error("Cannot allocate memory for data block");
+      else
+        str_ferror("Delta file %s doesn't fit entries of %s",fname,strfname);
+    }
+  }
+  if ((result==ERR_NONE)&&(delta_str_hash(mkstr)!=new_hash))
+  {
+    if (flags&STRFLAG_VERBOSE)
+      str_ferror("Applying delta %s didn't give the new version of %s",fname,strfname);
+    result=-1;
+  }
+  if (result==ERR_NONE)
+  {
+    if (flags&STRFLAG_VERBOSE)
+      printf("Entries kept: %lu, inserted: %lu, deleted: %lu\n",patch.kept,
+          patch.items_count,patch.deleted);
+    fp=str_fopen_temp(strfname,&tmpfname,flags);
+    if (fp!=NULL)
+    {
+      result=strmaker_fwrite(mkstr,fp,flags);
+      result=str_fclose_temp(fp,tmpfname,strfname,result,flags);
+    } else
+    {
+      result=-1;
+    }
+  }
+  if (mkstr!=NULL)
+    strmaker_free(mkstr);
+  file_unmap(data,data_len);
+  return result;
+}
@@ -0,0 +1,60 @@
+/******************************************************************************/
+/** @file strdelta.h
+ * Library for r/w of DK2 STR text strings files.
+ * @par Purpose:
+ *     Header file. Defines exported routines from strdelta.c.
+ * @par Comment:
+ *     None.
+ * @par  Copying and copyrights:
+ *     This program is free software; you can redistribute it and/or modify
+ *     it under the terms of the GNU General Public License as published by
+ *     the Free Software Foundation; either version 2 of the License, or
+ *     (at your option) any later version.
+ */
+/******************************************************************************/
+
+#ifndef STRDELTA_H
+#define STRDELTA_H
+
+#include <stdio.h>
+
+#define SIZEOF_DLT_Header     52
+#define SIZEOF_DLT_Offset      4
+#define SIZEOF_DLT_Op          8
+#define SIZEOF_DLT_ItemHeader  4
+#define SIZEOF_DLT_GapHeader   8
+
+// Operations of the delta; every one applies to given amount of entries
+enum STR_DeltaOp {
+        DLT_OP_KEEP              = 0x00, // Take next entries of old file
+        DLT_OP_DELETE            = 0x01, // Skip next entries of old file
+        DLT_OP_INSERT            = 0x02, // Take next items of the delta
+    };
+
+/**
+ * Differences between two versions of STR file; all values are
+ * little-endian.
+ *   Header:   magic "BFSD", version, old entries count, new entries count,
+ *             hash of old STR file (8 bytes), hash of new STR file
+ *             (8 bytes), new file ID, operations count, items count,
+ *             gaps count, size of new data block
+ *   Offsets:  offsets of entries in new data block, for every new entry
+ *   Ops:      operation and amount of entries it applies to
+ *   Items:    entry size, and the encoded entry padded to 4 bytes; size 0
+ *             means the entry shares data with an earlier new entry
+ *   Gaps:     offset, size, and the bytes padded to 4 bytes
+ * Operations give new entries in order, taking them from old file or
+ * from the items; entries are matched by content, so inserting or
+ * removing an entry doesn't change entries after it. Every entry is
+ * placed at its offset in the new data block. Gaps are the non-zero
+ * bytes of the new data block outside of all entries, like padding.
+ * Keeping the offsets makes entries which share data (see --dedup)
+ * share it in the rebuilt file too.
+ */
+
+// Routines
+
+short str_delta_make(const char *oldfname,const char *newfname,const char *fname,short flags);
+short str_delta_apply(const char *strfname,const char *fname,short flags);
+
+#endif
@@ -24,6 +24,9 @@
 #include "lbfileio.h"
 #include "unitext.h"
 #include "strmaker.h"
+#include "strstats.h"
+#include "strtcache.h"
+#include "stralloc.h"
 
 /**
  * Clears the STR_File structure, dropping any old pointers.
@@ -31,6 +34,8 @@
 short str_clear(struct STR_File *strfile)
 {
   strfile->str=NULL;
+  strfile->pool=NULL;
+  strfile->pool_len=0;
   strfile->str_count=0;
   strfile->alloc_count=0;
   strfile->file_id=0;
@@ -45,18 +50,194 @@ short str_set_alloc(struct STR_File *strfile,unsigned int count)
 {
   unsigned int prev_count=strfile->alloc_count;
   strfile->alloc_count=count;
-  strfile->str=realloc(strfile->str,strfile->alloc_count*sizeof(unsigned short *));
+  strfile->str=str_realloc(strfile->str,strfile->alloc_count*sizeof(unsigned short *));
   if ((strfile->alloc_count!=0)&&(strfile->str==NULL))
       return -1;
   if (prev_count<strfile->alloc_count)
   {
     int i;
-    for (i=strfile->alloc_count-prev_count;i<strfile->alloc_count;i++)
+    for (i=prev_count;i<strfile->alloc_count;i++)
         strfile->str[i]=NULL;
   }
   return ERR_NONE;
 }
 
+/**
+ * Opens a temporary file for writing an output which will replace
+ * the given file. Use str_fclose_temp() to finish writing.
+ * @param fname Name of the destination file.
+ * @param tmpfname Output for the temporary file name.
+ * @param flags Flags used to manage the behaviour of the function.
+ * @return Returns opened FILE, or NULL on error.
+ */
+FILE *str_fopen_temp(const char *fname,char **tmpfname,short flags)
+{
+  FILE *fp;
+  (*tmpfname)=str_malloc(strlen(fname)+5);
+  if ((*tmpfname)==NULL)
+  {
+    if (flags&STRFLAG_VERBOSE)
+      str_error("Cannot allocate memory for file name");
+    return NULL;
+  }
+  sprintf(*tmpfname,"%s.tmp",fname);
+  fp=fopen(*tmpfname,"wb");
+  if (fp==NULL)
+  {
+    if (flags&STRFLAG_VERBOSE)
+      str_ferror("%s when opening %s",strerror(errno),*tmpfname);
+    str_free(*tmpfname);
+    (*tmpfname)=NULL;
+  }
+  return fp;
+}
+
+/**
+ * Closes the temporary file and renames it to the destination name,
+ * replacing previous file. If the previous file had identical content,
+ * it is left untouched and the temporary file is deleted.
+ * @param fp The temporary file opened by str_fopen_temp().
+ * @param tmpfname Name of the temporary file; it is freed.
+ * @param fname Name of the destination file.
+ * @param result Result of writing; if it's an error, file is deleted.
+ * @param flags Flags used to manage the behaviour of the function.
+ * @return Returns ERR_NONE if the file was replaced, ERR_UNCHANGED
+ *     if there was no change, or negative error code.
+ */
+short str_fclose_temp(FILE *fp,char *tmpfname,const char *fname,short result,short flags)
+{
+  long written=ftell(fp);
+  int failed;
+  if (written>0)
+    STATS_ADD(bytes_written,written);
+  // The file is always closed, even if writing failed
+  failed=ferror(fp);
+  if (fclose(fp)!=0)
+    failed=1;
+  if (failed)
+  {
+    if ((result==ERR_NONE)&&(flags&STRFLAG_VERBOSE))
+      str_ferror("%s when writing %s",strerror(errno),tmpfname);
+    result=-1;
+  }
+  if (result!=ERR_NONE)
+  {
+    remove(tmpfname);
+    str_free(tmpfname);
+    return result;
+  }
+  switch (file_replace_if_changed(tmpfname,fname))
+  {
+  case 0:
+    result=ERR_UNCHANGED;
+    break;
+  case 1:
+    result=ERR_NONE;
+    break;
+  default:
+    if (flags&STRFLAG_VERBOSE)
+      str_ferror("%s when replacing %s",strerror(errno),fname);
+    result=-1;
+    break;
+  }
+  str_free(tmpfname);
+  return result;
+}
+
+/**
+ * Loads the codepage conversion file which lies in the same folder
+ * as given STR or TXT file.
+ * @param mkstr The STR_Maker structure to fill.
+ * @param fname Name of a file in the folder which contains MBToUni.dat.
+ * @param flags Flags used to manage the behaviour of the function.
+ * @return Returns ERR_NONE on success.
+ */
+short str_mb2uni_load(struct STR_Maker *mkstr,const char *fname,short flags)
+{
+  FILE *fp;
+  short result;
+  short prev_phase;
+  int path_len=filename_from_path(fname)-fname;
+  if (path_len<0) path_len=0;
+  char *mbfname=str_malloc(path_len+16);
+  if (mbfname==NULL)
+  {
+    if (flags&STRFLAG_VERBOSE)
+      str_error("Cannot allocate memory for codepage file name");
+    return -1;
+  }
+  if (path_len>0)
+    strncpy(mbfname,fname,path_len);
+  // Loading MBToUni instead of UniToMB, as I have no idea how to use UniToMB.
+  strcpy(mbfname+path_len,"MBToUni.dat");
+  prev_phase=stats_phase_enter(STAT_CODEPAGE);
+  fp=fopen(mbfname,"rb");
+  if (fp==NULL)
+  {
+    stats_phase_leave(prev_phase);
+    if (flags&STRFLAG_VERBOSE)
+      str_ferror("%s when opening %s",strerror(errno),mbfname);
+    str_free(mbfname);
+    return -1;
+  }
+  result=str_mb2uni_fread(mkstr,fp,flags);
+  /*
+  // Loading UniToMB; using it requires modification of the encoding function
+  // str_data_encode() in strmaker.c
+  strcpy(mbfname+path_len,"UniToMB.dat");
+  fp=fopen(mbfname,"rb");
+  if (fp==NULL)
+  {
+    if (flags&STRFLAG_VERBOSE)
+      str_ferror("%s when opening %s",strerror(errno),mbfname);
+    str_free(mbfname);
+    return -1;
+  }
+  result=str_uni2mb_fread(mkstr,fp,flags);
+  */
+  fclose(fp);
+  stats_phase_leave(prev_phase);
+  str_free(mbfname);
+  return result;
+}
+
+/**
+ * Fills STR_File with all entries of STR_Maker, decoded into Unicode.
+ * @param strfile Destination STR_File, cleared.
+ * @param mkstr Source STR_Maker, with codepage loaded.
+ * @param flags Flags used to manage the behaviour of the function.
+ * @return Returns ERR_NONE on success.
+ */
+short strfile_from_strmaker(struct STR_File *strfile,const struct STR_Maker *mkstr,short flags)
+{
+  short result;
+  strfile->file_id=mkstr->file_id;
+  if (str_set_alloc(strfile,mkstr->offs_count)!=ERR_NONE)
+  {
+    if (flags&STRFLAG_VERBOSE)
+      str_error("Cannot allocate memory for entries");
+    return -1;
+  }
+  int i;
+  for (i=0;i<mkstr->offs_count;i++)
+  {
+      if (flags&STRFLAG_DEBUG)
+          printf("Reading entry %d\n",i);
+      unsigned short *udata;
+      result=strmaker_get_unicode_entry(mkstr,&udata,i,flags);
+      if (udata!=NULL)
+      {
+          strfile->str[strfile->str_count]=udata;
+          strfile->str_count++;
+      }
+      if (result<ERR_NONE)
+          return -1;
+  }
+  if (flags&STRFLAG_DEBUG)
+      printf("Total entries decoded: %d\n",strfile->str_count);
+  return ERR_NONE;
+}
+
 /**
  * Loads STR file from given filename and creates structure for maintaining it.
  */
@@ -65,95 +246,316 @@ struct STR_File *str_open(char *fname,short flags)
   struct STR_File *strfile;
   struct STR_Maker *mkstr;
   FILE *fp;
-  strfile=malloc(sizeof(struct STR_File));
-  mkstr=malloc(sizeof(struct STR_Maker));
+  strfile=str_malloc(sizeof(struct STR_File));
+  mkstr=str_malloc(sizeof(struct STR_Maker));
   if ((strfile==NULL)||(mkstr==NULL))
   {
     if (flags&STRFLAG_VERBOSE)
       str_error("Cannot allocate STR_File memory");
-    free(strfile);
+    str_free(strfile);
     strmaker_free(mkstr);
     return NULL;
   }
   // Read source file
+  short result;
+  short prev_phase;
   strmaker_clear(mkstr);
+  prev_phase=stats_phase_enter(STAT_READ);
   fp=fopen(fname,"rb");
   if (fp==NULL)
   {
+    stats_phase_leave(prev_phase);
     if (flags&STRFLAG_VERBOSE)
       str_ferror("%s when opening %s",strerror(errno),fname);
-    free(strfile);
+    str_free(strfile);
     strmaker_free(mkstr);
     return NULL;
   }
-  short result;
   result=strmaker_fread(mkstr,fp,flags);
   fclose(fp);
+  stats_phase_leave(prev_phase);
   if (result != ERR_NONE)
   {
-    free(strfile);
+    str_free(strfile);
     strmaker_free(mkstr);
     return NULL;
   }
   mkstr->iosize=0;
   str_clear(strfile);
   //Read codepage converter
-  int path_len=filename_from_path(fname)-fname;
-  if (path_len<0) path_len=0;
-  char *mbfname=malloc(path_len+16);
-  if (path_len>0)
-    strncpy(mbfname,fname,path_len);
-  strcpy(mbfname+path_len,"MBToUni.dat");
-  fp=fopen(mbfname,"rb");
-  if (fp==NULL)
+  result=str_mb2uni_load(mkstr,fname,flags);
+  if (result != ERR_NONE)
   {
-    if (flags&STRFLAG_VERBOSE)
-      str_ferror("%s when opening %s",strerror(errno),mbfname);
-    free(strfile);
+    str_free(strfile);
     strmaker_free(mkstr);
     return NULL;
   }
-  result=str_mb2uni_fread(mkstr,fp,flags);
-  fclose(fp);
-  if (result != ERR_NONE)
+  // Do the conversion
+  prev_phase=stats_phase_enter(STAT_DECODE);
+  result=strfile_from_strmaker(strfile,mkstr,flags);
+  stats_phase_leave(prev_phase);
+  strmaker_free(mkstr);
+  if (result<ERR_NONE)
   {
-    free(mbfname);
-    free(strfile);
-    strmaker_free(mkstr);
+    str_close(strfile,flags);
     return NULL;
   }
-  free(mbfname);
-  // Do the conversion
+  return strfile;
+}
 
-  // new version - unfinished yet
-  strfile->file_id=mkstr->file_id;
-  str_set_alloc(strfile,mkstr->offs_count);
-  int i;
-  for (i=0;i<mkstr->offs_count;i++)
+/**
+ * Returns amount of entries from STR_File which should be placed in STR.
+ * The last entry is skipped if it's empty - text files usually end
+ * with a new line, which would create such entry.
+ */
+unsigned int str_entries_to_encode(const struct STR_File *strfile)
+{
+  unsigned int count=strfile->str_count;
+  if (count>0)
+    if ((strfile->str[count-1]==NULL)||(strfile->str[count-1][0]==0))
+      count--;
+  return count;
+}
+
+/**
+ * Hash table of entry texts, used to find repeated entries.
+ */
+struct STR_TextTable {
+    unsigned int size;       // Amount of slots, power of 2
+    unsigned int *slots;     // Entry index plus one, or 0 if slot is empty
+    unsigned long long *hashes; // Hashes of texts of all entries
+    };
+
+short text_table_init(struct STR_TextTable *tbl,unsigned int count)
+{
+  tbl->size=16;
+  while (tbl->size<(count<<1))
+    tbl->size<<=1;
+  tbl->slots=str_calloc(tbl->size,sizeof(unsigned int));
+  tbl->hashes=str_malloc((count+1)*sizeof(unsigned long long));
+  if ((tbl->slots==NULL)||(tbl->hashes==NULL))
   {
-      if (flags&STRFLAG_DEBUG)
-          printf("Reading entry %d\n",i);
-      unsigned short *udata;
-      result=strmaker_get_unicode_entry(mkstr,&udata,i,flags);
-      if (udata!=NULL)
+    str_free(tbl->slots);
+    str_free(tbl->hashes);
+    tbl->slots=NULL;
+    tbl->hashes=NULL;
+    return -1;
+  }
+  return ERR_NONE;
+}
+
+void text_table_free(struct STR_TextTable *tbl)
+{
+  str_free(tbl->slots);
+  str_free(tbl->hashes);
+  tbl->slots=NULL;
+  tbl->hashes=NULL;
+}
+
+/**
+ * Finds earlier entry with the same text as entry of given index.
+ * If there is no such entry, the given one is added to the table.
+ * @return Returns index of the earlier entry, or -1 if not found.
+ */
+long text_table_find_or_add(struct STR_TextTable *tbl,unsigned short **str,unsigned int index)
+{
+  unsigned long long hash;
+  unsigned int pos,k;
+  hash=hash_fnv64_buf(str[index],unicode_strlen(str[index])*sizeof(unsigned short),FNV_HASH_INIT);
+  tbl->hashes[index]=hash;
+  pos=(hash^(hash>>32))&(tbl->size-1);
+  while (tbl->slots[pos]!=0)
+  {
+    k=tbl->slots[pos]-1;
+    if ((tbl->hashes[k]==hash)&&(unicode_strcmp(str[k],str[index])==0))
+      return k;
+    pos=(pos+1)&(tbl->size-1);
+  }
+  tbl->slots[pos]=index+1;
+  return -1;
+}
+
+/**
+ * Fills STR_Maker with encoded entries from given STR_File.
+ * If previous version of the STR is given, entries which decode into
+ * the same text are copied from it without encoding.
+ * With STRFLAG_DEDUP, every repeated text is encoded only once, and
+ * the repeated entries share its data.
+ * @param mkstr Destination STR_Maker, with codepage loaded.
+ * @param strfile Source STR_File structure pointer.
+ * @param prev Previous version of the STR file, or NULL.
+ * @param reused Output for the amount of copied entries, or NULL.
+ * @param shared Output for the amount of shared entries, or NULL.
+ * @param flags Flags used to manage the behaviour of the function.
+ * @return Returns ERR_NONE on success.
+ */
+short strmaker_from_strfile(struct STR_Maker *mkstr,struct STR_File *strfile,
+    const struct STR_Maker *prev,unsigned int *reused,unsigned int *shared,short flags)
+{
+  struct STR_TextTable dedup;
+  short result;
+  unsigned int i,count;
+  if (reused!=NULL)
+      (*reused)=0;
+  if (shared!=NULL)
+      (*shared)=0;
+  mkstr->file_id=strfile->file_id;
+  count=str_entries_to_encode(strfile);
+  dedup.slots=NULL;
+  dedup.hashes=NULL;
+  if ((flags&STRFLAG_DEDUP)&&(text_table_init(&dedup,count)!=ERR_NONE))
+  {
+      if (flags&STRFLAG_VERBOSE)
+        str_error("Cannot allocate memory for entries hash table");
+      return -1;
+  }
+  for (i=0;i<count;i++)
+  {
+      if ((dedup.slots!=NULL)&&(strfile->str[i]!=NULL))
       {
-          strfile->str[strfile->str_count]=udata;
-          strfile->str_count++;
+          long dup_idx=text_table_find_or_add(&dedup,strfile->str,i);
+          if (dup_idx>=0)
+          {
+              if (flags&STRFLAG_DEBUG)
+                  printf("Entry %d shares data with entry %ld\n",i,dup_idx);
+              result=strmaker_add_shared_entry(mkstr,dup_idx);
+              if (result!=ERR_NONE)
+                  break;
+              if (shared!=NULL)
+                  (*shared)++;
+              continue;
+          }
       }
-      if (result<ERR_NONE)
+      if ((prev!=NULL)&&(i<prev->offs_count))
       {
-          free(strfile);
-          strmaker_free(mkstr);
-          return NULL;
+          char *edata;
+          int edata_len;
+          edata_len=strmaker_get_entry(prev,&edata,i,flags);
+          if ((edata_len>0)&&(edata!=NULL))
+          {
+              unsigned short *udata;
+              long udata_len;
+              result=str_data_decode(&udata,&udata_len,mkstr->mb2uni,mkstr->mb2uni_count,
+                  (unsigned char *)edata,edata_len);
+              if (result==ERR_NONE)
+              {
+                  result=unicode_strcmp(udata,strfile->str[i]);
+                  str_free(udata);
+                  if (result==0)
+                  {
+                      if (flags&STRFLAG_DEBUG)
+                          printf("Copying unchanged entry %d\n",i);
+                      result=strmaker_add_entry(mkstr,(unsigned char *)edata,edata_len);
+                      if (result!=ERR_NONE)
+                      {
+                          if (flags&STRFLAG_VERBOSE)
+                            str_error("Error on adding STR_Maker entry");
+                          break;
+                      }
+                      if (reused!=NULL)
+                          (*reused)++;
+                      continue;
+                  }
+              } else
+              {
+                  str_free(udata);
+              }
+          }
       }
+      if (flags&STRFLAG_DEBUG)
+          printf("Adding entry %d\n",i);
+      result=strmaker_add_unicode_entry(mkstr,strfile->str[i],flags);
+      if (result!=ERR_NONE)
+          break;
   }
+  text_table_free(&dedup);
+  if (i<count)
+      return -1;
   if (flags&STRFLAG_DEBUG)
-      printf("Total entries decoded: %d\n",strfile->str_count);
-  strmaker_free(mkstr);
-  return strfile;
+      printf("Total entries encoded: %d\n",count);
+  return ERR_NONE;
 }
 
-short str_write(struct STR_File *strfile,char *fname,short flags)
+/**
+ * Checks STR_Maker filled with STRFLAG_DEDUP. Entries which share data
+ * with an earlier entry are checked against their own text in STR_File:
+ * the text is encoded again, without sharing, and compared with the
+ * shared data; if the bytes differ (the data may be copied from previous
+ * version of the STR), the data is decoded and compared as text.
+ * Data of not shared entries is placed in ascending order.
+ * @return Returns amount of mismatches, or negative error code.
+ */
+int strmaker_check_strfile(const struct STR_Maker *mkstr,struct STR_File *strfile,short flags)
+{
+  unsigned char *fresh;
+  long fresh_len;
+  char *edata;
+  long edata_len;
+  long owner_offs;
+  unsigned int i;
+  int mismatches;
+  short result;
+  if (str_entries_to_encode(strfile)!=mkstr->offs_count)
+    return 1;
+  owner_offs=-1;
+  mismatches=0;
+  for (i=0;i<mkstr->offs_count;i++)
+  {
+    unsigned short *udata=NULL;
+    if (mkstr->offsets[i]>owner_offs)
+    {
+      owner_offs=mkstr->offsets[i];
+      continue;
+    }
+    if (strfile->str[i]==NULL)
+    {
+      mismatches++;
+      continue;
+    }
+    edata_len=strmaker_get_entry(mkstr,&edata,i,flags);
+    result=str_data_encode_r(&fresh,&fresh_len,mkstr->mb2uni,mkstr->mb2uni_count,
+        strfile->str[i],unicode_strlen(strfile->str[i]));
+    if (result!=ERR_NONE)
+    {
+      str_free(fresh);
+      return -1;
+    }
+    if ((edata!=NULL)&&(fresh_len==edata_len)&&(memcmp(fresh,edata,edata_len)==0))
+    {
+      str_free(fresh);
+      continue;
+    }
+    str_free(fresh);
+    if ((edata==NULL)||(edata_len<=0)||
+        (str_data_decode(&udata,&fresh_len,mkstr->mb2uni,mkstr->mb2uni_count,
+            (unsigned char *)edata,edata_len)!=ERR_NONE)||
+        (unicode_strcmp(udata,strfile->str[i])!=0))
+    {
+      if (flags&STRFLAG_DEBUG)
+        printf("Entry %u doesn't match the data it shares\n",i);
+      mismatches++;
+    }
+    str_free(udata);
+  }
+  return mismatches;
+}
+
+/**
+ * Encodes the STR_File and writes it into STR file.
+ * If prev_fname is given, the entries which weren't changed since
+ * previous version of the STR are copied from it instead of being
+ * encoded again. If encoding cache is given, texts are encoded only
+ * if they're not in the cache.
+ * @param strfile The STR_File struct pointer.
+ * @param fname Destination file name.
+ * @param prev_fname Previous version of the STR file, or NULL.
+ * @param cache Encoding cache for the codepage in fname folder, or NULL.
+ * @param flags Flags used to manage the behaviour of the function.
+ * @return Returns ERR_NONE on success, ERR_UNCHANGED if the existing
+ *     file already had the same content and wasn't rewritten.
+ */
+short str_write_cached(struct STR_File *strfile,char *fname,char *prev_fname,
+    struct STR_EncCache *cache,short flags)
 {
   if (strfile==NULL)
   {
@@ -162,7 +564,8 @@ short str_write(struct STR_File *strfile,char *fname,short flags)
   }
   // Allocating STR_Maker structure
   struct STR_Maker *mkstr;
-  mkstr=malloc(sizeof(struct STR_Maker));
+  struct STR_Maker *prev;
+  mkstr=str_malloc(sizeof(struct STR_Maker));
   if (mkstr==NULL)
   {
     if (flags&STRFLAG_VERBOSE)
@@ -171,13 +574,11 @@ short str_write(struct STR_File *strfile,char *fname,short flags)
   }
   short result;
   result=strmaker_clear(mkstr);
-  // Filling STR_Maker structure
-  mkstr->file_id=strfile->file_id;
+  mkstr->enccache=cache;
   // Setting starting size of buffers will make the program work faster
   result=strmaker_set_offsalloc(mkstr,strfile->str_count+4);
   if (result==ERR_NONE)
     result=strmaker_set_dataalloc(mkstr,4096);
-  int i;
   if (result!=ERR_NONE)
   {
     if (flags&STRFLAG_VERBOSE)
@@ -187,85 +588,285 @@ short str_write(struct STR_File *strfile,char *fname,short flags)
   }
   FILE *fp;
   //Read codepage converter
-  int path_len=filename_from_path(fname)-fname;
-  if (path_len<0) path_len=0;
-  char *mbfname=malloc(path_len+16);
-  if (path_len>0)
-    strncpy(mbfname,fname,path_len);
-  // Loading MBToUni instead of UniToMB, as I have no idea how to use MBToUni.
-  strcpy(mbfname+path_len,"MBToUni.dat");
-  fp=fopen(mbfname,"rb");
+  result=str_mb2uni_load(mkstr,fname,flags);
+  if (result != ERR_NONE)
+  {
+    strmaker_free(mkstr);
+    return -1;
+  }
+  // Read previous version of the file; if it fails, just encode everything
+  short prev_phase;
+  prev=NULL;
+  if (prev_fname!=NULL)
+  {
+    prev_phase=stats_phase_enter(STAT_READ);
+    fp=fopen(prev_fname,"rb");
+    if (fp!=NULL)
+    {
+      prev=str_malloc(sizeof(struct STR_Maker));
+      if (prev!=NULL)
+      {
+        strmaker_clear(prev);
+        result=strmaker_fread(prev,fp,flags&(~STRFLAG_VERBOSE));
+        if (result!=ERR_NONE)
+        {
+          strmaker_free(prev);
+          prev=NULL;
+        }
+      }
+      fclose(fp);
+    }
+    stats_phase_leave(prev_phase);
+    if ((prev==NULL)&&(flags&STRFLAG_VERBOSE))
+      printf("Previous STR not available, encoding all entries.\n");
+  }
+  unsigned int reused,shared;
+  prev_phase=stats_phase_enter(STAT_ENCODE);
+  result=strmaker_from_strfile(mkstr,strfile,prev,&reused,&shared,flags);
+  stats_phase_leave(prev_phase);
+  if (prev!=NULL)
+    strmaker_free(prev);
+  if (result!=ERR_NONE)
+  {
+    strmaker_free(mkstr);
+    return -1;
+  }
+  if ((prev_fname!=NULL)&&(flags&STRFLAG_VERBOSE))
+    printf("Entries copied unchanged: %u, encoded: %u\n",reused,mkstr->offs_count-reused-shared);
+  if (flags&STRFLAG_DEDUP)
+  {
+    if (flags&STRFLAG_VERBOSE)
+      printf("Repeated entries sharing data: %u\n",shared);
+    // Make sure the shared offsets still give the right texts
+    if (strmaker_check_strfile(mkstr,strfile,flags)!=0)
+    {
+      if (flags&STRFLAG_VERBOSE)
+        str_error("Verification of deduplicated entries failed");
+      strmaker_free(mkstr);
+      return -1;
+    }
+  }
+  // Open destination file
+  char *tmpfname;
+  prev_phase=stats_phase_enter(STAT_WRITE);
+  fp=str_fopen_temp(fname,&tmpfname,flags);
   if (fp==NULL)
+  {
+    stats_phase_leave(prev_phase);
+    strmaker_free(mkstr);
+    return -1;
+  }
+  result=strmaker_fwrite(mkstr,fp,flags);
+  result=str_fclose_temp(fp,tmpfname,fname,result,flags);
+  stats_phase_leave(prev_phase);
+  strmaker_free(mkstr);
+  return result;
+}
+
+/**
+ * Encodes the STR_File and writes it into STR file, copying unchanged
+ * entries from previous version of the STR.
+ * @return Returns ERR_NONE on success.
+ */
+short str_write_prev(struct STR_File *strfile,char *fname,char *prev_fname,short flags)
+{
+  return str_write_cached(strfile,fname,prev_fname,NULL,flags);
+}
+
+/**
+ * Encodes the STR_File and writes it into STR file.
+ * @param strfile The STR_File struct pointer.
+ * @param fname Destination file name.
+ * @param flags Flags used to manage the behaviour of the function.
+ * @return Returns ERR_NONE on success.
+ */
+short str_write(struct STR_File *strfile,char *fname,short flags)
+{
+  return str_write_prev(strfile,fname,NULL,flags);
+}
+
+/**
+ * Reads STR entry of given index from file, decodes it and compares
+ * with the given text. Used by str_check().
+ * @return Returns 0 if the entry decodes into given text.
+ */
+int str_check_decoded(struct STR_Maker *mkstr,FILE *fp,unsigned int index,
+    unsigned char **fdata,long *fdata_alloc,const unsigned short *str)
+{
+  long start,end,len;
+  unsigned short *udata;
+  long udata_len;
+  short result;
+  start=mkstr->offsets[index];
+  end=mkstr->disksize-SIZEOF_STR_Header-(mkstr->offs_count<<2);
+  if ((index+1<mkstr->offs_count)&&(mkstr->offsets[index+1]>start))
+    end=mkstr->offsets[index+1];
+  len=end-start;
+  if ((start<0)||(len<=0))
+    return 1;
+  if (len>(*fdata_alloc))
+  {
+    unsigned char *ptr;
+    ptr=str_realloc(*fdata,len);
+    if (ptr==NULL)
+      return 1;
+    (*fdata)=ptr;
+    (*fdata_alloc)=len;
+  }
+  if ((fseek(fp,SIZEOF_STR_Header+(mkstr->offs_count<<2)+start,SEEK_SET)!=0)||
+      (fread(*fdata,1,len,fp)!=len))
+    return 1;
+  result=str_data_decode(&udata,&udata_len,mkstr->mb2uni,mkstr->mb2uni_count,*fdata,len);
+  if (result!=ERR_NONE)
+  {
+    str_free(udata);
+    return 1;
+  }
+  result=unicode_strcmp(udata,str);
+  str_free(udata);
+  return result;
+}
+
+/**
+ * Checks whether existing STR file contains entries from given STR_File.
+ * Entries are encoded one by one and compared with the STR data read
+ * directly from file; nothing is written, and only the offsets table
+ * and current entry are kept in memory. If encoded bytes differ, the
+ * entry from file is decoded and compared as text.
+ * @param strfile The STR_File struct pointer.
+ * @param fname The STR file name to verify.
+ * @param stop_first If nonzero, checking ends at first mismatch.
+ * @param flags Flags used to manage the behaviour of the function.
+ * @return Returns amount of mismatches, or negative error code.
+ */
+int str_check(struct STR_File *strfile,char *fname,short stop_first,short flags)
+{
+  struct STR_Maker *mkstr;
+  unsigned char *fdata;
+  long fdata_alloc;
+  int mismatches;
+  unsigned int i,count,offs_num;
+  long data_pos;
+  short result;
+  FILE *fp;
+  mkstr=str_malloc(sizeof(struct STR_Maker));
+  if (mkstr==NULL)
   {
     if (flags&STRFLAG_VERBOSE)
-      str_ferror("%s when opening %s",strerror(errno),mbfname);
-    free(mbfname);
+      str_error("Cannot allocate STR_Maker memory");
+    return -1;
+  }
+  strmaker_clear(mkstr);
+  result=str_mb2uni_load(mkstr,fname,flags);
+  if (result!=ERR_NONE)
+  {
     strmaker_free(mkstr);
     return -1;
   }
-  result=str_mb2uni_fread(mkstr,fp,flags);
-  /*
-  // Loading UniToMB; using it requires modification of the encoding function
-  // str_data_encode() in strmaker.c
-  strcpy(mbfname+path_len,"UniToMB.dat");
-  fp=fopen(mbfname,"rb");
+  fp=fopen(fname,"rb");
   if (fp==NULL)
   {
     if (flags&STRFLAG_VERBOSE)
-      str_ferror("%s when opening %s",strerror(errno),mbfname);
-    free(mbfname);
+      str_ferror("%s when opening %s",strerror(errno),fname);
     strmaker_free(mkstr);
     return -1;
   }
-  result=str_uni2mb_fread(mkstr,fp,flags);
-  */
-  fclose(fp);
-  if (result != ERR_NONE)
+  // Read header and offsets
+  result=strmaker_fread_header(mkstr,fp,flags);
+  if (result!=ERR_NONE)
   {
-    free(mbfname);
+    fclose(fp);
     strmaker_free(mkstr);
     return -1;
   }
-  int max_idx=((int)strfile->str_count)-1;
-  for (i=0;i<max_idx;i++)
+  offs_num=mkstr->offs_count;
+  data_pos=SIZEOF_STR_Header+(offs_num<<2);
+  mismatches=0;
+  if (mkstr->file_id!=strfile->file_id)
   {
-      if (flags&STRFLAG_DEBUG)
-          printf("Adding entry %d\n",i);
-      result=strmaker_add_unicode_entry(mkstr,strfile->str[i],flags);
-      if (result!=ERR_NONE)
+    if (flags&STRFLAG_VERBOSE)
+      printf("File ID differs: text has %u, STR has %u\n",strfile->file_id,mkstr->file_id);
+    mismatches++;
+  }
+  count=str_entries_to_encode(strfile);
+  if ((count!=offs_num)&&((mismatches==0)||(!stop_first)))
+  {
+    if (flags&STRFLAG_VERBOSE)
+      printf("Entries count differs: text has %u, STR has %u\n",count,offs_num);
+    mismatches++;
+  }
+  if (offs_num<count)
+    count=offs_num;
+  // Compare the entries
+  short prev_phase=stats_phase_enter(STAT_ENCODE);
+  fdata=NULL;
+  fdata_alloc=0;
+  for (i=0;i<count;i++)
+  {
+    unsigned char *edata;
+    long edata_len;
+    if ((stop_first)&&(mismatches>0))
+      break;
+    if (flags&STRFLAG_DEBUG)
+      printf("Checking entry %d\n",i);
+    result=str_data_encode_r(&edata,&edata_len,mkstr->mb2uni,mkstr->mb2uni_count,
+        strfile->str[i],unicode_strlen(strfile->str[i]));
+    if (result!=ERR_NONE)
+    {
+      if (flags&STRFLAG_VERBOSE)
+        str_ferror("%s on unicode string encoding",str_error_text(result));
+      mismatches=-1;
+      break;
+    }
+    if (edata_len>fdata_alloc)
+    {
+      unsigned char *ptr;
+      ptr=str_realloc(fdata,edata_len);
+      if (ptr==NULL)
       {
-          strmaker_free(mkstr);
-          return -1;
+        if (flags&STRFLAG_VERBOSE)
+          str_error("Cannot allocate memory for STR entry");
+        str_free(edata);
+        mismatches=-1;
+        break;
       }
-  }
-  // Do the last entry separately, because if it's empty it should be skipped
-  if (max_idx>=0)
-    if (strfile->str[max_idx][0]!=0)
+      fdata=ptr;
+      fdata_alloc=edata_len;
+    }
+    long offs=data_pos+mkstr->offsets[i];
+    if ((mkstr->offsets[i]<0)||(offs+edata_len>mkstr->disksize)||
+        (fseek(fp,offs,SEEK_SET)!=0)||(fread(fdata,1,edata_len,fp)!=edata_len)||
+        (memcmp(fdata,edata,edata_len)!=0))
     {
-      i=max_idx;
-      if (flags&STRFLAG_DEBUG)
-          printf("Adding last entry %d\n",i);
-      result=strmaker_add_unicode_entry(mkstr,strfile->str[i],flags);
-      if (result!=ERR_NONE)
+      // The STR may come from another encoder (ie. with different padding);
+      // in that case, compare the decoded text
+      if (str_check_decoded(mkstr,fp,i,&fdata,&fdata_alloc,strfile->str[i])!=0)
       {
-          strmaker_free(mkstr);
-          return -1;
+        if (flags&STRFLAG_VERBOSE)
+          printf("Entry %u differs\n",i);
+        mismatches++;
       }
     }
-  if (flags&STRFLAG_DEBUG)
-      printf("Total entries encoded: %d\n",strfile->str_count);
-  // Open destination file
-  fp=fopen(fname,"wb");
-  if (fp==NULL)
-  {
-    if (flags&STRFLAG_VERBOSE)
-      str_ferror("%s when opening %s",strerror(errno),fname);
-    strmaker_free(mkstr);
-    return -1;
+    str_free(edata);
   }
-  result=strmaker_fwrite(mkstr,fp,flags);
+  stats_phase_leave(prev_phase);
+  str_free(fdata);
   fclose(fp);
-  return result;
+  strmaker_free(mkstr);
+  return mismatches;
+}
+
+/**
+ * Writes STR file, re-encoding only the entries which are different
+ * than in the existing version of the file.
+ * @param strfile The STR_File struct pointer.
+ * @param fname Destination file name; it is also the previous version.
+ * @param flags Flags used to manage the behaviour of the function.
+ * @return Returns ERR_NONE on success.
+ */
+short str_update(struct STR_File *strfile,char *fname,short flags)
+{
+  return str_write_prev(strfile,fname,fname,flags);
 }
 
 /*
@@ -336,55 +937,16 @@ short str_from_txtuni(struct STR_File *strfile,struct TXT_File *txtfile,short fl
               str_ferror("Can't read line %d of text file",k);
           return -1;
       }
-      long end_offs=txtfile->data_len;
-      if (((k+1)<txtfile->offs_count))
-      {
-        long tmp_end;
-        tmp_end=txtfile->offsets[k+1];
-        if ((tmp_end>offs)&&(tmp_end<end_offs))
-            end_offs=tmp_end;
-      }
       long data_len;
-      data_len=end_offs-offs;
-      // Allocating memory for unicode string
-      strfile->str[strfile->str_count]=malloc((data_len+1)*sizeof(unsigned short));
+      data_len=txtuni_line_length(txtfile,k);
+      // Allocating memory and copying string data without control characters
+      strfile->str[strfile->str_count]=unicode_line_unescape(txtfile->data+offs,data_len);
       if (strfile->str[strfile->str_count]==NULL)
       {
           if (flags&STRFLAG_VERBOSE)
             str_ferror("Can't malloc unicode string for entry %d",k);
           return -1;
       }
-      memset(strfile->str[strfile->str_count],0,(data_len+1)*sizeof(unsigned short));
-      // Copying string data without control characters
-      long i;
-      for (i=0;i<data_len;i++)
-      {
-          unsigned short chr;
-          chr=txtfile->data[offs+i];
-          if ((chr=='\n')||(chr=='\r')) break;
-          if (chr=='\\')
-          {
-            i++;
-            if (i>=data_len) break;
-            chr=txtfile->data[offs+i];
-            switch (chr)
-            {
-            case 'r':
-                chr='\r';
-                break;
-            case 'n':
-                chr='\n';
-                break;
-            case 't':
-                chr='\t';
-                break;
-            case '\\':
-            default:
-                break;
-            }
-          }
-          strfile->str[strfile->str_count][i]=chr;
-      }
       strfile->str_count++;
       k++;
   }
@@ -402,109 +964,304 @@ struct STR_File *str_open_unicode(char *fname,short flags)
   struct STR_File *strfile;
   struct TXT_File *txtfile;
   FILE *fp;
-  strfile=malloc(sizeof(struct STR_File));
-  txtfile=malloc(sizeof(struct TXT_File));
+  if (flags&STRFLAG_TXTCACHE)
+    return str_open_unicode_cached(fname,flags);
+  strfile=str_malloc(sizeof(struct STR_File));
+  txtfile=str_malloc(sizeof(struct TXT_File));
   if ((strfile==NULL)||(txtfile==NULL))
   {
     if (flags&STRFLAG_VERBOSE)
       str_error("Cannot allocate memory for structures");
-    free(strfile);
-    free(txtfile);
+    str_free(strfile);
+    str_free(txtfile);
     return NULL;
   }
   txtuni_clear(txtfile);
   str_clear(strfile);
   // Read source file
+  short result;
+  short prev_phase;
+  prev_phase=stats_phase_enter(STAT_READ);
   fp=fopen(fname,"rb");
   if (fp==NULL)
   {
+    stats_phase_leave(prev_phase);
     if (flags&STRFLAG_VERBOSE)
       str_ferror("%s when opening %s",strerror(errno),fname);
     txtuni_free(txtfile);
-    free(strfile);
+    str_free(strfile);
     return NULL;
   }
-  short result;
   result=txtuni_read(txtfile,fp,flags);
   fclose(fp);
+  stats_phase_leave(prev_phase);
   if (result != ERR_NONE)
   {
     txtuni_free(txtfile);
-    free(strfile);
+    str_free(strfile);
     return NULL;
   }
+  prev_phase=stats_phase_enter(STAT_LINES);
   result=str_from_txtuni(strfile,txtfile,flags);
+  stats_phase_leave(prev_phase);
   txtuni_free(txtfile);
   if (result != ERR_NONE)
   {
-    free(strfile);
+    str_free(strfile);
     return NULL;
   }
   return strfile;
 }
 
+struct STR_PatchItem {
+    unsigned int index;      // Entry index in STR
+    unsigned int line;       // Line number in patch file
+    unsigned short *udata;   // New text of the entry
+    };
+
+static int str_patch_item_cmp(const void *ptr1,const void *ptr2)
+{
+  const struct STR_PatchItem *item1=ptr1;
+  const struct STR_PatchItem *item2=ptr2;
+  if (item1->index!=item2->index)
+    return (item1->index<item2->index)?-1:1;
+  if (item1->line!=item2->line)
+    return (item1->line<item2->line)?-1:1;
+  return 0;
+}
+
+/**
+ * Reads patch items from Unicode patch file.
+ * Every line of patch file has entry index, a space or tab, and new
+ * text of the entry. Text is escaped in the same way as in TXT files.
+ * Empty lines are ignored.
+ * @return Returns ERR_NONE on success.
+ */
+short str_patch_from_txtuni(struct STR_PatchItem **items,unsigned int *count,
+    struct TXT_File *txtfile,short flags)
+{
+  unsigned int k;
+  (*count)=0;
+  (*items)=str_malloc((txtfile->offs_count+1)*sizeof(struct STR_PatchItem));
+  if ((*items)==NULL)
+  {
+    if (flags&STRFLAG_VERBOSE)
+      str_error("Cannot allocate memory for patch items");
+    return -1;
+  }
+  for (k=0;k<txtfile->offs_count;k++)
+  {
+    long offs,data_len,i;
+    unsigned int index;
+    offs=txtfile->offsets[k];
+    data_len=txtuni_line_length(txtfile,k);
+    if ((offs<0)||(data_len<0))
+      continue;
+    const unsigned short *line=txtfile->data+offs;
+    if ((data_len==0)||(line[0]=='\r')||(line[0]=='\n'))
+      continue;
+    index=0;
+    for (i=0;i<data_len;i++)
+    {
+      if ((line[i]<'0')||(line[i]>'9')) break;
+      // Too high index stays too high, instead of overflowing
+      if (index<STR_MAX_ENTRY_INDEX)
+        index=(index*10)+(line[i]-'0');
+    }
+    if ((i==0)||(i>=data_len)||((line[i]!=' ')&&(line[i]!='\t')))
+    {
+      if (flags&STRFLAG_VERBOSE)
+        str_ferror("Bad entry index in line %d of patch file",k+1);
+      return -1;
+    }
+    if (index>=STR_MAX_ENTRY_INDEX)
+    {
+      if (flags&STRFLAG_VERBOSE)
+        str_ferror("Entry index in line %d of patch file is too high",k+1);
+      return -1;
+    }
+    i++;
+    (*items)[*count].index=index;
+    (*items)[*count].line=k;
+    (*items)[*count].udata=unicode_line_unescape(line+i,data_len-i);
+    if ((*items)[*count].udata==NULL)
+    {
+      if (flags&STRFLAG_VERBOSE)
+        str_ferror("Can't malloc unicode string for patch line %d",k+1);
+      return -1;
+    }
+    (*count)++;
+  }
+  // Sort by entry index; if an entry is patched twice, last line wins
+  qsort(*items,*count,sizeof(struct STR_PatchItem),str_patch_item_cmp);
+  unsigned int n=0;
+  for (k=0;k<(*count);k++)
+  {
+    if ((k+1<(*count))&&((*items)[k+1].index==(*items)[k].index))
+    {
+      str_free((*items)[k].udata);
+      continue;
+    }
+    (*items)[n]=(*items)[k];
+    n++;
+  }
+  (*count)=n;
+  return ERR_NONE;
+}
+
+/**
+ * Applies patch file to existing STR file.
+ * Only the patched entries are encoded; other entries are moved
+ * within the data block without decoding.
+ * @param fname The STR file name.
+ * @param patchfname Unicode text patch file name.
+ * @param flags Flags used to manage the behaviour of the function.
+ * @return Returns ERR_NONE on success.
+ */
+short str_patch(char *fname,char *patchfname,short flags)
+{
+  struct STR_Maker *mkstr;
+  struct TXT_File *txtfile;
+  struct STR_PatchItem *items;
+  unsigned int count,i;
+  FILE *fp;
+  short result;
+  mkstr=str_malloc(sizeof(struct STR_Maker));
+  txtfile=str_malloc(sizeof(struct TXT_File));
+  if ((mkstr==NULL)||(txtfile==NULL))
+  {
+    if (flags&STRFLAG_VERBOSE)
+      str_error("Cannot allocate memory for structures");
+    str_free(mkstr);
+    str_free(txtfile);
+    return -1;
+  }
+  strmaker_clear(mkstr);
+  txtuni_clear(txtfile);
+  // Read the patch
+  fp=fopen(patchfname,"rb");
+  if (fp==NULL)
+  {
+    if (flags&STRFLAG_VERBOSE)
+      str_ferror("%s when opening %s",strerror(errno),patchfname);
+    txtuni_free(txtfile);
+    strmaker_free(mkstr);
+    return -1;
+  }
+  result=txtuni_read(txtfile,fp,flags);
+  fclose(fp);
+  items=NULL;
+  count=0;
+  if (result==ERR_NONE)
+    result=str_patch_from_txtuni(&items,&count,txtfile,flags);
+  txtuni_free(txtfile);
+  // Read the STR file and codepage
+  if (result==ERR_NONE)
+  {
+    fp=fopen(fname,"rb");
+    if (fp!=NULL)
+    {
+      result=strmaker_fread(mkstr,fp,flags);
+      fclose(fp);
+    } else
+    {
+      if (flags&STRFLAG_VERBOSE)
+        str_ferror("%s when opening %s",strerror(errno),fname);
+      result=-1;
+    }
+  }
+  if (result==ERR_NONE)
+    result=str_mb2uni_load(mkstr,fname,flags);
+  // Encode the new entries
+  unsigned int *indices;
+  unsigned char **edata;
+  long *edata_len;
+  indices=str_malloc((count+1)*sizeof(unsigned int));
+  edata=str_malloc((count+1)*sizeof(unsigned char *));
+  edata_len=str_malloc((count+1)*sizeof(long));
+  if ((indices==NULL)||(edata==NULL)||(edata_len==NULL))
+  {
+    if ((result==ERR_NONE)&&(flags&STRFLAG_VERBOSE))
+      str_error("Cannot allocate memory for patch entries");
+    result=-1;
+  }
+  for (i=0;i<count;i++)
+  {
+    if (edata!=NULL)
+      edata[i]=NULL;
+    if (result!=ERR_NONE)
+      continue;
+    if (flags&STRFLAG_DEBUG)
+      printf("Encoding patched entry %d\n",items[i].index);
+    indices[i]=items[i].index;
+    result=str_data_encode_r(&edata[i],&edata_len[i],mkstr->mb2uni,mkstr->mb2uni_count,
+        items[i].udata,unicode_strlen(items[i].udata));
+    if ((result!=ERR_NONE)&&(flags&STRFLAG_VERBOSE))
+      str_ferror("%s when encoding patched entry %u",str_error_text(result),items[i].index);
+  }
+  // Rebuild the data block and write the file
+  if (result==ERR_NONE)
+    result=strmaker_replace_entries(mkstr,indices,edata,edata_len,count,flags);
+  if (result==ERR_NONE)
+  {
+    if (flags&STRFLAG_VERBOSE)
+      printf("Entries patched: %u\n",count);
+    char *tmpfname;
+    fp=str_fopen_temp(fname,&tmpfname,flags);
+    if (fp!=NULL)
+    {
+      result=strmaker_fwrite(mkstr,fp,flags);
+      result=str_fclose_temp(fp,tmpfname,fname,result,flags);
+    } else
+    {
+      result=-1;
+    }
+  }
+  for (i=0;i<count;i++)
+  {
+    str_free(items[i].udata);
+    if (edata!=NULL)
+      str_free(edata[i]);
+  }
+  str_free(items);
+  str_free(indices);
+  str_free(edata);
+  str_free(edata_len);
+  strmaker_free(mkstr);
+  return result;
+}
+
 /**
  * Writes the unicode text file from given STR_File.
  * As for now, it writes the file directly, without use of TXT_File.
  * @param strfile The STR_File struct pointer.
  * @param fname Destination file name.
  * @param flags Flags used to manage the behaviour of the function.
+ * @return Returns ERR_NONE on success, ERR_UNCHANGED if the existing
+ *     file already had the same content and wasn't rewritten.
  */
 short str_write_unicode(struct STR_File *strfile,char *fname,short flags)
 {
   if (strfile==NULL) return -1;
   // Open destination file
   FILE *fp;
-  fp=fopen(fname,"wb");
+  char *tmpfname;
+  short prev_phase;
+  short result;
+  prev_phase=stats_phase_enter(STAT_WRITE);
+  fp=str_fopen_temp(fname,&tmpfname,flags);
   if (fp==NULL)
   {
-    if (flags&STRFLAG_VERBOSE)
-      str_ferror("%s when opening %s",strerror(errno),fname);
+    stats_phase_leave(prev_phase);
     return -1;
   }
-  fwrite("\xff\xfe",1,2,fp); // This seems to be an Unicode identifier in Windows
-  int i,k;
-  char buf[16];
-  sprintf(buf,"%d\r\n",strfile->file_id);
-  i=0;
-  while (buf[i]!=0)
-  {
-      fputc(buf[i],fp);
-      fputc(0,fp);
-      i++;
-  }
+  unicode_fwrite_header(fp,strfile->file_id);
+  int k;
   for (k=0;k<strfile->str_count;k++)
-  {
-    i=0;
-    if (strfile->str[k]!=NULL)
-      while (strfile->str[k][i]!=0)
-      {
-          unsigned short chr=strfile->str[k][i];
-          // Support some special characters
-          switch (chr)
-          {
-          case (unsigned char)'\n':
-              fwrite("\\\0\n\0",1,4,fp);
-              break;
-          case (unsigned char)'\r':
-              fwrite("\\\0\r\0",1,4,fp);
-              break;
-          case (unsigned char)'\t':
-              fwrite("\\\0\t\0",1,4,fp);
-              break;
-          case (unsigned char)'\\': // Write "\" as "\\".
-              fwrite("\\\0\\\0",1,4,fp);
-              break;
-          default:
-              fwrite(&(chr),1,2,fp);
-              break;
-          }
-          i++;
-      }
-      fwrite("\r\0\n\0",1,4,fp);
-  }
-  fclose(fp);
-  return ERR_NONE;
+    unicode_fwrite_line(fp,strfile->str[k]);
+  result=str_fclose_temp(fp,tmpfname,fname,ERR_NONE,flags);
+  stats_phase_leave(prev_phase);
+  return result;
 }
 
 /**
@@ -515,6 +1272,12 @@ short str_write_unicode(struct STR_File *strfile,char *fname,short flags)
 short str_close(struct STR_File *strfile,short flags)
 {
   if (strfile==NULL) return -1;
+  if (strfile->pool!=NULL)
+  {
+    // Strings are inside the mapped cache file
+    file_unmap(strfile->pool,strfile->pool_len);
+    str_free(strfile->str);
+  } else
   if (strfile->str!=NULL)
   {
     int i;
@@ -522,12 +1285,12 @@ short str_close(struct STR_File *strfile,short flags)
     {
       if (strfile->str[i]!=NULL)
       {
-        free(strfile->str[i]);
+        str_free(strfile->str[i]);
       }
     }
-    free(strfile->str);
+    str_free(strfile->str);
   }
-  free(strfile);
+  str_free(strfile);
   return ERR_NONE;
 }
 
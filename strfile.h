@@ -26,13 +26,38 @@ struct STR_File {
     unsigned int alloc_count;// Allocated entries
     unsigned int str_count;  // Used entries
     unsigned short **str;    // String are stored in unicode
+    void *pool;              // Mapped text cache with the strings, or NULL
+    long pool_len;
     };
 
+struct STR_Maker;
+struct STR_EncCache;
+struct TXT_File;
+
 // Routines
 
+short str_clear(struct STR_File *strfile);
 struct STR_File *str_open(char *fname,short flags);
 struct STR_File *str_open_unicode(char *fname,short flags);
+short str_write(struct STR_File *strfile,char *fname,short flags);
+short str_write_prev(struct STR_File *strfile,char *fname,char *prev_fname,short flags);
+short str_write_cached(struct STR_File *strfile,char *fname,char *prev_fname,
+    struct STR_EncCache *cache,short flags);
+short str_update(struct STR_File *strfile,char *fname,short flags);
+int str_check(struct STR_File *strfile,char *fname,short stop_first,short flags);
+short str_patch(char *fname,char *patchfname,short flags);
+short str_write_unicode(struct STR_File *strfile,char *fname,short flags);
 short str_close(struct STR_File *strfile,short flags);
 
+FILE *str_fopen_temp(const char *fname,char **tmpfname,short flags);
+short str_fclose_temp(FILE *fp,char *tmpfname,const char *fname,short result,short flags);
+short str_mb2uni_load(struct STR_Maker *mkstr,const char *fname,short flags);
+short str_from_txtuni(struct STR_File *strfile,struct TXT_File *txtfile,short flags);
+short strfile_from_strmaker(struct STR_File *strfile,const struct STR_Maker *mkstr,short flags);
+unsigned int str_entries_to_encode(const struct STR_File *strfile);
+short strmaker_from_strfile(struct STR_Maker *mkstr,struct STR_File *strfile,
+    const struct STR_Maker *prev,unsigned int *reused,unsigned int *shared,short flags);
+int strmaker_check_strfile(const struct STR_Maker *mkstr,struct STR_File *strfile,short flags);
+
 
 #endif
@@ -0,0 +1,404 @@
+/******************************************************************************/
+/** @file strfile.hpp
+ * Library for r/w of DK2 STR text strings files.
+ * @par Purpose:
+ *     C++17 interface to the library. Header only.
+ * @par Comment:
+ *     Objects own the C structures and free them when destroyed; they
+ *     can be moved, but not copied. Accessors return views into the
+ *     data held by the C structures, so no texts nor entries are copied.
+ *     Views are valid as long as the object they came from isn't
+ *     modified or destroyed. Errors are reported with STR_Error, just
+ *     like in the C routines; nothing here throws.
+ * @par  Copying and copyrights:
+ *     This program is free software; you can redistribute it and/or modify
+ *     it under the terms of the GNU General Public License as published by
+ *     the Free Software Foundation; either version 2 of the License, or
+ *     (at your option) any later version.
+ */
+/******************************************************************************/
+
+#ifndef STRFILE_HPP
+#define STRFILE_HPP
+
+#include <cstdio>
+#include <cstddef>
+#include <iterator>
+#include <string_view>
+#include <utility>
+
+extern "C" {
+#include "unitext.h"
+#include "strfile.h"
+#include "strmaker.h"
+#include "strctx.h"
+#include "stralloc.h"
+}
+
+namespace dk2str {
+
+// Texts are stored as UTF-16 in unsigned short arrays
+static_assert(sizeof(char16_t)==sizeof(unsigned short),"UTF-16 unit size mismatch");
+
+inline std::u16string_view text_view(const unsigned short *str) noexcept
+{
+    if (str==nullptr)
+        return std::u16string_view();
+    return std::u16string_view(reinterpret_cast<const char16_t *>(str),
+        unicode_strlen(const_cast<unsigned short *>(str)));
+}
+
+/**
+ * View of encoded bytes; the same as std::span<const unsigned char>,
+ * which isn't available in C++17.
+ */
+class ByteSpan {
+public:
+    constexpr ByteSpan() noexcept : ptr(nullptr), len(0) {}
+    constexpr ByteSpan(const unsigned char *data,std::size_t size) noexcept : ptr(data), len(size) {}
+    constexpr const unsigned char *data() const noexcept { return ptr; }
+    constexpr std::size_t size() const noexcept { return len; }
+    constexpr bool empty() const noexcept { return len==0; }
+    constexpr const unsigned char *begin() const noexcept { return ptr; }
+    constexpr const unsigned char *end() const noexcept { return ptr+len; }
+    constexpr unsigned char operator[](std::size_t i) const noexcept { return ptr[i]; }
+private:
+    const unsigned char *ptr;
+    std::size_t len;
+};
+
+/**
+ * Random access iterator over entries of a container, giving what
+ * the container's entry() returns for every index.
+ */
+template <typename Container,typename Value>
+class EntryIterator {
+public:
+    using iterator_category = std::random_access_iterator_tag;
+    using value_type = Value;
+    using difference_type = std::ptrdiff_t;
+    using pointer = void;
+    using reference = Value;
+
+    EntryIterator() noexcept : cont(nullptr), idx(0) {}
+    EntryIterator(const Container *container,unsigned int index) noexcept : cont(container), idx(index) {}
+    Value operator*() const noexcept { return cont->entry(idx); }
+    Value operator[](difference_type n) const noexcept { return cont->entry(idx+n); }
+    unsigned int index() const noexcept { return idx; }
+    EntryIterator &operator++() noexcept { idx++; return *this; }
+    EntryIterator operator++(int) noexcept { EntryIterator it=*this; idx++; return it; }
+    EntryIterator &operator--() noexcept { idx--; return *this; }
+    EntryIterator operator--(int) noexcept { EntryIterator it=*this; idx--; return it; }
+    EntryIterator &operator+=(difference_type n) noexcept { idx+=n; return *this; }
+    EntryIterator &operator-=(difference_type n) noexcept { idx-=n; return *this; }
+    EntryIterator operator+(difference_type n) const noexcept { return EntryIterator(cont,idx+n); }
+    EntryIterator operator-(difference_type n) const noexcept { return EntryIterator(cont,idx-n); }
+    difference_type operator-(const EntryIterator &it) const noexcept { return (difference_type)idx-(difference_type)it.idx; }
+    bool operator==(const EntryIterator &it) const noexcept { return idx==it.idx; }
+    bool operator!=(const EntryIterator &it) const noexcept { return idx!=it.idx; }
+    bool operator<(const EntryIterator &it) const noexcept { return idx<it.idx; }
+    bool operator>(const EntryIterator &it) const noexcept { return idx>it.idx; }
+    bool operator<=(const EntryIterator &it) const noexcept { return idx<=it.idx; }
+    bool operator>=(const EntryIterator &it) const noexcept { return idx>=it.idx; }
+private:
+    const Container *cont;
+    unsigned int idx;
+};
+
+/**
+ * Text allocated by the library, like a decoded entry.
+ */
+class Text {
+public:
+    Text() noexcept : str(nullptr), len(0) {}
+    Text(unsigned short *text,long text_len) noexcept : str(text), len(text_len) {}
+    Text(Text &&other) noexcept : str(std::exchange(other.str,nullptr)), len(std::exchange(other.len,0)) {}
+    Text &operator=(Text &&other) noexcept
+    {
+        if (this!=&other)
+        {
+            str_free(str);
+            str=std::exchange(other.str,nullptr);
+            len=std::exchange(other.len,0);
+        }
+        return *this;
+    }
+    Text(const Text &)=delete;
+    Text &operator=(const Text &)=delete;
+    ~Text() { str_free(str); }
+
+    explicit operator bool() const noexcept { return str!=nullptr; }
+    std::u16string_view view() const noexcept
+    {
+        return std::u16string_view(reinterpret_cast<const char16_t *>(str),(str!=nullptr)?len:0);
+    }
+    const unsigned short *c_str() const noexcept { return str; }
+    /** Gives up ownership; the text must be freed with str_free(). */
+    unsigned short *release() noexcept { len=0; return std::exchange(str,nullptr); }
+private:
+    unsigned short *str;
+    long len;
+};
+
+/**
+ * Encoded data allocated by the library, like an encoded entry.
+ */
+class Bytes {
+public:
+    Bytes() noexcept : ptr(nullptr), len(0) {}
+    Bytes(unsigned char *data,long data_len) noexcept : ptr(data), len(data_len) {}
+    Bytes(Bytes &&other) noexcept : ptr(std::exchange(other.ptr,nullptr)), len(std::exchange(other.len,0)) {}
+    Bytes &operator=(Bytes &&other) noexcept
+    {
+        if (this!=&other)
+        {
+            str_free(ptr);
+            ptr=std::exchange(other.ptr,nullptr);
+            len=std::exchange(other.len,0);
+        }
+        return *this;
+    }
+    Bytes(const Bytes &)=delete;
+    Bytes &operator=(const Bytes &)=delete;
+    ~Bytes() { str_free(ptr); }
+
+    explicit operator bool() const noexcept { return ptr!=nullptr; }
+    ByteSpan span() const noexcept { return ByteSpan(ptr,(ptr!=nullptr)?len:0); }
+private:
+    unsigned char *ptr;
+    long len;
+};
+
+/**
+ * Shared codepage, with conversion context using it. Contexts are
+ * only read by the conversion routines, so one Codepage can be used
+ * by many threads at once.
+ */
+class Codepage {
+public:
+    Codepage() noexcept : cp(nullptr) { ctx.codepage=nullptr; ctx.flags=0; }
+    Codepage(Codepage &&other) noexcept : cp(std::exchange(other.cp,nullptr)), ctx(other.ctx) {}
+    Codepage &operator=(Codepage &&other) noexcept
+    {
+        if (this!=&other)
+        {
+            str_codepage_free(cp);
+            cp=std::exchange(other.cp,nullptr);
+            ctx=other.ctx;
+        }
+        return *this;
+    }
+    Codepage(const Codepage &)=delete;
+    Codepage &operator=(const Codepage &)=delete;
+    ~Codepage() { str_codepage_free(cp); }
+
+    /**
+     * Loads MBToUni.dat which lies in the same folder as given file.
+     * @param flags Conversion flags, like STRFLAG_DEDUP.
+     */
+    static Codepage load(const char *fname,short flags=0,STR_Error *err=nullptr) noexcept
+    {
+        Codepage page;
+        page.cp=str_codepage_load(fname,err);
+        if (page.cp!=nullptr)
+            strctx_init(&page.ctx,page.cp,flags);
+        return page;
+    }
+
+    explicit operator bool() const noexcept { return cp!=nullptr; }
+    const STR_Context *context() const noexcept { return &ctx; }
+    const STR_Codepage *get() const noexcept { return cp; }
+
+    Text decode(ByteSpan edata,STR_Error *err=nullptr) const noexcept
+    {
+        unsigned short *udata=nullptr;
+        long udata_len=0;
+        if (strctx_decode_entry(&ctx,&udata,&udata_len,edata.data(),edata.size(),err)!=ERR_NONE)
+        {
+            str_free(udata);
+            return Text();
+        }
+        return Text(udata,udata_len);
+    }
+
+    Bytes encode(std::u16string_view text,STR_Error *err=nullptr) const noexcept
+    {
+        unsigned char *edata=nullptr;
+        long edata_len=0;
+        if (strctx_encode_entry(&ctx,&edata,&edata_len,
+            reinterpret_cast<const unsigned short *>(text.data()),text.size(),err)!=ERR_NONE)
+        {
+            str_free(edata);
+            return Bytes();
+        }
+        return Bytes(edata,edata_len);
+    }
+private:
+    STR_Codepage *cp;
+    STR_Context ctx;
+};
+
+/**
+ * STR file entries, decoded into Unicode; owns STR_File.
+ */
+class StrFile {
+public:
+    using const_iterator = EntryIterator<StrFile,std::u16string_view>;
+
+    StrFile() noexcept : file(nullptr) {}
+    /** Takes ownership of the STR_File, which must be freed by str_close(). */
+    explicit StrFile(STR_File *strfile) noexcept : file(strfile) {}
+    StrFile(StrFile &&other) noexcept : file(std::exchange(other.file,nullptr)) {}
+    StrFile &operator=(StrFile &&other) noexcept
+    {
+        if (this!=&other)
+            reset(std::exchange(other.file,nullptr));
+        return *this;
+    }
+    StrFile(const StrFile &)=delete;
+    StrFile &operator=(const StrFile &)=delete;
+    ~StrFile() { reset(nullptr); }
+
+    static StrFile read_str(const Codepage &cp,const char *fname,STR_Error *err=nullptr) noexcept
+    {
+        return StrFile(strctx_read_str(cp.context(),fname,err));
+    }
+
+    static StrFile read_text(const Codepage &cp,const char *fname,STR_Error *err=nullptr) noexcept
+    {
+        return StrFile(strctx_read_text(cp.context(),fname,err));
+    }
+
+    /** @return Returns ERR_NONE, ERR_UNCHANGED, or negative error code. */
+    short write_str(const Codepage &cp,const char *fname,STR_Error *err=nullptr) const noexcept
+    {
+        return strctx_write_str(cp.context(),file,fname,err);
+    }
+
+    short write_text(const Codepage &cp,const char *fname,STR_Error *err=nullptr) const noexcept
+    {
+        return strctx_write_text(cp.context(),file,fname,err);
+    }
+
+    explicit operator bool() const noexcept { return file!=nullptr; }
+    STR_File *get() const noexcept { return file; }
+    /** Gives up ownership; the STR_File must be freed with str_close(). */
+    STR_File *release() noexcept { return std::exchange(file,nullptr); }
+    void reset(STR_File *strfile) noexcept
+    {
+        if (file!=nullptr)
+            str_close(file,0);
+        file=strfile;
+    }
+
+    unsigned int file_id() const noexcept { return (file!=nullptr)?file->file_id:0; }
+    std::size_t size() const noexcept { return (file!=nullptr)?file->str_count:0; }
+    bool empty() const noexcept { return size()==0; }
+    std::u16string_view entry(unsigned int index) const noexcept
+    {
+        if (index>=size())
+            return std::u16string_view();
+        return text_view(file->str[index]);
+    }
+    std::u16string_view operator[](unsigned int index) const noexcept { return entry(index); }
+    const_iterator begin() const noexcept { return const_iterator(this,0); }
+    const_iterator end() const noexcept { return const_iterator(this,size()); }
+private:
+    STR_File *file;
+};
+
+/**
+ * STR file in encoded form; owns STR_Maker.
+ */
+class StrMaker {
+public:
+    using const_iterator = EntryIterator<StrMaker,ByteSpan>;
+
+    StrMaker() noexcept : maker(nullptr), shared_cp(false) {}
+    /**
+     * Takes ownership of the STR_Maker.
+     * @param shared_codepage If true, the codepage isn't owned by the maker,
+     *     and is detached before the maker is freed.
+     */
+    StrMaker(STR_Maker *mkstr,bool shared_codepage) noexcept : maker(mkstr), shared_cp(shared_codepage) {}
+    StrMaker(StrMaker &&other) noexcept : maker(std::exchange(other.maker,nullptr)), shared_cp(other.shared_cp) {}
+    StrMaker &operator=(StrMaker &&other) noexcept
+    {
+        if (this!=&other)
+        {
+            reset(std::exchange(other.maker,nullptr),other.shared_cp);
+        }
+        return *this;
+    }
+    StrMaker(const StrMaker &)=delete;
+    StrMaker &operator=(const StrMaker &)=delete;
+    ~StrMaker() { reset(nullptr,false); }
+
+    /** Reads STR file, which will use the given codepage for decoding. */
+    static StrMaker open(const Codepage &cp,const char *fname,STR_Error *err=nullptr) noexcept
+    {
+        return StrMaker(strctx_open_maker(cp.context(),fname,err),true);
+    }
+
+    explicit operator bool() const noexcept { return maker!=nullptr; }
+    STR_Maker *get() const noexcept { return maker; }
+    void reset(STR_Maker *mkstr,bool shared_codepage) noexcept
+    {
+        if (maker!=nullptr)
+        {
+            if (shared_cp)
+                strctx_close_maker(maker);
+            else
+                strmaker_free(maker);
+        }
+        maker=mkstr;
+        shared_cp=shared_codepage;
+    }
+
+    unsigned int file_id() const noexcept { return (maker!=nullptr)?maker->file_id:0; }
+    std::size_t size() const noexcept { return (maker!=nullptr)?maker->offs_count:0; }
+    bool empty() const noexcept { return size()==0; }
+    /** Returns the whole data block, which all entries point into. */
+    ByteSpan data() const noexcept
+    {
+        if (maker==nullptr)
+            return ByteSpan();
+        return ByteSpan(maker->data,maker->data_len);
+    }
+    /** Returns encoded entry; entries may share data. */
+    ByteSpan entry(unsigned int index) const noexcept
+    {
+        char *edata;
+        int len;
+        if (maker==nullptr)
+            return ByteSpan();
+        len=strmaker_get_entry(maker,&edata,index,0);
+        if ((edata==nullptr)||(len<=0))
+            return ByteSpan();
+        return ByteSpan(reinterpret_cast<const unsigned char *>(edata),len);
+    }
+    ByteSpan operator[](unsigned int index) const noexcept { return entry(index); }
+    /** Decodes entry into new text; returns empty Text on error. */
+    Text decode(unsigned int index) const noexcept
+    {
+        unsigned short *udata=nullptr;
+        long len=0;
+        if (maker==nullptr)
+            return Text();
+        if (strmaker_decode_entry(maker,&udata,&len,index,0)!=ERR_NONE)
+        {
+            str_free(udata);
+            return Text();
+        }
+        return Text(udata,len);
+    }
+    const_iterator begin() const noexcept { return const_iterator(this,0); }
+    const_iterator end() const noexcept { return const_iterator(this,size()); }
+private:
+    STR_Maker *maker;
+    bool shared_cp;
+};
+
+} // namespace dk2str
+
+#endif
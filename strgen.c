@@ -0,0 +1,425 @@
+/******************************************************************************/
+/** @file strgen.c
+ * Library for r/w of DK2 STR text strings files.
+ * @par Purpose:
+ *     Generator of random STR and TXT files, for tests and benchmarks.
+ * @par Comment:
+ *     Texts depend only on the parameters and entry index, so the same
+ *     files are generated every time, and any entry can be re-created
+ *     without keeping the previous ones in memory.
+ * @par  Copying and copyrights:
+ *     This program is free software; you can redistribute it and/or modify
+ *     it under the terms of the GNU General Public License as published by
+ *     the Free Software Foundation; either version 2 of the License, or
+ *     (at your option) any later version.
+ */
+/******************************************************************************/
+
+#include "strgen.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include "lbfileio.h"
+#include "unitext.h"
+#include "strfile.h"
+#include "strmaker.h"
+#include "stralloc.h"
+
+/**
+ * Fills generator parameters with default values.
+ */
+void strgen_defaults(struct STR_GenParams *gp)
+{
+  memset(gp,0,sizeof(struct STR_GenParams));
+  gp->entries=1000;
+  gp->file_id=1;
+  gp->min_len=8;
+  gp->max_len=300;
+  gp->length_dist=STRGEN_DIST_SHORT;
+  gp->param_pct=10;
+  gp->escape_pct=0;
+  gp->extend_cp=0;
+  gp->dup_pct=5;
+  gp->seed=1;
+}
+
+/**
+ * Gives next pseudo-random number from the state.
+ */
+unsigned long long strgen_random(unsigned long long *state)
+{
+  unsigned long long z;
+  (*state)+=0x9e3779b97f4a7c15ULL;
+  z=(*state);
+  z=(z^(z>>30))*0xbf58476d1ce4e5b9ULL;
+  z=(z^(z>>27))*0x94d049bb133111ebULL;
+  return z^(z>>31);
+}
+
+/**
+ * Adds characters to the codepage, so that it has characters which
+ * need 0xff escape when encoded. Existing characters are not changed,
+ * so texts encoded with the previous codepage decode the same way.
+ * @param count The new amount of characters.
+ * @return Returns ERR_NONE on success.
+ */
+short strgen_extend_codepage(struct STR_Maker *mkstr,long count)
+{
+  unsigned short *mb2uni;
+  long i;
+  if (mkstr->mb2uni_count>=count)
+    return ERR_NONE;
+  mb2uni=str_realloc(mkstr->mb2uni,count*sizeof(unsigned short));
+  if (mb2uni==NULL)
+    return -1;
+  // New characters are taken from CJK range, not used by DK2 codepages
+  for (i=mkstr->mb2uni_count;i<count;i++)
+    mb2uni[i]=0x4e00+i;
+  mb2uni[0]=count-1;
+  mkstr->mb2uni=mb2uni;
+  mkstr->mb2uni_count=count;
+  return ERR_NONE;
+}
+
+/**
+ * Prepares the generator. Characters for texts are chosen from
+ * the given codepage.
+ * @return Returns ERR_NONE on success.
+ */
+short strgen_init(struct STR_Generator *gen,const struct STR_GenParams *gp,
+    const unsigned short *mb2uni,long mb2uni_count)
+{
+  long i;
+  memset(gen,0,sizeof(struct STR_Generator));
+  memcpy(&gen->params,gp,sizeof(struct STR_GenParams));
+  if (gen->params.max_len<gen->params.min_len)
+    gen->params.max_len=gen->params.min_len;
+  gen->plain=str_malloc((mb2uni_count+1)*sizeof(unsigned short));
+  gen->escaped=str_malloc((mb2uni_count+1)*sizeof(unsigned short));
+  if ((gen->plain==NULL)||(gen->escaped==NULL))
+  {
+    strgen_free(gen);
+    return -1;
+  }
+  // Index 0 is not a character; skip also the ones which need escaping in text
+  for (i=1;i<mb2uni_count;i++)
+  {
+    unsigned short chr=mb2uni[i];
+    if ((chr<' ')||(chr=='%')||(chr=='\\')||(str_codepage_index(mb2uni,mb2uni_count,chr)!=i))
+      continue;
+    if (i<255)
+      gen->plain[gen->plain_count++]=chr;
+    else
+      gen->escaped[gen->escaped_count++]=chr;
+  }
+  if (gen->plain_count<1)
+  {
+    strgen_free(gen);
+    return -1;
+  }
+  return ERR_NONE;
+}
+
+void strgen_free(struct STR_Generator *gen)
+{
+  str_free(gen->plain);
+  str_free(gen->escaped);
+  gen->plain=NULL;
+  gen->escaped=NULL;
+  gen->plain_count=0;
+  gen->escaped_count=0;
+}
+
+/**
+ * Generates text of entry with given index. Parameters are written
+ * as "%N", like in texts decoded from STR files.
+ * @param text Output buffer.
+ * @param text_size Size of the output buffer, in characters.
+ * @return Returns length of the text.
+ */
+long strgen_entry_text(const struct STR_Generator *gen,unsigned long index,
+    unsigned short *text,long text_size)
+{
+  const struct STR_GenParams *gp=&gen->params;
+  unsigned long long state;
+  unsigned long range,len,n,params;
+  // Duplicates repeat text of a random earlier entry
+  while (1)
+  {
+    state=gp->seed^((unsigned long long)index*0xd1b54a32d192ed03ULL);
+    if ((index==0)||(strgen_random(&state)%100>=gp->dup_pct))
+      break;
+    index=strgen_random(&state)%index;
+  }
+  range=gp->max_len-gp->min_len+1;
+  if (gp->length_dist==STRGEN_DIST_SHORT)
+    len=gp->min_len+(strgen_random(&state)%range)*(strgen_random(&state)%range)/range;
+  else
+    len=gp->min_len+strgen_random(&state)%range;
+  params=0;
+  if (strgen_random(&state)%100<gp->param_pct)
+    params=1+strgen_random(&state)%3;
+  n=0;
+  while ((n<len)&&(n+4<text_size))
+  {
+    unsigned long word_len=1+strgen_random(&state)%10;
+    if ((n>0)&&(n+5<text_size))
+      text[n++]=' ';
+    if ((params>0)&&(strgen_random(&state)%4==0))
+    {
+      text[n++]='%';
+      text[n++]='1'+strgen_random(&state)%9;
+      params--;
+      continue;
+    }
+    while ((word_len>0)&&(n<len)&&(n+4<text_size))
+    {
+      if ((gen->escaped_count>0)&&(strgen_random(&state)%100<gp->escape_pct))
+        text[n++]=gen->escaped[strgen_random(&state)%gen->escaped_count];
+      else
+        text[n++]=gen->plain[strgen_random(&state)%gen->plain_count];
+      word_len--;
+    }
+  }
+  while ((params>0)&&(n+4<text_size))
+  {
+    text[n++]=' ';
+    text[n++]='%';
+    text[n++]='1'+strgen_random(&state)%9;
+    params--;
+  }
+  text[n]=0;
+  return n;
+}
+
+/**
+ * Writes codepage file, used when the codepage was extended.
+ * @return Returns ERR_NONE, ERR_UNCHANGED or negative error code.
+ */
+short strgen_write_codepage(struct STR_Maker *mkstr,const char *strfname,short flags)
+{
+  char *cpfname;
+  char *tmpfname;
+  FILE *fp;
+  long i;
+  int path_len=filename_from_path(strfname)-strfname;
+  cpfname=str_malloc(path_len+16);
+  if (cpfname==NULL)
+    return -1;
+  memcpy(cpfname,strfname,path_len);
+  strcpy(cpfname+path_len,"MBToUni.dat");
+  fp=str_fopen_temp(cpfname,&tmpfname,flags);
+  if (fp==NULL)
+  {
+    str_free(cpfname);
+    return -1;
+  }
+  fwrite("BFMU",1,4,fp);
+  write_int16_le_file(fp,0);
+  for (i=0;i<mkstr->mb2uni_count;i++)
+    write_int16_le_file(fp,mkstr->mb2uni[i]);
+  i=str_fclose_temp(fp,tmpfname,cpfname,ERR_NONE,flags);
+  if ((i==ERR_NONE)&&(flags&STRFLAG_VERBOSE))
+    printf("Codepage %s extended to %ld characters.\n",cpfname,(long)mkstr->mb2uni_count);
+  str_free(cpfname);
+  return i;
+}
+
+/**
+ * Prepares codepage in folder of the generated files. If characters
+ * needing escape are requested, but the codepage doesn't have them,
+ * the codepage file is extended - but only if it's allowed by the
+ * parameters, as it replaces the existing file.
+ * @param strfname Destination STR file name.
+ * @param gp Generator parameters.
+ * @param flags Flags used to manage the behaviour of the function.
+ * @return Returns ERR_NONE if the codepage was written, ERR_UNCHANGED
+ *     if it already was suitable, or negative error code.
+ */
+short str_generate_codepage(const char *strfname,const struct STR_GenParams *gp,short flags)
+{
+  struct STR_Maker *mkstr;
+  short result;
+  mkstr=str_malloc(sizeof(struct STR_Maker));
+  if (mkstr==NULL)
+    return -1;
+  strmaker_clear(mkstr);
+  if (str_mb2uni_load(mkstr,strfname,flags)!=ERR_NONE)
+  {
+    strmaker_free(mkstr);
+    return -1;
+  }
+  result=ERR_UNCHANGED;
+  if ((gp->escape_pct>0)&&(mkstr->mb2uni_count<=255))
+  {
+    if (!gp->extend_cp)
+    {
+      if (flags&STRFLAG_VERBOSE)
+        str_error("Codepage has no characters needing escape; use --extend-codepage to add them");
+      result=-1;
+    } else
+    if (strgen_extend_codepage(mkstr,STRGEN_EXTENDED_CP_COUNT)!=ERR_NONE)
+    {
+      if (flags&STRFLAG_VERBOSE)
+        str_error("Cannot extend the codepage");
+      result=-1;
+    } else
+    {
+      result=strgen_write_codepage(mkstr,strfname,flags);
+    }
+  }
+  strmaker_free(mkstr);
+  return result;
+}
+
+/**
+ * Generates STR file and matching TXT file. Entries are encoded and
+ * written one by one, so the files may be much larger than memory.
+ * If characters needing escape are requested, the codepage in the folder
+ * must have them - see str_generate_codepage().
+ * @param strfname Destination STR file name.
+ * @param txtfname Destination TXT file name.
+ * @param gp Generator parameters.
+ * @param flags Flags used to manage the behaviour of the function.
+ * @return Returns ERR_NONE on success.
+ */
+short str_generate(char *strfname,char *txtfname,const struct STR_GenParams *gp,short flags)
+{
+  struct STR_Maker *mkstr;
+  struct STR_Generator gen;
+  unsigned long *offsets;
+  unsigned short *text;
+  long text_size;
+  unsigned long i,data_pos;
+  char *str_tmpfname;
+  char *txt_tmpfname;
+  FILE *strfp;
+  FILE *txtfp;
+  short result;
+  mkstr=str_malloc(sizeof(struct STR_Maker));
+  if (mkstr==NULL)
+    return -1;
+  strmaker_clear(mkstr);
+  if (str_mb2uni_load(mkstr,strfname,flags)!=ERR_NONE)
+  {
+    strmaker_free(mkstr);
+    return -1;
+  }
+  if ((gp->escape_pct>0)&&(mkstr->mb2uni_count<=255))
+  {
+    if (flags&STRFLAG_VERBOSE)
+      str_error("Codepage has no characters needing escape");
+    strmaker_free(mkstr);
+    return -1;
+  }
+  if (strgen_init(&gen,gp,mkstr->mb2uni,mkstr->mb2uni_count)!=ERR_NONE)
+  {
+    if (flags&STRFLAG_VERBOSE)
+      str_error("Codepage has no characters to generate texts");
+    strmaker_free(mkstr);
+    return -1;
+  }
+  text_size=gen.params.max_len+16;
+  text=str_malloc(text_size*sizeof(unsigned short));
+  offsets=str_malloc((gp->entries+1)*sizeof(unsigned long));
+  if ((text==NULL)||(offsets==NULL))
+  {
+    if (flags&STRFLAG_VERBOSE)
+      str_error("Cannot allocate memory for generator");
+    str_free(text);
+    str_free(offsets);
+    strgen_free(&gen);
+    strmaker_free(mkstr);
+    return -1;
+  }
+  strfp=str_fopen_temp(strfname,&str_tmpfname,flags);
+  txtfp=NULL;
+  if (strfp!=NULL)
+    txtfp=str_fopen_temp(txtfname,&txt_tmpfname,flags);
+  if (txtfp==NULL)
+  {
+    if (strfp!=NULL)
+      str_fclose_temp(strfp,str_tmpfname,strfname,-1,flags);
+    str_free(text);
+    str_free(offsets);
+    strgen_free(&gen);
+    strmaker_free(mkstr);
+    return -1;
+  }
+  // Offsets table is written after all entries
+  fwrite("BFST",1,4,strfp);
+  write_int32_le_file(strfp,gp->file_id);
+  write_int32_le_file(strfp,gp->entries);
+  for (i=0;i<gp->entries;i++)
+    write_int32_le_file(strfp,0);
+  unicode_fwrite_header(txtfp,gp->file_id);
+  result=ERR_NONE;
+  data_pos=0;
+  for (i=0;i<gp->entries;i++)
+  {
+    unsigned char *edata;
+    long edata_len,len;
+    len=strgen_entry_text(&gen,i,text,text_size);
+    unicode_fwrite_line(txtfp,text);
+    result=str_data_encode_r(&edata,&edata_len,mkstr->mb2uni,mkstr->mb2uni_count,text,len);
+    if (result!=ERR_NONE)
+    {
+      if (flags&STRFLAG_VERBOSE)
+        str_ferror("%s when encoding entry %lu",str_error_text(result),i);
+      break;
+    }
+    offsets[i]=data_pos;
+    fwrite(edata,1,edata_len,strfp);
+    data_pos+=edata_len;
+    while ((data_pos%4)!=0)
+    {
+      fputc(0,strfp);
+      data_pos++;
+    }
+    str_free(edata);
+    // Offsets in STR file are 32-bit
+    if (data_pos+(gp->entries<<2)>0x7fffffffUL)
+    {
+      if (flags&STRFLAG_VERBOSE)
+        str_error("Generated data exceeds maximal STR file size");
+      result=-1;
+      break;
+    }
+    if ((flags&STRFLAG_VERBOSE)&&(((i+1)%1000000)==0))
+      printf("Entries generated: %lu\n",i+1);
+  }
+  if (result==ERR_NONE)
+  {
+    if (fseek(strfp,SIZEOF_STR_Header,SEEK_SET)!=0)
+      result=-1;
+    for (i=0;(result==ERR_NONE)&&(i<gp->entries);i++)
+      write_int32_le_file(strfp,offsets[i]+(gp->entries<<2));
+    if (ferror(strfp)||ferror(txtfp))
+    {
+      if (flags&STRFLAG_VERBOSE)
+        str_ferror("%s when writing generated files",strerror(errno));
+      result=-1;
+    }
+  }
+  if ((result==ERR_NONE)&&(flags&STRFLAG_VERBOSE))
+    printf("Generated %lu entries, %lu bytes of STR data.\n",gp->entries,data_pos);
+  short str_result,txt_result;
+  str_result=str_fclose_temp(strfp,str_tmpfname,strfname,result,flags);
+  if (str_result<ERR_NONE)
+    result=str_result;
+  txt_result=str_fclose_temp(txtfp,txt_tmpfname,txtfname,result,flags);
+  if ((str_result<ERR_NONE)||(txt_result<ERR_NONE))
+    result=-1;
+  else
+  if ((str_result==ERR_UNCHANGED)&&(txt_result==ERR_UNCHANGED))
+    result=ERR_UNCHANGED;
+  else
+    result=ERR_NONE;
+  str_free(text);
+  str_free(offsets);
+  strgen_free(&gen);
+  strmaker_free(mkstr);
+  return result;
+}
@@ -0,0 +1,64 @@
+/******************************************************************************/
+/** @file strgen.h
+ * Library for r/w of DK2 STR text strings files.
+ * @par Purpose:
+ *     Header file. Defines exported routines from strgen.c.
+ * @par Comment:
+ *     None.
+ * @par  Copying and copyrights:
+ *     This program is free software; you can redistribute it and/or modify
+ *     it under the terms of the GNU General Public License as published by
+ *     the Free Software Foundation; either version 2 of the License, or
+ *     (at your option) any later version.
+ */
+/******************************************************************************/
+
+#ifndef STRGEN_H
+#define STRGEN_H
+
+#include <stdio.h>
+
+enum STR_GenLengthDist {
+        STRGEN_DIST_UNIFORM      = 0x00, // Every length is equally common
+        STRGEN_DIST_SHORT        = 0x01, // Short texts are more common
+    };
+
+// Amount of characters in codepage extended for escaped characters
+#define STRGEN_EXTENDED_CP_COUNT 510
+
+struct STR_GenParams {
+    unsigned long entries;   // Amount of entries to generate
+    unsigned int file_id;
+    unsigned int min_len;    // Text length range, in characters
+    unsigned int max_len;
+    short length_dist;       // One of STR_GenLengthDist values
+    unsigned int param_pct;  // Percent of entries with parameters
+    unsigned int escape_pct; // Percent of characters needing 0xff escape
+    short extend_cp;         // Whether codepage file may be extended for escapes
+    unsigned int dup_pct;    // Percent of entries repeating earlier entry
+    unsigned long seed;
+    };
+
+struct STR_Generator {
+    struct STR_GenParams params;
+    unsigned short *plain;   // Characters encoded in one byte
+    long plain_count;
+    unsigned short *escaped; // Characters which need 0xff escape
+    long escaped_count;
+    };
+
+struct STR_Maker;
+
+// Routines
+
+void strgen_defaults(struct STR_GenParams *gp);
+short strgen_extend_codepage(struct STR_Maker *mkstr,long count);
+short strgen_init(struct STR_Generator *gen,const struct STR_GenParams *gp,
+    const unsigned short *mb2uni,long mb2uni_count);
+void strgen_free(struct STR_Generator *gen);
+long strgen_entry_text(const struct STR_Generator *gen,unsigned long index,
+    unsigned short *text,long text_size);
+short str_generate_codepage(const char *strfname,const struct STR_GenParams *gp,short flags);
+short str_generate(char *strfname,char *txtfname,const struct STR_GenParams *gp,short flags);
+
+#endif
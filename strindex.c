@@ -0,0 +1,745 @@
+/******************************************************************************/
+/** @file strindex.c
+ * Library for r/w of DK2 STR text strings files.
+ * @par Purpose:
+ *     Trigram index for fast searching of texts in many STR files.
+ * @par Comment:
+ *     Texts are indexed after decoding, with letter case ignored.
+ *     Query results are verified by decoding the candidate entries.
+ * @par  Copying and copyrights:
+ *     This program is free software; you can redistribute it and/or modify
+ *     it under the terms of the GNU General Public License as published by
+ *     the Free Software Foundation; either version 2 of the License, or
+ *     (at your option) any later version.
+ */
+/******************************************************************************/
+
+#include "strindex.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <dirent.h>
+#include "lbfileio.h"
+#include "unitext.h"
+#include "strfile.h"
+#include "strmaker.h"
+#include "strbatch.h"
+#include "stralloc.h"
+
+const char idx_magic[]="BFIX";
+#define IDX_VERSION 2
+
+struct IDX_Record {
+    unsigned long long key;
+    unsigned int file;
+    unsigned int entry;
+    };
+
+struct IDX_File {
+    char *name;
+    long size;
+    long mtime;
+    unsigned int entries;
+    int old_index;           // Index of the file in previous index, or -1
+    };
+
+struct IDX_Builder {
+    unsigned long records_alloc;
+    unsigned long records_count;
+    struct IDX_Record *records;
+    unsigned int files_alloc;
+    unsigned int files_count;
+    struct IDX_File *files;
+    unsigned long long cp_hash;
+    };
+
+/**
+ * Folds letter case of unicode character, for case-insensitive matching.
+ * Only Latin characters are folded.
+ */
+unsigned short index_fold_char(unsigned short chr)
+{
+  if ((chr>='A')&&(chr<='Z'))
+    return chr+('a'-'A');
+  if ((chr>=0xc0)&&(chr<=0xde)&&(chr!=0xd7))
+    return chr+0x20;
+  if ((chr>=0x100)&&(chr<0x180)&&((chr&1)==0))
+    return chr+1;
+  return chr;
+}
+
+unsigned long long index_trigram_key(const unsigned short *str)
+{
+  return ((unsigned long long)index_fold_char(str[0])<<32) +
+      ((unsigned long long)index_fold_char(str[1])<<16) +
+      (unsigned long long)index_fold_char(str[2]);
+}
+
+/**
+ * Checks if folded phrase occurs in given text.
+ * @return Returns 1 if the phrase was found.
+ */
+short index_text_contains(const unsigned short *text,const unsigned short *phrase)
+{
+  long i,k;
+  for (i=0;text[i]!=0;i++)
+  {
+    for (k=0;phrase[k]!=0;k++)
+    {
+      if (text[i+k]==0)
+        return 0;
+      if (index_fold_char(text[i+k])!=index_fold_char(phrase[k]))
+        break;
+    }
+    if (phrase[k]==0)
+      return 1;
+  }
+  return 0;
+}
+
+static int idx_record_cmp(const void *ptr1,const void *ptr2)
+{
+  const struct IDX_Record *rec1=ptr1;
+  const struct IDX_Record *rec2=ptr2;
+  if (rec1->key!=rec2->key)
+    return (rec1->key<rec2->key)?-1:1;
+  if (rec1->file!=rec2->file)
+    return (rec1->file<rec2->file)?-1:1;
+  if (rec1->entry!=rec2->entry)
+    return (rec1->entry<rec2->entry)?-1:1;
+  return 0;
+}
+
+short index_add_record(struct IDX_Builder *bld,unsigned long long key,
+    unsigned int file,unsigned int entry)
+{
+  if (bld->records_count+1>bld->records_alloc)
+  {
+    unsigned long new_alloc=bld->records_alloc*2+1024;
+    struct IDX_Record *records;
+    records=str_realloc(bld->records,new_alloc*sizeof(struct IDX_Record));
+    if (records==NULL)
+      return -1;
+    bld->records=records;
+    bld->records_alloc=new_alloc;
+  }
+  bld->records[bld->records_count].key=key;
+  bld->records[bld->records_count].file=file;
+  bld->records[bld->records_count].entry=entry;
+  bld->records_count++;
+  return ERR_NONE;
+}
+
+struct IDX_File *index_add_file(struct IDX_Builder *bld,const char *name)
+{
+  struct IDX_File *file;
+  if (bld->files_count+1>bld->files_alloc)
+  {
+    file=str_realloc(bld->files,(bld->files_alloc+32)*sizeof(struct IDX_File));
+    if (file==NULL)
+      return NULL;
+    bld->files=file;
+    bld->files_alloc+=32;
+  }
+  file=&bld->files[bld->files_count];
+  memset(file,0,sizeof(struct IDX_File));
+  file->old_index=-1;
+  file->name=str_malloc(strlen(name)+1);
+  if (file->name==NULL)
+    return NULL;
+  strcpy(file->name,name);
+  bld->files_count++;
+  return file;
+}
+
+/**
+ * Decodes all entries of STR file and adds their trigrams to the index.
+ */
+short index_add_strfile(struct IDX_Builder *bld,unsigned int file_idx,
+    char *fname,short flags)
+{
+  struct STR_File *strfile;
+  unsigned int i;
+  long k,len;
+  strfile=str_open(fname,flags);
+  if (strfile==NULL)
+    return -1;
+  for (i=0;i<strfile->str_count;i++)
+  {
+    len=unicode_strlen(strfile->str[i]);
+    for (k=0;k+3<=len;k++)
+    {
+      if (index_add_record(bld,index_trigram_key(strfile->str[i]+k),file_idx,i)!=ERR_NONE)
+      {
+        if (flags&STRFLAG_VERBOSE)
+          str_error("Cannot allocate memory for index");
+        str_close(strfile,flags);
+        return -1;
+      }
+    }
+  }
+  bld->files[file_idx].entries=strfile->str_count;
+  str_close(strfile,flags);
+  return ERR_NONE;
+}
+
+/**
+ * Clears the STR_Index structure, drops any pointers.
+ */
+short strindex_clear(struct STR_Index *index)
+{
+  memset(index,0,sizeof(struct STR_Index));
+  return ERR_NONE;
+}
+
+/**
+ * Maps index file into memory and checks its structure.
+ * @return Returns ERR_NONE on success.
+ */
+short strindex_open(struct STR_Index *index,const char *fname,short flags)
+{
+  unsigned long files_pos,trigrams_pos,postings_pos,names_pos;
+  strindex_clear(index);
+  index->data=file_map(fname,&index->data_len);
+  if (index->data==NULL)
+  {
+    if (flags&STRFLAG_VERBOSE)
+      str_ferror("Cannot map index file %s",fname);
+    return -1;
+  }
+  if ((index->data_len<SIZEOF_IDX_Header)||(memcmp(index->data,idx_magic,4)!=0)||
+      (read_int32_le_buf(index->data+4)!=IDX_VERSION))
+  {
+    if (flags&STRFLAG_VERBOSE)
+      str_ferror("File %s is not a STR index",fname);
+    strindex_close(index);
+    return -1;
+  }
+  index->files_count=read_int32_le_buf(index->data+8);
+  index->trigrams_count=read_int32_le_buf(index->data+12);
+  index->postings_count=read_int32_le_buf(index->data+16);
+  index->names_size=read_int32_le_buf(index->data+20);
+  index->cp_hash=((unsigned long long)(read_int32_le_buf(index->data+28)&0xffffffffUL)<<32)|
+      (read_int32_le_buf(index->data+24)&0xffffffffUL);
+  files_pos=SIZEOF_IDX_Header;
+  trigrams_pos=files_pos+(unsigned long)index->files_count*SIZEOF_IDX_FileItem;
+  postings_pos=trigrams_pos+(unsigned long)index->trigrams_count*SIZEOF_IDX_Trigram;
+  names_pos=postings_pos+(unsigned long)index->postings_count*SIZEOF_IDX_Posting;
+  if ((names_pos+index->names_size!=index->data_len)||(index->names_size<1)||
+      (index->data[index->data_len-1]!=0))
+  {
+    if (flags&STRFLAG_VERBOSE)
+      str_ferror("Index file %s is damaged",fname);
+    strindex_close(index);
+    return -1;
+  }
+  index->files=index->data+files_pos;
+  index->trigrams=index->data+trigrams_pos;
+  index->postings=index->data+postings_pos;
+  index->names=(const char *)index->data+names_pos;
+  return ERR_NONE;
+}
+
+/**
+ * Unmaps the index file.
+ */
+short strindex_close(struct STR_Index *index)
+{
+  file_unmap(index->data,index->data_len);
+  strindex_clear(index);
+  return ERR_NONE;
+}
+
+const char *strindex_file_name(const struct STR_Index *index,unsigned int file_idx)
+{
+  unsigned long offs=read_int32_le_buf(index->files+file_idx*SIZEOF_IDX_FileItem);
+  if (offs>=index->names_size)
+    return "";
+  return index->names+offs;
+}
+
+unsigned long long strindex_trigram_key(const struct STR_Index *index,unsigned int tri_idx)
+{
+  const unsigned char *ptr=index->trigrams+tri_idx*SIZEOF_IDX_Trigram;
+  return ((unsigned long long)(read_int32_le_buf(ptr+4)&0xffffffffUL)<<32)|
+      (read_int32_le_buf(ptr)&0xffffffffUL);
+}
+
+/**
+ * Finds postings range for given trigram.
+ * @return Returns amount of postings, and index of the first in first.
+ */
+unsigned long strindex_find_trigram(const struct STR_Index *index,unsigned long long key,
+    unsigned long *first)
+{
+  unsigned int lo=0,hi=index->trigrams_count;
+  while (lo<hi)
+  {
+    unsigned int mid=(lo+hi)>>1;
+    unsigned long long mid_key=strindex_trigram_key(index,mid);
+    if (mid_key==key)
+    {
+      const unsigned char *ptr=index->trigrams+mid*SIZEOF_IDX_Trigram;
+      unsigned long count;
+      (*first)=read_int32_le_buf(ptr+8);
+      count=read_int32_le_buf(ptr+12);
+      if (((*first)>index->postings_count)||(count>index->postings_count-(*first)))
+        return 0;
+      return count;
+    }
+    if (mid_key<key)
+      lo=mid+1;
+    else
+      hi=mid;
+  }
+  return 0;
+}
+
+/**
+ * Writes the index file from sorted records.
+ */
+short index_write(struct IDX_Builder *bld,const char *fname,short flags)
+{
+  FILE *fp;
+  char *tmpfname;
+  unsigned long i,k,trigrams_count,postings_count,names_size;
+  // Remove repeated records
+  k=0;
+  for (i=0;i<bld->records_count;i++)
+  {
+    if ((k>0)&&(idx_record_cmp(&bld->records[k-1],&bld->records[i])==0))
+      continue;
+    bld->records[k]=bld->records[i];
+    k++;
+  }
+  postings_count=k;
+  trigrams_count=0;
+  for (i=0;i<postings_count;i++)
+    if ((i==0)||(bld->records[i-1].key!=bld->records[i].key))
+      trigrams_count++;
+  names_size=0;
+  for (i=0;i<bld->files_count;i++)
+    names_size+=strlen(bld->files[i].name)+1;
+  names_size+=1;
+  fp=str_fopen_temp(fname,&tmpfname,flags);
+  if (fp==NULL)
+    return -1;
+  // Header
+  fwrite(idx_magic,1,4,fp);
+  write_int32_le_file(fp,IDX_VERSION);
+  write_int32_le_file(fp,bld->files_count);
+  write_int32_le_file(fp,trigrams_count);
+  write_int32_le_file(fp,postings_count);
+  write_int32_le_file(fp,names_size);
+  write_int32_le_file(fp,bld->cp_hash&0xffffffffUL);
+  write_int32_le_file(fp,bld->cp_hash>>32);
+  // Files
+  k=0;
+  for (i=0;i<bld->files_count;i++)
+  {
+    write_int32_le_file(fp,k);
+    write_int32_le_file(fp,bld->files[i].size);
+    write_int32_le_file(fp,bld->files[i].mtime);
+    write_int32_le_file(fp,bld->files[i].entries);
+    k+=strlen(bld->files[i].name)+1;
+  }
+  // Trigrams
+  k=0;
+  for (i=0;i<postings_count;i++)
+  {
+    if ((i+1<postings_count)&&(bld->records[i+1].key==bld->records[i].key))
+      continue;
+    write_int32_le_file(fp,bld->records[i].key&0xffffffffUL);
+    write_int32_le_file(fp,bld->records[i].key>>32);
+    write_int32_le_file(fp,k);
+    write_int32_le_file(fp,i+1-k);
+    k=i+1;
+  }
+  // Postings
+  for (i=0;i<postings_count;i++)
+  {
+    write_int32_le_file(fp,bld->records[i].file);
+    write_int32_le_file(fp,bld->records[i].entry);
+  }
+  // Names
+  for (i=0;i<bld->files_count;i++)
+    fwrite(bld->files[i].name,1,strlen(bld->files[i].name)+1,fp);
+  fputc(0,fp);
+  if (flags&STRFLAG_VERBOSE)
+    printf("Index has %lu files, %lu trigrams, %lu postings\n",
+        (unsigned long)bld->files_count,trigrams_count,postings_count);
+  return str_fclose_temp(fp,tmpfname,fname,ERR_NONE,flags);
+}
+
+/**
+ * Computes hash of the codepage in given folder, to be stored in
+ * the index.
+ * @return Returns ERR_NONE on success.
+ */
+short strindex_codepage_hash(const char *dirname,unsigned long long *cp_hash,short flags)
+{
+  char *cpfname;
+  cpfname=path_join(dirname,"MBToUni.dat");
+  if (cpfname==NULL)
+    return -1;
+  if (file_hash(cpfname,cp_hash)!=0)
+  {
+    if (flags&STRFLAG_VERBOSE)
+      str_ferror("%s when reading %s",strerror(errno),cpfname);
+    str_free(cpfname);
+    return -1;
+  }
+  str_free(cpfname);
+  return ERR_NONE;
+}
+
+/**
+ * Creates or updates trigram index of all STR files in given folder.
+ * Files which have the same size and modification time as in previous
+ * version of the index are not decoded again, unless the codepage
+ * has changed since then.
+ * @param dirname The folder with STR files and MBToUni.dat.
+ * @param flags Flags used to manage the behaviour of the function.
+ * @return Returns ERR_NONE on success.
+ */
+short str_index_build(const char *dirname,short flags)
+{
+  struct IDX_Builder bld;
+  struct STR_Index old;
+  short old_ok;
+  char *idxfname;
+  DIR *dir;
+  struct dirent *dent;
+  unsigned int i,k,reused;
+  short result;
+  memset(&bld,0,sizeof(bld));
+  if (strindex_codepage_hash(dirname,&bld.cp_hash,flags)!=ERR_NONE)
+    return -1;
+  idxfname=path_join(dirname,INDEX_FNAME);
+  if (idxfname==NULL)
+    return -1;
+  old_ok=(strindex_open(&old,idxfname,flags&(~STRFLAG_VERBOSE))==ERR_NONE);
+  if (old_ok&&(old.cp_hash!=bld.cp_hash))
+  {
+    if (flags&STRFLAG_VERBOSE)
+      printf("Codepage has changed, indexing all files.\n");
+    strindex_close(&old);
+    old_ok=0;
+  }
+  dir=opendir(dirname);
+  if (dir==NULL)
+  {
+    if (flags&STRFLAG_VERBOSE)
+      str_ferror("%s when opening folder %s",strerror(errno),dirname);
+    if (old_ok)
+      strindex_close(&old);
+    str_free(idxfname);
+    return -1;
+  }
+  result=ERR_NONE;
+  reused=0;
+  while ((dent=readdir(dir))!=NULL)
+  {
+    struct IDX_File *file;
+    char *fname;
+    if (!fname_has_ext(dent->d_name,".str"))
+      continue;
+    fname=path_join(dirname,dent->d_name);
+    file=index_add_file(&bld,dent->d_name);
+    if ((fname==NULL)||(file==NULL)||(file_stat(fname,&file->size,&file->mtime)!=0))
+    {
+      str_free(fname);
+      result=-1;
+      break;
+    }
+    // Check if the file is unchanged since last indexing; the mtime
+    // is compared in 32 bits, as stored in the index
+    if (old_ok)
+      for (k=0;k<old.files_count;k++)
+      {
+        const unsigned char *ptr=old.files+k*SIZEOF_IDX_FileItem;
+        if ((strcmp(strindex_file_name(&old,k),dent->d_name)==0)&&
+            ((read_int32_le_buf(ptr+4)&0xffffffffUL)==(file->size&0xffffffffUL))&&
+            ((read_int32_le_buf(ptr+8)&0xffffffffUL)==(file->mtime&0xffffffffUL)))
+        {
+          file->old_index=k;
+          file->entries=read_int32_le_buf(ptr+12);
+          break;
+        }
+      }
+    if (file->old_index>=0)
+    {
+      reused++;
+    } else
+    {
+      if (flags&STRFLAG_VERBOSE)
+        printf("Indexing %s\n",dent->d_name);
+      if (index_add_strfile(&bld,bld.files_count-1,fname,flags)!=ERR_NONE)
+        result=-1;
+    }
+    str_free(fname);
+    if (result!=ERR_NONE)
+      break;
+  }
+  closedir(dir);
+  // Copy postings of unchanged files from the previous index
+  if ((result==ERR_NONE)&&(reused>0))
+  {
+    int *file_map;
+    file_map=str_malloc(old.files_count*sizeof(int));
+    if (file_map==NULL)
+      result=-1;
+    for (k=0;(result==ERR_NONE)&&(k<old.files_count);k++)
+      file_map[k]=-1;
+    for (i=0;(result==ERR_NONE)&&(i<bld.files_count);i++)
+      if (bld.files[i].old_index>=0)
+        file_map[bld.files[i].old_index]=i;
+    for (i=0;(result==ERR_NONE)&&(i<old.trigrams_count);i++)
+    {
+      const unsigned char *ptr=old.trigrams+i*SIZEOF_IDX_Trigram;
+      unsigned long long key=strindex_trigram_key(&old,i);
+      unsigned long first=read_int32_le_buf(ptr+8);
+      unsigned long count=read_int32_le_buf(ptr+12);
+      unsigned long n;
+      for (n=first;(n<first+count)&&(n<old.postings_count);n++)
+      {
+        unsigned long file_idx=read_int32_le_buf(old.postings+n*SIZEOF_IDX_Posting);
+        if ((file_idx>=old.files_count)||(file_map[file_idx]<0))
+          continue;
+        if (index_add_record(&bld,key,file_map[file_idx],
+            read_int32_le_buf(old.postings+n*SIZEOF_IDX_Posting+4))!=ERR_NONE)
+        {
+          result=-1;
+          break;
+        }
+      }
+    }
+    str_free(file_map);
+  }
+  if (old_ok)
+    strindex_close(&old);
+  if (result==ERR_NONE)
+  {
+    if (flags&STRFLAG_VERBOSE)
+      printf("Files indexed: %u, unchanged: %u\n",bld.files_count-reused,reused);
+    qsort(bld.records,bld.records_count,sizeof(struct IDX_Record),idx_record_cmp);
+    result=index_write(&bld,idxfname,flags);
+  } else
+  {
+    if (flags&STRFLAG_VERBOSE)
+      str_error("Cannot create the index");
+  }
+  for (i=0;i<bld.files_count;i++)
+    str_free(bld.files[i].name);
+  str_free(bld.files);
+  str_free(bld.records);
+  str_free(idxfname);
+  if (result<ERR_NONE)
+    return result;
+  return ERR_NONE;
+}
+
+/**
+ * Checks if given posting is within postings range.
+ * Postings within a trigram are sorted by file, then by entry.
+ */
+short strindex_has_posting(const struct STR_Index *index,unsigned long first,
+    unsigned long count,unsigned long file_idx,unsigned long entry_idx)
+{
+  unsigned long lo=first,hi=first+count;
+  while (lo<hi)
+  {
+    unsigned long mid=(lo+hi)>>1;
+    const unsigned char *ptr=index->postings+mid*SIZEOF_IDX_Posting;
+    unsigned long mid_file=read_int32_le_buf(ptr);
+    unsigned long mid_entry=read_int32_le_buf(ptr+4);
+    if ((mid_file==file_idx)&&(mid_entry==entry_idx))
+      return 1;
+    if ((mid_file<file_idx)||((mid_file==file_idx)&&(mid_entry<entry_idx)))
+      lo=mid+1;
+    else
+      hi=mid;
+  }
+  return 0;
+}
+
+/**
+ * Reads STR file from the folder, sharing the codepage from cpstr.
+ * @return Returns new STR_Maker, or NULL on error.
+ */
+struct STR_Maker *strindex_load_strfile(const char *dirname,const char *name,
+    const struct STR_Maker *cpstr,short flags)
+{
+  struct STR_Maker *mkstr;
+  char *fname;
+  FILE *fp;
+  short result;
+  fname=path_join(dirname,name);
+  if (fname==NULL)
+    return NULL;
+  fp=fopen(fname,"rb");
+  if (fp==NULL)
+  {
+    if (flags&STRFLAG_VERBOSE)
+      str_ferror("%s when opening %s",strerror(errno),fname);
+    str_free(fname);
+    return NULL;
+  }
+  str_free(fname);
+  mkstr=str_malloc(sizeof(struct STR_Maker));
+  if (mkstr==NULL)
+  {
+    fclose(fp);
+    return NULL;
+  }
+  strmaker_clear(mkstr);
+  result=strmaker_fread(mkstr,fp,flags);
+  fclose(fp);
+  if (result!=ERR_NONE)
+  {
+    strmaker_free(mkstr);
+    return NULL;
+  }
+  // Use shared codepage; it must be detached before freeing the maker
+  mkstr->mb2uni=cpstr->mb2uni;
+  mkstr->mb2uni_count=cpstr->mb2uni_count;
+  return mkstr;
+}
+
+void strindex_free_strfile(struct STR_Maker *mkstr)
+{
+  if (mkstr==NULL)
+    return;
+  mkstr->mb2uni=NULL;
+  mkstr->mb2uni_count=0;
+  strmaker_free(mkstr);
+}
+
+/**
+ * Finds entries containing given phrase, using the trigram index
+ * of a folder. Candidates are verified by decoding them from STR files.
+ * @param dirname The folder with STR files and index.
+ * @param phrase The text to search for; must have at least 3 characters.
+ * @param flags Flags used to manage the behaviour of the function.
+ * @return Returns amount of matching entries, or negative error code.
+ */
+int str_index_query(const char *dirname,const unsigned short *phrase,short flags)
+{
+  struct STR_Index index;
+  struct STR_Maker *mkstr;
+  struct STR_Maker *filestr;
+  unsigned long *tri_first;
+  unsigned long *tri_count;
+  unsigned long long cp_hash;
+  char *fname;
+  long phrase_len,i;
+  unsigned long best,n;
+  int found;
+  short result;
+  phrase_len=unicode_strlen((unsigned short *)phrase);
+  if (phrase_len<3)
+  {
+    if (flags&STRFLAG_VERBOSE)
+      str_error("Phrase must have at least 3 characters to use the index");
+    return -1;
+  }
+  fname=path_join(dirname,INDEX_FNAME);
+  if (fname==NULL)
+    return -1;
+  result=strindex_open(&index,fname,flags);
+  str_free(fname);
+  if (result!=ERR_NONE)
+    return -1;
+  // Trigrams of texts decoded with another codepage would not match
+  if (strindex_codepage_hash(dirname,&cp_hash,flags)!=ERR_NONE)
+  {
+    strindex_close(&index);
+    return -1;
+  }
+  if (cp_hash!=index.cp_hash)
+  {
+    if (flags&STRFLAG_VERBOSE)
+      str_error("Codepage has changed since indexing; update the index");
+    strindex_close(&index);
+    return -1;
+  }
+  mkstr=str_malloc(sizeof(struct STR_Maker));
+  tri_first=str_malloc((phrase_len-2)*sizeof(unsigned long));
+  tri_count=str_malloc((phrase_len-2)*sizeof(unsigned long));
+  if ((mkstr==NULL)||(tri_first==NULL)||(tri_count==NULL))
+  {
+    if (flags&STRFLAG_VERBOSE)
+      str_error("Cannot allocate memory for query");
+    str_free(mkstr);
+    str_free(tri_first);
+    str_free(tri_count);
+    strindex_close(&index);
+    return -1;
+  }
+  strmaker_clear(mkstr);
+  // Get postings of every trigram, and find the shortest list
+  best=0;
+  for (i=0;i+3<=phrase_len;i++)
+  {
+    tri_count[i]=strindex_find_trigram(&index,index_trigram_key(phrase+i),&tri_first[i]);
+    if (tri_count[i]<tri_count[best])
+      best=i;
+  }
+  fname=path_join(dirname,"MBToUni.dat");
+  result=-1;
+  if (fname!=NULL)
+    result=str_mb2uni_load(mkstr,fname,flags);
+  str_free(fname);
+  found=0;
+  filestr=NULL;
+  long last_file=-1;
+  for (n=tri_first[best];(result==ERR_NONE)&&(n<tri_first[best]+tri_count[best]);n++)
+  {
+    unsigned long file_idx=read_int32_le_buf(index.postings+n*SIZEOF_IDX_Posting);
+    unsigned long entry_idx=read_int32_le_buf(index.postings+n*SIZEOF_IDX_Posting+4);
+    if (file_idx>=index.files_count)
+      continue;
+    for (i=0;i+3<=phrase_len;i++)
+    {
+      if (i==best) continue;
+      if (!strindex_has_posting(&index,tri_first[i],tri_count[i],file_idx,entry_idx))
+        break;
+    }
+    if (i+3<=phrase_len)
+      continue;
+    // Load the STR file of candidate entry
+    if (last_file!=(long)file_idx)
+    {
+      strindex_free_strfile(filestr);
+      filestr=strindex_load_strfile(dirname,strindex_file_name(&index,file_idx),mkstr,flags);
+      last_file=file_idx;
+    }
+    if (filestr==NULL)
+      continue;
+    // Verify the match on decoded text
+    unsigned short *udata=NULL;
+    if (strmaker_get_unicode_entry(filestr,&udata,entry_idx,flags&(~STRFLAG_VERBOSE))<0)
+    {
+      str_free(udata);
+      continue;
+    }
+    if ((udata!=NULL)&&(index_text_contains(udata,phrase)))
+    {
+      str_print_entry(strindex_file_name(&index,file_idx),entry_idx,udata);
+      found++;
+    }
+    str_free(udata);
+  }
+  if (flags&STRFLAG_VERBOSE)
+    printf("Matching entries: %d\n",found);
+  strindex_free_strfile(filestr);
+  str_free(tri_first);
+  str_free(tri_count);
+  strmaker_free(mkstr);
+  strindex_close(&index);
+  if (result!=ERR_NONE)
+    return -1;
+  return found;
+}
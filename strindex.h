@@ -0,0 +1,63 @@
+/******************************************************************************/
+/** @file strindex.h
+ * Library for r/w of DK2 STR text strings files.
+ * @par Purpose:
+ *     Header file. Defines exported routines from strindex.c.
+ * @par Comment:
+ *     None.
+ * @par  Copying and copyrights:
+ *     This program is free software; you can redistribute it and/or modify
+ *     it under the terms of the GNU General Public License as published by
+ *     the Free Software Foundation; either version 2 of the License, or
+ *     (at your option) any later version.
+ */
+/******************************************************************************/
+
+#ifndef STRINDEX_H
+#define STRINDEX_H
+
+#include <stdio.h>
+
+#define INDEX_FNAME "strtool.idx"
+
+#define SIZEOF_IDX_Header     32
+#define SIZEOF_IDX_FileItem   16
+#define SIZEOF_IDX_Trigram    16
+#define SIZEOF_IDX_Posting     8
+
+/**
+ * Trigram index file layout; all values are little-endian, and every
+ * section starts at offset aligned to 8 bytes, so the file can be used
+ * directly after mapping it into memory.
+ *   Header:   magic "BFIX", version, files count, trigrams count,
+ *             postings count, names size, 64-bit hash of MBToUni.dat
+ *   Files:    name offset, STR file size, STR file mtime, entries count;
+ *             only low 32 bits of the mtime are stored, which is enough
+ *             as it's only compared for equality with current mtime
+ *   Trigrams: 48-bit key (three UTF-16 chars) in 8 bytes,
+ *             first posting index, postings count
+ *   Postings: file index, entry index
+ *   Names:    zero-terminated file names
+ */
+struct STR_Index {
+    unsigned char *data;     // Mapped index file
+    long data_len;
+    unsigned int files_count;
+    unsigned int trigrams_count;
+    unsigned int postings_count;
+    const unsigned char *files;
+    const unsigned char *trigrams;
+    const unsigned char *postings;
+    const char *names;
+    unsigned int names_size;
+    unsigned long long cp_hash; // Hash of the codepage used for indexing
+    };
+
+// Routines
+
+short strindex_open(struct STR_Index *index,const char *fname,short flags);
+short strindex_close(struct STR_Index *index);
+short str_index_build(const char *dirname,short flags);
+int str_index_query(const char *dirname,const unsigned short *phrase,short flags);
+
+#endif
@@ -0,0 +1,376 @@
+/******************************************************************************/
+/** @file strlive.c
+ * Library for r/w of DK2 STR text strings files.
+ * @par Purpose:
+ *     STR file reloaded in background when it changes.
+ * @par Comment:
+ *     New version is loaded by a separate thread and published by
+ *     replacing a pointer; readers only mark the epoch in which they
+ *     started reading, and old versions are freed when no reader from
+ *     an earlier epoch is left.
+ * @par  Copying and copyrights:
+ *     This program is free software; you can redistribute it and/or modify
+ *     it under the terms of the GNU General Public License as published by
+ *     the Free Software Foundation; either version 2 of the License, or
+ *     (at your option) any later version.
+ */
+/******************************************************************************/
+
+#include "strlive.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "lbfileio.h"
+#include "unitext.h"
+#include "strfile.h"
+#include "strmaker.h"
+#include "strdcache.h"
+#include "stralloc.h"
+
+// Shared fields are only accessed with __sync builtins; these are full
+// barriers, and unlike volatile accesses with fences, thread checkers
+// understand them
+#define LIVE_LOAD(var) __sync_fetch_and_add(&(var),0)
+#define LIVE_LOAD_PTR(var) __sync_val_compare_and_swap(&(var),NULL,NULL)
+#define LIVE_CLEAR(var) __sync_and_and_fetch(&(var),0)
+
+/**
+ * Frees snapshot with its STR file.
+ */
+void strlive_snapshot_free(struct STR_Snapshot *snap,short flags)
+{
+  if (snap==NULL)
+    return;
+  if (snap->strfile!=NULL)
+    str_close(snap->strfile,flags);
+  str_free(snap);
+}
+
+/**
+ * Loads new snapshot from STR or text file.
+ * @return Returns the snapshot, or NULL on error.
+ */
+struct STR_Snapshot *strlive_snapshot_load(struct STR_Live *live,short from_text)
+{
+  struct STR_Snapshot *snap;
+  snap=str_malloc(sizeof(struct STR_Snapshot));
+  if (snap==NULL)
+    return NULL;
+  memset(snap,0,sizeof(struct STR_Snapshot));
+  if (from_text)
+    snap->strfile=str_open_unicode(live->txtfname,live->flags);
+  else
+    snap->strfile=str_open(live->strfname,live->flags);
+  if (snap->strfile==NULL)
+  {
+    str_free(snap);
+    return NULL;
+  }
+  return snap;
+}
+
+/**
+ * Frees replaced snapshots which no reader can be using anymore.
+ * Called only by the thread which publishes snapshots.
+ */
+void strlive_reclaim(struct STR_Live *live)
+{
+  struct STR_Snapshot **link;
+  struct STR_Snapshot *snap;
+  unsigned long min_epoch,epoch;
+  long i,count;
+  // Readers which started in an epoch before the snapshot was replaced
+  // may still use it; the ones which started later see the new one
+  min_epoch=~0UL;
+  count=LIVE_LOAD(live->readers_count);
+  if (count>LIVE_MAX_READERS)
+    count=LIVE_MAX_READERS;
+  for (i=0;i<count;i++)
+  {
+    epoch=LIVE_LOAD(live->readers[i].epoch);
+    if ((epoch!=0)&&(epoch<min_epoch))
+      min_epoch=epoch;
+  }
+  link=&live->retired;
+  while ((*link)!=NULL)
+  {
+    snap=(*link);
+    if (snap->retire_epoch<=min_epoch)
+    {
+      (*link)=snap->retired_next;
+      strlive_snapshot_free(snap,live->flags);
+    } else
+    {
+      link=&snap->retired_next;
+    }
+  }
+}
+
+/**
+ * Replaces current snapshot with the new one. The old one is freed
+ * later, by strlive_reclaim().
+ */
+void strlive_publish(struct STR_Live *live,struct STR_Snapshot *snap)
+{
+  struct STR_Snapshot *old;
+  old=LIVE_LOAD_PTR(live->current);
+  snap->version=old->version+1;
+  // Only this thread changes the pointer, so the swap always succeeds
+  old=__sync_val_compare_and_swap(&live->current,old,snap);
+  old->retire_epoch=__sync_add_and_fetch(&live->epoch,1);
+  old->retired_next=live->retired;
+  live->retired=old;
+}
+
+/**
+ * Remembers which of the watched files were changed.
+ */
+void strlive_file_changed(void *ctx,const char *path,short is_dir)
+{
+  struct STR_Live *live=ctx;
+  const char *fname;
+  if (is_dir)
+    return;
+  fname=filename_from_path(path);
+  if (strcmp(fname,filename_from_path(live->txtfname))==0)
+    live->txt_changed=1;
+  else
+  if (strcmp(fname,filename_from_path(live->strfname))==0)
+    live->str_changed=1;
+}
+
+/**
+ * Work of the reload thread; waits for changes of the files until
+ * asked to stop.
+ */
+void strlive_thread(void *ctx)
+{
+  struct STR_Live *live=ctx;
+  struct STR_Snapshot *snap;
+  while (!LIVE_LOAD(live->stop))
+  {
+    live->txt_changed=0;
+    live->str_changed=0;
+    if (watch_wait(&live->watch,LIVE_WAIT_MS,strlive_file_changed,live)>0)
+    {
+      // Text is the source; STR written from it has the same entries
+      snap=NULL;
+      if (live->txt_changed)
+        snap=strlive_snapshot_load(live,1);
+      else
+      if (live->str_changed)
+        snap=strlive_snapshot_load(live,0);
+      if (snap!=NULL)
+      {
+        strlive_publish(live,snap);
+        __sync_add_and_fetch(&live->reloads,1);
+      } else
+      if (live->txt_changed||live->str_changed)
+      {
+        // Keep the previous version; file may be written again soon
+        __sync_add_and_fetch(&live->failures,1);
+      }
+    }
+    strlive_reclaim(live);
+  }
+}
+
+/**
+ * Loads STR file, and starts reloading it whenever the STR or TXT file
+ * changes. STR file is loaded first, if it exists.
+ * @param name File name, without extension.
+ * @param flags Flags used to manage the behaviour of the function.
+ * @return Returns the STR_Live structure, or NULL on error.
+ */
+struct STR_Live *strlive_open(const char *name,short flags)
+{
+  struct STR_Live *live;
+  long size,mtime;
+  char *dirname;
+  int name_len,dir_len;
+  short result;
+  live=str_malloc(sizeof(struct STR_Live));
+  if (live==NULL)
+    return NULL;
+  memset(live,0,sizeof(struct STR_Live));
+  live->flags=flags;
+  live->epoch=1;
+  name_len=strlen(name);
+  live->strfname=str_malloc(name_len+5);
+  live->txtfname=str_malloc(name_len+5);
+  if ((live->strfname==NULL)||(live->txtfname==NULL))
+  {
+    if (flags&STRFLAG_VERBOSE)
+      str_error("Can't allocate memory for file names");
+    str_free(live->strfname);
+    str_free(live->txtfname);
+    str_free(live);
+    return NULL;
+  }
+  sprintf(live->strfname,"%s.str",name);
+  sprintf(live->txtfname,"%s.txt",name);
+  watch_init(&live->watch);
+  live->current=strlive_snapshot_load(live,file_stat(live->strfname,&size,&mtime)!=0);
+  result=(live->current!=NULL)?ERR_NONE:-1;
+  if (result==ERR_NONE)
+  {
+    dir_len=filename_from_path(live->strfname)-live->strfname;
+    dirname=str_malloc(dir_len+2);
+    if (dirname!=NULL)
+    {
+      strncpy(dirname,live->strfname,dir_len);
+      strcpy(dirname+dir_len,(dir_len>0)?"":".");
+      result=watch_add_dir(&live->watch,dirname);
+      if ((result!=ERR_NONE)&&(flags&STRFLAG_VERBOSE))
+        str_ferror("Cannot watch folder %s",dirname);
+      str_free(dirname);
+    } else
+    {
+      result=ERR_NO_MEMORY;
+    }
+  }
+  if (result==ERR_NONE)
+  {
+    result=thread_start(&live->thread,strlive_thread,live);
+    if ((result!=ERR_NONE)&&(flags&STRFLAG_VERBOSE))
+      str_error("Cannot start reload thread");
+  }
+  if (result!=ERR_NONE)
+  {
+    strlive_snapshot_free(live->current,flags);
+    watch_free(&live->watch);
+    str_free(live->strfname);
+    str_free(live->txtfname);
+    str_free(live);
+    return NULL;
+  }
+  return live;
+}
+
+/**
+ * Stops reloading and frees the structure with all snapshots.
+ * No reader can be reading when this is called.
+ */
+short strlive_close(struct STR_Live *live)
+{
+  struct STR_Snapshot *snap;
+  if (live==NULL)
+    return -1;
+  __sync_add_and_fetch(&live->stop,1);
+  thread_join(&live->thread);
+  while (live->retired!=NULL)
+  {
+    snap=live->retired;
+    live->retired=snap->retired_next;
+    strlive_snapshot_free(snap,live->flags);
+  }
+  strlive_snapshot_free(live->current,live->flags);
+  watch_free(&live->watch);
+  str_free(live->strfname);
+  str_free(live->txtfname);
+  str_free(live);
+  return ERR_NONE;
+}
+
+/**
+ * Gives a reader slot to the calling thread. Every thread which reads
+ * the snapshots needs its own slot.
+ * @return Returns the slot number, or -1 if there are no free slots.
+ */
+int strlive_reader_register(struct STR_Live *live)
+{
+  long slot;
+  slot=__sync_fetch_and_add(&live->readers_count,1);
+  if (slot>=LIVE_MAX_READERS)
+  {
+    __sync_fetch_and_sub(&live->readers_count,1);
+    return -1;
+  }
+  return slot;
+}
+
+/**
+ * Starts reading; gives the current snapshot, which stays valid
+ * until strlive_read_end() is called. Never waits for the reload.
+ * @param reader The reader slot number.
+ */
+const struct STR_Snapshot *strlive_read_begin(struct STR_Live *live,int reader)
+{
+  unsigned long epoch;
+  // Epoch is marked before the snapshot pointer is read; if the epoch
+  // changed meanwhile, the mark could have been missed by reclaiming
+  while (1)
+  {
+    epoch=LIVE_LOAD(live->epoch);
+    __sync_add_and_fetch(&live->readers[reader].epoch,epoch);
+    if (LIVE_LOAD(live->epoch)==epoch)
+      break;
+    LIVE_CLEAR(live->readers[reader].epoch);
+  }
+  return LIVE_LOAD_PTR(live->current);
+}
+
+/**
+ * Finishes reading; the snapshot given by strlive_read_begin()
+ * can't be used anymore.
+ */
+void strlive_read_end(struct STR_Live *live,int reader)
+{
+  LIVE_CLEAR(live->readers[reader].epoch);
+}
+
+struct STR_LiveLookup {
+    struct STR_Live *live;
+    int reader;
+    const char *name;
+    };
+
+/**
+ * Prints one entry of the current version, for str_live_lookup().
+ * @return Returns 1 if the entry was printed, 0 if it doesn't exist.
+ */
+int str_live_lookup_entry(void *data,unsigned int index,short flags)
+{
+  struct STR_LiveLookup *lookup=data;
+  const struct STR_Snapshot *snap;
+  int count;
+  snap=strlive_read_begin(lookup->live,lookup->reader);
+  if (index<snap->strfile->str_count)
+  {
+    str_print_entry(lookup->name,index,snap->strfile->str[index]);
+    count=1;
+  } else
+  {
+    if (flags&STRFLAG_VERBOSE)
+      str_ferror("No entry %u in %s version %lu",index,lookup->name,snap->version);
+    count=0;
+  }
+  strlive_read_end(lookup->live,lookup->reader);
+  return count;
+}
+
+/**
+ * Prints entries of STR file which is reloaded when it changes. If no
+ * numbers are given, they are read from standard input, one per line,
+ * and every entry is printed from the newest version of the file.
+ * @param name File name, without extension.
+ * @param ids Entry numbers, as text.
+ * @return Returns amount of entries printed, or negative error code.
+ */
+int str_live_lookup(const char *name,char **ids,int ids_count,short flags)
+{
+  struct STR_LiveLookup lookup;
+  int count;
+  lookup.live=strlive_open(name,flags);
+  if (lookup.live==NULL)
+    return -1;
+  lookup.reader=strlive_reader_register(lookup.live);
+  lookup.name=filename_from_path(name);
+  count=str_lookup_ids(ids,ids_count,str_live_lookup_entry,&lookup,flags);
+  if (flags&STRFLAG_VERBOSE)
+    printf("Reloads: %lu, failed: %lu\n",LIVE_LOAD(lookup.live->reloads),
+        LIVE_LOAD(lookup.live->failures));
+  strlive_close(lookup.live);
+  return count;
+}
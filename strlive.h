@@ -0,0 +1,79 @@
+/******************************************************************************/
+/** @file strlive.h
+ * Library for r/w of DK2 STR text strings files.
+ * @par Purpose:
+ *     Header file. Defines exported routines from strlive.c.
+ * @par Comment:
+ *     None.
+ * @par  Copying and copyrights:
+ *     This program is free software; you can redistribute it and/or modify
+ *     it under the terms of the GNU General Public License as published by
+ *     the Free Software Foundation; either version 2 of the License, or
+ *     (at your option) any later version.
+ */
+/******************************************************************************/
+
+#ifndef STRLIVE_H
+#define STRLIVE_H
+
+#include <stdio.h>
+#include "strthread.h"
+#include "strwatch.h"
+
+// Maximal amount of reader threads
+#define LIVE_MAX_READERS THREADS_MAX_COUNT
+// How often the reload thread checks if it should stop
+#define LIVE_WAIT_MS 200
+
+/**
+ * One version of the STR file. Never modified after it is published.
+ */
+struct STR_Snapshot {
+    struct STR_File *strfile;
+    unsigned long version;   // Increased with every reload
+    unsigned long retire_epoch; // Epoch when it was replaced by newer one
+    struct STR_Snapshot *retired_next;
+    };
+
+/**
+ * Reader slot; every reader thread uses its own one.
+ */
+struct STR_LiveReader {
+    unsigned long epoch;     // Epoch when reading started, 0 if not reading
+    char pad[64-sizeof(unsigned long)]; // Keeps every slot in own cache line
+    };
+
+/**
+ * STR file which is reloaded in background when its STR or TXT file
+ * changes. Readers are never blocked; a replaced snapshot is freed when
+ * all readers which could see it have finished reading.
+ */
+struct STR_Live {
+    char *strfname;
+    char *txtfname;
+    struct STR_Snapshot *current;
+    unsigned long epoch;     // Global epoch, increased with every reload
+    struct STR_LiveReader readers[LIVE_MAX_READERS];
+    long readers_count;
+    struct STR_Snapshot *retired; // Replaced snapshots, not freed yet
+    struct STR_Watch watch;
+    struct THRD_Thread thread;
+    short stop;
+    short txt_changed;       // Set by the watcher callback
+    short str_changed;
+    unsigned long reloads;   // Counters can be read with __sync_fetch_and_add(&x,0)
+    unsigned long failures;
+    short flags;
+    };
+
+// Routines
+
+struct STR_Live *strlive_open(const char *name,short flags);
+short strlive_close(struct STR_Live *live);
+int strlive_reader_register(struct STR_Live *live);
+const struct STR_Snapshot *strlive_read_begin(struct STR_Live *live,int reader);
+void strlive_read_end(struct STR_Live *live,int reader);
+
+int str_live_lookup(const char *name,char **ids,int ids_count,short flags);
+
+#endif
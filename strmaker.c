@@ -23,6 +23,11 @@
 #include <stdarg.h>
 #include "lbfileio.h"
 #include "unitext.h"
+#include "strcache.h"
+#include "strstats.h"
+#include "strtrace.h"
+#include "strctx.h"
+#include "stralloc.h"
 
 const char str_magic[]="BFST";
 const char mb2uni_magic[]="BFMU";
@@ -42,16 +47,41 @@ short str_error(const char *msg)
  */
 short str_ferror(const char *format, ...)
 {
-    static char errmessage[255];
+    // Not static, so that many threads can report errors
+    char errmessage[255];
     va_list val;
     va_start(val, format);
-    vsprintf(errmessage,format,val);
+    vsnprintf(errmessage,sizeof(errmessage),format,val);
     va_end(val);
     short result;
     result=str_error(errmessage);
     return result;
 }
 
+/**
+ * Returns description of error code returned by the library routines.
+ */
+const char *str_error_text(short code)
+{
+    switch (code)
+    {
+    case ERR_NONE:
+        return "No error";
+    case ERR_NO_MEMORY:
+        return "Cannot allocate memory";
+    case ERR_CHUNK_HEADER:
+        return "Data too short for next chunk header";
+    case ERR_END_CHUNK:
+        return "Entry end chunk has nonzero size";
+    case ERR_ENTRY_LENGTH:
+        return "Entry length exceeds file size";
+    case ERR_CHUNK_TYPE:
+        return "Bad STR chunk type";
+    default:
+        return "Error";
+    }
+}
+
 /**
  * Returns file name pointer from given filename with path.
  * @param pathname The source filename, possibly with path.
@@ -62,13 +92,15 @@ char *filename_from_path(const char *pathname)
     const char *fname = NULL;
     if (pathname)
     {
-        fname = strrchr (pathname, '/') + 1;
-        char *fname2 = strrchr (pathname, '\\') + 1;
+        fname = strrchr (pathname, '/');
+        char *fname2 = strrchr (pathname, '\\');
         if ((!fname)||(fname2>fname))
             fname = fname2;
     }
     if (!fname)
         fname=pathname;
+    else
+        fname++;
     return (char *)fname;
 }
 
@@ -76,7 +108,7 @@ char *filename_from_path(const char *pathname)
  * Encodes an unicode string into STR file entry. This version
  * tries to use UniToMb, which is fast and proper,
  * but we don't know how to use UniToMb correctly, so it's bugged.
- * @return Returns ERR_NONE on success.
+ * @return Returns ERR_NONE on success, or negative ERR_* code.
  */
 short str_data_encode(unsigned char **edata,long *edata_len,
     const unsigned short *uni2mb,const long uni2mb_count,
@@ -87,11 +119,10 @@ short str_data_encode(unsigned char **edata,long *edata_len,
   int blockpos;
   blockpos=0;
   (*edata_len)=blockpos+(SIZEOF_STR_ChunkHeader<<1)+(udata_len>>2);
-  (*edata)=malloc((*edata_len)+1);
+  (*edata)=str_malloc((*edata_len)+1);
   if ((*edata)==NULL)
   {
-    str_error("Can't allocate memory to start encoding STR entry from Unicode");
-    return -1;
+    return ERR_NO_MEMORY;
   }
   unsigned int chunk_type;
   eidx=0;
@@ -107,12 +138,16 @@ short str_data_encode(unsigned char **edata,long *edata_len,
         {
         case '\\':
             sidx='\\';
+            break;
         case 'n':
             sidx='\n';
+            break;
         case 't':
             sidx='\t';
+            break;
         default:
             sidx='_';
+            break;
         }
       }
       unsigned short chr;
@@ -162,11 +197,10 @@ short str_data_encode(unsigned char **edata,long *edata_len,
       if ((blockpos+SIZEOF_STR_ChunkHeader+eidx+chrlen)>(*edata_len))
       {
           (*edata_len)=(blockpos+(SIZEOF_STR_ChunkHeader<<1)+eidx+chrlen);
-          (*edata)=realloc((*edata),(*edata_len)+1);
+          (*edata)=str_realloc((*edata),(*edata_len)+1);
           if ((*edata)==NULL)
           {
-            str_error("Can't allocate memory when encoding STR entry from Unicode");
-            return -1;
+            return ERR_NO_MEMORY;
           }
       }
       (*edata)[blockpos+SIZEOF_STR_ChunkHeader+eidx]=(unsigned char)(chr&0xff);
@@ -182,11 +216,10 @@ short str_data_encode(unsigned char **edata,long *edata_len,
   if ((blockpos+(SIZEOF_STR_ChunkHeader<<1)+eidx)!=(*edata_len))
   {
       (*edata_len)=(blockpos+(SIZEOF_STR_ChunkHeader<<1)+eidx);
-      (*edata)=realloc((*edata),(*edata_len)+1);
+      (*edata)=str_realloc((*edata),(*edata_len)+1);
       if ((*edata)==NULL)
       {
-          str_error("Can't allocate memory to end encoding STR entry from Unicode");
-          return -1;
+          return ERR_NO_MEMORY;
       }
   }
   write_int32_le_buf((*edata)+blockpos,chunk_type+(eidx<<8));
@@ -196,11 +229,81 @@ short str_data_encode(unsigned char **edata,long *edata_len,
   return ERR_NONE;
 }
 
+/**
+ * Finds codepage index of given unicode character.
+ * @return Returns index in mb2uni array, or -1 if the character
+ *     has no representation in the codepage.
+ */
+long str_codepage_index(const unsigned short *mb2uni,const long mb2uni_count,
+    unsigned short uchr)
+{
+  long k;
+  for (k=0;k<mb2uni_count;k++)
+  {
+      if (mb2uni[k]==uchr)
+          return k;
+  }
+  return -1;
+}
+
+/**
+ * Writes codepage index of a character as STR text chunk bytes.
+ * Indices above 254 are prefixed with 0xff bytes, each of them
+ * adding 254 to the index.
+ * @return Returns amount of bytes written.
+ */
+int str_char_encode(unsigned char *edata,long mbidx)
+{
+  int eidx=0;
+  while (mbidx>=255)
+  {
+     edata[eidx]=(unsigned char)(0xff);
+     eidx++;
+     mbidx-=254;
+  }
+  edata[eidx]=(unsigned char)(mbidx);
+  eidx++;
+  return eidx;
+}
+
+/**
+ * Encodes plain unicode text into STR text chunk bytes, without any
+ * chunk headers. Unlike str_data_encode_r(), no characters have special
+ * meaning, so the output can be used to search in STR data.
+ * @param unmapped Output for amount of characters not in the codepage.
+ * @return Returns ERR_NONE on success, or negative ERR_* code.
+ */
+short str_text_encode(unsigned char **edata,long *edata_len,
+    const unsigned short *mb2uni,const long mb2uni_count,
+    const unsigned short *udata,const long udata_len,long *unmapped)
+{
+  long i,k;
+  (*unmapped)=0;
+  (*edata_len)=0;
+  // Every character may be written with up to 257 bytes
+  (*edata)=str_malloc(udata_len*((0xffff/254)+1)+1);
+  if ((*edata)==NULL)
+  {
+    return ERR_NO_MEMORY;
+  }
+  for (i=0;i<udata_len;i++)
+  {
+      k=str_codepage_index(mb2uni,mb2uni_count,udata[i]);
+      if (k<0)
+      {
+          (*unmapped)++;
+          k='_';
+      }
+      (*edata_len)+=str_char_encode((*edata)+(*edata_len),k);
+  }
+  return ERR_NONE;
+}
+
 /**
  * Encodes an unicode string into STR file entry. This special version
  * uses MbToUni conversion array instead of UniToMb, which is slower,
  * but as we don't know how to use UniToMb, that's the only way.
- * @return Returns ERR_NONE on success.
+ * @return Returns ERR_NONE on success, or negative ERR_* code.
  */
 short str_data_encode_r(unsigned char **edata,long *edata_len,
     const unsigned short *mb2uni,const long mb2uni_count,
@@ -211,13 +314,13 @@ short str_data_encode_r(unsigned char **edata,long *edata_len,
   int blockpos;
   blockpos=0;
   (*edata_len)=blockpos+(SIZEOF_STR_ChunkHeader<<1)+udata_len;
-  (*edata)=malloc((*edata_len)+1);
+  (*edata)=str_malloc((*edata_len)+1);
   if ((*edata)==NULL)
   {
-    str_error("Can't allocate memory to start encoding STR entry from Unicode");
-    return -1;
+    return ERR_NO_MEMORY;
   }
   unsigned int chunk_type;
+  STATS_ADD(entries_encoded,1);
   eidx=0;
   chunk_type=CTSTR_STRING;
   //printf("Starting encoding loop...");
@@ -231,12 +334,17 @@ short str_data_encode_r(unsigned char **edata,long *edata_len,
         {
         case '\\':
             sidx='\\';
+            break;
         case 'n':
             sidx='\n';
+            break;
         case 't':
             sidx='\t';
+            break;
         default:
             sidx='_';
+            STATS_ADD(unmapped_chars,1);
+            break;
         }
       } else
       if (sidx=='%')
@@ -249,21 +357,21 @@ short str_data_encode_r(unsigned char **edata,long *edata_len,
         {
             //Closing the previous chunk
             write_int32_le_buf((*edata)+blockpos,chunk_type+(eidx<<8));
-            while ((eidx%4)!=0)
-            { (*edata)[blockpos+SIZEOF_STR_ChunkHeader+eidx]=0; eidx++; }
-            blockpos+=eidx+SIZEOF_STR_ChunkHeader;
-            eidx=0;
-            // Allocatinm memory for new one, and a little more
-            if ((blockpos+SIZEOF_STR_ChunkHeader+eidx+(SIZEOF_STR_ChunkHeader<<2))>(*edata_len))
+            STATS_ADD(chunks[chunk_type],1);
+            // Allocatinm memory for padding and new one, and a little more
+            if ((blockpos+SIZEOF_STR_ChunkHeader+eidx+3+(SIZEOF_STR_ChunkHeader<<2))>(*edata_len))
             {
-                (*edata_len)=blockpos+SIZEOF_STR_ChunkHeader+eidx+(SIZEOF_STR_ChunkHeader<<2);
-                (*edata)=realloc((*edata),(*edata_len)+1);
+                (*edata_len)=blockpos+SIZEOF_STR_ChunkHeader+eidx+3+(SIZEOF_STR_ChunkHeader<<2);
+                (*edata)=str_realloc((*edata),(*edata_len)+1);
                 if ((*edata)==NULL)
                 {
-                    str_error("Can't allocate memory for parameter when encoding STR entry from Unicode");
-                    return -1;
+                    return ERR_NO_MEMORY;
                 }
             }
+            while ((eidx%4)!=0)
+            { (*edata)[blockpos+SIZEOF_STR_ChunkHeader+eidx]=0; eidx++; }
+            blockpos+=eidx+SIZEOF_STR_ChunkHeader;
+            eidx=0;
             // Param chunk has only header
         //TODO: write the code to handle parameters
             chunk_type=CTSTR_PARAM;
@@ -277,6 +385,7 @@ short str_data_encode_r(unsigned char **edata,long *edata_len,
             // Closing the param chunk
             // It always have four bytes, so zero-padding isn't neccessary
             write_int32_le_buf((*edata)+blockpos,chunk_type+(sidx<<8));
+            STATS_ADD(chunks[chunk_type],1);
             blockpos+=eidx+SIZEOF_STR_ChunkHeader;
             eidx=0;
             chunk_type=CTSTR_STRING;
@@ -287,14 +396,14 @@ short str_data_encode_r(unsigned char **edata,long *edata_len,
       unsigned short chr;
       // Using MBToUni instead of UniToMB, as I have no idea how to handle MBToUni.
       int k;
-      chr='_';
-      for (k=0;k<mb2uni_count;k++)
+      k=str_codepage_index(mb2uni,mb2uni_count,sidx);
+      if (k>=0)
       {
-          if (mb2uni[k]==sidx)
-          {
-              chr=k;
-              break;
-          }
+          chr=k;
+      } else
+      {
+          chr='_';
+          STATS_ADD(unmapped_chars,1);
       }
       //printf(" *%04x",k);
 
@@ -307,28 +416,21 @@ short str_data_encode_r(unsigned char **edata,long *edata_len,
          chrlen++;
          k-=254;
       }
+      STATS_ADD(escape_bytes,chrlen-1);
       if ((blockpos+SIZEOF_STR_ChunkHeader+eidx+chrlen)>(*edata_len))
       {
           (*edata_len)=(blockpos+(SIZEOF_STR_ChunkHeader<<1)+eidx+chrlen);
-          (*edata)=realloc((*edata),(*edata_len)+1);
+          (*edata)=str_realloc((*edata),(*edata_len)+1);
           if ((*edata)==NULL)
           {
-            str_error("Can't allocate memory when encoding STR entry from Unicode");
-            return -1;
+            return ERR_NO_MEMORY;
           }
       }
-      k=chr;
-      while (k>=255)
-      {
-         (*edata)[blockpos+SIZEOF_STR_ChunkHeader+eidx]=(unsigned char)(0xff);
-         eidx++;
-         k-=254;
-      }
-      (*edata)[blockpos+SIZEOF_STR_ChunkHeader+eidx]=(unsigned char)(k);
-      eidx++;
+      eidx+=str_char_encode((*edata)+blockpos+SIZEOF_STR_ChunkHeader+eidx,chr);
   }
   // Closing previous chunk
   write_int32_le_buf((*edata)+blockpos,chunk_type+(eidx<<8));
+  STATS_ADD(chunks[chunk_type],1);
   // No zero padding at end of whole entry (just don't ask..)
 //TODO: suspicious
 //  while ((eidx%4)!=0)
@@ -340,14 +442,14 @@ short str_data_encode_r(unsigned char **edata,long *edata_len,
   if ((blockpos+SIZEOF_STR_ChunkHeader+eidx)!=(*edata_len))
   {
       (*edata_len)=(blockpos+SIZEOF_STR_ChunkHeader+eidx);
-      (*edata)=realloc((*edata),(*edata_len)+1);
+      (*edata)=str_realloc((*edata),(*edata_len)+1);
       if ((*edata)==NULL)
       {
-          str_error("Can't allocate memory to end encoding STR entry from Unicode");
-          return -1;
+          return ERR_NO_MEMORY;
       }
   }
   write_int32_le_buf((*edata)+blockpos,chunk_type);
+  STATS_ADD(chunks[chunk_type],1);
   //printf("Finished\n");
   return ERR_NONE;
 }
@@ -375,6 +477,7 @@ int str_data_strchunk_decode(unsigned short *udata,
       chr=(unsigned char)edata[i];
       if (chr==0xff)
       {
+        STATS_ADD(escape_bytes,1);
         mbidx+=254;
         continue;
       }
@@ -383,7 +486,10 @@ int str_data_strchunk_decode(unsigned short *udata,
       if (mbidx<mb2uni_count)
         uchr=mb2uni[mbidx];
       else
+      {
         uchr=(unsigned char)'_';
+        STATS_ADD(unmapped_chars,1);
+      }
       if (uchr=='%')
       {
           udata[udata_len]='%';
@@ -415,7 +521,7 @@ int str_data_strchunk_decode(unsigned short *udata,
 
 /**
  * Decodes STR file entry into Unicode string and returns it.
- * @return Returns ERR_NONE on success.
+ * @return Returns ERR_NONE on success, or negative ERR_* code.
  */
 short str_data_decode(unsigned short **udata,long *udata_len,
     const unsigned short *mb2uni,const long mb2uni_count,
@@ -424,12 +530,12 @@ short str_data_decode(unsigned short **udata,long *udata_len,
   //printf("Decoding entry...\n");
   int uidx,eidx;
   (*udata_len)=(edata_len<<1);
-  (*udata)=malloc(((*udata_len)+1)*sizeof(unsigned short));
+  (*udata)=str_malloc(((*udata_len)+1)*sizeof(unsigned short));
   if ((*udata)==NULL)
   {
-    str_error("Can't allocate memory to start decoding STR entry to Unicode");
-    return -1;
+    return ERR_NO_MEMORY;
   }
+  STATS_ADD(entries_decoded,1);
   uidx=0;
   eidx=0;
   unsigned int chunk_type=CTSTR_END;
@@ -437,10 +543,8 @@ short str_data_decode(unsigned short **udata,long *udata_len,
   do {
     if (eidx+SIZEOF_STR_ChunkHeader>edata_len)
     {
-      str_ferror("Data too short for next chunk header");
-      str_ferror("Last type %d, size %d, total %d",chunk_type,chunk_len,edata_len);
       (*udata)[uidx]=0;
-      return -1;
+      return ERR_CHUNK_HEADER;
     }
     chunk_type=read_int32_le_buf(edata+eidx);
     eidx += 4;
@@ -452,9 +556,8 @@ short str_data_decode(unsigned short **udata,long *udata_len,
     case CTSTR_END:
         if (chunk_len!=0)
         {
-            str_ferror("Entry end chunk has nonzero size");
             (*udata)[uidx]=0;
-            return -1;
+            return ERR_END_CHUNK;
         }
         break;
     case CTSTR_PARAM:
@@ -464,11 +567,10 @@ short str_data_decode(unsigned short **udata,long *udata_len,
             {
                 //printf("realloc! %d to %d\n",(*udata_len),(uidx+8));
                 (*udata_len)=(uidx+8);
-                (*udata)=realloc((*udata),((*udata_len)+1)*sizeof(unsigned short));
+                (*udata)=str_realloc((*udata),((*udata_len)+1)*sizeof(unsigned short));
                 if ((*udata)==NULL)
                 {
-                    str_error("Can't allocate memory when decoding STR chunk to Unicode");
-                    return -1;
+                    return ERR_NO_MEMORY;
                 }
             }
             (*udata)[uidx]='%';
@@ -490,9 +592,8 @@ short str_data_decode(unsigned short **udata,long *udata_len,
         //printf("string, uidx=%d\n",uidx);
         if (eidx+chunk_len>edata_len)
         {
-            str_error("Entry length exceeds file size");
             (*udata)[uidx]=0;
-            return -1;
+            return ERR_ENTRY_LENGTH;
         }
         if (chunk_len>0)
         {
@@ -500,11 +601,10 @@ short str_data_decode(unsigned short **udata,long *udata_len,
             {
                 //printf("realloc! %d to %d\n",(*udata_len),(uidx+chunk_len));
                 (*udata_len)=(uidx+chunk_len);
-                (*udata)=realloc((*udata),((*udata_len)+1)*sizeof(unsigned short));
+                (*udata)=str_realloc((*udata),((*udata_len)+1)*sizeof(unsigned short));
                 if ((*udata)==NULL)
                 {
-                    str_error("Can't allocate memory when decoding STR chunk to Unicode");
-                    return -1;
+                    return ERR_NO_MEMORY;
                 }
             }
            // decode
@@ -519,22 +619,20 @@ short str_data_decode(unsigned short **udata,long *udata_len,
         break;
     default:
         {
-            str_ferror("Bad STR chunk type %02x",chunk_type);
             (*udata)[uidx]=0;
-            return -1;
+            return ERR_CHUNK_TYPE;
         }
     }
+    STATS_ADD(chunks[chunk_type],1);
     if ((eidx%4)!=0) eidx += 4-(eidx%4);
   } while (chunk_type!=CTSTR_END);
   if ((uidx)!=(*udata_len))
   {
       (*udata_len)=(uidx);
-      (*udata)=realloc((*udata),((*udata_len)+1)*sizeof(unsigned short));
+      (*udata)=str_realloc((*udata),((*udata_len)+1)*sizeof(unsigned short));
       if ((*udata)==NULL)
       {
-          str_error("Can't allocate memory to end decoding STR entry to Unicode");
-          str_ferror("wanted %d bytes",((*udata_len)+1)*sizeof(unsigned short));
-          return -1;
+          return ERR_NO_MEMORY;
       }
   }
   (*udata)[uidx]=0;
@@ -542,6 +640,72 @@ short str_data_decode(unsigned short **udata,long *udata_len,
   return ERR_NONE;
 }
 
+/**
+ * Decodes STR file entry into Unicode string and returns it.
+ * This version doesn't check the entry structure, so it can only be used
+ * on entries which passed strmaker_validate(). Every encoded byte gives
+ * at most two characters, so the output buffer never has to grow.
+ * @return Returns ERR_NONE on success, or negative ERR_* code.
+ */
+short str_data_decode_unchecked(unsigned short **udata,long *udata_len,
+    const unsigned short *mb2uni,const long mb2uni_count,
+    const unsigned char *edata,const long edata_len)
+{
+  unsigned short *str;
+  unsigned long chunk;
+  unsigned int chunk_len;
+  long uidx,eidx;
+  int val;
+  str=str_malloc(((edata_len<<1)+1)*sizeof(unsigned short));
+  if (str==NULL)
+  {
+    (*udata)=NULL;
+    return ERR_NO_MEMORY;
+  }
+  STATS_ADD(entries_decoded,1);
+  uidx=0;
+  eidx=0;
+  while (1)
+  {
+    chunk=read_int32_le_buf(edata+eidx);
+    eidx+=SIZEOF_STR_ChunkHeader;
+    chunk_len=(chunk>>8);
+    STATS_ADD(chunks[chunk&0xff],1);
+    if ((chunk&0xff)==CTSTR_END)
+      break;
+    if ((chunk&0xff)==CTSTR_PARAM)
+    {
+      str[uidx]='%';
+      uidx++;
+      val=(chunk_len+1)/10;
+      if (val>0)
+      {
+        str[uidx]='0'+val;
+        uidx++;
+      }
+      str[uidx]='0'+(chunk_len+1)%10;
+      uidx++;
+    } else
+    if (chunk_len>0)
+    {
+      val=str_data_strchunk_decode(str+uidx,mb2uni,mb2uni_count,edata+eidx,chunk_len);
+      if (val>0)
+        uidx+=val;
+      eidx+=chunk_len;
+      eidx=(eidx+3)&(~3);
+    }
+  }
+  (*udata_len)=uidx;
+  (*udata)=str_realloc(str,(uidx+1)*sizeof(unsigned short));
+  if ((*udata)==NULL)
+  {
+    str_free(str);
+    return ERR_NO_MEMORY;
+  }
+  (*udata)[uidx]=0;
+  return ERR_NONE;
+}
+
 /**
  * Sets allocated amount of offset entries in STR_Maker.
  * @return Returns ERR_NONE on success.
@@ -550,13 +714,13 @@ short strmaker_set_offsalloc(struct STR_Maker *mkstr,unsigned int count)
 {
   unsigned int prev_count=mkstr->offs_alloc;
   mkstr->offs_alloc=count;
-  mkstr->offsets=realloc(mkstr->offsets,mkstr->offs_alloc*sizeof(long));
+  mkstr->offsets=str_realloc(mkstr->offsets,mkstr->offs_alloc*sizeof(long));
   if ((mkstr->offs_alloc!=0)&&(mkstr->offsets==NULL))
       return -1;
   if (prev_count<mkstr->offs_alloc)
   {
     int i;
-    for (i=mkstr->offs_alloc-prev_count;i<mkstr->offs_alloc;i++)
+    for (i=prev_count;i<mkstr->offs_alloc;i++)
         mkstr->offsets[i]=-1;
   }
   return ERR_NONE;
@@ -570,7 +734,7 @@ short strmaker_set_dataalloc(struct STR_Maker *mkstr,unsigned long len)
 {
   unsigned int prev_len=mkstr->data_alloc;
   mkstr->data_alloc=len;
-  mkstr->data=realloc(mkstr->data,mkstr->data_alloc*sizeof(unsigned char));
+  mkstr->data=str_realloc(mkstr->data,mkstr->data_alloc*sizeof(unsigned char));
   if ((mkstr->data_alloc!=0)&&(mkstr->data==NULL))
       return -1;
   if (prev_len<mkstr->data_alloc)
@@ -598,6 +762,8 @@ short strmaker_add_entry(struct STR_Maker *mkstr,unsigned char *edata,unsigned l
       result=strmaker_set_offsalloc(mkstr,mkstr->offs_count+4);
   if (result!=ERR_NONE)
       return result;
+  // The new entry wasn't validated
+  mkstr->validated=0;
   while ((mkstr->data_len%4)>0)
   {
       mkstr->data[mkstr->data_len]=0;
@@ -615,6 +781,133 @@ short strmaker_add_entry(struct STR_Maker *mkstr,unsigned char *edata,unsigned l
   return ERR_NONE;
 }
 
+/**
+ * Adds entry which shares data with existing entry of given index.
+ * Only the offset is added; the data block isn't changed.
+ * @return Returns ERR_NONE on success.
+ */
+short strmaker_add_shared_entry(struct STR_Maker *mkstr,unsigned int entryidx)
+{
+  short result=ERR_NONE;
+  if (entryidx>=mkstr->offs_count)
+      return -1;
+  if (mkstr->offs_count+1>mkstr->offs_alloc)
+      result=strmaker_set_offsalloc(mkstr,mkstr->offs_count+4);
+  if (result!=ERR_NONE)
+      return result;
+  mkstr->offsets[mkstr->offs_count]=mkstr->offsets[entryidx];
+  mkstr->offs_count++;
+  return ERR_NONE;
+}
+
+/**
+ * Replaces or adds encoded entries in STR_Maker.
+ * The data block is rebuilt in one pass: unchanged entries are moved
+ * to their new positions, replaced ones are copied from edata array,
+ * and the offsets are shifted accordingly. Indices beyond the current
+ * entries count are allowed - the gap is filled with empty entries; but
+ * they must be lower than STR_MAX_ENTRY_INDEX.
+ * @param indices Indices of entries to replace, sorted in ascending order.
+ * @param edata Encoded data of the new entries.
+ * @param edata_len Sizes of the encoded entries.
+ * @param count Amount of items in the previous arrays.
+ * @return Returns ERR_NONE on success.
+ */
+short strmaker_replace_entries(struct STR_Maker *mkstr,const unsigned int *indices,
+    unsigned char **edata,const long *edata_len,unsigned int count,short flags)
+{
+  // Encoded empty string - text chunk with no characters and end chunk
+  static const unsigned char empty_entry[SIZEOF_STR_ChunkHeader<<1]={CTSTR_STRING,0,0,0,CTSTR_END,0,0,0};
+  unsigned int new_count;
+  unsigned long new_len;
+  unsigned int i,k;
+  char *src;
+  long len;
+  new_count=mkstr->offs_count;
+  if ((count>0)&&(indices[count-1]>=new_count))
+  {
+      // Protects from overflow of the count and huge allocations
+      if (indices[count-1]>=STR_MAX_ENTRY_INDEX)
+      {
+          if (flags&STRFLAG_VERBOSE)
+            str_ferror("Entry %u is beyond the highest allowed index %u",indices[count-1],
+                STR_MAX_ENTRY_INDEX-1);
+          return -1;
+      }
+      new_count=indices[count-1]+1;
+  }
+  // Compute size of the new data block
+  new_len=0;
+  k=0;
+  for (i=0;i<new_count;i++)
+  {
+      if ((k<count)&&(indices[k]==i))
+      {
+          len=edata_len[k];
+          k++;
+      } else
+      if (i<mkstr->offs_count)
+      {
+          len=strmaker_get_entry(mkstr,&src,i,flags);
+      } else
+      {
+          len=sizeof(empty_entry);
+      }
+      new_len+=(len+3)&(~3);
+  }
+  unsigned char *new_data;
+  long *new_offsets;
+  new_data=str_malloc(new_len+16);
+  new_offsets=str_malloc((new_count+2)*sizeof(long));
+  if ((new_data==NULL)||(new_offsets==NULL))
+  {
+      if (flags&STRFLAG_VERBOSE)
+        str_error("Can't allocate memory for replacing entries");
+      str_free(new_data);
+      str_free(new_offsets);
+      return -1;
+  }
+  // Move the entries into new block
+  new_len=0;
+  k=0;
+  for (i=0;i<new_count;i++)
+  {
+      if ((k<count)&&(indices[k]==i))
+      {
+          src=(char *)edata[k];
+          len=edata_len[k];
+          k++;
+      } else
+      if (i<mkstr->offs_count)
+      {
+          len=strmaker_get_entry(mkstr,&src,i,flags);
+      } else
+      {
+          src=(char *)empty_entry;
+          len=sizeof(empty_entry);
+      }
+      new_offsets[i]=new_len;
+      if (len>0)
+          memcpy(new_data+new_len,src,len);
+      new_len+=len;
+      while ((new_len%4)>0)
+      {
+          new_data[new_len]=0;
+          new_len++;
+      }
+  }
+  str_free(mkstr->data);
+  str_free(mkstr->offsets);
+  mkstr->data=new_data;
+  mkstr->data_alloc=new_len+16;
+  mkstr->data_len=new_len;
+  mkstr->offsets=new_offsets;
+  mkstr->offs_alloc=new_count+2;
+  mkstr->offs_count=new_count;
+  mkstr->validated=0;
+  return ERR_NONE;
+}
+
 /**
  * Encodes given Unicode text entry and places it in STR_Maker structure.
  * @return Returns ERR_NONE on success.
@@ -625,20 +918,41 @@ short strmaker_add_unicode_entry(struct STR_Maker *mkstr,unsigned short *udata,s
   long udata_len=unicode_strlen(udata);
   unsigned char *edata;
   long edata_len;
+  // If the text was encoded before, use the cached data
+  if (mkstr->enccache!=NULL)
+  {
+    const unsigned char *cdata;
+    if (enccache_get(mkstr->enccache,udata,udata_len,&cdata,&edata_len))
+    {
+      if (flags&STRFLAG_DEBUG)
+          printf("Using cached encoding\n");
+      result=strmaker_add_entry(mkstr,(unsigned char *)cdata,edata_len);
+      if ((result!=ERR_NONE)&&(flags&STRFLAG_VERBOSE))
+        str_error("Error on adding STR_Maker entry");
+      return result;
+    }
+  }
+  short traced=TRACE_ENTRY_ENABLED(udata_len);
+  if (traced)
+    trace_begin_index("encode entry",mkstr->offs_count);
   //result=str_data_encode(&edata,&edata_len,mkstr->uni2mb,mkstr->uni2mb_count,udata,udata_len);
   result=str_data_encode_r(&edata,&edata_len,mkstr->mb2uni,mkstr->mb2uni_count,
       udata,udata_len);
+  if (traced)
+    trace_end("encode entry");
   //printf("Have: ");int i;
   //for (i=0;i<edata_len;i++) printf("%02x ",edata[i]);
   //printf("\n");
   if (result!=ERR_NONE)
   {
       if (flags&STRFLAG_VERBOSE)
-        str_error("Error on unicode string encoding");
+        str_ferror("%s on unicode string encoding",str_error_text(result));
       return result;
   }
+  if (mkstr->enccache!=NULL)
+      enccache_put(mkstr->enccache,udata,udata_len,edata,edata_len);
   result=strmaker_add_entry(mkstr,edata,edata_len);
-  free(edata);
+  str_free(edata);
   if (result!=ERR_NONE)
   {
       if (flags&STRFLAG_VERBOSE)
@@ -652,22 +966,25 @@ short strmaker_add_unicode_entry(struct STR_Maker *mkstr,unsigned short *udata,s
 
 /**
  * Decodes STR entry of given index and returns it in udata pointer.
- * @return Returns size of the entry, or negative error code.
+ * The amount of characters is returned in udata_len, which doesn't
+ * limit the entry size like the short return value would.
+ * @return Returns ERR_NONE on success, or negative error code.
  */
-short strmaker_get_unicode_entry(const struct STR_Maker *mkstr,
-    unsigned short **udata,int index,short flags)
+short strmaker_decode_entry(const struct STR_Maker *mkstr,
+    unsigned short **udata,long *udata_len,int index,short flags)
 {
     char *edata;
     int edata_len;
+    (*udata_len)=0;
     // Get the encoded data
     edata_len=strmaker_get_entry(mkstr,&edata,index,flags);
     if (flags&STRFLAG_DEBUG)
         printf("Got entry, size %d\n",edata_len);
     if ((edata_len<=0)||(edata==NULL))
     {
-      (*udata)=malloc(2*sizeof(unsigned short));
+      (*udata)=str_malloc(2*sizeof(unsigned short));
       if ((*udata)!=NULL) (*udata)[0]=0;
-      if (edata_len==0) return 0;
+      if (edata_len==0) return ERR_NONE;
       if (edata_len>0) edata_len=-1;
       if (flags&STRFLAG_VERBOSE)
         str_error("Error in STR structure");
@@ -675,12 +992,176 @@ short strmaker_get_unicode_entry(const struct STR_Maker *mkstr,
     }
     // Decode it
     short result;
-    long udata_len;
-    result=str_data_decode(udata,&udata_len,mkstr->mb2uni,mkstr->mb2uni_count,
-        edata,edata_len);
+    short traced=TRACE_ENTRY_ENABLED(edata_len);
+    if (traced)
+      trace_begin_index("decode entry",index);
+    if (mkstr->validated)
+      result=str_data_decode_unchecked(udata,udata_len,mkstr->mb2uni,mkstr->mb2uni_count,
+          (unsigned char *)edata,edata_len);
+    else
+      result=str_data_decode(udata,udata_len,mkstr->mb2uni,mkstr->mb2uni_count,
+          edata,edata_len);
+    if (traced)
+      trace_end("decode entry");
     if (result!=ERR_NONE)
+    {
+        if (flags&STRFLAG_VERBOSE)
+          str_ferror("%s in entry %d",str_error_text(result),index);
         return result;
-    return udata_len;
+    }
+    return ERR_NONE;
+}
+
+/**
+ * Decodes STR entry of given index and returns it in udata pointer.
+ * @return Returns ERR_NONE on success, or negative error code.
+ */
+short strmaker_get_unicode_entry(const struct STR_Maker *mkstr,
+    unsigned short **udata,int index,short flags)
+{
+    long udata_len;
+    return strmaker_decode_entry(mkstr,udata,&udata_len,index,flags);
+}
+
+struct STR_EntryOffset {
+    long offs;
+    unsigned int index;
+    };
+
+static int entry_offset_cmp(const void *ptr1,const void *ptr2)
+{
+  const struct STR_EntryOffset *eo1=ptr1;
+  const struct STR_EntryOffset *eo2=ptr2;
+  if (eo1->offs!=eo2->offs)
+    return (eo1->offs<eo2->offs)?-1:1;
+  return (eo1->index<eo2->index)?-1:1;
+}
+
+static int entry_index_cmp(const void *ptr1,const void *ptr2)
+{
+  unsigned int idx1=*(const unsigned int *)ptr1;
+  unsigned int idx2=*(const unsigned int *)ptr2;
+  if (idx1!=idx2)
+    return (idx1<idx2)?-1:1;
+  return 0;
+}
+
+/**
+ * Checks if given range of data block lies within text of a CTSTR_STRING
+ * chunk of the entry starting at given offset, and doesn't start in
+ * the middle of escaped character.
+ * @return Returns 1 if the range is a text inside the entry, 0 otherwise.
+ */
+short strmaker_is_text_range(const struct STR_Maker *mkstr,long start,long offs,long len)
+{
+  long pos=start;
+  unsigned int chunk_type,chunk_len;
+  while (pos+SIZEOF_STR_ChunkHeader<=mkstr->data_len)
+  {
+    chunk_type=read_int32_le_buf(mkstr->data+pos);
+    chunk_len=(chunk_type>>8);
+    chunk_type&=0xff;
+    pos+=SIZEOF_STR_ChunkHeader;
+    switch (chunk_type)
+    {
+    case CTSTR_STRING:
+        if ((offs>=pos)&&(offs+len<=pos+chunk_len))
+        {
+          if ((offs>pos)&&(mkstr->data[offs-1]==0xff))
+            return 0;
+          return 1;
+        }
+        pos+=chunk_len;
+        break;
+    case CTSTR_PARAM:
+        break;
+    case CTSTR_END:
+    default:
+        return 0;
+    }
+    if (pos>offs)
+      return 0;
+    if ((pos%4)!=0) pos+=4-(pos%4);
+  }
+  return 0;
+}
+
+/**
+ * Searches for encoded text in all entries of STR_Maker, without
+ * decoding them. Data block is scanned for the byte sequence, and every
+ * hit is mapped to entry through the offsets table.
+ * @param pattern Text encoded by str_text_encode().
+ * @param indices Output for the array of matching entry indices.
+ * @return Returns amount of matching entries, or negative error code.
+ */
+int strmaker_search(const struct STR_Maker *mkstr,const unsigned char *pattern,
+    long pattern_len,unsigned int **indices)
+{
+  struct STR_EntryOffset *sorted;
+  unsigned int count,i;
+  long pos,last_start;
+  (*indices)=NULL;
+  if ((pattern_len<1)||(mkstr->offs_count<1))
+    return 0;
+  // Entries sorted by offset, for mapping hits back to entries
+  sorted=str_malloc(mkstr->offs_count*sizeof(struct STR_EntryOffset));
+  (*indices)=str_malloc(mkstr->offs_count*sizeof(unsigned int));
+  if ((sorted==NULL)||((*indices)==NULL))
+  {
+    str_free(sorted);
+    str_free(*indices);
+    (*indices)=NULL;
+    return -1;
+  }
+  for (i=0;i<mkstr->offs_count;i++)
+  {
+    sorted[i].offs=mkstr->offsets[i];
+    sorted[i].index=i;
+  }
+  qsort(sorted,mkstr->offs_count,sizeof(struct STR_EntryOffset),entry_offset_cmp);
+  count=0;
+  last_start=-1;
+  pos=0;
+  while (pos+pattern_len<=mkstr->data_len)
+  {
+    const unsigned char *hit;
+    hit=memchr(mkstr->data+pos,pattern[0],mkstr->data_len-pattern_len+1-pos);
+    if (hit==NULL)
+      break;
+    pos=hit-mkstr->data;
+    if (memcmp(hit+1,pattern+1,pattern_len-1)==0)
+    {
+      // Find the last entry starting at or before the hit
+      unsigned int lo=0,hi=mkstr->offs_count;
+      while (hi-lo>1)
+      {
+        unsigned int mid=(lo+hi)>>1;
+        if (sorted[mid].offs<=pos)
+          lo=mid;
+        else
+          hi=mid;
+      }
+      long start=sorted[lo].offs;
+      if ((start>=0)&&(start<=pos)&&(start!=last_start)&&
+          (strmaker_is_text_range(mkstr,start,pos,pattern_len)))
+      {
+        // Add all entries which share this data
+        while ((lo>0)&&(sorted[lo-1].offs==start))
+          lo--;
+        while ((lo<mkstr->offs_count)&&(sorted[lo].offs==start))
+        {
+          (*indices)[count]=sorted[lo].index;
+          count++;
+          lo++;
+        }
+        last_start=start;
+      }
+    }
+    pos++;
+  }
+  str_free(sorted);
+  qsort(*indices,count,sizeof(unsigned int),entry_index_cmp);
+  return count;
 }
 
 /**
@@ -704,6 +1185,8 @@ short strmaker_clear(struct STR_Maker *mkstr)
   mkstr->uni2mb_count=0;
   mkstr->file_id=0;
   mkstr->iosize=0;
+  mkstr->enccache=NULL;
+  mkstr->validated=0;
   return ERR_NONE;
 }
 
@@ -713,11 +1196,11 @@ short strmaker_clear(struct STR_Maker *mkstr)
  */
 short strmaker_free(struct STR_Maker *mkstr)
 {
-  free(mkstr->offsets);
-  free(mkstr->data);
-  free(mkstr->mb2uni);
-  free(mkstr->uni2mb);
-  free(mkstr);
+  str_free(mkstr->offsets);
+  str_free(mkstr->data);
+  str_free(mkstr->mb2uni);
+  str_free(mkstr->uni2mb);
+  str_free(mkstr);
   return ERR_NONE;
 }
 
@@ -747,7 +1230,7 @@ short str_mb2uni_fread(struct STR_Maker *mkstr,FILE *fp,short flags)
       return -1;
   }
   dlen-=6;
-  mkstr->mb2uni=malloc(dlen);
+  mkstr->mb2uni=str_malloc(dlen);
   if (mkstr->mb2uni==NULL)
   {
       if (flags&STRFLAG_VERBOSE)
@@ -755,6 +1238,7 @@ short str_mb2uni_fread(struct STR_Maker *mkstr,FILE *fp,short flags)
       return -1;
   }
   nread=fread(mkstr->mb2uni,1,dlen,fp);
+  STATS_ADD(bytes_read,nread+6);
   mkstr->mb2uni_count = (dlen>>1);
   if (nread!=dlen)
   {
@@ -791,7 +1275,7 @@ short str_uni2mb_fread(struct STR_Maker *mkstr,FILE *fp,short flags)
       return -1;
   }
   dlen-=6;
-  mkstr->uni2mb=malloc(dlen);
+  mkstr->uni2mb=str_malloc(dlen);
   if (mkstr->uni2mb==NULL)
   {
       if (flags&STRFLAG_VERBOSE)
@@ -810,11 +1294,12 @@ short str_uni2mb_fread(struct STR_Maker *mkstr,FILE *fp,short flags)
 }
 
 /**
- * Loads STR maker from current position of disk file.
+ * Loads STR header and offsets table from current position of disk file.
+ * After this call, the file position is at start of the data block.
  * Requires the STR_Maker to be allocated before.
  * @return Returns ERR_NONE on success.
  */
-short strmaker_fread(struct STR_Maker *mkstr,FILE *fp,short flags)
+short strmaker_fread_header(struct STR_Maker *mkstr,FILE *fp,short flags)
 {
   long nread=0;
   int i;
@@ -847,7 +1332,22 @@ short strmaker_fread(struct STR_Maker *mkstr,FILE *fp,short flags)
       nread += 4;
   }
   mkstr->disksize=file_length_opened(fp);
-  long length=mkstr->disksize-SIZEOF_STR_Header-offs_delta;
+  return ERR_NONE;
+}
+
+/**
+ * Loads STR maker from current position of disk file.
+ * Requires the STR_Maker to be allocated before.
+ * @return Returns ERR_NONE on success.
+ */
+short strmaker_fread(struct STR_Maker *mkstr,FILE *fp,short flags)
+{
+  long nread;
+  short result;
+  result=strmaker_fread_header(mkstr,fp,flags);
+  if (result!=ERR_NONE)
+      return result;
+  long length=mkstr->disksize-SIZEOF_STR_Header-(mkstr->offs_count<<2);
   if (length<1)
   {
       if (flags&STRFLAG_VERBOSE)
@@ -863,6 +1363,7 @@ short strmaker_fread(struct STR_Maker *mkstr,FILE *fp,short flags)
   }
   mkstr->data_len=length;
   nread=fread(mkstr->data,1,length,fp);
+  STATS_ADD(bytes_read,SIZEOF_STR_Header+(mkstr->offs_count<<2)+nread);
   if (nread!=length)
   {
       if (flags&STRFLAG_VERBOSE)
@@ -874,6 +1375,14 @@ short strmaker_fread(struct STR_Maker *mkstr,FILE *fp,short flags)
       }
       return -1;
   }
+  // Malformed entries are rejected here, so they can be decoded without checks
+  struct STR_Error err;
+  if (strmaker_validate(mkstr,&err)!=ERR_NONE)
+  {
+      if (flags&STRFLAG_VERBOSE)
+        str_ferror("%s",err.message);
+      return -1;
+  }
   return ERR_NONE;
 }
 
@@ -901,9 +1410,128 @@ short strmaker_fwrite(struct STR_Maker *mkstr,FILE *fp,short flags)
   return ERR_NONE;
 }
 
+/**
+ * Computes length of encoded entry by walking through its chunks.
+ * @param edata Encoded entry data.
+ * @param maxlen Amount of data available; returned if end chunk is missing.
+ * @return Returns size of the entry, including its end chunk.
+ */
+long str_entry_length(const unsigned char *edata,long maxlen)
+{
+  long eidx=0;
+  unsigned long chunk;
+  while (eidx+SIZEOF_STR_ChunkHeader<=maxlen)
+  {
+      chunk=read_int32_le_buf(edata+eidx);
+      eidx+=SIZEOF_STR_ChunkHeader;
+      if ((chunk&0xff)==CTSTR_END)
+          return eidx;
+      if ((chunk&0xff)==CTSTR_STRING)
+          eidx+=(chunk>>8);
+      if ((eidx%4)!=0) eidx += 4-(eidx%4);
+  }
+  return maxlen;
+}
+
+/**
+ * Checks structure of all entries in STR_Maker: whether the offsets point
+ * into data block, and whether every chunk chain has known chunk types
+ * and ends with end chunk before end of the data. Entries sharing data
+ * are checked once. If the check passes, entries are decoded without
+ * any further checks.
+ * @param err Error structure, filled with description of the first
+ *     problem found; may be NULL.
+ * @return Returns ERR_NONE if all entries are correct.
+ */
+short strmaker_validate(struct STR_Maker *mkstr,struct STR_Error *err)
+{
+  long offs_min,offs_max,offs;
+  long eidx,chunk_start,limit,prev_limit;
+  unsigned long chunk;
+  unsigned int i;
+  mkstr->validated=0;
+  strctx_error_clear(err);
+  if (mkstr->offs_count==0)
+  {
+    mkstr->validated=1;
+    return ERR_NONE;
+  }
+  // Range of the whole offsets table, in a loop simple enough to vectorize
+  offs_min=mkstr->offsets[0];
+  offs_max=mkstr->offsets[0];
+  for (i=1;i<mkstr->offs_count;i++)
+  {
+    offs=mkstr->offsets[i];
+    offs_min=(offs<offs_min)?offs:offs_min;
+    offs_max=(offs>offs_max)?offs:offs_max;
+  }
+  if ((offs_min<0)||(offs_max+SIZEOF_STR_ChunkHeader>(long)mkstr->data_len))
+  {
+    // Find the exact entry only if there's a problem
+    for (i=0;i<mkstr->offs_count;i++)
+    {
+      offs=mkstr->offsets[i];
+      if ((offs<0)||(offs+SIZEOF_STR_ChunkHeader>(long)mkstr->data_len))
+        return strctx_error_set(err,-1,"Entry %u: offset %ld is outside of data block of %lu bytes",
+            i,offs,mkstr->data_len);
+    }
+  }
+  // Chunk chains; entries are usually in order, so shared ones are
+  // recognized by comparing with the previous entry. Every chain must
+  // end within the size given by strmaker_get_entry(), and alignment
+  // is counted from the entry start, as when decoding.
+  offs=-1;
+  prev_limit=-1;
+  for (i=0;i<mkstr->offs_count;i++)
+  {
+    limit=(long)mkstr->data_len-mkstr->offsets[i];
+    if ((i+1<mkstr->offs_count)&&(mkstr->offsets[i+1]>mkstr->offsets[i]))
+      limit=mkstr->offsets[i+1]-mkstr->offsets[i];
+    if ((mkstr->offsets[i]==offs)&&(limit==prev_limit))
+      continue;
+    offs=mkstr->offsets[i];
+    prev_limit=limit;
+    eidx=0;
+    while (1)
+    {
+      if (eidx+SIZEOF_STR_ChunkHeader>limit)
+        return strctx_error_set(err,ERR_CHUNK_HEADER,
+            "Entry %u: no end chunk within %ld bytes of the entry",i,limit);
+      chunk_start=offs+eidx;
+      chunk=read_int32_le_buf(mkstr->data+offs+eidx)&0xffffffffUL;
+      eidx+=SIZEOF_STR_ChunkHeader;
+      if ((chunk&0xff)==CTSTR_END)
+      {
+        if ((chunk>>8)!=0)
+          return strctx_error_set(err,ERR_END_CHUNK,
+              "Entry %u: end chunk at data offset %ld has nonzero size %lu",i,chunk_start,chunk>>8);
+        break;
+      }
+      if ((chunk&0xff)==CTSTR_STRING)
+      {
+        eidx+=(chunk>>8);
+        if (eidx>limit)
+          return strctx_error_set(err,ERR_ENTRY_LENGTH,
+              "Entry %u: string chunk at data offset %ld exceeds the entry by %ld bytes",
+              i,chunk_start,eidx-limit);
+        eidx=(eidx+3)&(~3);
+      } else
+      if ((chunk&0xff)!=CTSTR_PARAM)
+      {
+        return strctx_error_set(err,ERR_CHUNK_TYPE,
+            "Entry %u: chunk at data offset %ld has bad type %02lx",i,chunk_start,chunk&0xff);
+      }
+    }
+  }
+  mkstr->validated=1;
+  return ERR_NONE;
+}
+
 /**
  * Gives a specific entry from STR_Maker structure.
  * The entry is not copied nor decoded, just returned directly in edata pointer.
+ * Entries may share data, so the size is computed from entry chunks,
+ * and the next offset is only used as a limit.
  * @return Returns size of the entry, and its pointer in edata.
  */
 int strmaker_get_entry(const struct STR_Maker *mkstr,char **edata,unsigned int entryidx,short flags)
@@ -914,17 +1542,15 @@ int strmaker_get_entry(const struct STR_Maker *mkstr,char **edata,unsigned int e
       return 0;
   }
   long start=mkstr->offsets[entryidx];
-  if (start<0)
+  if ((start<0)||(start>=mkstr->data_len))
   {
       (*edata)=NULL;
       return 0;
   }
   (*edata)=mkstr->data+start;
+  long end=mkstr->data_len;
   entryidx++;
-  if (entryidx>=mkstr->offs_count)
-      return (mkstr->data_len - start);
-  long end=mkstr->offsets[entryidx];
-  if (end<start)
-      return (mkstr->data_len - start);
-  return (end - start);
+  if ((entryidx<mkstr->offs_count)&&(mkstr->offsets[entryidx]>start))
+      end=mkstr->offsets[entryidx];
+  return str_entry_length((unsigned char *)(*edata),end-start);
 }
@@ -20,12 +20,18 @@
 
 #include <stdio.h>
 
+// Entries may be added beyond end of STR file only below this index
+#define STR_MAX_ENTRY_INDEX 0x100000
+
 enum DK2STR_ChunkType {
         CTSTR_END                = 0x00,
         CTSTR_PARAM              = 0x02,
         CTSTR_STRING             = 0x01,
     };
 
+struct STR_EncCache;
+struct STR_Error;
+
 struct STR_Maker {
     char magic[4];
     unsigned int file_id;    // File ID is written in header of every STR
@@ -41,6 +47,8 @@ struct STR_Maker {
     unsigned short *uni2mb;
     unsigned long iosize;
     long disksize;
+    struct STR_EncCache *enccache; // Optional cache of encoded entries
+    short validated;         // Structure of all entries was checked by strmaker_validate()
     };
 
 #define SIZEOF_STR_Header 12
@@ -50,29 +58,54 @@ struct STR_Maker {
 
 short str_error(const char *msg);
 short str_ferror(const char *format, ...);
+const char *str_error_text(short code);
 
 char *filename_from_path(const char *pathname);
 
 short str_data_encode(unsigned char **edata,long *edata_len,
     const unsigned short *uni2mb,const long uni2mb_count,
     const unsigned short *udata,const long udata_len);
+long str_codepage_index(const unsigned short *mb2uni,const long mb2uni_count,
+    unsigned short uchr);
+int str_char_encode(unsigned char *edata,long mbidx);
+short str_text_encode(unsigned char **edata,long *edata_len,
+    const unsigned short *mb2uni,const long mb2uni_count,
+    const unsigned short *udata,const long udata_len,long *unmapped);
 short str_data_encode_r(unsigned char **edata,long *edata_len,
     const unsigned short *mb2uni,const long mb2uni_count,
     const unsigned short *udata,const long udata_len);
+int str_data_strchunk_decode(unsigned short *udata,
+    const unsigned short *mb2uni,const long mb2uni_count,
+    const unsigned char *edata,const long edata_len);
 short str_data_decode(unsigned short **udata,long *udata_len,
     const unsigned short *mb2uni,const long mb2uni_count,
     const unsigned char *edata,const long edata_len);
+short str_data_decode_unchecked(unsigned short **udata,long *udata_len,
+    const unsigned short *mb2uni,const long mb2uni_count,
+    const unsigned char *edata,const long edata_len);
 
 short strmaker_clear(struct STR_Maker *mkstr);
+short strmaker_set_offsalloc(struct STR_Maker *mkstr,unsigned int count);
+short strmaker_set_dataalloc(struct STR_Maker *mkstr,unsigned long len);
 short strmaker_free(struct STR_Maker *mkstr);
 short strmaker_add_entry(struct STR_Maker *mkstr,unsigned char *edata,unsigned long len);
+short strmaker_add_shared_entry(struct STR_Maker *mkstr,unsigned int entryidx);
+short strmaker_replace_entries(struct STR_Maker *mkstr,const unsigned int *indices,
+    unsigned char **edata,const long *edata_len,unsigned int count,short flags);
 short strmaker_add_unicode_entry(struct STR_Maker *mkstr,unsigned short *udata,short flags);
+short strmaker_decode_entry(const struct STR_Maker *mkstr,
+    unsigned short **udata,long *udata_len,int index,short flags);
 short strmaker_get_unicode_entry(const struct STR_Maker *mkstr,
     unsigned short **udata,int index,short flags);
 
 short str_mb2uni_fread(struct STR_Maker *mkstr,FILE *fp,short flags);
+short strmaker_fread_header(struct STR_Maker *mkstr,FILE *fp,short flags);
 short strmaker_fread(struct STR_Maker *mkstr,FILE *fp,short flags);
 short strmaker_fwrite(struct STR_Maker *mkstr,FILE *fp,short flags);
+int strmaker_search(const struct STR_Maker *mkstr,const unsigned char *pattern,
+    long pattern_len,unsigned int **indices);
+long str_entry_length(const unsigned char *edata,long maxlen);
+short strmaker_validate(struct STR_Maker *mkstr,struct STR_Error *err);
 int strmaker_get_entry(const struct STR_Maker *mkstr,char **edata,unsigned int entryidx,short flags);
 short convert_mb2uni(struct STR_Maker *mkstr,char *edata,unsigned short *str,unsigned long data_len);
 
@@ -0,0 +1,357 @@
+/******************************************************************************/
+/** @file strround.c
+ * Library for r/w of DK2 STR text strings files.
+ * @par Purpose:
+ *     Round-trip verification of STR files conversion.
+ * @par Comment:
+ *     Every STR file is decoded, written as text into memory, read back
+ *     and encoded again; the result is compared with original entries.
+ *     Files are processed in parallel, sharing one codepage.
+ * @par  Copying and copyrights:
+ *     This program is free software; you can redistribute it and/or modify
+ *     it under the terms of the GNU General Public License as published by
+ *     the Free Software Foundation; either version 2 of the License, or
+ *     (at your option) any later version.
+ */
+/******************************************************************************/
+
+#include "strround.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <dirent.h>
+#include "lbfileio.h"
+#include "unitext.h"
+#include "strfile.h"
+#include "strmaker.h"
+#include "strbatch.h"
+#include "strctx.h"
+#include "strthread.h"
+#include "strstats.h"
+#include "stralloc.h"
+
+struct STR_RoundTripJob {
+    const char *dirname;     // Folder of the STR files
+    struct STR_Context ctx;  // Context with shared codepage
+    struct STR_RoundTrip *items;
+    short flags;
+    };
+
+/**
+ * Compares entries of two STR_Maker structures, storing the differences.
+ */
+void str_roundtrip_compare(const struct STR_Maker *mkstr,const struct STR_Maker *mk2,
+    struct STR_RoundTrip *rt,short flags)
+{
+  unsigned int i;
+  int len1,len2;
+  char *edata1;
+  char *edata2;
+  rt->id_differs=(mkstr->file_id!=mk2->file_id);
+  rt->count_differs=(mkstr->offs_count!=mk2->offs_count);
+  for (i=0;i<mkstr->offs_count;i++)
+  {
+    len1=strmaker_get_entry(mkstr,&edata1,i,flags);
+    len2=strmaker_get_entry(mk2,&edata2,i,flags);
+    if ((len1==len2)&&((len1==0)||(memcmp(edata1,edata2,len1)==0)))
+      continue;
+    if (rt->mismatches<ROUNDTRIP_MAX_REPORTED)
+      rt->mismatch_idx[rt->mismatches]=i;
+    rt->mismatches++;
+  }
+  // Entries may be the same, but placed differently in data block
+  if ((rt->mismatches==0)&&(!rt->count_differs))
+  {
+    if ((mkstr->data_len!=mk2->data_len)||
+        (memcmp(mkstr->data,mk2->data,mkstr->data_len)!=0)||
+        (memcmp(mkstr->offsets,mk2->offsets,mkstr->offs_count*sizeof(long))!=0))
+      rt->layout_differs=1;
+  }
+}
+
+/**
+ * Verifies that STR data survives conversion to text and back.
+ * Everything is done in memory; the codepage from mkstr is used
+ * for both decoding and encoding.
+ * @param mkstr The STR file data, with codepage loaded.
+ * @param rt Round-trip result structure; counters must be cleared.
+ *     On failure, its error is filled with the reason.
+ * @param flags Flags used to manage the behaviour of the function.
+ * @return Returns ERR_NONE if the conversion succeeded, even if
+ *     the result differs; negative error code on failure.
+ */
+short str_roundtrip_maker(const struct STR_Maker *mkstr,struct STR_RoundTrip *rt,short flags)
+{
+  struct STR_File *strfile;
+  struct STR_File *strfile2;
+  struct TXT_File *txtfile;
+  struct STR_Maker *mk2;
+  unsigned int i;
+  short result;
+  short prev_phase;
+  rt->entries=mkstr->offs_count;
+  rt->str_size=SIZEOF_STR_Header+(mkstr->offs_count<<2)+mkstr->data_len;
+  strfile=str_malloc(sizeof(struct STR_File));
+  strfile2=str_malloc(sizeof(struct STR_File));
+  txtfile=str_malloc(sizeof(struct TXT_File));
+  mk2=str_malloc(sizeof(struct STR_Maker));
+  if ((strfile==NULL)||(strfile2==NULL)||(txtfile==NULL)||(mk2==NULL))
+  {
+    strctx_error_set(&rt->error,-1,"Cannot allocate memory for round-trip");
+    str_free(strfile);
+    str_free(strfile2);
+    str_free(txtfile);
+    str_free(mk2);
+    return -1;
+  }
+  str_clear(strfile);
+  str_clear(strfile2);
+  txtuni_clear(txtfile);
+  strmaker_clear(mk2);
+  // STR to text
+  prev_phase=stats_phase_enter(STAT_DECODE);
+  result=strfile_from_strmaker(strfile,mkstr,flags);
+  stats_phase_leave(prev_phase);
+  if (result!=ERR_NONE)
+  {
+    strctx_error_set(&rt->error,result,"Cannot decode entries");
+  } else
+  {
+    prev_phase=stats_phase_enter(STAT_LINES);
+    result=txtuni_add_header(txtfile,strfile->file_id);
+    for (i=0;(i<strfile->str_count)&&(result==ERR_NONE);i++)
+      result=txtuni_add_line(txtfile,strfile->str[i]);
+    if (result==ERR_NONE)
+      result=txtuni_index_lines(txtfile,flags);
+    stats_phase_leave(prev_phase);
+    if (result!=ERR_NONE)
+      strctx_error_set(&rt->error,result,"Cannot allocate memory for text");
+  }
+  // Text to STR
+  if (result==ERR_NONE)
+  {
+    prev_phase=stats_phase_enter(STAT_LINES);
+    result=str_from_txtuni(strfile2,txtfile,flags);
+    stats_phase_leave(prev_phase);
+    if (result!=ERR_NONE)
+      strctx_error_set(&rt->error,result,"Cannot read back the text");
+  }
+  if (result==ERR_NONE)
+  {
+    mk2->mb2uni=mkstr->mb2uni;
+    mk2->mb2uni_count=mkstr->mb2uni_count;
+    prev_phase=stats_phase_enter(STAT_ENCODE);
+    result=strmaker_from_strfile(mk2,strfile2,NULL,NULL,NULL,flags);
+    stats_phase_leave(prev_phase);
+    if (result!=ERR_NONE)
+      strctx_error_set(&rt->error,result,"Cannot encode entries");
+  }
+  if (result==ERR_NONE)
+    str_roundtrip_compare(mkstr,mk2,rt,flags);
+  // The codepage is shared, so it can't be freed with the maker
+  mk2->mb2uni=NULL;
+  mk2->mb2uni_count=0;
+  strmaker_free(mk2);
+  txtuni_free(txtfile);
+  str_close(strfile2,flags);
+  str_close(strfile,flags);
+  return result;
+}
+
+/**
+ * Verifies one file of the round-trip job; called from worker threads.
+ */
+void str_roundtrip_job_item(void *ctx,unsigned int index)
+{
+  struct STR_RoundTripJob *job=ctx;
+  struct STR_RoundTrip *rt;
+  struct STR_Maker *mkstr;
+  unsigned long long start;
+  char *fname;
+  rt=&job->items[index];
+  start=clock_ns();
+  fname=path_join(job->dirname,rt->name);
+  if (fname==NULL)
+  {
+    rt->result=strctx_error_set(&rt->error,-1,"Cannot allocate memory for file name");
+    return;
+  }
+  stats_file_enter(fname);
+  mkstr=strctx_open_maker(&job->ctx,fname,&rt->error);
+  str_free(fname);
+  if (mkstr==NULL)
+  {
+    rt->result=rt->error.code;
+  } else
+  {
+    rt->result=str_roundtrip_maker(mkstr,rt,job->flags);
+    strctx_close_maker(mkstr);
+  }
+  stats_file_leave();
+  rt->time_ns=clock_ns()-start;
+}
+
+/**
+ * Prints round-trip result of one file.
+ */
+void str_roundtrip_print(const struct STR_RoundTrip *rt)
+{
+  unsigned int i;
+  if (rt->result!=ERR_NONE)
+  {
+    printf("%s: %s\n",rt->name,rt->error.message);
+    return;
+  }
+  if (rt->id_differs)
+    printf("%s: file ID differs\n",rt->name);
+  if (rt->count_differs)
+    printf("%s: entries count differs\n",rt->name);
+  if (rt->mismatches>0)
+  {
+    printf("%s: %u of %u entries differ:",rt->name,rt->mismatches,rt->entries);
+    for (i=0;(i<rt->mismatches)&&(i<ROUNDTRIP_MAX_REPORTED);i++)
+      printf(" %u",rt->mismatch_idx[i]);
+    if (rt->mismatches>ROUNDTRIP_MAX_REPORTED)
+      printf(" ...");
+    printf("\n");
+  } else
+  if (rt->layout_differs)
+  {
+    printf("%s: entries match, data layout differs\n",rt->name);
+  }
+}
+
+/**
+ * Verifies that STR file, or all STR files in a folder, survive
+ * conversion to text and back without any change of entries.
+ * Files are verified in parallel; the results are printed in order.
+ * @param name STR file name without extension, or folder name.
+ * @param threads Amount of threads to use.
+ * @param flags Flags used to manage the behaviour of the function.
+ * @return Returns amount of files which didn't survive round-trip,
+ *     or negative error code.
+ */
+int str_roundtrip(const char *name,unsigned int threads,short flags)
+{
+  struct STR_RoundTripJob job;
+  struct STR_RoundTrip *items;
+  struct STR_Codepage *codepage;
+  struct STR_Error err;
+  char *strfname;
+  DIR *dir;
+  struct dirent *dent;
+  unsigned int count,alloc_count,i;
+  unsigned long entries;
+  unsigned long long bytes,start,elapsed;
+  int failed;
+  strfname=str_malloc(strlen(name)+5);
+  if (strfname==NULL)
+  {
+    if (flags&STRFLAG_VERBOSE)
+      str_error("Cannot allocate memory for round-trip");
+    return -1;
+  }
+  sprintf(strfname,"%s.str",name);
+  items=NULL;
+  count=0;
+  alloc_count=0;
+  job.dirname="";
+  // If there's no such STR file, treat the name as a folder
+  if (file_length(strfname)<0)
+  {
+    dir=opendir(name);
+    if (dir==NULL)
+    {
+      if (flags&STRFLAG_VERBOSE)
+        str_ferror("%s when opening %s",strerror(errno),strfname);
+      str_free(strfname);
+      return -1;
+    }
+    while ((dent=readdir(dir))!=NULL)
+    {
+      if (!fname_has_ext(dent->d_name,".str"))
+        continue;
+      if (count>=alloc_count)
+      {
+        struct STR_RoundTrip *new_items;
+        alloc_count+=64;
+        new_items=str_realloc(items,alloc_count*sizeof(struct STR_RoundTrip));
+        if (new_items==NULL)
+          break;
+        items=new_items;
+      }
+      memset(&items[count],0,sizeof(struct STR_RoundTrip));
+      items[count].name=str_malloc(strlen(dent->d_name)+1);
+      if (items[count].name==NULL)
+        break;
+      strcpy(items[count].name,dent->d_name);
+      count++;
+    }
+    closedir(dir);
+    job.dirname=name;
+    str_free(strfname);
+    strfname=path_join(name,"MBToUni.dat");
+  } else
+  {
+    items=str_malloc(sizeof(struct STR_RoundTrip));
+    if (items!=NULL)
+    {
+      memset(items,0,sizeof(struct STR_RoundTrip));
+      items[0].name=str_malloc(strlen(strfname)+1);
+      if (items[0].name!=NULL)
+      {
+        strcpy(items[0].name,strfname);
+        count=1;
+      }
+    }
+  }
+  codepage=str_codepage_load(strfname,&err);
+  str_free(strfname);
+  if (codepage==NULL)
+  {
+    if (flags&STRFLAG_VERBOSE)
+      str_error(err.message);
+    for (i=0;i<count;i++)
+      str_free(items[i].name);
+    str_free(items);
+    return -1;
+  }
+  if (threads<1)
+    threads=1;
+  if (flags&STRFLAG_VERBOSE)
+    printf("Verifying %u files on %u threads...\n",count,threads);
+  strctx_init(&job.ctx,codepage,flags);
+  job.items=items;
+  job.flags=flags&(~STRFLAG_VERBOSE);
+  start=clock_ns();
+  thread_parallel_for(count,threads,str_roundtrip_job_item,&job);
+  elapsed=clock_ns()-start;
+  failed=0;
+  entries=0;
+  bytes=0;
+  for (i=0;i<count;i++)
+  {
+    struct STR_RoundTrip *rt=&items[i];
+    if ((rt->result!=ERR_NONE)||rt->id_differs||rt->count_differs||(rt->mismatches>0))
+      failed++;
+    entries+=rt->entries;
+    bytes+=rt->str_size;
+    str_roundtrip_print(rt);
+    if (flags&STRFLAG_DEBUG)
+      printf("%s: %u entries, %.3f ms\n",rt->name,rt->entries,rt->time_ns/1000000.0);
+    str_free(rt->name);
+  }
+  if (flags&STRFLAG_VERBOSE)
+  {
+    double secs=elapsed/1000000000.0;
+    printf("Files verified: %u, entries: %lu, failed files: %d\n",count,entries,failed);
+    if (secs>0)
+      printf("Time %.3f s, %.2f MB/s, %.0f entries/s\n",secs,
+          bytes/(1024.0*1024.0)/secs,entries/secs);
+  }
+  str_free(items);
+  str_codepage_free(codepage);
+  return failed;
+}
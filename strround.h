@@ -0,0 +1,49 @@
+/******************************************************************************/
+/** @file strround.h
+ * Library for r/w of DK2 STR text strings files.
+ * @par Purpose:
+ *     Header file. Defines exported routines from strround.c.
+ * @par Comment:
+ *     None.
+ * @par  Copying and copyrights:
+ *     This program is free software; you can redistribute it and/or modify
+ *     it under the terms of the GNU General Public License as published by
+ *     the Free Software Foundation; either version 2 of the License, or
+ *     (at your option) any later version.
+ */
+/******************************************************************************/
+
+#ifndef STRROUND_H
+#define STRROUND_H
+
+#include <stdio.h>
+#include "strctx.h"
+
+// Amount of mismatched entry indices remembered for every file
+#define ROUNDTRIP_MAX_REPORTED 10
+
+/**
+ * Result of round-trip verification of one STR file.
+ */
+struct STR_RoundTrip {
+    char *name;              // STR file name
+    short result;            // ERR_NONE, or negative if the file couldn't be converted
+    unsigned int entries;    // Amount of entries in the STR file
+    unsigned int mismatches; // Entries which were encoded differently
+    unsigned int mismatch_idx[ROUNDTRIP_MAX_REPORTED];
+    short id_differs;        // File ID was not preserved
+    short count_differs;     // Amount of entries was not preserved
+    short layout_differs;    // Entries are the same, but data block is not
+    long str_size;           // Size of the STR data
+    unsigned long long time_ns;
+    struct STR_Error error;  // Reason of failure, if result is negative
+    };
+
+struct STR_Maker;
+
+// Routines
+
+short str_roundtrip_maker(const struct STR_Maker *mkstr,struct STR_RoundTrip *rt,short flags);
+int str_roundtrip(const char *name,unsigned int threads,short flags);
+
+#endif
@@ -0,0 +1,184 @@
+/******************************************************************************/
+/** @file strsearch.c
+ * Library for r/w of DK2 STR text strings files.
+ * @par Purpose:
+ *     Searching for a phrase in STR files, without an index.
+ * @par Comment:
+ *     The phrase is encoded once, and searched for in raw data of every
+ *     STR file; only the matching entries are decoded.
+ * @par  Copying and copyrights:
+ *     This program is free software; you can redistribute it and/or modify
+ *     it under the terms of the GNU General Public License as published by
+ *     the Free Software Foundation; either version 2 of the License, or
+ *     (at your option) any later version.
+ */
+/******************************************************************************/
+
+#include "strsearch.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <dirent.h>
+#include "lbfileio.h"
+#include "unitext.h"
+#include "strfile.h"
+#include "strmaker.h"
+#include "strbatch.h"
+#include "stralloc.h"
+
+/**
+ * Searches for encoded text in one STR file and prints matching entries.
+ * @param cpstr STR_Maker with loaded codepage, used for decoding.
+ * @return Returns amount of matching entries, or negative error code.
+ */
+int str_search_file(const char *strfname,const struct STR_Maker *cpstr,
+    const unsigned char *pattern,long pattern_len,short flags)
+{
+  struct STR_Maker *mkstr;
+  unsigned int *indices;
+  int count,i;
+  FILE *fp;
+  short result;
+  mkstr=str_malloc(sizeof(struct STR_Maker));
+  if (mkstr==NULL)
+  {
+    if (flags&STRFLAG_VERBOSE)
+      str_error("Cannot allocate STR_Maker memory");
+    return -1;
+  }
+  strmaker_clear(mkstr);
+  fp=fopen(strfname,"rb");
+  if (fp==NULL)
+  {
+    if (flags&STRFLAG_VERBOSE)
+      str_ferror("%s when opening %s",strerror(errno),strfname);
+    strmaker_free(mkstr);
+    return -1;
+  }
+  result=strmaker_fread(mkstr,fp,flags);
+  fclose(fp);
+  if (result!=ERR_NONE)
+  {
+    strmaker_free(mkstr);
+    return -1;
+  }
+  count=strmaker_search(mkstr,pattern,pattern_len,&indices);
+  // Decode only the matching entries, using shared codepage
+  mkstr->mb2uni=cpstr->mb2uni;
+  mkstr->mb2uni_count=cpstr->mb2uni_count;
+  for (i=0;i<count;i++)
+  {
+    unsigned short *udata;
+    strmaker_get_unicode_entry(mkstr,&udata,indices[i],flags);
+    if (udata!=NULL)
+    {
+      str_print_entry(filename_from_path(strfname),indices[i],udata);
+      str_free(udata);
+    }
+  }
+  mkstr->mb2uni=NULL;
+  mkstr->mb2uni_count=0;
+  str_free(indices);
+  strmaker_free(mkstr);
+  return count;
+}
+
+/**
+ * Searches for a phrase in STR file, or in all STR files in a folder.
+ * The phrase is encoded once, and then searched in raw STR data;
+ * only the matching entries are decoded.
+ * @param name STR file name without extension, or folder name.
+ * @param phrase The text to search for.
+ * @param flags Flags used to manage the behaviour of the function.
+ * @return Returns amount of matching entries, or negative error code.
+ */
+int str_search(const char *name,const unsigned short *phrase,short flags)
+{
+  struct STR_Maker *cpstr;
+  unsigned char *pattern;
+  long pattern_len,unmapped;
+  char *strfname;
+  DIR *dir;
+  struct dirent *dent;
+  int count,files,result;
+  strfname=str_malloc(strlen(name)+5);
+  cpstr=str_malloc(sizeof(struct STR_Maker));
+  if ((strfname==NULL)||(cpstr==NULL))
+  {
+    if (flags&STRFLAG_VERBOSE)
+      str_error("Cannot allocate memory for search");
+    str_free(strfname);
+    str_free(cpstr);
+    return -1;
+  }
+  strmaker_clear(cpstr);
+  sprintf(strfname,"%s.str",name);
+  // If there's no such STR file, treat the name as a folder
+  dir=NULL;
+  if (file_length(strfname)<0)
+  {
+    dir=opendir(name);
+    if (dir==NULL)
+    {
+      if (flags&STRFLAG_VERBOSE)
+        str_ferror("%s when opening %s",strerror(errno),strfname);
+      str_free(strfname);
+      strmaker_free(cpstr);
+      return -1;
+    }
+    str_free(strfname);
+    strfname=path_join(name,"MBToUni.dat");
+  }
+  result=str_mb2uni_load(cpstr,strfname,flags);
+  if (result==ERR_NONE)
+  {
+    result=str_text_encode(&pattern,&pattern_len,cpstr->mb2uni,cpstr->mb2uni_count,
+        phrase,unicode_strlen((unsigned short *)phrase),&unmapped);
+    if ((result!=ERR_NONE)&&(flags&STRFLAG_VERBOSE))
+      str_ferror("%s when encoding the phrase",str_error_text(result));
+  }
+  if (result!=ERR_NONE)
+  {
+    if (dir!=NULL)
+      closedir(dir);
+    str_free(strfname);
+    strmaker_free(cpstr);
+    return -1;
+  }
+  if ((unmapped>0)&&(flags&STRFLAG_VERBOSE))
+    printf("Warning: %ld characters of the phrase are not in codepage.\n",unmapped);
+  count=0;
+  files=0;
+  if (dir==NULL)
+  {
+    result=str_search_file(strfname,cpstr,pattern,pattern_len,flags);
+    if (result>0)
+      count+=result;
+    files++;
+  } else
+  {
+    while ((dent=readdir(dir))!=NULL)
+    {
+      char *fname;
+      if (!fname_has_ext(dent->d_name,".str"))
+        continue;
+      fname=path_join(name,dent->d_name);
+      if (fname==NULL)
+        continue;
+      result=str_search_file(fname,cpstr,pattern,pattern_len,flags);
+      if (result>0)
+        count+=result;
+      files++;
+      str_free(fname);
+    }
+    closedir(dir);
+  }
+  if (flags&STRFLAG_VERBOSE)
+    printf("Files searched: %d, matching entries: %d\n",files,count);
+  str_free(pattern);
+  str_free(strfname);
+  strmaker_free(cpstr);
+  return count;
+}
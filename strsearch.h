@@ -0,0 +1,29 @@
+/******************************************************************************/
+/** @file strsearch.h
+ * Library for r/w of DK2 STR text strings files.
+ * @par Purpose:
+ *     Header file. Defines exported routines from strsearch.c.
+ * @par Comment:
+ *     None.
+ * @par  Copying and copyrights:
+ *     This program is free software; you can redistribute it and/or modify
+ *     it under the terms of the GNU General Public License as published by
+ *     the Free Software Foundation; either version 2 of the License, or
+ *     (at your option) any later version.
+ */
+/******************************************************************************/
+
+#ifndef STRSEARCH_H
+#define STRSEARCH_H
+
+#include <stdio.h>
+
+struct STR_Maker;
+
+// Routines
+
+int str_search_file(const char *strfname,const struct STR_Maker *cpstr,
+    const unsigned char *pattern,long pattern_len,short flags);
+int str_search(const char *name,const unsigned short *phrase,short flags);
+
+#endif
@@ -0,0 +1,200 @@
+/******************************************************************************/
+/** @file strstats.c
+ * Library for r/w of DK2 STR text strings files.
+ * @par Purpose:
+ *     Statistics of conversion - time of every phase and counters.
+ * @par Comment:
+ *     Phases may be nested; time is always counted only for the innermost
+ *     one, so the phase times of one thread sum up to its run time. Phases
+ *     are also written as trace spans, if tracing is on.
+ * @par  Copying and copyrights:
+ *     This program is free software; you can redistribute it and/or modify
+ *     it under the terms of the GNU General Public License as published by
+ *     the Free Software Foundation; either version 2 of the License, or
+ *     (at your option) any later version.
+ */
+/******************************************************************************/
+
+#include "strstats.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "lbfileio.h"
+#include "strtrace.h"
+
+STATS_THREAD_LOCAL struct STR_Stats str_stats;
+
+const char *stats_phase_names[STAT_PHASES_COUNT]={
+    "other", "read", "codepage", "lines", "decode", "encode", "write",
+    };
+
+const char *stats_chunk_names[3]={
+    "end", "string", "param",
+    };
+
+/**
+ * Starts measuring time of phases on the calling thread.
+ */
+void stats_enable(void)
+{
+  memset(&str_stats,0,sizeof(struct STR_Stats));
+  str_stats.enabled=1;
+  str_stats.phase=STAT_OTHER;
+  str_stats.start=clock_ns();
+  str_stats.phase_start=str_stats.start;
+}
+
+/**
+ * Changes current phase; time since previous phase change is added to
+ * the phase which was current until now.
+ * @return Returns the previous phase.
+ */
+short stats_phase_switch(short phase)
+{
+  unsigned long long now;
+  short prev_phase;
+  if (!str_stats.enabled)
+    return STAT_OTHER;
+  now=clock_ns();
+  prev_phase=str_stats.phase;
+  str_stats.phase_ns[prev_phase]+=now-str_stats.phase_start;
+  str_stats.phase=phase;
+  str_stats.phase_start=now;
+  return prev_phase;
+}
+
+/**
+ * Enters a phase. If tracing is on, the phase is also written
+ * as a trace span.
+ * @return Returns the previous phase, to be given to stats_phase_leave().
+ */
+short stats_phase_enter(short phase)
+{
+  if (TRACE_ENABLED)
+    trace_begin(stats_phase_names[phase],NULL);
+  return stats_phase_switch(phase);
+}
+
+/**
+ * Leaves current phase, going back to the one which was current
+ * before stats_phase_enter().
+ */
+void stats_phase_leave(short prev_phase)
+{
+  if (TRACE_ENABLED)
+    trace_end(NULL);
+  stats_phase_switch(prev_phase);
+}
+
+/**
+ * Begins work on given file. Files are written as trace spans, if
+ * tracing is on, with phases of the file nested in them.
+ */
+void stats_file_enter(const char *fname)
+{
+  if (TRACE_ENABLED)
+    trace_begin("file",fname);
+}
+
+/**
+ * Ends work on the file given to stats_file_enter().
+ */
+void stats_file_leave(void)
+{
+  if (TRACE_ENABLED)
+    trace_end("file");
+}
+
+/**
+ * Ends measurement of the current phase, so that printed times are
+ * up to date.
+ * @return Returns total time since statistics were enabled.
+ */
+unsigned long long stats_update(void)
+{
+  stats_phase_switch(str_stats.phase);
+  return str_stats.phase_start-str_stats.start;
+}
+
+/**
+ * Finishes statistics of a worker thread, copying them to given
+ * structure so that they can be merged after the thread ends.
+ */
+void stats_thread_end(struct STR_Stats *dst)
+{
+  stats_phase_switch(str_stats.phase);
+  memcpy(dst,&str_stats,sizeof(struct STR_Stats));
+  str_stats.enabled=0;
+}
+
+/**
+ * Adds counters and phase times of a finished thread to statistics
+ * of the calling thread.
+ */
+void stats_merge(const struct STR_Stats *src)
+{
+  int i;
+  if ((!str_stats.enabled)||(!src->enabled))
+    return;
+  for (i=0;i<STAT_PHASES_COUNT;i++)
+    str_stats.phase_ns[i]+=src->phase_ns[i];
+  str_stats.entries_decoded+=src->entries_decoded;
+  str_stats.entries_encoded+=src->entries_encoded;
+  for (i=0;i<3;i++)
+    str_stats.chunks[i]+=src->chunks[i];
+  str_stats.escape_bytes+=src->escape_bytes;
+  str_stats.unmapped_chars+=src->unmapped_chars;
+  str_stats.reallocs+=src->reallocs;
+  str_stats.bytes_read+=src->bytes_read;
+  str_stats.bytes_written+=src->bytes_written;
+}
+
+/**
+ * Prints human-readable summary of the statistics.
+ */
+void stats_print(FILE *fp)
+{
+  unsigned long long total;
+  int i;
+  total=stats_update();
+  fprintf(fp,"Statistics:\n");
+  for (i=0;i<STAT_PHASES_COUNT;i++)
+  {
+    fprintf(fp,"  %-10s %10.3f ms %6.1f%%\n",stats_phase_names[i],
+        str_stats.phase_ns[i]/1000000.0,(total>0)?(str_stats.phase_ns[i]*100.0/total):0.0);
+  }
+  fprintf(fp,"  %-10s %10.3f ms\n","total",total/1000000.0);
+  fprintf(fp,"  Entries decoded: %lu, encoded: %lu\n",str_stats.entries_decoded,str_stats.entries_encoded);
+  fprintf(fp,"  Chunks: %lu string, %lu param, %lu end\n",str_stats.chunks[1],
+      str_stats.chunks[2],str_stats.chunks[0]);
+  fprintf(fp,"  Escape bytes: %lu, unmapped characters: %lu\n",str_stats.escape_bytes,
+      str_stats.unmapped_chars);
+  fprintf(fp,"  Reallocs: %lu\n",str_stats.reallocs);
+  fprintf(fp,"  Bytes read: %llu, written: %llu\n",str_stats.bytes_read,str_stats.bytes_written);
+}
+
+/**
+ * Prints the statistics as JSON object.
+ */
+void stats_print_json(FILE *fp)
+{
+  unsigned long long total;
+  int i;
+  total=stats_update();
+  fprintf(fp,"{\n  \"phases_ns\": {");
+  for (i=0;i<STAT_PHASES_COUNT;i++)
+    fprintf(fp,"%s\"%s\": %llu",(i>0)?", ":"",stats_phase_names[i],str_stats.phase_ns[i]);
+  fprintf(fp,"},\n  \"total_ns\": %llu,\n",total);
+  fprintf(fp,"  \"entries_decoded\": %lu,\n  \"entries_encoded\": %lu,\n",
+      str_stats.entries_decoded,str_stats.entries_encoded);
+  fprintf(fp,"  \"chunks\": {");
+  for (i=0;i<3;i++)
+    fprintf(fp,"%s\"%s\": %lu",(i>0)?", ":"",stats_chunk_names[i],str_stats.chunks[i]);
+  fprintf(fp,"},\n");
+  fprintf(fp,"  \"escape_bytes\": %lu,\n  \"unmapped_chars\": %lu,\n",
+      str_stats.escape_bytes,str_stats.unmapped_chars);
+  fprintf(fp,"  \"reallocs\": %lu,\n",str_stats.reallocs);
+  fprintf(fp,"  \"bytes_read\": %llu,\n  \"bytes_written\": %llu\n}\n",
+      str_stats.bytes_read,str_stats.bytes_written);
+}
@@ -0,0 +1,77 @@
+/******************************************************************************/
+/** @file strstats.h
+ * Library for r/w of DK2 STR text strings files.
+ * @par Purpose:
+ *     Header file. Defines exported routines from strstats.c.
+ * @par Comment:
+ *     None.
+ * @par  Copying and copyrights:
+ *     This program is free software; you can redistribute it and/or modify
+ *     it under the terms of the GNU General Public License as published by
+ *     the Free Software Foundation; either version 2 of the License, or
+ *     (at your option) any later version.
+ */
+/******************************************************************************/
+
+#ifndef STRSTATS_H
+#define STRSTATS_H
+
+#include <stdio.h>
+
+enum STR_StatPhase {
+        STAT_OTHER               = 0x00, // Time not in any of the phases below
+        STAT_READ                = 0x01, // Opening and reading input files
+        STAT_CODEPAGE            = 0x02, // Loading MBToUni.dat
+        STAT_LINES               = 0x03, // Splitting text file into lines
+        STAT_DECODE              = 0x04,
+        STAT_ENCODE              = 0x05,
+        STAT_WRITE               = 0x06, // Writing and replacing output files
+        STAT_PHASES_COUNT        = 0x07,
+    };
+
+/**
+ * Counters gathered during the whole program run.
+ * Counters and phase times are updated only if the statistics are
+ * enabled. Every thread has its own copy of the structure; threads
+ * started by strthread.c routines add theirs to the starting thread
+ * when they're joined.
+ */
+struct STR_Stats {
+    short enabled;
+    short phase;             // Current phase, one of STR_StatPhase
+    unsigned long long phase_start; // Time when current phase was entered
+    unsigned long long start;       // Time when statistics were enabled
+    unsigned long long phase_ns[STAT_PHASES_COUNT];
+    unsigned long entries_decoded;
+    unsigned long entries_encoded;
+    unsigned long chunks[3]; // Chunks by type (end, string, param)
+    unsigned long escape_bytes;   // 0xff bytes in encoded texts
+    unsigned long unmapped_chars; // Characters replaced with '_'
+    unsigned long reallocs;
+    unsigned long long bytes_read;
+    unsigned long long bytes_written;
+    };
+
+#if defined(_MSC_VER)
+#define STATS_THREAD_LOCAL __declspec(thread)
+#else
+#define STATS_THREAD_LOCAL __thread
+#endif
+
+extern STATS_THREAD_LOCAL struct STR_Stats str_stats;
+
+#define STATS_ADD(counter,val) do { if (str_stats.enabled) str_stats.counter+=(val); } while (0)
+
+// Routines
+
+void stats_enable(void);
+short stats_phase_enter(short phase);
+void stats_phase_leave(short prev_phase);
+void stats_file_enter(const char *fname);
+void stats_file_leave(void);
+void stats_thread_end(struct STR_Stats *dst);
+void stats_merge(const struct STR_Stats *src);
+void stats_print(FILE *fp);
+void stats_print_json(FILE *fp);
+
+#endif
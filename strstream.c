@@ -0,0 +1,426 @@
+/******************************************************************************/
+/** @file strstream.c
+ * Library for r/w of DK2 STR text strings files.
+ * @par Purpose:
+ *     Incremental parsing of STR files from non-seekable streams.
+ * @par Comment:
+ *     The parser is fed with blocks of data of any size, and gives every
+ *     entry to a callback as soon as all of its chunks have arrived.
+ *     It never seeks, so STR data can come from pipes or archives.
+ * @par  Copying and copyrights:
+ *     This program is free software; you can redistribute it and/or modify
+ *     it under the terms of the GNU General Public License as published by
+ *     the Free Software Foundation; either version 2 of the License, or
+ *     (at your option) any later version.
+ */
+/******************************************************************************/
+
+#include "strstream.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include "lbfileio.h"
+#include "unitext.h"
+#include "strfile.h"
+#include "strmaker.h"
+#include "strstats.h"
+#include "stralloc.h"
+
+const char strstream_magic[] = "BFST";
+
+struct STR_StreamExport {
+    FILE *fp;                // Destination text file
+    const struct STR_Codepage *codepage;
+    short flags;
+    };
+
+/**
+ * Prepares the STR_Stream structure for parsing a new file.
+ * @param header_cb Function called when header is received; may be NULL.
+ * @param entry_cb Function called for every entry.
+ * @param cb_data Value given to the callbacks.
+ */
+short strstream_init(struct STR_Stream *stream,STR_StreamHeaderFunc header_cb,
+    STR_StreamEntryFunc entry_cb,void *cb_data)
+{
+  memset(stream,0,sizeof(struct STR_Stream));
+  stream->state=STRSTREAM_HEADER;
+  stream->header_cb=header_cb;
+  stream->entry_cb=entry_cb;
+  stream->cb_data=cb_data;
+  strctx_error_clear(&stream->error);
+  return ERR_NONE;
+}
+
+/**
+ * Frees buffers allocated by the parser.
+ */
+void strstream_free(struct STR_Stream *stream)
+{
+  str_free(stream->offsets);
+  str_free(stream->offs_min);
+  str_free(stream->data);
+  stream->offsets=NULL;
+  stream->offs_min=NULL;
+  stream->data=NULL;
+  stream->data_alloc=0;
+  stream->data_len=0;
+}
+
+/**
+ * Marks the parsing as failed, and stores the error.
+ */
+short strstream_fail(struct STR_Stream *stream,short code,const char *message,long value)
+{
+  stream->state=STRSTREAM_FAILED;
+  return strctx_error_set(&stream->error,code,message,value);
+}
+
+/**
+ * Interprets the file header, when all of it was received.
+ */
+short strstream_header_done(struct STR_Stream *stream)
+{
+  long count;
+  if (memcmp(stream->header,strstream_magic,4)!=0)
+    return strstream_fail(stream,-1,"File is not STR - bad magic value",0);
+  stream->file_id=read_int32_le_buf(stream->header+4);
+  count=read_int32_le_buf(stream->header+8);
+  if (count<0)
+    return strstream_fail(stream,-1,"Bad amount of entries, %ld",count);
+  stream->offs_count=count;
+  stream->offsets=str_malloc((count+1)*sizeof(long));
+  stream->offs_min=str_malloc((count+1)*sizeof(long));
+  if ((stream->offsets==NULL)||(stream->offs_min==NULL))
+    return strstream_fail(stream,ERR_NO_MEMORY,"Cannot allocate memory for %ld offsets",count);
+  stream->offs_recv=0;
+  stream->part_len=0;
+  stream->state=STRSTREAM_OFFSETS;
+  return ERR_NONE;
+}
+
+/**
+ * Prepares for receiving data, when the whole offsets table was received.
+ */
+short strstream_offsets_done(struct STR_Stream *stream)
+{
+  unsigned int i;
+  long offs_min;
+  short result;
+  // Smallest offset still needed is kept for every entry, so that data
+  // before it can be released after the entry is given to the callback
+  offs_min=0x7fffffffL;
+  for (i=stream->offs_count;i>0;i--)
+  {
+    if (stream->offsets[i-1]<0)
+      return strstream_fail(stream,-1,"Entry offset %ld is before data block",stream->offsets[i-1]);
+    if (stream->offsets[i-1]<offs_min)
+      offs_min=stream->offsets[i-1];
+    stream->offs_min[i-1]=offs_min;
+  }
+  stream->next_entry=0;
+  stream->data_base=0;
+  stream->data_len=0;
+  if (stream->offs_count>0)
+    stream->scan_pos=stream->offsets[0];
+  stream->state=(stream->offs_count>0)?STRSTREAM_DATA:STRSTREAM_DONE;
+  if (stream->header_cb!=NULL)
+  {
+    result=stream->header_cb(stream->cb_data,stream->file_id,stream->offs_count);
+    if (result<ERR_NONE)
+      return strstream_fail(stream,result,"Header rejected by caller, error %ld",result);
+  }
+  return ERR_NONE;
+}
+
+/**
+ * Gives to the callback all entries which were fully received, checking
+ * their chunks. Scanning of incomplete entry is continued where it stopped.
+ */
+short strstream_emit_entries(struct STR_Stream *stream)
+{
+  unsigned long chunk;
+  long offs,pos;
+  short result;
+  while (stream->next_entry<stream->offs_count)
+  {
+    offs=stream->offsets[stream->next_entry];
+    pos=stream->scan_pos-stream->data_base;
+    if (pos+SIZEOF_STR_ChunkHeader>stream->data_len)
+      return ERR_NONE;
+    chunk=read_int32_le_buf(stream->data+pos)&0xffffffffUL;
+    switch (chunk&0xff)
+    {
+    case CTSTR_END:
+        if ((chunk>>8)!=0)
+          return strstream_fail(stream,ERR_END_CHUNK,"End chunk at data offset %ld has nonzero size",
+              stream->scan_pos);
+        result=stream->entry_cb(stream->cb_data,stream->next_entry,
+            stream->data+(offs-stream->data_base),stream->scan_pos+SIZEOF_STR_ChunkHeader-offs);
+        if (result<ERR_NONE)
+          return strstream_fail(stream,result,"Entry rejected by caller, error %ld",result);
+        stream->next_entry++;
+        if (stream->next_entry<stream->offs_count)
+          stream->scan_pos=stream->offsets[stream->next_entry];
+        break;
+    case CTSTR_PARAM:
+        stream->scan_pos+=SIZEOF_STR_ChunkHeader;
+        break;
+    case CTSTR_STRING:
+        if (pos+SIZEOF_STR_ChunkHeader+(chunk>>8)>stream->data_len)
+          return ERR_NONE;
+        // Chunks are aligned relative to start of the entry
+        pos=stream->scan_pos-offs+SIZEOF_STR_ChunkHeader+(chunk>>8);
+        stream->scan_pos=offs+((pos+3)&(~3));
+        break;
+    default:
+        return strstream_fail(stream,ERR_CHUNK_TYPE,"Chunk at data offset %ld has bad type",
+            stream->scan_pos);
+    }
+  }
+  stream->state=STRSTREAM_DONE;
+  return ERR_NONE;
+}
+
+/**
+ * Adds received part of the data block to buffer, releasing the data
+ * which is no longer needed.
+ */
+short strstream_feed_data(struct STR_Stream *stream,const unsigned char *buf,unsigned long len)
+{
+  unsigned long keep_from,drop;
+  unsigned char *ndata;
+  // Data before the smallest offset of remaining entries isn't needed;
+  // it is moved out only if that frees at least half of the buffer
+  keep_from=stream->offs_min[stream->next_entry];
+  if (keep_from>stream->data_base+stream->data_len)
+  {
+    // Skip whole blocks which are before all remaining entries
+    drop=keep_from-(stream->data_base+stream->data_len);
+    if (drop>len) drop=len;
+    stream->data_base+=stream->data_len+drop;
+    stream->data_len=0;
+    buf+=drop;
+    len-=drop;
+  } else
+  {
+    drop=keep_from-stream->data_base;
+    if ((drop>0)&&(drop>=(stream->data_len>>1)))
+    {
+      memmove(stream->data,stream->data+drop,stream->data_len-drop);
+      stream->data_len-=drop;
+      stream->data_base+=drop;
+    }
+  }
+  if (stream->data_len+len>stream->data_alloc)
+  {
+    unsigned long nalloc=stream->data_alloc*2;
+    if (nalloc<stream->data_len+len)
+      nalloc=stream->data_len+len;
+    ndata=str_realloc(stream->data,nalloc);
+    if (ndata==NULL)
+      return strstream_fail(stream,ERR_NO_MEMORY,"Cannot allocate %ld bytes for data",nalloc);
+    stream->data=ndata;
+    stream->data_alloc=nalloc;
+  }
+  memcpy(stream->data+stream->data_len,buf,len);
+  stream->data_len+=len;
+  return strstream_emit_entries(stream);
+}
+
+/**
+ * Gives next block of STR file to the parser. Entries which are
+ * complete after the block are given to the entry callback.
+ * @param buf The block of data.
+ * @param len Size of the block; can be any, including zero.
+ * @return Returns ERR_NONE on success, or negative error code;
+ *     the error is described in stream->error.
+ */
+short strstream_feed(struct STR_Stream *stream,const unsigned char *buf,unsigned long len)
+{
+  unsigned long n;
+  short result;
+  STATS_ADD(bytes_read,len);
+  stream->received+=len;
+  while (len>0)
+  {
+    switch (stream->state)
+    {
+    case STRSTREAM_HEADER:
+        n=SIZEOF_STR_Header-stream->part_len;
+        if (n>len) n=len;
+        memcpy(stream->header+stream->part_len,buf,n);
+        stream->part_len+=n;
+        buf+=n;
+        len-=n;
+        if (stream->part_len==SIZEOF_STR_Header)
+        {
+          result=strstream_header_done(stream);
+          if ((result==ERR_NONE)&&(stream->offs_count==0))
+            result=strstream_offsets_done(stream);
+          if (result!=ERR_NONE)
+            return result;
+        }
+        break;
+    case STRSTREAM_OFFSETS:
+        // The header buffer is reused for collecting bytes of one offset
+        n=4-stream->part_len;
+        if (n>len) n=len;
+        memcpy(stream->header+stream->part_len,buf,n);
+        stream->part_len+=n;
+        buf+=n;
+        len-=n;
+        if (stream->part_len==4)
+        {
+          stream->offsets[stream->offs_recv]=read_int32_le_buf(stream->header)
+              -(long)(stream->offs_count<<2);
+          stream->offs_recv++;
+          stream->part_len=0;
+          if (stream->offs_recv==stream->offs_count)
+          {
+            result=strstream_offsets_done(stream);
+            if (result!=ERR_NONE)
+              return result;
+          }
+        }
+        break;
+    case STRSTREAM_DATA:
+        return strstream_feed_data(stream,buf,len);
+    case STRSTREAM_DONE:
+        // Data after the last entry is ignored
+        return ERR_NONE;
+    default:
+        return stream->error.code;
+    }
+  }
+  return ERR_NONE;
+}
+
+/**
+ * Finishes parsing, when there's no more data.
+ * @return Returns ERR_NONE if all entries were given to the callback.
+ */
+short strstream_finish(struct STR_Stream *stream)
+{
+  switch (stream->state)
+  {
+  case STRSTREAM_DONE:
+      return ERR_NONE;
+  case STRSTREAM_HEADER:
+  case STRSTREAM_OFFSETS:
+      return strstream_fail(stream,-1,"Data ended within STR header, after %ld bytes",
+          (long)stream->received);
+  case STRSTREAM_DATA:
+      return strstream_fail(stream,ERR_ENTRY_LENGTH,"Data ended before entry %ld was complete",
+          stream->next_entry);
+  default:
+      return stream->error.code;
+  }
+}
+
+/**
+ * Parses STR file from the given stream, reading it in blocks until
+ * end of file. The stream doesn't have to be seekable.
+ * @return Returns ERR_NONE if the whole file was parsed.
+ */
+short strstream_fread(struct STR_Stream *stream,FILE *fp)
+{
+  unsigned char *buf;
+  size_t nread;
+  short result;
+  buf=str_malloc(STRSTREAM_READ_BLOCK);
+  if (buf==NULL)
+    return strstream_fail(stream,ERR_NO_MEMORY,"Cannot allocate read buffer",0);
+  result=ERR_NONE;
+  while (result==ERR_NONE)
+  {
+    nread=fread(buf,1,STRSTREAM_READ_BLOCK,fp);
+    if (nread==0)
+      break;
+    result=strstream_feed(stream,buf,nread);
+  }
+  str_free(buf);
+  if (result!=ERR_NONE)
+    return result;
+  if (ferror(fp))
+    return strstream_fail(stream,-1,"Read error after %ld bytes",(long)stream->received);
+  return strstream_finish(stream);
+}
+
+short str_export_stream_header(void *data,unsigned int file_id,unsigned int count)
+{
+  struct STR_StreamExport *exp=data;
+  unicode_fwrite_header(exp->fp,file_id);
+  return ERR_NONE;
+}
+
+short str_export_stream_entry(void *data,unsigned int index,
+    const unsigned char *edata,long edata_len)
+{
+  struct STR_StreamExport *exp=data;
+  unsigned short *udata;
+  long udata_len;
+  short prev_phase;
+  short result;
+  prev_phase=stats_phase_enter(STAT_DECODE);
+  // Entries given by the parser have checked structure
+  result=str_data_decode_unchecked(&udata,&udata_len,exp->codepage->mb2uni,
+      exp->codepage->mb2uni_count,edata,edata_len);
+  stats_phase_leave(prev_phase);
+  if (result!=ERR_NONE)
+    return result;
+  unicode_fwrite_line(exp->fp,udata);
+  str_free(udata);
+  return ERR_NONE;
+}
+
+/**
+ * Exports STR file read from the given stream into text file. Every
+ * entry is written as soon as it is received, so the STR file is
+ * never kept in memory as a whole.
+ * @param fp The stream with STR file data; doesn't have to be seekable.
+ * @param strfname Name of the STR file; only its folder is used,
+ *     to find the codepage file.
+ * @param txtfname Name of the destination text file.
+ * @param flags Flags used to manage the behaviour of the function.
+ * @return Returns ERR_NONE, ERR_UNCHANGED or negative error code.
+ */
+short str_export_stream(FILE *fp,char *strfname,char *txtfname,short flags)
+{
+  struct STR_StreamExport exp;
+  struct STR_Stream stream;
+  struct STR_Codepage *cp;
+  struct STR_Error err;
+  char *tmpfname;
+  short prev_phase;
+  short result;
+  prev_phase=stats_phase_enter(STAT_CODEPAGE);
+  cp=str_codepage_load(strfname,&err);
+  stats_phase_leave(prev_phase);
+  if (cp==NULL)
+  {
+    if (flags&STRFLAG_VERBOSE)
+      str_ferror("%s",err.message);
+    return -1;
+  }
+  exp.fp=str_fopen_temp(txtfname,&tmpfname,flags);
+  if (exp.fp==NULL)
+  {
+    str_codepage_free(cp);
+    return -1;
+  }
+  exp.codepage=cp;
+  exp.flags=flags;
+  strstream_init(&stream,str_export_stream_header,str_export_stream_entry,&exp);
+  result=strstream_fread(&stream,fp);
+  if ((result!=ERR_NONE)&&(flags&STRFLAG_VERBOSE))
+    str_ferror("%s",stream.error.message);
+  strstream_free(&stream);
+  str_codepage_free(cp);
+  prev_phase=stats_phase_enter(STAT_WRITE);
+  result=str_fclose_temp(exp.fp,tmpfname,txtfname,result,flags);
+  stats_phase_leave(prev_phase);
+  return result;
+}
@@ -0,0 +1,86 @@
+/******************************************************************************/
+/** @file strstream.h
+ * Library for r/w of DK2 STR text strings files.
+ * @par Purpose:
+ *     Header file. Defines exported routines from strstream.c.
+ * @par Comment:
+ *     None.
+ * @par  Copying and copyrights:
+ *     This program is free software; you can redistribute it and/or modify
+ *     it under the terms of the GNU General Public License as published by
+ *     the Free Software Foundation; either version 2 of the License, or
+ *     (at your option) any later version.
+ */
+/******************************************************************************/
+
+#ifndef STRSTREAM_H
+#define STRSTREAM_H
+
+#include <stdio.h>
+#include "strctx.h"
+#include "strmaker.h"
+
+// Size of blocks read by strstream_fread()
+#define STRSTREAM_READ_BLOCK 0x4000
+
+enum STR_StreamState {
+        STRSTREAM_HEADER         = 0x00, // Expecting file header
+        STRSTREAM_OFFSETS        = 0x01, // Expecting offsets table
+        STRSTREAM_DATA           = 0x02, // Expecting entries data
+        STRSTREAM_DONE           = 0x03, // All entries were given to the callback
+        STRSTREAM_FAILED         = 0x04, // Parsing failed; error is set
+    };
+
+/**
+ * Called when the header and offsets table are received.
+ * @return Returns ERR_NONE to continue parsing, or negative error code.
+ */
+typedef short (*STR_StreamHeaderFunc)(void *data,unsigned int file_id,unsigned int count);
+/**
+ * Called for every entry, in order of the offsets table, as soon as
+ * all of its chunks are received. The entry data is only valid during
+ * the call; its structure was already checked.
+ * @return Returns ERR_NONE to continue parsing, or negative error code.
+ */
+typedef short (*STR_StreamEntryFunc)(void *data,unsigned int index,
+    const unsigned char *edata,long edata_len);
+
+/**
+ * Incremental parser of STR file, fed with blocks of any size.
+ * Received data is kept only until all entries which use it are given
+ * to the callback, so the memory needed doesn't depend on file size.
+ */
+struct STR_Stream {
+    short state;
+    unsigned char header[SIZEOF_STR_Header];
+    unsigned int part_len;   // Bytes of the header or current offset received
+    unsigned int file_id;
+    unsigned int offs_count;
+    unsigned int offs_recv;  // Offsets received
+    long *offsets;           // Offsets of entries in data block
+    long *offs_min;          // Smallest offset of the entry and all entries after it
+    unsigned char *data;     // Received part of the data block
+    unsigned long data_alloc;// Allocated data size
+    unsigned long data_len;  // Size of used data
+    unsigned long data_base; // Data block offset of the first byte in data
+    unsigned int next_entry; // Entry which will be given to the callback next
+    unsigned long scan_pos;  // Data block offset of next chunk of that entry
+    unsigned long long received; // Bytes fed to the parser
+    STR_StreamHeaderFunc header_cb;
+    STR_StreamEntryFunc entry_cb;
+    void *cb_data;
+    struct STR_Error error;
+    };
+
+// Routines
+
+short strstream_init(struct STR_Stream *stream,STR_StreamHeaderFunc header_cb,
+    STR_StreamEntryFunc entry_cb,void *cb_data);
+short strstream_feed(struct STR_Stream *stream,const unsigned char *buf,unsigned long len);
+short strstream_finish(struct STR_Stream *stream);
+short strstream_fread(struct STR_Stream *stream,FILE *fp);
+void strstream_free(struct STR_Stream *stream);
+
+short str_export_stream(FILE *fp,char *strfname,char *txtfname,short flags);
+
+#endif
@@ -0,0 +1,234 @@
+/******************************************************************************/
+/** @file strtcache.c
+ * Library for r/w of DK2 STR text strings files.
+ * @par Purpose:
+ *     Cache of parsed text files.
+ * @par Comment:
+ *     Cache file is checked against size and hash of the text file;
+ *     when they match, the entries are used directly from the mapped
+ *     cache, without reading and splitting the text file.
+ * @par  Copying and copyrights:
+ *     This program is free software; you can redistribute it and/or modify
+ *     it under the terms of the GNU General Public License as published by
+ *     the Free Software Foundation; either version 2 of the License, or
+ *     (at your option) any later version.
+ */
+/******************************************************************************/
+
+#include "strtcache.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "lbfileio.h"
+#include "unitext.h"
+#include "strfile.h"
+#include "strmaker.h"
+#include "strstats.h"
+#include "stralloc.h"
+
+const char txc_magic[]="BFTC";
+#define TXC_VERSION 1
+
+#define TXC_ALIGNED(pos) (((pos)+TXC_ALIGN-1)&(~(unsigned long)(TXC_ALIGN-1)))
+
+/**
+ * Gives name of the cache file for given text file; extension of the
+ * text file is replaced.
+ * @return Returns allocated file name, or NULL on error.
+ */
+char *txtcache_fname(const char *txtfname)
+{
+  const char *ext;
+  char *fname;
+  int len;
+  ext=strrchr(filename_from_path(txtfname),'.');
+  len=(ext!=NULL)?(ext-txtfname):strlen(txtfname);
+  fname=str_malloc(len+strlen(TXTCACHE_EXT)+1);
+  if (fname==NULL)
+    return NULL;
+  memcpy(fname,txtfname,len);
+  strcpy(fname+len,TXTCACHE_EXT);
+  return fname;
+}
+
+/**
+ * Loads parsed text file from its cache file. Only structure of the
+ * cache is checked - it's assumed to be written by txtcache_write().
+ * @param txt_size Size of the text file; must match the cached one.
+ * @param txt_hash Hash of the text file; must match the cached one.
+ * @return Returns the STR_File struct pointer, or NULL if there's no
+ *     valid cache for the text file.
+ */
+struct STR_File *txtcache_load(const char *txtfname,long txt_size,
+    unsigned long long txt_hash,short flags)
+{
+  struct STR_File *strfile;
+  unsigned char *data;
+  const unsigned short *pool;
+  unsigned long count,pool_size,pool_pos,offs;
+  unsigned long long hash;
+  unsigned int i;
+  char *fname;
+  long len;
+  fname=txtcache_fname(txtfname);
+  if (fname==NULL)
+    return NULL;
+  data=file_map(fname,&len);
+  str_free(fname);
+  if (data==NULL)
+    return NULL;
+  if ((len<SIZEOF_TXC_Header)||(memcmp(data,txc_magic,4)!=0)||
+      (read_int32_le_buf(data+4)!=TXC_VERSION))
+  {
+    file_unmap(data,len);
+    return NULL;
+  }
+  hash=((unsigned long long)(read_int32_le_buf(data+20)&0xffffffffUL)<<32)|
+      (read_int32_le_buf(data+16)&0xffffffffUL);
+  count=read_int32_le_buf(data+12)&0xffffffffUL;
+  pool_size=read_int32_le_buf(data+28)&0xffffffffUL;
+  pool_pos=TXC_ALIGNED(SIZEOF_TXC_Header+count*SIZEOF_TXC_Offset);
+  if ((read_int32_le_buf(data+8)!=txt_size)||(hash!=txt_hash))
+  {
+    if (flags&STRFLAG_DEBUG)
+      printf("text cache is out of date\n");
+    file_unmap(data,len);
+    return NULL;
+  }
+  pool=(const unsigned short *)(data+pool_pos);
+  // Zero at end of the pool terminates every entry
+  if ((count>len/SIZEOF_TXC_Offset)||(pool_size<1)||
+      (pool_pos+pool_size*sizeof(unsigned short)!=len)||(pool[pool_size-1]!=0))
+  {
+    if (flags&STRFLAG_VERBOSE)
+      str_ferror("Text cache of %s is damaged",txtfname);
+    file_unmap(data,len);
+    return NULL;
+  }
+  strfile=str_malloc(sizeof(struct STR_File));
+  if (strfile==NULL)
+  {
+    file_unmap(data,len);
+    return NULL;
+  }
+  str_clear(strfile);
+  strfile->str=str_malloc(count*sizeof(unsigned short *)+1);
+  if (strfile->str==NULL)
+  {
+    file_unmap(data,len);
+    str_free(strfile);
+    return NULL;
+  }
+  strfile->pool=data;
+  strfile->pool_len=len;
+  strfile->file_id=read_int32_le_buf(data+24);
+  strfile->alloc_count=count;
+  for (i=0;i<count;i++)
+  {
+    offs=read_int32_le_buf(data+SIZEOF_TXC_Header+i*SIZEOF_TXC_Offset)&0xffffffffUL;
+    if (offs>=pool_size)
+    {
+      if (flags&STRFLAG_VERBOSE)
+        str_ferror("Text cache of %s is damaged at entry %u",txtfname,i);
+      str_close(strfile,flags);
+      return NULL;
+    }
+    strfile->str[i]=(unsigned short *)(pool+offs);
+  }
+  strfile->str_count=count;
+  return strfile;
+}
+
+/**
+ * Writes parsed text file into its cache file.
+ * @param txt_size Size of the text file.
+ * @param txt_hash Hash of the text file.
+ * @return Returns ERR_NONE, ERR_UNCHANGED or negative error code.
+ */
+short txtcache_write(const struct STR_File *strfile,const char *txtfname,
+    long txt_size,unsigned long long txt_hash,short flags)
+{
+  FILE *fp;
+  char *fname;
+  char *tmpfname;
+  unsigned long pool_size,pos;
+  unsigned int i;
+  short result;
+  fname=txtcache_fname(txtfname);
+  if (fname==NULL)
+    return ERR_NO_MEMORY;
+  fp=str_fopen_temp(fname,&tmpfname,flags);
+  if (fp==NULL)
+  {
+    str_free(fname);
+    return -1;
+  }
+  pool_size=0;
+  for (i=0;i<strfile->str_count;i++)
+    pool_size+=unicode_strlen(strfile->str[i])+1;
+  // Header
+  fwrite(txc_magic,1,4,fp);
+  write_int32_le_file(fp,TXC_VERSION);
+  write_int32_le_file(fp,txt_size);
+  write_int32_le_file(fp,strfile->str_count);
+  write_int32_le_file(fp,txt_hash&0xffffffffUL);
+  write_int32_le_file(fp,txt_hash>>32);
+  write_int32_le_file(fp,strfile->file_id);
+  write_int32_le_file(fp,pool_size);
+  // Offsets
+  pos=0;
+  for (i=0;i<strfile->str_count;i++)
+  {
+    write_int32_le_file(fp,pos);
+    pos+=unicode_strlen(strfile->str[i])+1;
+  }
+  for (pos=SIZEOF_TXC_Header+strfile->str_count*SIZEOF_TXC_Offset;(pos%TXC_ALIGN)!=0;pos++)
+    fputc(0,fp);
+  // Pool
+  for (i=0;i<strfile->str_count;i++)
+    fwrite(strfile->str[i],sizeof(unsigned short),unicode_strlen(strfile->str[i])+1,fp);
+  result=str_fclose_temp(fp,tmpfname,fname,ferror(fp)?-1:ERR_NONE,flags);
+  str_free(fname);
+  return result;
+}
+
+/**
+ * Creates STR_File structure from Unicode Text file, using its cache
+ * file if the text wasn't changed. Otherwise, the text is parsed and
+ * the cache is written for the next time.
+ * @param fname Source text file name.
+ * @param flags Flags used to manage the behaviour of the function.
+ * @return Returns the STR_File struct pointer, or NULL.
+ */
+struct STR_File *str_open_unicode_cached(char *fname,short flags)
+{
+  struct STR_File *strfile;
+  unsigned long long txt_hash;
+  long txt_size,txt_mtime;
+  short prev_phase;
+  flags&=~STRFLAG_TXTCACHE;
+  prev_phase=stats_phase_enter(STAT_READ);
+  if ((file_stat(fname,&txt_size,&txt_mtime)!=0)||(file_hash(fname,&txt_hash)!=0))
+  {
+    // Reading the text file will report the problem
+    stats_phase_leave(prev_phase);
+    return str_open_unicode(fname,flags);
+  }
+  strfile=txtcache_load(fname,txt_size,txt_hash,flags);
+  stats_phase_leave(prev_phase);
+  if (strfile!=NULL)
+  {
+    if (flags&STRFLAG_DEBUG)
+      printf("got %u entries from text cache\n",strfile->str_count);
+    return strfile;
+  }
+  strfile=str_open_unicode(fname,flags);
+  if (strfile==NULL)
+    return NULL;
+  prev_phase=stats_phase_enter(STAT_WRITE);
+  if ((txtcache_write(strfile,fname,txt_size,txt_hash,flags)<ERR_NONE)&&(flags&STRFLAG_VERBOSE))
+    str_ferror("Cannot write text cache of %s",fname);
+  stats_phase_leave(prev_phase);
+  return strfile;
+}
@@ -0,0 +1,46 @@
+/******************************************************************************/
+/** @file strtcache.h
+ * Library for r/w of DK2 STR text strings files.
+ * @par Purpose:
+ *     Header file. Defines exported routines from strtcache.c.
+ * @par Comment:
+ *     None.
+ * @par  Copying and copyrights:
+ *     This program is free software; you can redistribute it and/or modify
+ *     it under the terms of the GNU General Public License as published by
+ *     the Free Software Foundation; either version 2 of the License, or
+ *     (at your option) any later version.
+ */
+/******************************************************************************/
+
+#ifndef STRTCACHE_H
+#define STRTCACHE_H
+
+#include <stdio.h>
+
+#define TXTCACHE_EXT ".txc"
+#define SIZEOF_TXC_Header     32
+#define SIZEOF_TXC_Offset      4
+#define TXC_ALIGN             16
+
+/**
+ * Parsed text file, stored next to it to skip parsing on the next load.
+ *   Header:   magic "BFTC", version, text file size, entries count,
+ *             text file hash (8 bytes), file ID, pool size in characters
+ *   Offsets:  position of every entry in the pool, in characters
+ *   Pool:     unescaped entries, each terminated by zero; aligned to 16
+ * Characters are stored in the same byte order as in the text file.
+ */
+
+struct STR_File;
+
+// Routines
+
+char *txtcache_fname(const char *txtfname);
+struct STR_File *txtcache_load(const char *txtfname,long txt_size,
+    unsigned long long txt_hash,short flags);
+short txtcache_write(const struct STR_File *strfile,const char *txtfname,
+    long txt_size,unsigned long long txt_hash,short flags);
+struct STR_File *str_open_unicode_cached(char *fname,short flags);
+
+#endif
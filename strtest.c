@@ -0,0 +1,478 @@
+/******************************************************************************/
+/** @file strtest.c
+ * Library for r/w of DK2 STR text strings files.
+ * @par Purpose:
+ *     Tests of the STR library routines.
+ * @par Comment:
+ *     Separate program; run it from the source folder, as it uses
+ *     MBToUni.dat from there. Exit code is the amount of failed tests.
+ * @par  Copying and copyrights:
+ *     This program is free software; you can redistribute it and/or modify
+ *     it under the terms of the GNU General Public License as published by
+ *     the Free Software Foundation; either version 2 of the License, or
+ *     (at your option) any later version.
+ */
+/******************************************************************************/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "lbfileio.h"
+#include "unitext.h"
+#include "strfile.h"
+#include "strmaker.h"
+#include "strlive.h"
+#include "strthread.h"
+#include "strdelta.h"
+#include "stralloc.h"
+
+#define TEST_CODEPAGE_FNAME "MBToUni.dat"
+#define TEST_MAX_TEXT 256
+#define TEST_LIVE_NAME "strtest_live"
+#define TEST_LIVE_READERS 4
+#define TEST_LIVE_VERSIONS 5
+// How long to wait for one reload, in 10 ms steps
+#define TEST_LIVE_WAIT 500
+#define TEST_DELTA_NAME "strtest_delta"
+
+int tests_run=0;
+int tests_failed=0;
+
+/**
+ * Counts result of one check, and reports it if it failed.
+ */
+void test_check(int passed,const char *test,const char *what)
+{
+  tests_run++;
+  if (passed)
+    return;
+  tests_failed++;
+  printf("FAILED %s: %s\n",test,what);
+}
+
+/**
+ * Converts ASCII text into Unicode buffer.
+ * @return Returns length of the text.
+ */
+long test_unicode(unsigned short *dst,const char *src)
+{
+  long i;
+  for (i=0;(src[i]!=0)&&(i+1<TEST_MAX_TEXT);i++)
+    dst[i]=(unsigned char)src[i];
+  dst[i]=0;
+  return i;
+}
+
+/**
+ * Loads the codepage used by all tests.
+ * @return Returns STR_Maker with the codepage, or NULL on error.
+ */
+struct STR_Maker *test_load_codepage(void)
+{
+  struct STR_Maker *mkstr;
+  FILE *fp;
+  short result;
+  mkstr=str_malloc(sizeof(struct STR_Maker));
+  if (mkstr==NULL)
+    return NULL;
+  strmaker_clear(mkstr);
+  fp=fopen(TEST_CODEPAGE_FNAME,"rb");
+  if (fp==NULL)
+  {
+    strmaker_free(mkstr);
+    return NULL;
+  }
+  result=str_mb2uni_fread(mkstr,fp,STRFLAG_VERBOSE);
+  fclose(fp);
+  if (result!=ERR_NONE)
+  {
+    strmaker_free(mkstr);
+    return NULL;
+  }
+  return mkstr;
+}
+
+/**
+ * Adds the text as STR entry and decodes it back.
+ * @return Returns 1 if the decoded text is equal to expected one.
+ */
+int test_encode_decode(struct STR_Maker *mkstr,const char *text,const char *expected)
+{
+  unsigned short utext[TEST_MAX_TEXT];
+  unsigned short uexpected[TEST_MAX_TEXT];
+  unsigned short *udata;
+  int passed;
+  test_unicode(utext,text);
+  if (strmaker_add_unicode_entry(mkstr,utext,STRFLAG_VERBOSE)!=ERR_NONE)
+    return 0;
+  udata=NULL;
+  passed=(strmaker_get_unicode_entry(mkstr,&udata,mkstr->offs_count-1,STRFLAG_VERBOSE)>=0);
+  test_unicode(uexpected,expected);
+  if (passed)
+    passed=(unicode_strcmp(udata,uexpected)==0);
+  str_free(udata);
+  return passed;
+}
+
+/**
+ * Entry texts are in escaped form; backslash sequences are encoded as
+ * the characters they stand for, and decoding escapes them back.
+ * Unknown sequences become '_'.
+ */
+void test_encode_escapes(struct STR_Maker *mkstr)
+{
+  test_check(test_encode_decode(mkstr,"a\\\\b","a\\\\b"),"encode_escapes","backslash");
+  test_check(test_encode_decode(mkstr,"a\\nb","a\\nb"),"encode_escapes","new line");
+  test_check(test_encode_decode(mkstr,"a\\tb","a\\tb"),"encode_escapes","tab");
+  test_check(test_encode_decode(mkstr,"a\\qb","a_b"),"encode_escapes","unknown escape");
+  test_check(test_encode_decode(mkstr,"plain text","plain text"),"encode_escapes","no escape");
+}
+
+/**
+ * Makes STR_Maker with two entries of given texts, the second sharing
+ * data of the first, and verifies it against the texts.
+ * @return Returns amount of mismatches found, or negative error code.
+ */
+int test_shared_mismatches(struct STR_Maker *cpstr,const char *text1,const char *text2)
+{
+  struct STR_Maker *mkstr;
+  struct STR_File strfile;
+  unsigned short utext1[TEST_MAX_TEXT];
+  unsigned short utext2[TEST_MAX_TEXT];
+  unsigned short *texts[2];
+  int mismatches;
+  mkstr=str_malloc(sizeof(struct STR_Maker));
+  if (mkstr==NULL)
+    return -1;
+  strmaker_clear(mkstr);
+  // The codepage is shared, so it's detached before freeing
+  mkstr->mb2uni=cpstr->mb2uni;
+  mkstr->mb2uni_count=cpstr->mb2uni_count;
+  test_unicode(utext1,text1);
+  test_unicode(utext2,text2);
+  texts[0]=utext1;
+  texts[1]=utext2;
+  str_clear(&strfile);
+  strfile.str=texts;
+  strfile.str_count=2;
+  strfile.alloc_count=2;
+  mismatches=-1;
+  if ((strmaker_add_unicode_entry(mkstr,utext1,0)==ERR_NONE)&&
+      (strmaker_add_shared_entry(mkstr,0)==ERR_NONE))
+    mismatches=strmaker_check_strfile(mkstr,&strfile,0);
+  mkstr->mb2uni=NULL;
+  mkstr->mb2uni_count=0;
+  strmaker_free(mkstr);
+  return mismatches;
+}
+
+/**
+ * Verification of --dedup output accepts entries sharing data of
+ * the same text, and rejects ones sharing data of different text.
+ */
+void test_dedup_check(struct STR_Maker *mkstr)
+{
+  test_check(test_shared_mismatches(mkstr,"Horned Reaper","Horned Reaper")==0,
+      "dedup_check","same texts");
+  test_check(test_shared_mismatches(mkstr,"Horned Reaper","Dark Angel")>0,
+      "dedup_check","different texts");
+}
+
+/**
+ * Growing the text arrays keeps existing items, and clears new ones.
+ */
+void test_grow_alloc(void)
+{
+  struct TXT_File *txtfile;
+  txtfile=str_malloc(sizeof(struct TXT_File));
+  if (txtfile==NULL)
+  {
+    test_check(0,"grow_alloc","allocation");
+    return;
+  }
+  txtuni_clear(txtfile);
+  test_check((txtuni_set_offsalloc(txtfile,2)==ERR_NONE)&&
+      (txtuni_set_dataalloc(txtfile,2)==ERR_NONE),"grow_alloc","first allocation");
+  txtfile->offsets[0]=10;
+  txtfile->offsets[1]=20;
+  txtfile->data[0]='a';
+  txtfile->data[1]='b';
+  test_check((txtuni_set_offsalloc(txtfile,3)==ERR_NONE)&&
+      (txtuni_set_dataalloc(txtfile,3)==ERR_NONE),"grow_alloc","second allocation");
+  test_check((txtfile->offsets[0]==10)&&(txtfile->offsets[1]==20)&&(txtfile->offsets[2]==-1),
+      "grow_alloc","offsets");
+  test_check((txtfile->data[0]=='a')&&(txtfile->data[1]=='b')&&(txtfile->data[2]==0),
+      "grow_alloc","data");
+  txtuni_free(txtfile);
+}
+
+/**
+ * Console output of entries is UTF-8 in one line, and bad entry numbers
+ * are rejected rather than truncated.
+ */
+void test_print_entry(void)
+{
+  static const unsigned short text[]={'a','\n',0xe9,0x20ac,0xd83d,0xde00,0xd800,'\\',0};
+  static const char expected[]="a\\n\xc3\xa9\xe2\x82\xac\xf0\x9f\x98\x80\xef\xbf\xbd\\\\";
+  char buf[64];
+  unsigned int index;
+  FILE *fp;
+  size_t len;
+  fp=tmpfile();
+  if (fp==NULL)
+  {
+    test_check(0,"print_entry","temporary file");
+    return;
+  }
+  unicode_fputs_utf8(fp,text);
+  rewind(fp);
+  len=fread(buf,1,sizeof(buf)-1,fp);
+  buf[len]='\0';
+  fclose(fp);
+  test_check(strcmp(buf,expected)==0,"print_entry","utf-8 text");
+  test_check((str_parse_entry_index("12",&index)==ERR_NONE)&&(index==12),"print_entry","number");
+  test_check(str_parse_entry_index("4294967296",&index)!=ERR_NONE,"print_entry","too large");
+  test_check(str_parse_entry_index("-1",&index)!=ERR_NONE,"print_entry","negative");
+  test_check(str_parse_entry_index("5x",&index)!=ERR_NONE,"print_entry","not a number");
+}
+
+struct TEST_LiveReader {
+    struct STR_Live *live;
+    short stop;
+    unsigned long reads;
+    unsigned long errors;
+    unsigned long last_version;
+    struct THRD_Thread thread;
+    };
+
+/**
+ * Writes text file with one entry, "version N" followed by N dots,
+ * and replaces the live file with it, so the watcher never sees it
+ * written partially.
+ */
+int test_live_write(int version)
+{
+  unsigned short text[TEST_MAX_TEXT];
+  char buf[TEST_MAX_TEXT];
+  FILE *fp;
+  int n;
+  n=sprintf(buf,"version %d",version);
+  memset(buf+n,'.',version);
+  buf[n+version]='\0';
+  test_unicode(text,buf);
+  fp=fopen(TEST_LIVE_NAME ".tmp","wb");
+  if (fp==NULL)
+    return 0;
+  unicode_fwrite_header(fp,1);
+  unicode_fwrite_line(fp,text);
+  fclose(fp);
+  remove(TEST_LIVE_NAME ".txt");
+  return (rename(TEST_LIVE_NAME ".tmp",TEST_LIVE_NAME ".txt")==0);
+}
+
+/**
+ * Gives version number written into the entry by test_live_write().
+ * @return Returns the number, or -1 if the text isn't a complete entry.
+ */
+int test_live_version(const struct STR_Snapshot *snap)
+{
+  char buf[TEST_MAX_TEXT];
+  const unsigned short *text;
+  int i,version;
+  if ((snap->strfile==NULL)||(snap->strfile->str_count<1))
+    return -1;
+  text=snap->strfile->str[0];
+  for (i=0;(text[i]!=0)&&(i+1<TEST_MAX_TEXT);i++)
+    buf[i]=(char)text[i];
+  buf[i]='\0';
+  if (sscanf(buf,"version %d",&version)!=1)
+    return -1;
+  // Dots are checked, so that text of freed snapshot is noticed
+  for (i=strlen(buf)-version;buf[i]=='.';i++);
+  if ((i<1)||(buf[i]!='\0'))
+    return -1;
+  return version;
+}
+
+/**
+ * Reads the live file until stopped; every read must give a complete
+ * version, and versions can't go back.
+ */
+void test_live_reader(void *ctx)
+{
+  struct TEST_LiveReader *rdr=ctx;
+  const struct STR_Snapshot *snap;
+  int reader,version;
+  reader=strlive_reader_register(rdr->live);
+  if (reader<0)
+  {
+    rdr->errors++;
+    return;
+  }
+  while (!__sync_fetch_and_add(&rdr->stop,0))
+  {
+    snap=strlive_read_begin(rdr->live,reader);
+    version=test_live_version(snap);
+    if ((version<0)||(snap->version<rdr->last_version))
+      rdr->errors++;
+    rdr->last_version=snap->version;
+    strlive_read_end(rdr->live,reader);
+    rdr->reads++;
+  }
+}
+
+/**
+ * Readers of live file keep reading while new versions are published.
+ */
+void test_live_reload(void)
+{
+  struct TEST_LiveReader readers[TEST_LIVE_READERS];
+  struct STR_Live *live;
+  const struct STR_Snapshot *snap;
+  unsigned long errors,reads;
+  int i,version,wait;
+  remove(TEST_LIVE_NAME ".str");
+  if (!test_live_write(1))
+  {
+    test_check(0,"live_reload","write text file");
+    return;
+  }
+  live=strlive_open(TEST_LIVE_NAME,STRFLAG_VERBOSE);
+  test_check(live!=NULL,"live_reload","open");
+  if (live==NULL)
+  {
+    remove(TEST_LIVE_NAME ".txt");
+    return;
+  }
+  memset(readers,0,sizeof(readers));
+  for (i=0;i<TEST_LIVE_READERS;i++)
+  {
+    readers[i].live=live;
+    thread_start(&readers[i].thread,test_live_reader,&readers[i]);
+  }
+  for (version=2;version<=TEST_LIVE_VERSIONS;version++)
+  {
+    test_check(test_live_write(version),"live_reload","write text file");
+    for (wait=0;(wait<TEST_LIVE_WAIT)&&
+        (__sync_fetch_and_add(&live->reloads,0)<(unsigned long)version-1);wait++)
+      thread_sleep_ms(10);
+  }
+  errors=0;
+  reads=0;
+  for (i=0;i<TEST_LIVE_READERS;i++)
+  {
+    __sync_add_and_fetch(&readers[i].stop,1);
+    thread_join(&readers[i].thread);
+    errors+=readers[i].errors;
+    reads+=readers[i].reads;
+  }
+  test_check(__sync_fetch_and_add(&live->reloads,0)==TEST_LIVE_VERSIONS-1,
+      "live_reload","reloads count");
+  test_check((reads>0)&&(errors==0),"live_reload","concurrent reads");
+  i=strlive_reader_register(live);
+  test_check(i>=0,"live_reload","reader slot");
+  if (i>=0)
+  {
+    snap=strlive_read_begin(live,i);
+    test_check(test_live_version(snap)==TEST_LIVE_VERSIONS,"live_reload","newest version");
+    strlive_read_end(live,i);
+  }
+  strlive_close(live);
+  remove(TEST_LIVE_NAME ".txt");
+}
+
+/**
+ * Writes STR file with entries of given texts, using the codepage of
+ * cpstr; extra bytes are written at end of the data block.
+ * @return Returns 1 on success.
+ */
+int test_delta_write(struct STR_Maker *cpstr,const char *fname,const char **texts,
+    int count,const char *extra,int extra_len)
+{
+  unsigned short utext[TEST_MAX_TEXT];
+  struct STR_Maker *mkstr;
+  FILE *fp;
+  int i,passed;
+  mkstr=str_malloc(sizeof(struct STR_Maker));
+  if (mkstr==NULL)
+    return 0;
+  strmaker_clear(mkstr);
+  mkstr->mb2uni=cpstr->mb2uni;
+  mkstr->mb2uni_count=cpstr->mb2uni_count;
+  passed=1;
+  for (i=0;(i<count)&&(passed);i++)
+  {
+    test_unicode(utext,texts[i]);
+    passed=(strmaker_add_unicode_entry(mkstr,utext,0)==ERR_NONE);
+  }
+  fp=fopen(fname,"wb");
+  if (fp==NULL)
+    passed=0;
+  if (passed)
+    passed=(strmaker_fwrite(mkstr,fp,0)==ERR_NONE);
+  if (fp!=NULL)
+  {
+    fwrite(extra,1,extra_len,fp);
+    fclose(fp);
+  }
+  mkstr->mb2uni=NULL;
+  mkstr->mb2uni_count=0;
+  strmaker_free(mkstr);
+  return passed;
+}
+
+/**
+ * Delta of file with inserted and removed entries only stores the new
+ * entries, and bytes outside of entries are kept.
+ */
+void test_delta_insert_delete(struct STR_Maker *cpstr)
+{
+  static const char *old_texts[]={"Horned Reaper","Dark Angel","Vampire","Black Knight"};
+  static const char *new_texts[]={"Imp","Horned Reaper","Vampire","Black Knight","Goblin"};
+  unsigned char header[SIZEOF_DLT_Header];
+  unsigned long long new_hash,hash;
+  FILE *fp;
+  int passed;
+  passed=test_delta_write(cpstr,TEST_DELTA_NAME "_old.str",old_texts,4,"",0)&&
+      test_delta_write(cpstr,TEST_DELTA_NAME ".str",old_texts,4,"",0)&&
+      test_delta_write(cpstr,TEST_DELTA_NAME "_new.str",new_texts,5,"\x07\x08\x09",3);
+  test_check(passed,"delta_insert_delete","write files");
+  test_check(str_delta_make(TEST_DELTA_NAME "_old.str",TEST_DELTA_NAME "_new.str",
+      TEST_DELTA_NAME ".dlt",0)==ERR_NONE,"delta_insert_delete","make");
+  fp=fopen(TEST_DELTA_NAME ".dlt","rb");
+  passed=(fp!=NULL)&&(fread(header,1,SIZEOF_DLT_Header,fp)==SIZEOF_DLT_Header);
+  if (fp!=NULL)
+    fclose(fp);
+  // Items and gaps counts
+  test_check(passed&&(read_int32_le_buf(header+40)==2),"delta_insert_delete","items count");
+  test_check(passed&&(read_int32_le_buf(header+44)==1),"delta_insert_delete","gaps count");
+  test_check(str_delta_apply(TEST_DELTA_NAME ".str",TEST_DELTA_NAME ".dlt",0)==ERR_NONE,
+      "delta_insert_delete","apply");
+  passed=(file_hash(TEST_DELTA_NAME "_new.str",&new_hash)==0)&&
+      (file_hash(TEST_DELTA_NAME ".str",&hash)==0);
+  test_check(passed&&(hash==new_hash),"delta_insert_delete","rebuilt file");
+  remove(TEST_DELTA_NAME "_old.str");
+  remove(TEST_DELTA_NAME "_new.str");
+  remove(TEST_DELTA_NAME ".str");
+  remove(TEST_DELTA_NAME ".dlt");
+}
+
+int main(int argc, char *argv[])
+{
+  struct STR_Maker *mkstr;
+  mkstr=test_load_codepage();
+  if (mkstr==NULL)
+  {
+    printf("Cannot load %s\n",TEST_CODEPAGE_FNAME);
+    return 1;
+  }
+  test_encode_escapes(mkstr);
+  test_dedup_check(mkstr);
+  test_grow_alloc();
+  test_print_entry();
+  test_live_reload();
+  test_delta_insert_delete(mkstr);
+  strmaker_free(mkstr);
+  printf("Checks run: %d, failed: %d\n",tests_run,tests_failed);
+  return tests_failed;
+}
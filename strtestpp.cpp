@@ -0,0 +1,107 @@
+/******************************************************************************/
+/** @file strtestpp.cpp
+ * Library for r/w of DK2 STR text strings files.
+ * @par Purpose:
+ *     Unit tests of the C++ interface, from strfile.hpp.
+ * @par Comment:
+ *     Checks that the header compiles, and that texts and entries given
+ *     by its classes have the lengths and content of the C routines.
+ *     Needs MBToUni.dat in the current folder.
+ * @par  Copying and copyrights:
+ *     This program is free software; you can redistribute it and/or modify
+ *     it under the terms of the GNU General Public License as published by
+ *     the Free Software Foundation; either version 2 of the License, or
+ *     (at your option) any later version.
+ */
+/******************************************************************************/
+
+#include "strfile.hpp"
+
+#include <cstdio>
+#include <string>
+#include <utility>
+
+#define TEST_CODEPAGE_FNAME "MBToUni.dat"
+// More characters than a short can count
+#define TEST_LONG_TEXT 40000
+
+static int tests_run=0;
+static int tests_failed=0;
+
+/**
+ * Counts result of one check, and reports it if it failed.
+ */
+static void test_check(bool passed,const char *test,const char *what)
+{
+    tests_run++;
+    if (passed)
+        return;
+    tests_failed++;
+    std::printf("FAILED %s: %s\n",test,what);
+}
+
+/**
+ * Encoding through Codepage and decoding back gives the same text.
+ */
+static void test_codepage(const dk2str::Codepage &cp)
+{
+    std::u16string text(u"Horned Reaper\\nDark Angel");
+    dk2str::Bytes edata=cp.encode(text);
+    test_check((bool)edata,"codepage","encode");
+    dk2str::Text decoded=cp.decode(edata.span());
+    test_check((bool)decoded,"codepage","decode");
+    test_check(decoded.view()==text,"codepage","decoded text");
+}
+
+/**
+ * StrMaker gives entries longer than 32767 characters with their
+ * full length.
+ */
+static void test_maker_long_entry()
+{
+    STR_Maker *mkstr;
+    std::FILE *fp;
+    mkstr=static_cast<STR_Maker *>(str_malloc(sizeof(STR_Maker)));
+    if (mkstr==nullptr)
+    {
+        test_check(false,"maker_long_entry","allocation");
+        return;
+    }
+    strmaker_clear(mkstr);
+    dk2str::StrMaker maker(mkstr,false);
+    fp=std::fopen(TEST_CODEPAGE_FNAME,"rb");
+    if (fp==nullptr)
+    {
+        test_check(false,"maker_long_entry","codepage");
+        return;
+    }
+    short result=str_mb2uni_fread(mkstr,fp,STRFLAG_VERBOSE);
+    std::fclose(fp);
+    test_check(result==ERR_NONE,"maker_long_entry","codepage");
+    std::u16string text(TEST_LONG_TEXT,u'a');
+    text[TEST_LONG_TEXT-1]=u'z';
+    result=strmaker_add_unicode_entry(mkstr,
+        reinterpret_cast<unsigned short *>(&text[0]),STRFLAG_VERBOSE);
+    test_check(result==ERR_NONE,"maker_long_entry","add entry");
+    test_check(maker.size()==1,"maker_long_entry","entries count");
+    test_check(!(*maker.begin()).empty(),"maker_long_entry","encoded entry");
+    dk2str::Text decoded=maker.decode(0);
+    test_check((bool)decoded,"maker_long_entry","decode");
+    test_check(decoded.view().size()==TEST_LONG_TEXT,"maker_long_entry","length");
+    test_check(decoded.view()==text,"maker_long_entry","decoded text");
+}
+
+int main(int argc, char *argv[])
+{
+    STR_Error err;
+    dk2str::Codepage cp=dk2str::Codepage::load(TEST_CODEPAGE_FNAME,0,&err);
+    if (!cp)
+    {
+        std::printf("Cannot load %s\n",TEST_CODEPAGE_FNAME);
+        return 1;
+    }
+    test_codepage(cp);
+    test_maker_long_entry();
+    std::printf("Checks run: %d, failed: %d\n",tests_run,tests_failed);
+    return tests_failed;
+}
@@ -0,0 +1,306 @@
+/******************************************************************************/
+/** @file strthread.c
+ * Library for r/w of DK2 STR text strings files.
+ * @par Purpose:
+ *     Running work on many threads.
+ * @par Comment:
+ *     Uses Windows threads on Windows, and POSIX threads elsewhere.
+ * @par  Copying and copyrights:
+ *     This program is free software; you can redistribute it and/or modify
+ *     it under the terms of the GNU General Public License as published by
+ *     the Free Software Foundation; either version 2 of the License, or
+ *     (at your option) any later version.
+ */
+/******************************************************************************/
+
+#include "strthread.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#if defined(_WIN32)
+#include <windows.h>
+#else
+#include <pthread.h>
+#include <unistd.h>
+#endif
+#include "unitext.h"
+#include "stralloc.h"
+
+struct THRD_ParallelFor {
+    volatile long next;      // Next index to be processed
+    unsigned int count;
+    ParallelForFunc func;
+    void *ctx;
+    short stats_enabled;     // Whether the workers gather statistics
+    };
+
+/**
+ * Worker thread of parallel-for, with its own statistics.
+ */
+struct THRD_Worker {
+    struct THRD_ParallelFor *pf;
+    struct STR_Stats stats;
+    };
+
+/**
+ * Returns amount of processors available for the program.
+ */
+unsigned int thread_cpu_count(void)
+{
+#if defined(_WIN32)
+  SYSTEM_INFO info;
+  GetSystemInfo(&info);
+  if (info.dwNumberOfProcessors<1)
+    return 1;
+  return info.dwNumberOfProcessors;
+#else
+  long count=sysconf(_SC_NPROCESSORS_ONLN);
+  if (count<1)
+    return 1;
+  return count;
+#endif
+}
+
+/**
+ * Takes next indices from the shared counter until all are done.
+ */
+void thread_parallel_for_work(struct THRD_ParallelFor *pf)
+{
+  long index;
+  while ((index=__sync_fetch_and_add(&pf->next,1))<pf->count)
+    pf->func(pf->ctx,index);
+}
+
+/**
+ * Does the work on a started thread; statistics of the thread are
+ * stored, to be merged after it's joined.
+ */
+void thread_parallel_for_worker(struct THRD_Worker *worker)
+{
+  if (worker->pf->stats_enabled)
+    stats_enable();
+  thread_parallel_for_work(worker->pf);
+  stats_thread_end(&worker->stats);
+}
+
+#if defined(_WIN32)
+DWORD WINAPI thread_parallel_for_proc(LPVOID param)
+{
+  thread_parallel_for_worker(param);
+  return 0;
+}
+#else
+void *thread_parallel_for_proc(void *param)
+{
+  thread_parallel_for_worker(param);
+  return NULL;
+}
+#endif
+
+/**
+ * Calls the function for every index from 0 to count-1, on given
+ * amount of threads. Indices are taken in ascending order, but calls
+ * may finish in any order. The calling thread does work too.
+ * Statistics gathered by other threads are added to the calling one.
+ * @param threads Amount of threads, including the calling one.
+ * @return Returns ERR_NONE when all calls are finished.
+ */
+short thread_parallel_for(unsigned int count,unsigned int threads,ParallelForFunc func,void *ctx)
+{
+  struct THRD_ParallelFor pf;
+  struct THRD_Worker workers[THREADS_MAX_COUNT];
+#if defined(_WIN32)
+  HANDLE handles[THREADS_MAX_COUNT];
+#else
+  pthread_t handles[THREADS_MAX_COUNT];
+#endif
+  unsigned int i,started;
+  pf.next=0;
+  pf.count=count;
+  pf.func=func;
+  pf.ctx=ctx;
+  pf.stats_enabled=str_stats.enabled;
+  if (threads>THREADS_MAX_COUNT)
+    threads=THREADS_MAX_COUNT;
+  if (threads>count)
+    threads=count;
+  // If a thread cannot be started, the rest of work is done by others
+  started=0;
+  for (i=1;i<threads;i++)
+  {
+    workers[started].pf=&pf;
+    workers[started].stats.enabled=0;
+#if defined(_WIN32)
+    handles[started]=CreateThread(NULL,0,thread_parallel_for_proc,&workers[started],0,NULL);
+    if (handles[started]==NULL)
+      break;
+#else
+    if (pthread_create(&handles[started],NULL,thread_parallel_for_proc,&workers[started])!=0)
+      break;
+#endif
+    started++;
+  }
+  thread_parallel_for_work(&pf);
+  for (i=0;i<started;i++)
+  {
+#if defined(_WIN32)
+    WaitForSingleObject(handles[i],INFINITE);
+    CloseHandle(handles[i]);
+#else
+    pthread_join(handles[i],NULL);
+#endif
+    stats_merge(&workers[i].stats);
+  }
+  return ERR_NONE;
+}
+
+/**
+ * Runs function of a thread started by thread_start().
+ */
+void thread_start_run(struct THRD_Thread *thrd)
+{
+  if (thrd->stats.enabled)
+    stats_enable();
+  thrd->func(thrd->ctx);
+  stats_thread_end(&thrd->stats);
+}
+
+#if defined(_WIN32)
+DWORD WINAPI thread_start_proc(LPVOID param)
+{
+  thread_start_run(param);
+  return 0;
+}
+#else
+void *thread_start_proc(void *param)
+{
+  thread_start_run(param);
+  return NULL;
+}
+#endif
+
+/**
+ * Starts a thread calling the function. The THRD_Thread structure
+ * must exist until thread_join() is called. Statistics gathered by the
+ * thread are added to the thread which joins it.
+ * @return Returns ERR_NONE if the thread was started.
+ */
+short thread_start(struct THRD_Thread *thrd,ThreadFunc func,void *ctx)
+{
+  thrd->func=func;
+  thrd->ctx=ctx;
+  thrd->stats.enabled=str_stats.enabled;
+#if defined(_WIN32)
+  thrd->handle=CreateThread(NULL,0,thread_start_proc,thrd,0,NULL);
+  if (thrd->handle==NULL)
+    return -1;
+#else
+  thrd->handle=str_malloc(sizeof(pthread_t));
+  if (thrd->handle==NULL)
+    return ERR_NO_MEMORY;
+  if (pthread_create(thrd->handle,NULL,thread_start_proc,thrd)!=0)
+  {
+    str_free(thrd->handle);
+    thrd->handle=NULL;
+    return -1;
+  }
+#endif
+  return ERR_NONE;
+}
+
+/**
+ * Waits until the thread started by thread_start() finishes.
+ */
+short thread_join(struct THRD_Thread *thrd)
+{
+  if (thrd->handle==NULL)
+    return -1;
+#if defined(_WIN32)
+  WaitForSingleObject(thrd->handle,INFINITE);
+  CloseHandle(thrd->handle);
+#else
+  pthread_join(*(pthread_t *)thrd->handle,NULL);
+  str_free(thrd->handle);
+#endif
+  thrd->handle=NULL;
+  stats_merge(&thrd->stats);
+  return ERR_NONE;
+}
+
+/**
+ * Suspends the calling thread for given time.
+ */
+void thread_sleep_ms(unsigned int ms)
+{
+#if defined(_WIN32)
+  Sleep(ms);
+#else
+  usleep(ms*1000);
+#endif
+}
+
+/**
+ * Creates a mutex, to be freed with thread_mutex_free().
+ * @return Returns ERR_NONE on success.
+ */
+short thread_mutex_init(struct THRD_Mutex *mtx)
+{
+#if defined(_WIN32)
+  mtx->handle=str_malloc(sizeof(CRITICAL_SECTION));
+  if (mtx->handle==NULL)
+    return ERR_NO_MEMORY;
+  InitializeCriticalSection(mtx->handle);
+#else
+  mtx->handle=str_malloc(sizeof(pthread_mutex_t));
+  if (mtx->handle==NULL)
+    return ERR_NO_MEMORY;
+  if (pthread_mutex_init(mtx->handle,NULL)!=0)
+  {
+    str_free(mtx->handle);
+    mtx->handle=NULL;
+    return -1;
+  }
+#endif
+  return ERR_NONE;
+}
+
+/**
+ * Waits until no other thread holds the mutex, and takes it.
+ */
+void thread_mutex_lock(struct THRD_Mutex *mtx)
+{
+#if defined(_WIN32)
+  EnterCriticalSection(mtx->handle);
+#else
+  pthread_mutex_lock(mtx->handle);
+#endif
+}
+
+/**
+ * Releases the mutex taken by thread_mutex_lock().
+ */
+void thread_mutex_unlock(struct THRD_Mutex *mtx)
+{
+#if defined(_WIN32)
+  LeaveCriticalSection(mtx->handle);
+#else
+  pthread_mutex_unlock(mtx->handle);
+#endif
+}
+
+/**
+ * Frees the mutex; no thread may hold it.
+ */
+void thread_mutex_free(struct THRD_Mutex *mtx)
+{
+  if (mtx->handle==NULL)
+    return;
+#if defined(_WIN32)
+  DeleteCriticalSection(mtx->handle);
+#else
+  pthread_mutex_destroy(mtx->handle);
+#endif
+  str_free(mtx->handle);
+  mtx->handle=NULL;
+}
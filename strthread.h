@@ -0,0 +1,57 @@
+/******************************************************************************/
+/** @file strthread.h
+ * Library for r/w of DK2 STR text strings files.
+ * @par Purpose:
+ *     Header file. Defines exported routines from strthread.c.
+ * @par Comment:
+ *     None.
+ * @par  Copying and copyrights:
+ *     This program is free software; you can redistribute it and/or modify
+ *     it under the terms of the GNU General Public License as published by
+ *     the Free Software Foundation; either version 2 of the License, or
+ *     (at your option) any later version.
+ */
+/******************************************************************************/
+
+#ifndef STRTHREAD_H
+#define STRTHREAD_H
+
+#include <stdio.h>
+#include "strstats.h"
+
+// Maximal amount of worker threads
+#define THREADS_MAX_COUNT 64
+
+typedef void (*ParallelForFunc)(void *ctx,unsigned int index);
+typedef void (*ThreadFunc)(void *ctx);
+
+/**
+ * Thread started by thread_start(); the handle is system specific.
+ */
+struct THRD_Thread {
+    void *handle;
+    ThreadFunc func;
+    void *ctx;
+    struct STR_Stats stats;  // Statistics of the thread, merged at join
+    };
+
+/**
+ * Mutex created by thread_mutex_init(); the handle is system specific.
+ */
+struct THRD_Mutex {
+    void *handle;
+    };
+
+// Routines
+
+unsigned int thread_cpu_count(void);
+short thread_parallel_for(unsigned int count,unsigned int threads,ParallelForFunc func,void *ctx);
+short thread_start(struct THRD_Thread *thrd,ThreadFunc func,void *ctx);
+short thread_join(struct THRD_Thread *thrd);
+void thread_sleep_ms(unsigned int ms);
+short thread_mutex_init(struct THRD_Mutex *mtx);
+void thread_mutex_lock(struct THRD_Mutex *mtx);
+void thread_mutex_unlock(struct THRD_Mutex *mtx);
+void thread_mutex_free(struct THRD_Mutex *mtx);
+
+#endif
@@ -18,14 +18,173 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <locale.h>
 #include "unitext.h"
 #include "strfile.h"
+#include "strbatch.h"
+#include "strsearch.h"
+#include "strwatch.h"
+#include "strindex.h"
+#include "strgen.h"
+#include "strstats.h"
+#include "strtrace.h"
+#include "stralloc.h"
+#include "strround.h"
+#include "strthread.h"
+#include "strstream.h"
+#include "strdcache.h"
+#include "strlive.h"
+#include "strbundle.h"
+#include "strdelta.h"
+#include "lbfileio.h"
+
+/**
+ * Prints conversion statistics; registered to be called at exit.
+ */
+void print_stats(void)
+{
+    stats_print(stdout);
+}
+
+void print_stats_json(void)
+{
+    stats_print_json(stdout);
+}
+
+void print_alloc_stats(void)
+{
+    stralloc_accounting_print(stdout);
+}
+
+/**
+ * Finishes the trace file; registered to be called at exit.
+ */
+void close_trace(void)
+{
+    trace_close(STRFLAG_VERBOSE);
+}
+
+/**
+ * Counts output files written and skipped because they were unchanged.
+ */
+void count_output(short result,int *written,int *skipped)
+{
+    if (result==ERR_NONE)
+      (*written)++;
+    else
+    if (result==ERR_UNCHANGED)
+      (*skipped)++;
+}
 
 int main(int argc, char *argv[])
 {
     printf("\nDungeon Keeper 2 text STR tool %s\n",VER_STRING);
     printf("designed for Polish Dungeon Keeper Team\n");
     printf("-------------------------------\n");
+    // Options are removed from the arguments list
+    short check_all=0;
+    short live_lookup=0;
+    short opt_flags=0;
+    struct STR_GenParams gen_params;
+    strgen_defaults(&gen_params);
+    char *trace_fname=NULL;
+    long trace_large_entry=0;
+    unsigned int threads=thread_cpu_count();
+    unsigned long cache_size=DECCACHE_DEFAULT_LIMIT;
+    int i,k;
+    k=1;
+    for (i=1;i<argc;i++)
+    {
+        if (strncmp(argv[i],"--",2)!=0)
+        {
+            argv[k]=argv[i];
+            k++;
+        } else
+        if (strcmp(argv[i],"--all")==0)
+        {
+            check_all=1;
+        } else
+        if (strcmp(argv[i],"--live")==0)
+        {
+            live_lookup=1;
+        } else
+        if (strcmp(argv[i],"--dedup")==0)
+        {
+            opt_flags|=STRFLAG_DEDUP;
+        } else
+        if (strcmp(argv[i],"--cache")==0)
+        {
+            opt_flags|=STRFLAG_KEEPCACHE;
+        } else
+        if (strcmp(argv[i],"--txt-cache")==0)
+        {
+            opt_flags|=STRFLAG_TXTCACHE;
+        } else
+        if (strcmp(argv[i],"--stats")==0)
+        {
+            stats_enable();
+            atexit(print_stats);
+        } else
+        if (strcmp(argv[i],"--stats=json")==0)
+        {
+            stats_enable();
+            atexit(print_stats_json);
+        } else
+        if (strcmp(argv[i],"--alloc-stats")==0)
+        {
+            // Nothing is allocated by the library before this point
+            if (stralloc_accounting_enable()==ERR_NONE)
+              atexit(print_alloc_stats);
+        } else
+        if (strncmp(argv[i],"--trace=",8)==0)
+        {
+            trace_fname=argv[i]+8;
+        } else
+        if (sscanf(argv[i],"--trace-entries=%ld",&trace_large_entry)==1)
+        {
+        } else
+        if (sscanf(argv[i],"--threads=%u",&threads)==1)
+        {
+        } else
+        if (sscanf(argv[i],"--cache-size=%lu",&cache_size)==1)
+        {
+            cache_size*=1024;
+        } else
+        if (sscanf(argv[i],"--len=%u-%u",&gen_params.min_len,&gen_params.max_len)==2)
+        {
+        } else
+        if (strcmp(argv[i],"--dist=short")==0)
+        {
+            gen_params.length_dist=STRGEN_DIST_SHORT;
+        } else
+        if (strcmp(argv[i],"--dist=uniform")==0)
+        {
+            gen_params.length_dist=STRGEN_DIST_UNIFORM;
+        } else
+        if (sscanf(argv[i],"--params=%u",&gen_params.param_pct)==1)
+        {
+        } else
+        if (sscanf(argv[i],"--escapes=%u",&gen_params.escape_pct)==1)
+        {
+        } else
+        if (strcmp(argv[i],"--extend-codepage")==0)
+        {
+            gen_params.extend_cp=1;
+        } else
+        if (sscanf(argv[i],"--dups=%u",&gen_params.dup_pct)==1)
+        {
+        } else
+        if (sscanf(argv[i],"--seed=%lu",&gen_params.seed)==1)
+        {
+        } else
+        if (sscanf(argv[i],"--file-id=%u",&gen_params.file_id)==1)
+        {
+        } else
+        {
+            printf("Unknown option \"%s\" ignored.\n",argv[i]);
+        }
+    }
+    argc=k;
     if ((argc<3)||(strlen(argv[2])!=1))
     {
         printf("Not enought parameters.\n");
@@ -33,27 +192,82 @@ int main(int argc, char *argv[])
         printf("  %s <strfile> <operation>\n","strtool");
         printf("The <strfile> should be given without extension.\n");
         printf("Valid <operations> are:\n");
-        printf("  x: eXport entries into text file \n");
+        printf("  x: eXport entries into text file; with \"-\" after x, str file\n");
+        printf("     data is read from standard input\n");
         printf("  c: Create the str file using text file\n");
+        printf("  u: Update the str file, encoding only changed entries\n");
+        printf("  p: apply Patch file to the str file; usage:\n");
+        printf("     %s <strfile> p <patchfile>\n","strtool");
+        printf("  v: Verify if the str file is up to date with text file;\n");
+        printf("     stops on first difference, unless --all is given\n");
+        printf("  s: Search for a phrase in str file, or in all str files\n");
+        printf("     in folder given instead of <strfile>; usage:\n");
+        printf("     %s <strfile> s <phrase>\n","strtool");
         printf("  d: Dump str file structure data\n");
+        printf("  b: Build all str files in folder given instead of <strfile>,\n");
+        printf("     converting only text files changed since previous build\n");
+        printf("  w: Watch folder given instead of <strfile> with its sub-folders,\n");
+        printf("     converting every text file into str file when it's saved\n");
+        printf("  i: create or update search Index of str files in folder\n");
+        printf("     given instead of <strfile>\n");
+        printf("  q: Query the search index of folder; usage:\n");
+        printf("     %s <folder> q <phrase>\n","strtool");
+        printf("  g: Generate random str and text files for tests; usage:\n");
+        printf("     %s <strfile> g [entries] [--len=MIN-MAX] [--dist=short|uniform]\n","strtool");
+        printf("     [--params=PCT] [--escapes=PCT [--extend-codepage]] [--dups=PCT]\n");
+        printf("     [--seed=N] [--file-id=N]\n");
+        printf("  l: Look up entries with given numbers; usage:\n");
+        printf("     %s <strfile> l [number...] [--cache-size=KB] [--live]\n","strtool");
+        printf("     %s <bundle>.stb l <strfile> [number...]\n","strtool");
+        printf("     without numbers, they are read from standard input; with\n");
+        printf("     --live, the file is reloaded whenever it's written\n");
+        printf("  k: pacK all str files in folder given instead of <strfile> into\n");
+        printf("     one bundle; usage:\n");
+        printf("     %s <folder> k <bundle>.stb\n","strtool");
+        printf("  n: uNpack the bundle into str files in folder; usage:\n");
+        printf("     %s <folder> n <bundle>.stb\n","strtool");
+        printf("  f: make delta File with entries which differ from older str\n");
+        printf("     file; usage:\n");
+        printf("     %s <strfile> f <old strfile>.str <deltafile>\n","strtool");
+        printf("  a: Apply delta file to the older str file; usage:\n");
+        printf("     %s <strfile> a <deltafile>\n","strtool");
+        printf("  r: verify Round-trip of str file, or all str files in folder,\n");
+        printf("     through text and back; works in memory, on --threads=N threads\n");
+        printf("Use --dedup with c, u or b to store repeated entries once\n");
+        printf("Use --cache with b to keep encoded texts for the next build\n");
+        printf("Use --txt-cache with c, u or v to keep parsed text file for the next run\n");
+        printf("Use --stats or --stats=json to show time of conversion phases\n");
+        printf("Use --alloc-stats to show memory used by every allocation site\n");
+        printf("Use --trace=<file> to write trace of conversion phases, and\n");
+        printf("     --trace-entries=<size> to also trace entries of that size or larger\n");
         printf("\n");
         system("PAUSE");	
     	return 1;
     }
   struct STR_File *strfile;
-  short flags = STRFLAG_VERBOSE;
+  short flags = STRFLAG_VERBOSE|opt_flags;
+  int files_written=0;
+  int files_skipped=0;
+  int exit_code=0;
   int fname_len=strlen(argv[1]);
-  char *strfname=malloc(fname_len+5);
-  char *txtfname=malloc(fname_len+5);
+  char *strfname=str_malloc(fname_len+5);
+  char *txtfname=str_malloc(fname_len+5);
   if ((strfname==NULL)||(txtfname==NULL))
   {
     str_error("Can't allocate memory for file names");
     return 4;
   }
+  if (trace_fname!=NULL)
+  {
+    if (trace_open(trace_fname,trace_large_entry,flags)!=ERR_NONE)
+      return 2;
+    atexit(close_trace);
+  }
   strfile=NULL;
   sprintf(strfname,"%s.str",argv[1]);
   sprintf(txtfname,"%s.txt",argv[1]);
   char operatn=tolower(argv[2][0]);
+  stats_file_enter(argv[1]);
   switch (operatn)
   {
   case 'd':
@@ -74,11 +288,218 @@ int main(int argc, char *argv[])
         return 2;
       }
       printf("Writing STR file...\n");
-      str_write(strfile,strfname,flags);
+      count_output(str_write(strfile,strfname,flags),&files_written,&files_skipped);
       printf("Creation finished.\n");
       break;
+  case 'u':
+      printf("Opening Unicode Text file...\n");
+      strfile=str_open_unicode(txtfname,flags);
+      if (strfile==NULL)
+      {
+        return 2;
+      }
+      printf("Updating STR file...\n");
+      count_output(str_update(strfile,strfname,flags),&files_written,&files_skipped);
+      printf("Update finished.\n");
+      break;
+  case 'p':
+      if (argc<4)
+      {
+        printf("Patch file name not specified.\n");
+        printf("Exiting without any changes.\n");
+        break;
+      }
+      printf("Patching STR file...\n");
+      {
+        short result=str_patch(strfname,argv[3],flags);
+        if (result<ERR_NONE)
+          return 2;
+        count_output(result,&files_written,&files_skipped);
+      }
+      printf("Patching finished.\n");
+      break;
+  case 'v':
+      printf("Opening Unicode Text file...\n");
+      strfile=str_open_unicode(txtfname,flags);
+      if (strfile==NULL)
+      {
+        return 2;
+      }
+      printf("Verifying STR file...\n");
+      {
+        int mismatches=str_check(strfile,strfname,!check_all,flags);
+        if (mismatches<0)
+          return 2;
+        if (mismatches>0)
+        {
+          printf("STR file is out of date.\n");
+          exit_code=5;
+        } else
+        {
+          printf("STR file is up to date.\n");
+        }
+      }
+      break;
+  case 's':
+      if (argc<4)
+      {
+        printf("Search phrase not specified.\n");
+        break;
+      }
+      setlocale(LC_CTYPE,"");
+      {
+        unsigned short *phrase=unicode_from_mbs(argv[3]);
+        if (phrase==NULL)
+        {
+          printf("Cannot convert the search phrase.\n");
+          return 2;
+        }
+        int count=str_search(argv[1],phrase,flags);
+        str_free(phrase);
+        if (count<0)
+          return 2;
+      }
+      break;
+  case 'b':
+      printf("Building STR files in folder...\n");
+      if (str_batch_build(argv[1],flags)<ERR_NONE)
+        return 2;
+      printf("Build finished.\n");
+      break;
+  case 'i':
+      printf("Indexing STR files in folder...\n");
+      if (str_index_build(argv[1],flags)<ERR_NONE)
+        return 2;
+      printf("Indexing finished.\n");
+      break;
+  case 'q':
+      if (argc<4)
+      {
+        printf("Search phrase not specified.\n");
+        break;
+      }
+      setlocale(LC_CTYPE,"");
+      {
+        unsigned short *phrase=unicode_from_mbs(argv[3]);
+        if (phrase==NULL)
+        {
+          printf("Cannot convert the search phrase.\n");
+          return 2;
+        }
+        int count=str_index_query(argv[1],phrase,flags);
+        str_free(phrase);
+        if (count<0)
+          return 2;
+      }
+      break;
+  case 'g':
+      if (argc>3)
+        gen_params.entries=strtoul(argv[3],NULL,10);
+      printf("Generating %lu entries...\n",gen_params.entries);
+      {
+        short result=str_generate_codepage(strfname,&gen_params,flags);
+        if (result<ERR_NONE)
+          return 2;
+        // Codepage is counted only if it was written
+        if (result==ERR_NONE)
+          count_output(result,&files_written,&files_skipped);
+        result=str_generate(strfname,txtfname,&gen_params,flags);
+        if (result<ERR_NONE)
+          return 2;
+        count_output(result,&files_written,&files_skipped);
+      }
+      printf("Generation finished.\n");
+      break;
+  case 'r':
+      printf("Verifying round-trip conversion...\n");
+      {
+        int failed=str_roundtrip(argv[1],threads,flags);
+        if (failed<0)
+          return 2;
+        if (failed>0)
+        {
+          printf("Some entries don't survive the conversion.\n");
+          exit_code=5;
+        } else
+        {
+          printf("All entries survived the conversion.\n");
+        }
+      }
+      break;
+  case 'w':
+      if (str_watch_build(argv[1],NULL,flags)<ERR_NONE)
+        return 2;
+      break;
+  case 'k':
+  case 'n':
+      if (argc<4)
+      {
+        printf("Bundle file name not given.\n");
+        return 1;
+      } else
+      {
+        short result;
+        if (operatn=='k')
+          result=str_bundle_pack(argv[1],argv[3],flags);
+        else
+          result=str_bundle_unpack(argv[3],argv[1],flags);
+        if (result<ERR_NONE)
+          return 2;
+        if (operatn=='k')
+          count_output(result,&files_written,&files_skipped);
+      }
+      break;
+  case 'f':
+  case 'a':
+      if (argc<((operatn=='f')?5:4))
+      {
+        printf("Delta file name not given.\n");
+        return 1;
+      } else
+      {
+        short result;
+        if (operatn=='f')
+          result=str_delta_make(argv[3],strfname,argv[4],flags);
+        else
+          result=str_delta_apply(strfname,argv[3],flags);
+        if (result<ERR_NONE)
+          return 2;
+        count_output(result,&files_written,&files_skipped);
+      }
+      break;
+  case 'l':
+    {
+      int count;
+      if (fname_has_ext(argv[1],".stb"))
+      {
+        if (argc<4)
+        {
+          printf("Name of STR file in the bundle not given.\n");
+          return 1;
+        }
+        count=str_bundle_lookup(argv[1],argv[3],argv+4,argc-4,flags);
+      } else
+      if (live_lookup)
+        count=str_live_lookup(argv[1],argv+3,argc-3,flags);
+      else
+        count=str_lookup(argv[1],argv+3,argc-3,cache_size,flags);
+      if (count<0)
+        return 2;
+    }
+      break;
   case 'e':
   case 'x':
+      if ((argc>3)&&(strcmp(argv[3],"-")==0))
+      {
+        printf("Exporting STR data from standard input...\n");
+        file_set_binary(stdin);
+        short result=str_export_stream(stdin,strfname,txtfname,flags);
+        if (result<ERR_NONE)
+          return 2;
+        count_output(result,&files_written,&files_skipped);
+        printf("Extraction finished.\n");
+        break;
+      }
       printf("Opening STR file...\n");
       strfile=str_open(strfname,flags);
       if (strfile==NULL)
@@ -86,7 +507,7 @@ int main(int argc, char *argv[])
         return 2;
       }
       printf("Wriring Unicode Text file...\n");
-      str_write_unicode(strfile,txtfname,flags);
+      count_output(str_write_unicode(strfile,txtfname,flags),&files_written,&files_skipped);
       printf("Extraction finished.\n");
       break;
   default:
@@ -94,9 +515,13 @@ int main(int argc, char *argv[])
       printf("Exiting without any changes.\n");
       break;
   }
-  free(strfname);
-  free(txtfname);
-  if (!str_close(strfile,flags))
-    return 3;
-  return 0;
+  stats_file_leave();
+  if (files_written+files_skipped>0)
+      printf("Files written: %d, skipped as unchanged: %d\n",files_written,files_skipped);
+  str_free(strfname);
+  str_free(txtfname);
+  if (strfile!=NULL)
+    if (str_close(strfile,flags)!=ERR_NONE)
+      return 3;
+  return exit_code;
 }
@@ -0,0 +1,180 @@
+/******************************************************************************/
+/** @file strtrace.c
+ * Library for r/w of DK2 STR text strings files.
+ * @par Purpose:
+ *     Writes trace events in Chrome trace format, to be viewed in
+ *     chrome://tracing or Perfetto.
+ * @par Comment:
+ *     Every event is formatted on the thread which made it, and written
+ *     under a lock, so events from many threads don't mix. Events are
+ *     tagged with system identifier of the thread.
+ * @par  Copying and copyrights:
+ *     This program is free software; you can redistribute it and/or modify
+ *     it under the terms of the GNU General Public License as published by
+ *     the Free Software Foundation; either version 2 of the License, or
+ *     (at your option) any later version.
+ */
+/******************************************************************************/
+
+#include "strtrace.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include "lbfileio.h"
+#include "unitext.h"
+#include "strmaker.h"
+#include "strthread.h"
+
+struct STR_Trace str_trace;
+
+/**
+ * Starts writing trace events into given file.
+ * @param large_entry Entries of this size or larger get their own
+ *     events; 0 disables tracing of entries.
+ * @return Returns ERR_NONE on success.
+ */
+short trace_open(const char *fname,long large_entry,short flags)
+{
+  if (thread_mutex_init(&str_trace.lock)!=ERR_NONE)
+  {
+    if (flags&STRFLAG_VERBOSE)
+      str_error("Cannot create lock for trace file");
+    return -1;
+  }
+  str_trace.fp=fopen(fname,"wb");
+  if (str_trace.fp==NULL)
+  {
+    if (flags&STRFLAG_VERBOSE)
+      str_ferror("%s when opening %s",strerror(errno),fname);
+    thread_mutex_free(&str_trace.lock);
+    return -1;
+  }
+  str_trace.start=clock_ns();
+  str_trace.large_entry=large_entry;
+  fprintf(str_trace.fp,"{\"traceEvents\":[\n");
+  return ERR_NONE;
+}
+
+/**
+ * Finishes the trace file.
+ * @return Returns ERR_NONE on success.
+ */
+short trace_close(short flags)
+{
+  FILE *fp=str_trace.fp;
+  int failed;
+  if (fp==NULL)
+    return ERR_NONE;
+  thread_mutex_lock(&str_trace.lock);
+  str_trace.fp=NULL;
+  thread_mutex_unlock(&str_trace.lock);
+  thread_mutex_free(&str_trace.lock);
+  // Last event has no comma after it
+  fprintf(fp,"{\"name\":\"process_name\",\"ph\":\"M\",\"pid\":1,\"tid\":%lu,"
+      "\"args\":{\"name\":\"strtool\"}}\n]}\n",current_thread_id());
+  // The file is always closed, even if writing failed
+  failed=ferror(fp);
+  if (fclose(fp)!=0)
+    failed=1;
+  if (failed)
+  {
+    if (flags&STRFLAG_VERBOSE)
+      str_ferror("%s when writing trace file",strerror(errno));
+    return -1;
+  }
+  return ERR_NONE;
+}
+
+/**
+ * Copies text into buffer, escaping characters which can't be used
+ * directly in JSON strings.
+ */
+void trace_json_escape(char *dst,long dst_size,const char *src)
+{
+  long n=0;
+  while ((*src!=0)&&(n+3<dst_size))
+  {
+    unsigned char chr=*src;
+    if ((chr=='"')||(chr=='\\'))
+    {
+      dst[n++]='\\';
+      dst[n++]=chr;
+    } else
+    if (chr>=' ')
+    {
+      dst[n++]=chr;
+    }
+    src++;
+  }
+  dst[n]=0;
+}
+
+/**
+ * Writes formatted event into the trace file. Events from many
+ * threads are written one after another, never mixed.
+ */
+void trace_write(const char *event)
+{
+  thread_mutex_lock(&str_trace.lock);
+  if (str_trace.fp!=NULL)
+    fputs(event,str_trace.fp);
+  thread_mutex_unlock(&str_trace.lock);
+}
+
+/**
+ * Writes event which begins a span on the current thread.
+ * @param name Name of the span.
+ * @param detail Additional text shown with the span, or NULL.
+ */
+void trace_begin(const char *name,const char *detail)
+{
+  char buf[512];
+  char event[768];
+  double ts;
+  if (str_trace.fp==NULL)
+    return;
+  ts=(clock_ns()-str_trace.start)/1000.0;
+  if (detail!=NULL)
+  {
+    trace_json_escape(buf,sizeof(buf),detail);
+    snprintf(event,sizeof(event),"{\"name\":\"%s\",\"ph\":\"B\",\"ts\":%.3f,\"pid\":1,\"tid\":%lu,"
+        "\"args\":{\"detail\":\"%s\"}},\n",name,ts,current_thread_id(),buf);
+  } else
+  {
+    snprintf(event,sizeof(event),"{\"name\":\"%s\",\"ph\":\"B\",\"ts\":%.3f,\"pid\":1,\"tid\":%lu},\n",
+        name,ts,current_thread_id());
+  }
+  trace_write(event);
+}
+
+/**
+ * Writes event which begins a span for item of given index.
+ */
+void trace_begin_index(const char *name,long index)
+{
+  char buf[32];
+  sprintf(buf,"%ld",index);
+  trace_begin(name,buf);
+}
+
+/**
+ * Writes event which ends the last span begun on the current thread.
+ * @param name Name of the span, or NULL.
+ */
+void trace_end(const char *name)
+{
+  char event[256];
+  double ts;
+  if (str_trace.fp==NULL)
+    return;
+  ts=(clock_ns()-str_trace.start)/1000.0;
+  if (name!=NULL)
+    snprintf(event,sizeof(event),"{\"name\":\"%s\",\"ph\":\"E\",\"ts\":%.3f,\"pid\":1,\"tid\":%lu},\n",
+        name,ts,current_thread_id());
+  else
+    snprintf(event,sizeof(event),"{\"ph\":\"E\",\"ts\":%.3f,\"pid\":1,\"tid\":%lu},\n",
+        ts,current_thread_id());
+  trace_write(event);
+}
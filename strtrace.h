@@ -0,0 +1,47 @@
+/******************************************************************************/
+/** @file strtrace.h
+ * Library for r/w of DK2 STR text strings files.
+ * @par Purpose:
+ *     Header file. Defines exported routines from strtrace.c.
+ * @par Comment:
+ *     Define STRTRACE_DISABLED to remove tracing from the code.
+ * @par  Copying and copyrights:
+ *     This program is free software; you can redistribute it and/or modify
+ *     it under the terms of the GNU General Public License as published by
+ *     the Free Software Foundation; either version 2 of the License, or
+ *     (at your option) any later version.
+ */
+/******************************************************************************/
+
+#ifndef STRTRACE_H
+#define STRTRACE_H
+
+#include <stdio.h>
+#include "strthread.h"
+
+struct STR_Trace {
+    FILE *fp;                // Trace output file, NULL if tracing is off
+    unsigned long long start;// Time of opening the trace
+    long large_entry;        // Minimal size of traced entries, 0 to trace none
+    struct THRD_Mutex lock;  // Taken when writing an event
+    };
+
+extern struct STR_Trace str_trace;
+
+#ifndef STRTRACE_DISABLED
+#define TRACE_ENABLED (str_trace.fp!=NULL)
+#define TRACE_ENTRY_ENABLED(len) ((str_trace.large_entry>0)&&((len)>=str_trace.large_entry)&&(str_trace.fp!=NULL))
+#else
+#define TRACE_ENABLED 0
+#define TRACE_ENTRY_ENABLED(len) 0
+#endif
+
+// Routines
+
+short trace_open(const char *fname,long large_entry,short flags);
+short trace_close(short flags);
+void trace_begin(const char *name,const char *detail);
+void trace_begin_index(const char *name,long index);
+void trace_end(const char *name);
+
+#endif
@@ -0,0 +1,582 @@
+/******************************************************************************/
+/** @file strwatch.c
+ * Library for r/w of DK2 STR text strings files.
+ * @par Purpose:
+ *     Watching folders for changed files, and the watch mode which
+ *     converts text files whenever they're saved.
+ * @par Comment:
+ *     Uses inotify on Linux. On other systems, files in watched folders
+ *     are checked periodically for changed size or modification time.
+ * @par  Copying and copyrights:
+ *     This program is free software; you can redistribute it and/or modify
+ *     it under the terms of the GNU General Public License as published by
+ *     the Free Software Foundation; either version 2 of the License, or
+ *     (at your option) any later version.
+ */
+/******************************************************************************/
+
+#include "strwatch.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <dirent.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#if defined(__linux__)
+#include <sys/inotify.h>
+#include <poll.h>
+#include <unistd.h>
+#endif
+#include "lbfileio.h"
+#include "unitext.h"
+#include "strfile.h"
+#include "strmaker.h"
+#include "strbatch.h"
+#include "strctx.h"
+#include "strthread.h"
+#include "strstats.h"
+#include "stralloc.h"
+
+#if defined(__linux__)
+#define WATCH_INOTIFY_MASK (IN_CLOSE_WRITE|IN_MOVED_TO|IN_CREATE)
+#endif
+
+/**
+ * Codepage loaded for one folder, kept while watching.
+ */
+struct STR_WatchCodepage {
+    char *dirname;           // Folder, with ending separator, or empty
+    struct STR_Codepage *cp;
+    };
+
+struct STR_WatchJob {
+    struct STR_Watch watch;
+    unsigned int cps_alloc;
+    unsigned int cps_count;
+    struct STR_WatchCodepage *cps;
+    unsigned int pending_alloc;
+    unsigned int pending_count;
+    char **pending;          // Text files changed since last conversion
+    unsigned long long pending_since; // Time of the first pending change
+    unsigned long converted;
+    unsigned long failed;
+    short flags;
+    };
+
+/**
+ * Prepares the watcher; no folders are watched yet.
+ * @return Returns ERR_NONE on success.
+ */
+short watch_init(struct STR_Watch *watch)
+{
+  memset(watch,0,sizeof(struct STR_Watch));
+#if defined(__linux__)
+  watch->fd=inotify_init();
+#else
+  watch->fd=-1;
+#endif
+  return ERR_NONE;
+}
+
+/**
+ * Frees the watcher, stopping to watch all folders.
+ */
+void watch_free(struct STR_Watch *watch)
+{
+  unsigned int i;
+#if defined(__linux__)
+  if (watch->fd>=0)
+    close(watch->fd);
+#endif
+  watch->fd=-1;
+  for (i=0;i<watch->dirs_count;i++)
+    str_free(watch->dirs[i].path);
+  for (i=0;i<watch->files_count;i++)
+    str_free(watch->files[i].path);
+  str_free(watch->dirs);
+  str_free(watch->files);
+  watch->dirs=NULL;
+  watch->files=NULL;
+  watch->dirs_count=0;
+  watch->files_count=0;
+}
+
+/**
+ * Finds file known to polling; adds it if it's not known.
+ * @param added Output, set to 1 if the file was added.
+ */
+struct STR_WatchFile *watch_get_file(struct STR_Watch *watch,char *path,short *added)
+{
+  struct STR_WatchFile *file;
+  unsigned int i;
+  (*added)=0;
+  for (i=0;i<watch->files_count;i++)
+  {
+    if (strcmp(watch->files[i].path,path)==0)
+      return &watch->files[i];
+  }
+  if (watch->files_count>=watch->files_alloc)
+  {
+    unsigned int nalloc=watch->files_alloc*2+16;
+    file=str_realloc(watch->files,nalloc*sizeof(struct STR_WatchFile));
+    if (file==NULL)
+      return NULL;
+    watch->files=file;
+    watch->files_alloc=nalloc;
+  }
+  file=&watch->files[watch->files_count];
+  memset(file,0,sizeof(struct STR_WatchFile));
+  file->path=path;
+  watch->files_count++;
+  (*added)=1;
+  return file;
+}
+
+/**
+ * Checks files of a folder, reporting the ones which are new or changed.
+ * @param func Function to call, or NULL when only remembering the state.
+ * @return Returns amount of reported files.
+ */
+int watch_scan_dir(struct STR_Watch *watch,const char *dirname,WatchFunc func,void *ctx)
+{
+  struct STR_WatchFile *file;
+  struct dirent *dent;
+  struct stat st;
+  DIR *dir;
+  char *path;
+  short added;
+  int count;
+  dir=opendir(dirname);
+  if (dir==NULL)
+    return 0;
+  count=0;
+  while ((dent=readdir(dir))!=NULL)
+  {
+    if ((strcmp(dent->d_name,".")==0)||(strcmp(dent->d_name,"..")==0))
+      continue;
+    path=path_join(dirname,dent->d_name);
+    if (path==NULL)
+      break;
+    if (stat(path,&st)!=0)
+    {
+      str_free(path);
+      continue;
+    }
+    file=watch_get_file(watch,path,&added);
+    if (file==NULL)
+    {
+      str_free(path);
+      break;
+    }
+    if (!added)
+      str_free(path);
+    file->seen=1;
+    if ((!added)&&(file->size==st.st_size)&&(file->mtime==st.st_mtime))
+      continue;
+    file->size=st.st_size;
+    file->mtime=st.st_mtime;
+    file->is_dir=S_ISDIR(st.st_mode);
+    // Folder's time changes with its content; only new folders are reported
+    if ((func!=NULL)&&((!file->is_dir)||added))
+    {
+      func(ctx,file->path,file->is_dir);
+      count++;
+    }
+  }
+  closedir(dir);
+  return count;
+}
+
+/**
+ * Starts watching a folder; files in sub-folders are not watched,
+ * unless the sub-folders are added too. Adding the same folder
+ * again does nothing.
+ * @return Returns ERR_NONE on success.
+ */
+short watch_add_dir(struct STR_Watch *watch,const char *dirname)
+{
+  struct STR_WatchDir *dir;
+  unsigned int i;
+  for (i=0;i<watch->dirs_count;i++)
+  {
+    if (strcmp(watch->dirs[i].path,dirname)==0)
+      return ERR_NONE;
+  }
+  if (watch->dirs_count>=watch->dirs_alloc)
+  {
+    unsigned int nalloc=watch->dirs_alloc*2+4;
+    dir=str_realloc(watch->dirs,nalloc*sizeof(struct STR_WatchDir));
+    if (dir==NULL)
+      return ERR_NO_MEMORY;
+    watch->dirs=dir;
+    watch->dirs_alloc=nalloc;
+  }
+  dir=&watch->dirs[watch->dirs_count];
+  dir->path=str_malloc(strlen(dirname)+1);
+  if (dir->path==NULL)
+    return ERR_NO_MEMORY;
+  strcpy(dir->path,dirname);
+  dir->wd=-1;
+#if defined(__linux__)
+  if (watch->fd>=0)
+  {
+    dir->wd=inotify_add_watch(watch->fd,dirname,WATCH_INOTIFY_MASK);
+    if (dir->wd<0)
+    {
+      str_free(dir->path);
+      return -1;
+    }
+  }
+#endif
+  watch->dirs_count++;
+  if (watch->fd<0)
+    watch_scan_dir(watch,dirname,NULL,NULL);
+  return ERR_NONE;
+}
+
+/**
+ * Starts watching a folder with all its sub-folders.
+ * @return Returns ERR_NONE on success.
+ */
+short watch_add_tree(struct STR_Watch *watch,const char *dirname)
+{
+  struct dirent *dent;
+  struct stat st;
+  DIR *dir;
+  char *path;
+  short result;
+  result=watch_add_dir(watch,dirname);
+  if (result!=ERR_NONE)
+    return result;
+  dir=opendir(dirname);
+  if (dir==NULL)
+    return -1;
+  while ((result==ERR_NONE)&&((dent=readdir(dir))!=NULL))
+  {
+    if ((strcmp(dent->d_name,".")==0)||(strcmp(dent->d_name,"..")==0))
+      continue;
+    path=path_join(dirname,dent->d_name);
+    if (path==NULL)
+    {
+      result=ERR_NO_MEMORY;
+      break;
+    }
+    if ((stat(path,&st)==0)&&S_ISDIR(st.st_mode))
+      result=watch_add_tree(watch,path);
+    str_free(path);
+  }
+  closedir(dir);
+  return result;
+}
+
+#if defined(__linux__)
+/**
+ * Reads events from inotify, reporting the changed files.
+ * @return Returns amount of reported files, or -1 on error.
+ */
+int watch_read_events(struct STR_Watch *watch,unsigned int timeout_ms,WatchFunc func,void *ctx)
+{
+  char buf[4096] __attribute__ ((aligned(__alignof__(struct inotify_event))));
+  const struct inotify_event *event;
+  struct pollfd pfd;
+  unsigned int i;
+  char *path;
+  long len,pos;
+  int count;
+  pfd.fd=watch->fd;
+  pfd.events=POLLIN;
+  if (poll(&pfd,1,timeout_ms)<=0)
+    return 0;
+  len=read(watch->fd,buf,sizeof(buf));
+  if (len<=0)
+    return (errno==EINTR)?0:-1;
+  count=0;
+  for (pos=0;pos<len;pos+=sizeof(struct inotify_event)+event->len)
+  {
+    event=(const struct inotify_event *)(buf+pos);
+    if ((event->len==0)||(event->mask&IN_Q_OVERFLOW))
+      continue;
+    // New files are reported when they're closed after writing
+    if ((event->mask&IN_CREATE)&&(!(event->mask&IN_ISDIR)))
+      continue;
+    for (i=0;i<watch->dirs_count;i++)
+    {
+      if (watch->dirs[i].wd==event->wd)
+        break;
+    }
+    if (i>=watch->dirs_count)
+      continue;
+    path=path_join(watch->dirs[i].path,event->name);
+    if (path==NULL)
+      return -1;
+    func(ctx,path,(event->mask&IN_ISDIR)!=0);
+    str_free(path);
+    count++;
+  }
+  return count;
+}
+#endif
+
+/**
+ * Waits for changes in watched folders, calling the function for every
+ * file which was written. Returns as soon as there are changes, or after
+ * the timeout.
+ * @return Returns amount of reported files, or -1 on error.
+ */
+int watch_wait(struct STR_Watch *watch,unsigned int timeout_ms,WatchFunc func,void *ctx)
+{
+  unsigned int i,waited;
+  int count;
+#if defined(__linux__)
+  if (watch->fd>=0)
+    return watch_read_events(watch,timeout_ms,func,ctx);
+#endif
+  waited=0;
+  while (1)
+  {
+    count=0;
+    for (i=0;i<watch->dirs_count;i++)
+      count+=watch_scan_dir(watch,watch->dirs[i].path,func,ctx);
+    if ((count>0)||(waited>=timeout_ms))
+      return count;
+    thread_sleep_ms(WATCH_POLL_INTERVAL_MS);
+    waited+=WATCH_POLL_INTERVAL_MS;
+  }
+}
+
+/**
+ * Gives codepage for the folder of given file, loading it if it's
+ * not loaded yet.
+ * @return Returns the codepage, or NULL on error.
+ */
+const struct STR_Codepage *str_watch_codepage(struct STR_WatchJob *job,const char *fname,
+    struct STR_Error *err)
+{
+  struct STR_WatchCodepage *wcp;
+  unsigned int i;
+  int dir_len;
+  dir_len=filename_from_path(fname)-fname;
+  for (i=0;i<job->cps_count;i++)
+  {
+    wcp=&job->cps[i];
+    if ((strlen(wcp->dirname)==dir_len)&&(strncmp(wcp->dirname,fname,dir_len)==0))
+    {
+      if (wcp->cp==NULL)
+        wcp->cp=str_codepage_load(fname,err);
+      return wcp->cp;
+    }
+  }
+  if (job->cps_count>=job->cps_alloc)
+  {
+    unsigned int nalloc=job->cps_alloc*2+4;
+    wcp=str_realloc(job->cps,nalloc*sizeof(struct STR_WatchCodepage));
+    if (wcp==NULL)
+    {
+      strctx_error_set(err,ERR_NO_MEMORY,"Cannot allocate memory for codepages");
+      return NULL;
+    }
+    job->cps=wcp;
+    job->cps_alloc=nalloc;
+  }
+  wcp=&job->cps[job->cps_count];
+  wcp->dirname=str_malloc(dir_len+1);
+  if (wcp->dirname==NULL)
+  {
+    strctx_error_set(err,ERR_NO_MEMORY,"Cannot allocate memory for codepages");
+    return NULL;
+  }
+  strncpy(wcp->dirname,fname,dir_len);
+  wcp->dirname[dir_len]='\0';
+  wcp->cp=str_codepage_load(fname,err);
+  job->cps_count++;
+  return wcp->cp;
+}
+
+/**
+ * Remembers a change in watched folders; called by the watcher.
+ */
+void str_watch_changed(void *ctx,const char *path,short is_dir)
+{
+  struct STR_WatchJob *job=ctx;
+  unsigned int i;
+  int dir_len;
+  char *fname;
+  if (is_dir)
+  {
+    // Text files are created in new folders after the folder itself
+    watch_add_tree(&job->watch,path);
+    return;
+  }
+  if (strcmp(filename_from_path(path),"MBToUni.dat")==0)
+  {
+    // Changed codepage will be loaded again when needed
+    dir_len=filename_from_path(path)-path;
+    for (i=0;i<job->cps_count;i++)
+    {
+      if ((strlen(job->cps[i].dirname)==dir_len)&&(strncmp(job->cps[i].dirname,path,dir_len)==0))
+      {
+        str_codepage_free(job->cps[i].cp);
+        job->cps[i].cp=NULL;
+      }
+    }
+    return;
+  }
+  if (!fname_has_ext(path,".txt"))
+    return;
+  for (i=0;i<job->pending_count;i++)
+  {
+    if (strcmp(job->pending[i],path)==0)
+      return;
+  }
+  if (job->pending_count>=job->pending_alloc)
+  {
+    unsigned int nalloc=job->pending_alloc*2+8;
+    char **pending=str_realloc(job->pending,nalloc*sizeof(char *));
+    if (pending==NULL)
+      return;
+    job->pending=pending;
+    job->pending_alloc=nalloc;
+  }
+  fname=str_malloc(strlen(path)+1);
+  if (fname==NULL)
+    return;
+  strcpy(fname,path);
+  if (job->pending_count==0)
+    job->pending_since=clock_ns();
+  job->pending[job->pending_count]=fname;
+  job->pending_count++;
+}
+
+/**
+ * Converts one changed text file into STR, using codepage of its folder.
+ * @return Returns ERR_NONE or ERR_UNCHANGED on success.
+ */
+short str_watch_convert(struct STR_WatchJob *job,const char *txtfname,struct STR_Error *err)
+{
+  const struct STR_Codepage *cp;
+  struct STR_Context ctx;
+  struct STR_File *strfile;
+  char *strfname;
+  int name_len;
+  short result;
+  cp=str_watch_codepage(job,txtfname,err);
+  if (cp==NULL)
+    return -1;
+  strctx_init(&ctx,cp,job->flags);
+  strfile=strctx_read_text(&ctx,txtfname,err);
+  if (strfile==NULL)
+    return -1;
+  name_len=strlen(txtfname);
+  strfname=str_malloc(name_len+1);
+  if (strfname==NULL)
+  {
+    str_close(strfile,job->flags);
+    return strctx_error_set(err,ERR_NO_MEMORY,"Cannot allocate memory for file name");
+  }
+  strcpy(strfname,txtfname);
+  strcpy(strfname+name_len-4,".str");
+  result=strctx_write_str(&ctx,strfile,strfname,err);
+  str_free(strfname);
+  str_close(strfile,job->flags);
+  return result;
+}
+
+/**
+ * Converts all pending text files.
+ */
+void str_watch_convert_pending(struct STR_WatchJob *job)
+{
+  struct STR_Error err;
+  unsigned int i;
+  short result;
+  for (i=0;i<job->pending_count;i++)
+  {
+    stats_file_enter(job->pending[i]);
+    result=str_watch_convert(job,job->pending[i],&err);
+    stats_file_leave();
+    if (result>=ERR_NONE)
+    {
+      job->converted++;
+      if (job->flags&STRFLAG_VERBOSE)
+        printf("%s %s, %.1f ms after the change\n",(result==ERR_UNCHANGED)?"Unchanged":"Converted",
+            job->pending[i],(clock_ns()-job->pending_since)/1000000.0);
+    } else
+    {
+      job->failed++;
+      if (job->flags&STRFLAG_VERBOSE)
+        str_ferror("%s",err.message);
+    }
+    str_free(job->pending[i]);
+  }
+  job->pending_count=0;
+  fflush(stdout);
+}
+
+/**
+ * Watches the folder with all its sub-folders, and converts every text
+ * file into STR as soon as it is written. Writes which come quickly one
+ * after another are converted together, when they stop. Codepages are
+ * loaded once for every folder.
+ * @param dirname The folder to watch.
+ * @param stop Watching ends when this becomes nonzero; if NULL,
+ *     it never ends.
+ * @param flags Flags used to manage the behaviour of the function.
+ * @return Returns ERR_NONE when stopped, or negative error code.
+ */
+short str_watch_build(const char *dirname,volatile short *stop,short flags)
+{
+  struct STR_WatchJob job;
+  unsigned int i,timeout;
+  short result;
+  int count;
+  memset(&job,0,sizeof(struct STR_WatchJob));
+  job.flags=flags;
+  watch_init(&job.watch);
+  result=watch_add_tree(&job.watch,dirname);
+  if (result!=ERR_NONE)
+  {
+    if (flags&STRFLAG_VERBOSE)
+      str_ferror("Cannot watch folder %s",dirname);
+    watch_free(&job.watch);
+    return result;
+  }
+  if (flags&STRFLAG_VERBOSE)
+  {
+    printf("Watching %u folders in %s; press Ctrl+C to stop.\n",job.watch.dirs_count,dirname);
+    if (job.watch.fd<0)
+      printf("Changes are checked every %d ms.\n",WATCH_POLL_INTERVAL_MS);
+    fflush(stdout);
+  }
+  while ((stop==NULL)||(!(*stop)))
+  {
+    timeout=(job.pending_count>0)?WATCH_DEBOUNCE_MS:WATCH_IDLE_MS;
+    count=watch_wait(&job.watch,timeout,str_watch_changed,&job);
+    if (count<0)
+    {
+      if (flags&STRFLAG_VERBOSE)
+        str_error("Cannot read changes of watched folders");
+      result=-1;
+      break;
+    }
+    if (job.pending_count==0)
+      continue;
+    // Convert when writes stop, or when they don't stop for too long
+    if ((count==0)||(clock_ns()-job.pending_since>=WATCH_DEBOUNCE_MAX_MS*1000000ULL))
+      str_watch_convert_pending(&job);
+  }
+  if (flags&STRFLAG_VERBOSE)
+    printf("Files converted: %lu, failed: %lu\n",job.converted,job.failed);
+  for (i=0;i<job.pending_count;i++)
+    str_free(job.pending[i]);
+  str_free(job.pending);
+  for (i=0;i<job.cps_count;i++)
+  {
+    str_codepage_free(job.cps[i].cp);
+    str_free(job.cps[i].dirname);
+  }
+  str_free(job.cps);
+  watch_free(&job.watch);
+  return result;
+}
@@ -0,0 +1,70 @@
+/******************************************************************************/
+/** @file strwatch.h
+ * Library for r/w of DK2 STR text strings files.
+ * @par Purpose:
+ *     Header file. Defines exported routines from strwatch.c.
+ * @par Comment:
+ *     None.
+ * @par  Copying and copyrights:
+ *     This program is free software; you can redistribute it and/or modify
+ *     it under the terms of the GNU General Public License as published by
+ *     the Free Software Foundation; either version 2 of the License, or
+ *     (at your option) any later version.
+ */
+/******************************************************************************/
+
+#ifndef STRWATCH_H
+#define STRWATCH_H
+
+#include <stdio.h>
+
+// Interval of checking the files where inotify is not available
+#define WATCH_POLL_INTERVAL_MS 250
+// Watch mode: quiet time after a write before converting, and longest delay
+#define WATCH_DEBOUNCE_MS 20
+#define WATCH_DEBOUNCE_MAX_MS 200
+#define WATCH_IDLE_MS 1000
+
+/**
+ * Called for every file written, or directory created, in watched folders.
+ */
+typedef void (*WatchFunc)(void *ctx,const char *path,short is_dir);
+
+struct STR_WatchDir {
+    char *path;
+    int wd;                  // inotify watch descriptor
+    };
+
+struct STR_WatchFile {
+    char *path;
+    long size;               // Size and modification time seen by polling
+    long mtime;
+    short is_dir;
+    short seen;              // Found in the last scan
+    };
+
+/**
+ * Watcher of changes in folders. Uses inotify on Linux, and checks
+ * sizes and modification times of files on other systems.
+ */
+struct STR_Watch {
+    int fd;                  // inotify descriptor, or -1 when polling
+    unsigned int dirs_alloc;
+    unsigned int dirs_count;
+    struct STR_WatchDir *dirs;
+    unsigned int files_alloc;// Files known to polling
+    unsigned int files_count;
+    struct STR_WatchFile *files;
+    };
+
+// Routines
+
+short watch_init(struct STR_Watch *watch);
+short watch_add_dir(struct STR_Watch *watch,const char *dirname);
+short watch_add_tree(struct STR_Watch *watch,const char *dirname);
+int watch_wait(struct STR_Watch *watch,unsigned int timeout_ms,WatchFunc func,void *ctx);
+void watch_free(struct STR_Watch *watch);
+
+short str_watch_build(const char *dirname,volatile short *stop,short flags);
+
+#endif
@@ -21,7 +21,11 @@
 #include <stdlib.h>
 #include <string.h>
 #include <stdarg.h>
+#include <errno.h>
+#include <limits.h>
 #include "lbfileio.h"
+#include "strstats.h"
+#include "stralloc.h"
 
 short str_wtos(char *dst,const short *src)
 {
@@ -39,6 +43,40 @@ short str_wtos(char *dst,const short *src)
     return ERR_NONE;
 }
 
+/**
+ * Converts multibyte string in current locale into unicode.
+ * Characters outside of the Basic Multilingual Plane are replaced by '_'.
+ * @return Returns newly allocated zero-terminated string, or NULL.
+ */
+unsigned short *unicode_from_mbs(const char *src)
+{
+    size_t len,i;
+    wchar_t *wstr;
+    unsigned short *str;
+    len=mbstowcs(NULL,src,0);
+    if (len==(size_t)-1)
+      return NULL;
+    wstr=str_malloc((len+1)*sizeof(wchar_t));
+    str=str_malloc((len+1)*sizeof(unsigned short));
+    if ((wstr==NULL)||(str==NULL))
+    {
+      str_free(wstr);
+      str_free(str);
+      return NULL;
+    }
+    mbstowcs(wstr,src,len+1);
+    for (i=0;i<len;i++)
+    {
+      if ((unsigned long)wstr[i]>0xffff)
+        str[i]='_';
+      else
+        str[i]=wstr[i];
+    }
+    str[len]=0;
+    str_free(wstr);
+    return str;
+}
+
 int unicode_strlen(unsigned short *buf)
 {
     int i=0;
@@ -48,6 +86,22 @@ int unicode_strlen(unsigned short *buf)
     return i;
 }
 
+/**
+ * Compares two zero-terminated unicode strings.
+ * NULL pointer is treated as an empty string.
+ * @return Returns 0 if strings are identical, nonzero otherwise.
+ */
+int unicode_strcmp(const unsigned short *str1,const unsigned short *str2)
+{
+    static const unsigned short empty[1]={0};
+    int i=0;
+    if (str1==NULL) str1=empty;
+    if (str2==NULL) str2=empty;
+    while ((str1[i]==str2[i])&&(str1[i]!=0))
+       i++;
+    return (int)str1[i]-(int)str2[i];
+}
+
 unsigned int unicode_buf_lines_count(unsigned short *buf,long buflen)
 {
   unsigned int lncount=1;
@@ -110,17 +164,86 @@ long unicode_buf_newln_offs(unsigned short *buf,long offs,long buflen)
   return -1;
 }
 
+/**
+ * Returns length of given line in TXT_File, including the end of line.
+ * @return Returns the amount of characters, or -1 if there's no such line.
+ */
+long txtuni_line_length(const struct TXT_File *txtfile,unsigned int k)
+{
+  if (k>=txtfile->offs_count)
+      return -1;
+  long offs=txtfile->offsets[k];
+  if (offs<0)
+      return -1;
+  long end_offs=txtfile->data_len;
+  if (((k+1)<txtfile->offs_count))
+  {
+    long tmp_end;
+    tmp_end=txtfile->offsets[k+1];
+    if ((tmp_end>offs)&&(tmp_end<end_offs))
+        end_offs=tmp_end;
+  }
+  return end_offs-offs;
+}
+
+/**
+ * Creates a copy of the text line, replacing escape sequences ("\n",
+ * "\r", "\t", "\\") with the characters they represent.
+ * Copying ends at end of line or after buf_len characters.
+ * @return Returns newly allocated zero-terminated string, or NULL.
+ */
+unsigned short *unicode_line_unescape(const unsigned short *buf,long buf_len)
+{
+  unsigned short *str;
+  long i,n;
+  str=str_malloc((buf_len+1)*sizeof(unsigned short));
+  if (str==NULL)
+      return NULL;
+  n=0;
+  for (i=0;i<buf_len;i++)
+  {
+      unsigned short chr;
+      chr=buf[i];
+      if ((chr=='\n')||(chr=='\r')) break;
+      if (chr=='\\')
+      {
+        i++;
+        if (i>=buf_len) break;
+        chr=buf[i];
+        switch (chr)
+        {
+        case 'r':
+            chr='\r';
+            break;
+        case 'n':
+            chr='\n';
+            break;
+        case 't':
+            chr='\t';
+            break;
+        case '\\':
+        default:
+            break;
+        }
+      }
+      str[n]=chr;
+      n++;
+  }
+  str[n]=0;
+  return str;
+}
+
 short txtuni_set_offsalloc(struct TXT_File *txtfile,unsigned int count)
 {
   unsigned int prev_count=txtfile->offs_alloc;
   txtfile->offs_alloc=count;
-  txtfile->offsets=realloc(txtfile->offsets,txtfile->offs_alloc*sizeof(long));
+  txtfile->offsets=str_realloc(txtfile->offsets,txtfile->offs_alloc*sizeof(long));
   if ((txtfile->offs_alloc!=0)&&(txtfile->offsets==NULL))
       return -1;
   if (prev_count<txtfile->offs_alloc)
   {
     int i;
-    for (i=txtfile->offs_alloc-prev_count;i<txtfile->offs_alloc;i++)
+    for (i=prev_count;i<txtfile->offs_alloc;i++)
         txtfile->offsets[i]=-1;
   }
   return ERR_NONE;
@@ -130,13 +253,13 @@ short txtuni_set_dataalloc(struct TXT_File *txtfile,unsigned long len)
 {
   unsigned int prev_len=txtfile->data_alloc;
   txtfile->data_alloc=len;
-  txtfile->data=realloc(txtfile->data,txtfile->data_alloc*sizeof(unsigned short));
+  txtfile->data=str_realloc(txtfile->data,txtfile->data_alloc*sizeof(unsigned short));
   if ((txtfile->data_alloc!=0)&&(txtfile->data==NULL))
       return -1;
   if (prev_len<txtfile->data_alloc)
   {
     int i;
-    for (i=txtfile->data_alloc-prev_len;i<txtfile->data_alloc;i++)
+    for (i=prev_len;i<txtfile->data_alloc;i++)
         txtfile->data[i]=0;
   }
   return ERR_NONE;
@@ -155,9 +278,9 @@ short txtuni_clear(struct TXT_File *txtfile)
 
 short txtuni_free(struct TXT_File *txtfile)
 {
-  free(txtfile->offsets);
-  free(txtfile->data);
-  free(txtfile);
+  str_free(txtfile->offsets);
+  str_free(txtfile->data);
+  str_free(txtfile);
   return ERR_NONE;
 }
 
@@ -193,15 +316,33 @@ short txtuni_read(struct TXT_File *txtfile,FILE *fp,short flags)
   if (flags&STRFLAG_DEBUG)
       printf("reading %d entries from FILE at %08x into %08x\n",txtfile->data_len,fp,txtfile->data);
   nread=fread(txtfile->data,1,txtfile->data_len*sizeof(unsigned short),fp);
+  STATS_ADD(bytes_read,nread);
   if (nread!=txtfile->data_len*sizeof(unsigned short))
   {
       if (flags&STRFLAG_VERBOSE)
         str_ferror("%s when reading text file",strerror(errno));
       return -1;
   }
+  short prev_phase=stats_phase_enter(STAT_LINES);
+  result=txtuni_index_lines(txtfile,flags);
+  stats_phase_leave(prev_phase);
+  return result;
+}
+
+/**
+ * Fills offsets of text lines in TXT_File with data already loaded.
+ * @return Returns ERR_NONE on success.
+ */
+short txtuni_index_lines(struct TXT_File *txtfile,short flags)
+{
   // Counting text lines
   unsigned int lncount=unicode_buf_lines_count(txtfile->data,txtfile->data_len);
-  txtuni_set_offsalloc(txtfile,lncount+2);
+  if (txtuni_set_offsalloc(txtfile,lncount+2)!=ERR_NONE)
+  {
+      if (flags&STRFLAG_VERBOSE)
+        str_ferror("Cannot allocate memory for text lines");
+      return -1;
+  }
   unsigned int i;
   long offs;
   txtfile->offs_count=0;
@@ -223,3 +364,218 @@ short txtuni_read(struct TXT_File *txtfile,FILE *fp,short flags)
   }
   return ERR_NONE;
 }
+
+/**
+ * Writes the character into text buffer, as escape sequence if it's
+ * one of special characters.
+ * @return Returns amount of characters written, 1 or 2.
+ */
+int unicode_char_escape(unsigned short *dst,unsigned short chr)
+{
+  // Support some special characters
+  switch (chr)
+  {
+  case (unsigned char)'\n':
+      dst[0]='\\';
+      dst[1]='\n';
+      return 2;
+  case (unsigned char)'\r':
+      dst[0]='\\';
+      dst[1]='\r';
+      return 2;
+  case (unsigned char)'\t':
+      dst[0]='\\';
+      dst[1]='\t';
+      return 2;
+  case (unsigned char)'\\': // Write "\" as "\\".
+      dst[0]='\\';
+      dst[1]='\\';
+      return 2;
+  default:
+      dst[0]=chr;
+      return 1;
+  }
+}
+
+/**
+ * Writes beginning of Unicode text file - the BOM and file ID line.
+ */
+void unicode_fwrite_header(FILE *fp,unsigned int file_id)
+{
+  fwrite("\xff\xfe",1,2,fp); // This seems to be an Unicode identifier in Windows
+  int i;
+  char buf[16];
+  sprintf(buf,"%d\r\n",file_id);
+  i=0;
+  while (buf[i]!=0)
+  {
+      fputc(buf[i],fp);
+      fputc(0,fp);
+      i++;
+  }
+}
+
+/**
+ * Writes one text line into Unicode text file, with end of line.
+ * Special characters are written as escape sequences.
+ */
+void unicode_fwrite_line(FILE *fp,const unsigned short *str)
+{
+    unsigned short buf[2];
+    int i=0;
+    if (str!=NULL)
+      while (str[i]!=0)
+      {
+          int n=unicode_char_escape(buf,str[i]);
+          write_int16_le_file(fp,buf[0]);
+          if (n>1)
+            write_int16_le_file(fp,buf[1]);
+          i++;
+      }
+    fwrite("\r\0\n\0",1,4,fp);
+}
+
+/**
+ * Writes text to console in UTF-8, without end of line.
+ * Special characters are escaped as in TXT file, but with letters,
+ * so that the text stays in one line; unicode_line_unescape() reads
+ * them back. Unpaired surrogates are written as U+FFFD.
+ */
+void unicode_fputs_utf8(FILE *fp,const unsigned short *str)
+{
+    unsigned long chr;
+    int i=0;
+    if (str==NULL)
+      return;
+    while (str[i]!=0)
+    {
+        chr=str[i++];
+        switch (chr)
+        {
+        case '\n':
+            fputs("\\n",fp);
+            continue;
+        case '\r':
+            fputs("\\r",fp);
+            continue;
+        case '\t':
+            fputs("\\t",fp);
+            continue;
+        case '\\':
+            fputs("\\\\",fp);
+            continue;
+        default:
+            break;
+        }
+        if ((chr>=0xd800)&&(chr<0xdc00)&&(str[i]>=0xdc00)&&(str[i]<0xe000))
+        {
+            chr=0x10000+((chr-0xd800)<<10)+(str[i]-0xdc00);
+            i++;
+        } else
+        if ((chr>=0xd800)&&(chr<0xe000))
+        {
+            chr=0xfffd;
+        }
+        if (chr<0x80)
+        {
+            fputc(chr,fp);
+        } else
+        if (chr<0x800)
+        {
+            fputc(0xc0|(chr>>6),fp);
+            fputc(0x80|(chr&0x3f),fp);
+        } else
+        if (chr<0x10000)
+        {
+            fputc(0xe0|(chr>>12),fp);
+            fputc(0x80|((chr>>6)&0x3f),fp);
+            fputc(0x80|(chr&0x3f),fp);
+        } else
+        {
+            fputc(0xf0|(chr>>18),fp);
+            fputc(0x80|((chr>>12)&0x3f),fp);
+            fputc(0x80|((chr>>6)&0x3f),fp);
+            fputc(0x80|(chr&0x3f),fp);
+        }
+    }
+}
+
+/**
+ * Prints one entry on console as "name:index: text", in UTF-8.
+ */
+void str_print_entry(const char *name,unsigned int index,const unsigned short *text)
+{
+    printf("%s:%u: ",name,index);
+    unicode_fputs_utf8(stdout,text);
+    printf("\n");
+}
+
+/**
+ * Parses entry number given as decimal text.
+ * @return Returns ERR_NONE on success, or negative value if the text isn't
+ *     a number or doesn't fit into unsigned int.
+ */
+short str_parse_entry_index(const char *id,unsigned int *index)
+{
+    unsigned long val;
+    char *endp;
+    if ((id[0]<'0')||(id[0]>'9'))
+      return -1;
+    errno=0;
+    val=strtoul(id,&endp,10);
+    if ((*endp!='\0')||(errno==ERANGE)||(val>UINT_MAX))
+      return -1;
+    *index=val;
+    return ERR_NONE;
+}
+
+/**
+ * Makes sure TXT_File data has space for given amount of characters
+ * added at its end.
+ * @return Returns ERR_NONE on success.
+ */
+short txtuni_reserve(struct TXT_File *txtfile,long len)
+{
+  unsigned long alloc;
+  if (txtfile->data_len+len+1<=txtfile->data_alloc)
+    return ERR_NONE;
+  alloc=txtfile->data_alloc+(txtfile->data_alloc>>1)+len+256;
+  return txtuni_set_dataalloc(txtfile,alloc);
+}
+
+/**
+ * Adds the BOM and file ID line to data of empty TXT_File, creating
+ * the same content as unicode_fwrite_header() writes to file.
+ * @return Returns ERR_NONE on success.
+ */
+short txtuni_add_header(struct TXT_File *txtfile,unsigned int file_id)
+{
+  char buf[16];
+  int i;
+  sprintf(buf,"%d\r\n",file_id);
+  if (txtuni_reserve(txtfile,strlen(buf)+1)!=ERR_NONE)
+    return -1;
+  txtfile->data[txtfile->data_len++]=0xfeff;
+  for (i=0;buf[i]!=0;i++)
+    txtfile->data[txtfile->data_len++]=(unsigned char)buf[i];
+  return ERR_NONE;
+}
+
+/**
+ * Adds one text line to data of TXT_File, the same way as
+ * unicode_fwrite_line() writes it to file.
+ * Line offsets are not updated; use txtuni_index_lines() at end.
+ * @return Returns ERR_NONE on success.
+ */
+short txtuni_add_line(struct TXT_File *txtfile,const unsigned short *str)
+{
+  long len,i;
+  len=(str!=NULL)?unicode_strlen((unsigned short *)str):0;
+  if (txtuni_reserve(txtfile,(len<<1)+2)!=ERR_NONE)
+    return -1;
+  for (i=0;i<len;i++)
+    txtfile->data_len+=unicode_char_escape(txtfile->data+txtfile->data_len,str[i]);
+  txtfile->data[txtfile->data_len++]='\r';
+  txtfile->data[txtfile->data_len++]='\n';
+  return ERR_NONE;
+}
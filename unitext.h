@@ -22,8 +22,22 @@
 
 #define STRFLAG_VERBOSE         0x01
 #define STRFLAG_DEBUG           0x02
+// Store repeated entries only once, sharing their data
+#define STRFLAG_DEDUP           0x04
+// Keep the encoding cache in a file between batch builds
+#define STRFLAG_KEEPCACHE       0x08
+// Load parsed text files from cache files next to them
+#define STRFLAG_TXTCACHE        0x10
 
 #define ERR_NONE                0x00
+// Not an error - the output file was identical, so it wasn't rewritten
+#define ERR_UNCHANGED           0x01
+// Errors of the entry encoding and decoding routines, which don't print
+#define ERR_NO_MEMORY           -2
+#define ERR_CHUNK_HEADER        -3
+#define ERR_END_CHUNK           -4
+#define ERR_ENTRY_LENGTH        -5
+#define ERR_CHUNK_TYPE          -6
 
 struct TXT_File {
     unsigned int offs_alloc; // Allocated offset entries
@@ -37,13 +51,27 @@ struct TXT_File {
 // Routines
 
 short txtuni_read(struct TXT_File *txtfile,FILE *fp,short flags);
+short txtuni_index_lines(struct TXT_File *txtfile,short flags);
+short txtuni_add_header(struct TXT_File *txtfile,unsigned int file_id);
+short txtuni_add_line(struct TXT_File *txtfile,const unsigned short *str);
 short txtuni_free(struct TXT_File *txtfile);
 short txtuni_clear(struct TXT_File *txtfile);
 short txtuni_set_dataalloc(struct TXT_File *txtfile,unsigned long len);
 short txtuni_set_offsalloc(struct TXT_File *txtfile,unsigned int count);
+long txtuni_line_length(const struct TXT_File *txtfile,unsigned int k);
+unsigned short *unicode_line_unescape(const unsigned short *buf,long buf_len);
 long unicode_buf_newln_offs(unsigned short *buf,long offs,long buflen);
 unsigned int unicode_buf_lines_count(unsigned short *buf,long buflen);
+unsigned short *unicode_from_mbs(const char *src);
+int unicode_strlen(unsigned short *buf);
+int unicode_strcmp(const unsigned short *str1,const unsigned short *str2);
 short str_wtos(char *dst,const short *src);
+int unicode_char_escape(unsigned short *dst,unsigned short chr);
+void unicode_fwrite_header(FILE *fp,unsigned int file_id);
+void unicode_fwrite_line(FILE *fp,const unsigned short *str);
+void unicode_fputs_utf8(FILE *fp,const unsigned short *str);
+short str_parse_entry_index(const char *id,unsigned int *index);
+void str_print_entry(const char *name,unsigned int index,const unsigned short *text);
 
 
 #endif